@@ -0,0 +1,247 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * access_pattern.h -- Finds sequential, strided, and polling runs of transfers.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __ACCESS_PATTERN_H
+#define __ACCESS_PATTERN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include "mem_transfer.h"
+
+
+/*
+ * A run of transfers of one type that follow a simple pattern, from
+ * the transfer 'firstId' through 'lastId'. Other transfers may be
+ * mixed in with the run: a memcpy() shows up as a SEQUENTIAL run of
+ * reads and another of writes, interleaved.
+ */
+
+struct AccessPattern {
+    enum Kind {
+        SEQUENTIAL,     // Each transfer starts where the last one ended, or ends where it began
+        STRIDED,        // Constant distance between transfers, with gaps or overlap
+        POLLING,        // Small reads of the same address, over and over
+        NUM_KINDS,
+    };
+
+    Kind kind;
+    MemTransfer::TypeEnum type;     // READ or WRITE
+    ClockType beginTime;            // Times of the first and last transfers
+    ClockType endTime;
+    OffsetType firstId;
+    OffsetType lastId;
+    AddressType lowAddress;         // First and last bytes touched
+    AddressType highAddress;
+    int64_t stride;                 // Bytes from one transfer's address to the next
+    uint64_t count;                 // Transfers in the run
+
+    static const char *getKindName(Kind kind) {
+        switch (kind) {
+        case SEQUENTIAL:    return "sequential";
+        case STRIDED:       return "strided";
+        case POLLING:       return "polling";
+        default:            return "(invalid)";
+        }
+    }
+};
+
+
+/*
+ * Classifies transfers into AccessPatterns, one transfer at a time,
+ * in log order. This works like a hardware stride prefetcher: for
+ * each transfer type there's a small table of streams, each
+ * predicting the address of its next transfer. A transfer that
+ * matches a prediction extends that stream. Otherwise it trains a
+ * stream that has seen only one transfer, if one is close enough,
+ * or it replaces a stream: one that hasn't yet predicted a transfer
+ * correctly if possible, so that random traffic doesn't push out
+ * the runs it's mixed in with, and the least recently used of those.
+ *
+ * A stream ends when it's replaced, or when MAX_GAP transfers go by
+ * without extending it. If it was long enough, it's classified and
+ * appended to the caller's list. Finish() ends every stream.
+ *
+ * VERSION changes whenever the rules do, so indexes get rebuilt.
+ */
+
+class AccessClassifier {
+public:
+    static const int VERSION = 1;
+    static const int STREAMS = 8;               // Per transfer type
+    static const int MIN_RUN = 8;               // Transfers in a SEQUENTIAL or STRIDED run
+    static const int MIN_POLLS = 16;            // Reads in a POLLING run
+    static const int MAX_POLL_LENGTH = 16;      // Largest read that counts as a poll
+    static const int MAX_STRIDE = 64 * 1024;
+    static const int MAX_GAP = 256;             // Transfers between two in the same run
+
+    AccessClassifier() : clock(0) {
+        for (int t = 0; t < 2; t++)
+            for (int i = 0; i < STREAMS; i++)
+                streams[t][i].run.count = 0;
+    }
+
+    // Classify one transfer. 'time' is the time at its end.
+    void AddTransfer(const MemTransfer &mt, ClockType time,
+                     std::vector<AccessPattern> &finished)
+    {
+        if (!mt.byteCount || (mt.type != MemTransfer::READ && mt.type != MemTransfer::WRITE))
+            return;
+
+        Stream *table = streams[mt.type == MemTransfer::WRITE];
+        Stream *match = NULL;
+        Stream *trainee = NULL;
+        Stream *victim = &table[0];
+        int64_t traineeDistance = 0;
+
+        clock++;
+
+        for (int i = 0; i < STREAMS; i++) {
+            Stream &s = table[i];
+
+            if (s.run.count && mt.id - s.run.lastId > MAX_GAP)
+                End(s, finished);
+
+            if (!s.run.count) {
+                victim = &s;
+                continue;
+            }
+
+            if (s.run.count >= 2 && s.predicts(mt)) {
+                match = &s;
+                break;
+            }
+
+            int64_t distance = (int64_t)mt.address - (int64_t)s.address;
+            if (s.run.count == 1 && distance >= -MAX_STRIDE && distance <= MAX_STRIDE &&
+                (!trainee || llabs(distance) < llabs(traineeDistance))) {
+                trainee = &s;
+                traineeDistance = distance;
+            }
+
+            if (victim->run.count && s.isCheaperThan(*victim))
+                victim = &s;
+        }
+
+        if (!match && trainee) {
+            match = trainee;
+            match->run.stride = traineeDistance;
+            match->contiguous = (mt.address == trainee->address + trainee->length ||
+                                 mt.address + mt.byteCount == trainee->address);
+        }
+
+        if (match) {
+            AccessPattern &run = match->run;
+            run.endTime = time;
+            run.lastId = mt.id;
+            run.lowAddress = std::min(run.lowAddress, mt.address);
+            run.highAddress = std::max<AddressType>(run.highAddress,
+                                                    mt.address + mt.byteCount - 1);
+            run.count++;
+        } else {
+            End(*victim, finished);
+
+            match = victim;
+            AccessPattern &run = match->run;
+            run.type = mt.type;
+            run.beginTime = run.endTime = time;
+            run.firstId = run.lastId = mt.id;
+            run.lowAddress = mt.address;
+            run.highAddress = mt.address + mt.byteCount - 1;
+            run.stride = 0;
+            run.count = 1;
+            match->contiguous = false;
+        }
+
+        match->address = mt.address;
+        match->length = mt.byteCount;
+        match->lastUse = clock;
+    }
+
+    void Finish(std::vector<AccessPattern> &finished)
+    {
+        for (int t = 0; t < 2; t++)
+            for (int i = 0; i < STREAMS; i++)
+                End(streams[t][i], finished);
+    }
+
+private:
+    struct Stream {
+        AccessPattern run;          // Empty if count is zero
+        AddressType address;        // Last transfer
+        LengthType length;
+        bool contiguous;            // SEQUENTIAL, even if the lengths vary
+        uint64_t lastUse;
+
+        // Is this a better stream to replace than 'other'? Streams are proven after one correct prediction.
+        bool isCheaperThan(const Stream &other) const {
+            bool proven = run.count >= 3, otherProven = other.run.count >= 3;
+            if (proven != otherProven)
+                return !proven;
+            return lastUse < other.lastUse;
+        }
+
+        bool predicts(const MemTransfer &mt) const {
+            if (!contiguous)
+                return mt.address == address + run.stride &&
+                    (run.stride || mt.byteCount == length);
+            if (run.stride > 0)
+                return mt.address == address + length;
+            return mt.address + mt.byteCount == address;
+        }
+    };
+
+    void End(Stream &s, std::vector<AccessPattern> &finished)
+    {
+        AccessPattern &run = s.run;
+
+        if (!run.count)
+            return;
+
+        if (s.contiguous) {
+            run.kind = AccessPattern::SEQUENTIAL;
+        } else if (run.stride) {
+            run.kind = AccessPattern::STRIDED;
+        } else {
+            run.kind = AccessPattern::POLLING;
+        }
+
+        bool keep;
+        if (run.kind == AccessPattern::POLLING)
+            keep = (run.type == MemTransfer::READ && run.count >= MIN_POLLS &&
+                    s.length <= MAX_POLL_LENGTH);
+        else
+            keep = run.count >= MIN_RUN;
+
+        if (keep)
+            finished.push_back(run);
+        run.count = 0;
+    }
+
+    Stream streams[2][STREAMS];
+    uint64_t clock;
+};
+
+#endif /* __ACCESS_PATTERN_H */
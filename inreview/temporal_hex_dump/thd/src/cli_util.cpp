@@ -0,0 +1,64 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * cli_util.cpp -- Shared setup for the command-line tools.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <wx/filefn.h>
+#include <wx/utils.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "cli_util.h"
+
+
+bool
+openLogIndex(const char *path, LogReader &reader, LogIndex &index, bool quiet)
+{
+    wxString name(path, wxConvUTF8);
+    if (!wxFileExists(name)) {
+        fprintf(stderr, "Can't open '%s'\n", path);
+        return false;
+    }
+
+    reader.Open(name.c_str());
+    index.Open(&reader);
+
+    bool showProgress = !quiet && isatty(fileno(stderr));
+
+    if (!quiet && index.GetState() != LogIndex::COMPLETE)
+        fprintf(stderr, "No up-to-date index, building one first\n");
+
+    while (index.GetState() != LogIndex::COMPLETE) {
+        if (index.GetState() == LogIndex::ERROR) {
+            fprintf(stderr, showProgress ? "\nIndexing failed\n" : "Indexing failed\n");
+            return false;
+        }
+        if (showProgress)
+            fprintf(stderr, "\rIndexing... %5.1f%%", index.GetProgress() * 100.0);
+        wxMilliSleep(quiet ? 10 : 100);
+    }
+    if (showProgress)
+        fprintf(stderr, "\r%20s\r", "");
+
+    return true;
+}
@@ -0,0 +1,45 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * cli_util.h -- Shared setup for the command-line tools.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __CLI_UTIL_H
+#define __CLI_UTIL_H
+
+#include "log_reader.h"
+#include "log_index.h"
+
+
+/*
+ * Open a log and its index, and wait for the index to be COMPLETE,
+ * building it first if there isn't an up-to-date one. Unless 'quiet',
+ * says so on stderr, with a progress line if stderr is a terminal.
+ * Prints an error and returns false if the log can't be opened or
+ * indexing fails.
+ *
+ * wxWidgets must already be initialized.
+ */
+
+bool openLogIndex(const char *path, LogReader &reader, LogIndex &index, bool quiet = false);
+
+#endif /* __CLI_UTIL_H */
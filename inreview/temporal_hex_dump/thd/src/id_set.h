@@ -0,0 +1,334 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * id_set.h -- A compressed, append-only set of transfer IDs.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __ID_SET_H
+#define __ID_SET_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+
+/*
+ * A sorted set of 64-bit IDs, built by appending them in increasing
+ * order, and indexed by rank: Select(i) is the i'th smallest ID, and
+ * Rank(id) is how many IDs are smaller.
+ *
+ * The layout follows Roaring bitmaps. IDs are grouped into chunks of
+ * 2^16 by their high bits, and each chunk stores the low 16 bits of
+ * its IDs in one of three ways: as runs of consecutive IDs, as a
+ * sorted array, or as a bitmap. A chunk is finished when the first
+ * ID of the next one arrives, and then it switches to whichever of
+ * the three is smallest. Contiguous matches cost a few bytes per
+ * run, sparse ones about two bytes per ID, and dense scattered ones
+ * an eighth of a byte. The chunk still being appended to starts out
+ * as runs and moves to an array or bitmap if it gets fragmented, so
+ * it never grows past 8 kB either.
+ *
+ * Each chunk also records how many IDs come before it, so both
+ * lookups are a binary search over chunks plus a little work inside
+ * one.
+ */
+
+class IdSet {
+public:
+    IdSet() : count(0) {}
+
+    uint64_t size() const {
+        return count;
+    }
+
+    void clear() {
+        chunks.clear();
+        count = 0;
+    }
+
+    // 'id' must be larger than every ID already in the set.
+    void append(uint64_t id)
+    {
+        uint64_t key = id >> CHUNK_SHIFT;
+        uint16_t low = (uint16_t) id;
+
+        if (chunks.empty() || chunks.back().key != key) {
+            if (!chunks.empty())
+                chunks.back().finish(count - chunks.back().before);
+            chunks.push_back(Chunk());
+            chunks.back().key = key;
+            chunks.back().before = count;
+        }
+
+        Chunk &c = chunks.back();
+        bool extendsRun = c.numRuns && low == c.lastLow + 1;
+
+        if (!extendsRun)
+            c.numRuns++;
+        c.lastLow = low;
+
+        switch (c.kind) {
+
+        case RUNS:
+            if (extendsRun) {
+                c.runs.back().last = low;
+            } else {
+                c.runs.push_back(Run(low));
+                if (c.runs.size() > MAX_OPEN_RUNS) {
+                    if (count - c.before < MAX_ARRAY)
+                        c.toArray();
+                    else
+                        c.toBitmap();
+                }
+            }
+            break;
+
+        case ARRAY:
+            c.array.push_back(low);
+            if (c.array.size() > MAX_ARRAY)
+                c.toBitmap();
+            break;
+
+        case BITMAP:
+            c.bits[low >> 6] |= (uint64_t)1 << (low & 63);
+            break;
+        }
+
+        count++;
+    }
+
+    // The i'th smallest ID, for i < size().
+    uint64_t select(uint64_t i) const
+    {
+        const Chunk &c = *(std::upper_bound(chunks.begin(), chunks.end(), i, beforeLess) - 1);
+        uint32_t n = i - c.before;
+
+        switch (c.kind) {
+
+        case RUNS:
+            for (std::vector<Run>::const_iterator r = c.runs.begin();; r++) {
+                uint32_t len = r->last - r->start + 1;
+                if (n < len)
+                    return (c.key << CHUNK_SHIFT) | (r->start + n);
+                n -= len;
+            }
+
+        case ARRAY:
+            return (c.key << CHUNK_SHIFT) | c.array[n];
+
+        case BITMAP:
+            for (uint32_t w = 0;; w++) {
+                uint32_t pop = __builtin_popcountll(c.bits[w]);
+                if (n < pop) {
+                    uint64_t word = c.bits[w];
+                    while (n--)
+                        word &= word - 1;
+                    return (c.key << CHUNK_SHIFT) | (w << 6) | __builtin_ctzll(word);
+                }
+                n -= pop;
+            }
+        }
+        return 0;
+    }
+
+    // How many IDs in the set are smaller than 'id'.
+    uint64_t rank(uint64_t id) const
+    {
+        uint64_t key = id >> CHUNK_SHIFT;
+        uint16_t low = (uint16_t) id;
+        std::vector<Chunk>::const_iterator i =
+            std::lower_bound(chunks.begin(), chunks.end(), key, keyLess);
+
+        if (i == chunks.end())
+            return count;
+        if (i->key != key)
+            return i->before;
+
+        uint64_t n = i->before;
+
+        switch (i->kind) {
+
+        case RUNS:
+            for (std::vector<Run>::const_iterator r = i->runs.begin();
+                 r != i->runs.end() && low > r->start; r++) {
+                if (low > r->last)
+                    n += r->last - r->start + 1;
+                else
+                    n += low - r->start;
+            }
+            return n;
+
+        case ARRAY:
+            return n + (std::lower_bound(i->array.begin(), i->array.end(), low) -
+                        i->array.begin());
+
+        case BITMAP:
+            for (uint32_t w = 0; w < (uint32_t)(low >> 6); w++)
+                n += __builtin_popcountll(i->bits[w]);
+            return n + __builtin_popcountll(i->bits[low >> 6] &
+                                            (((uint64_t)1 << (low & 63)) - 1));
+        }
+        return n;
+    }
+
+    // Approximate memory use, in bytes.
+    uint64_t memoryUsed() const
+    {
+        uint64_t bytes = chunks.capacity() * sizeof(Chunk);
+        for (std::vector<Chunk>::const_iterator i = chunks.begin(); i != chunks.end(); i++)
+            bytes += (i->runs.capacity() * sizeof(Run) +
+                      i->array.capacity() * sizeof(uint16_t) +
+                      i->bits.size() * sizeof(uint64_t));
+        return bytes;
+    }
+
+private:
+    static const int CHUNK_SHIFT = 16;
+    static const size_t MAX_ARRAY = 4096;
+    static const int BITMAP_WORDS = (1 << CHUNK_SHIFT) / 64;
+    static const size_t BITMAP_BYTES = BITMAP_WORDS * sizeof(uint64_t);
+
+    enum Kind {
+        RUNS,
+        ARRAY,
+        BITMAP,
+    };
+
+    struct Run {
+        Run(uint16_t id) : start(id), last(id) {}
+
+        uint16_t start;
+        uint16_t last;              // Inclusive
+    };
+
+    // Runs the open chunk can hold before it's as big as a bitmap
+    static const size_t MAX_OPEN_RUNS = BITMAP_BYTES / sizeof(Run);
+
+    struct Chunk {
+        Chunk() : key(0), before(0), kind(RUNS), numRuns(0), lastLow(0) {}
+
+        uint64_t key;               // ID >> CHUNK_SHIFT
+        uint64_t before;            // IDs in earlier chunks
+        Kind kind;
+        uint32_t numRuns;           // Runs of consecutive IDs, whatever the kind
+        uint16_t lastLow;
+        std::vector<Run> runs;      // Only one of these is used, depending on 'kind'
+        std::vector<uint16_t> array;
+        std::vector<uint64_t> bits;
+
+        // Switch to the smallest representation, once no more IDs will be appended.
+        void finish(uint64_t size) {
+            size_t runBytes = numRuns * sizeof(Run);
+            size_t arrayBytes = size <= MAX_ARRAY ? size * sizeof(uint16_t) : BITMAP_BYTES + 1;
+
+            if (runBytes <= arrayBytes && runBytes <= BITMAP_BYTES)
+                toRuns();
+            else if (arrayBytes <= BITMAP_BYTES)
+                toArray();
+            else
+                toBitmap();
+
+            std::vector<Run>(runs).swap(runs);
+            std::vector<uint16_t>(array).swap(array);
+        }
+
+        void toRuns() {
+            if (kind == RUNS)
+                return;
+
+            std::vector<uint16_t> ids;
+            getIds(ids);
+            for (std::vector<uint16_t>::iterator i = ids.begin(); i != ids.end(); i++) {
+                if (!runs.empty() && *i == runs.back().last + 1)
+                    runs.back().last = *i;
+                else
+                    runs.push_back(Run(*i));
+            }
+            release();
+            kind = RUNS;
+        }
+
+        void toArray() {
+            if (kind == ARRAY)
+                return;
+
+            std::vector<uint16_t> ids;
+            getIds(ids);
+            release();
+            array.swap(ids);
+            kind = ARRAY;
+        }
+
+        void toBitmap() {
+            if (kind == BITMAP)
+                return;
+
+            std::vector<uint16_t> ids;
+            getIds(ids);
+            release();
+            bits.assign(BITMAP_WORDS, 0);
+            for (std::vector<uint16_t>::iterator i = ids.begin(); i != ids.end(); i++)
+                bits[*i >> 6] |= (uint64_t)1 << (*i & 63);
+            kind = BITMAP;
+        }
+
+        void getIds(std::vector<uint16_t> &ids) const {
+            switch (kind) {
+
+            case RUNS:
+                for (std::vector<Run>::const_iterator r = runs.begin(); r != runs.end(); r++)
+                    for (uint32_t id = r->start; id <= r->last; id++)
+                        ids.push_back(id);
+                break;
+
+            case ARRAY:
+                ids = array;
+                break;
+
+            case BITMAP:
+                for (uint32_t w = 0; w < (uint32_t)BITMAP_WORDS; w++)
+                    for (uint64_t word = bits[w]; word; word &= word - 1)
+                        ids.push_back((w << 6) | __builtin_ctzll(word));
+                break;
+            }
+        }
+
+        void release() {
+            std::vector<Run>().swap(runs);
+            std::vector<uint16_t>().swap(array);
+            std::vector<uint64_t>().swap(bits);
+        }
+    };
+
+    static bool beforeLess(uint64_t i, const Chunk &c) {
+        return i < c.before;
+    }
+
+    static bool keyLess(const Chunk &c, uint64_t key) {
+        return c.key < key;
+    }
+
+    std::vector<Chunk> chunks;
+    uint64_t count;
+};
+
+#endif /* __ID_SET_H */
@@ -0,0 +1,548 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * index_verifier.cpp -- Checks a finished log index against a fresh replay
+ *                       of the log, in parallel.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include "index_verifier.h"
+#include "trace_event.h"
+
+using namespace sqlite3x;
+
+
+/*
+ * One segment's replay. This mirrors IndexerThread::Entry() step for
+ * step: the same timestep boundaries, the same rule for skipping
+ * strata rows whose time didn't move, and the same block snapshots.
+ */
+
+class IndexVerifier::Segment {
+public:
+    Segment(IndexVerifier *verifier, int segment);
+    ~Segment();
+
+    void Run();
+
+    uint64_t rowsChecked;
+    uint64_t snapshotsChecked;
+    uint64_t transfersReplayed;
+
+private:
+    struct BlockState {
+        OffsetType firstWriteOffset;
+        OffsetType lastWriteOffset;
+        bool wDirty;
+    };
+
+    bool LoadStart();
+    bool CheckRow();
+    bool CheckSnapshots();
+    void Diverge(const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+    IndexVerifier *verifier;
+    LogIndex *index;
+    size_t row;
+    size_t endRow;
+    bool lastSegment;
+
+    sqlite3_connection db;
+    LogReader reader;
+    LogInstant instant;
+    MemTransfer mt;
+
+    int numBlocks;
+    BlockState *blocks;
+    uint8_t *memory;
+    std::vector<int> dirtyList;
+};
+
+
+IndexVerifier::IndexVerifier(LogIndex *_index)
+    : rowsChecked(0),
+      snapshotsChecked(0),
+      transfersReplayed(0),
+      numSegments(0),
+      index(_index),
+      nextSegment(0),
+      runningThreads(0),
+      diverged(false),
+      bytesReplayed(0)
+{
+    dbPath = std::string(index->GetIndexFileName().GetFullPath().fn_str());
+}
+
+
+IndexVerifier::~IndexVerifier()
+{
+    Wait();
+}
+
+
+void
+IndexVerifier::Start(int numThreads)
+{
+    /*
+     * Read every row's header up front. For a very large log this is
+     * a few tens of MB, and it lets us cut segments anywhere.
+     */
+
+    {
+        sqlite3_connection db(dbPath.c_str());
+        sqlite3_command cmd(db, "SELECT time, offset, transferId FROM strata ORDER BY time");
+        sqlite3_cursor crsr = cmd.executecursor();
+
+        while (crsr.step()) {
+            RowHeader h;
+            h.time = crsr.getint64(0);
+            h.offset = crsr.getint64(1);
+            h.transferId = crsr.getint64(2);
+            rows.push_back(h);
+        }
+    }
+
+    numThreads = std::max(1, numThreads);
+    numSegments = std::max<int>(1, std::min<size_t>(rows.size(),
+                                                    numThreads * SEGMENTS_PER_THREAD));
+    runningThreads = numThreads;
+
+    for (int i = 0; i < numThreads; i++) {
+        WorkerThread *thread = new WorkerThread(this);
+        thread->Create();
+        thread->Run();
+        threads.push_back(thread);
+    }
+}
+
+
+bool
+IndexVerifier::Wait()
+{
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->Wait();
+        delete threads[i];
+    }
+    threads.clear();
+
+    wxCriticalSectionLocker locker(lock);
+    return !diverged;
+}
+
+
+double
+IndexVerifier::GetProgress()
+{
+    double logSize = std::max<double>(1.0, index->GetLogFileName().GetSize().ToDouble());
+    wxCriticalSectionLocker locker(lock);
+    return bytesReplayed / logSize;
+}
+
+
+bool
+IndexVerifier::IsDone()
+{
+    wxCriticalSectionLocker locker(lock);
+    return runningThreads == 0;
+}
+
+
+bool
+IndexVerifier::NextSegment(int &segment)
+{
+    /*
+     * Hand out segments in order. Once a divergence is known, any
+     * segment that starts after it can't find an earlier one.
+     */
+
+    wxCriticalSectionLocker locker(lock);
+
+    while (nextSegment < numSegments) {
+        segment = nextSegment++;
+
+        size_t first = rows.size() * segment / numSegments;
+        if (!diverged || !first || rows[first - 1].transferId < firstDivergence.transferId)
+            return true;
+    }
+    return false;
+}
+
+
+void
+IndexVerifier::Report(const Divergence &d)
+{
+    wxCriticalSectionLocker locker(lock);
+
+    if (!diverged || d.transferId < firstDivergence.transferId) {
+        firstDivergence = d;
+        diverged = true;
+    }
+}
+
+
+bool
+IndexVerifier::ShouldStop(OffsetType transferId)
+{
+    wxCriticalSectionLocker locker(lock);
+    return diverged && firstDivergence.transferId < transferId;
+}
+
+
+wxThread::ExitCode
+IndexVerifier::WorkerThread::Entry()
+{
+    TraceLog::setThreadName("Verifier");
+
+    int segment;
+    while (verifier->NextSegment(segment)) {
+        Segment s(verifier, segment);
+        s.Run();
+
+        wxCriticalSectionLocker locker(verifier->lock);
+        verifier->rowsChecked += s.rowsChecked;
+        verifier->snapshotsChecked += s.snapshotsChecked;
+        verifier->transfersReplayed += s.transfersReplayed;
+    }
+
+    wxCriticalSectionLocker locker(verifier->lock);
+    verifier->runningThreads--;
+    return 0;
+}
+
+
+IndexVerifier::Segment::Segment(IndexVerifier *_verifier, int segment)
+    : rowsChecked(0),
+      snapshotsChecked(0),
+      transfersReplayed(0),
+      verifier(_verifier),
+      index(_verifier->index),
+      row(_verifier->rows.size() * segment / _verifier->numSegments),
+      endRow(_verifier->rows.size() * (segment + 1) / _verifier->numSegments),
+      lastSegment(segment + 1 == _verifier->numSegments),
+      db(_verifier->dbPath.c_str()),
+      reader(*_verifier->index->reader),
+      instant(_verifier->index->GetNumStrata(), 0, 0, true),
+      numBlocks(_verifier->index->GetNumBlocks()),
+      blocks(new BlockState[numBlocks]),
+      memory(new uint8_t[numBlocks << LogBlock::SHIFT])
+{
+    memset(blocks, 0, sizeof blocks[0] * numBlocks);
+    memset(memory, 0, numBlocks << LogBlock::SHIFT);
+}
+
+
+IndexVerifier::Segment::~Segment()
+{
+    delete[] blocks;
+    delete[] memory;
+}
+
+
+void
+IndexVerifier::Segment::Run()
+{
+    TraceScope trace("Verify segment");
+
+    if (!LoadStart())
+        return;
+
+    // The first segment starts before the first transfer, the rest just after a row.
+    bool eof = row > 0 && !reader.Next(mt);
+    OffsetType prevOffset = instant.offset;
+    ClockType prevTime = instant.time;
+
+    while (1) {
+        // Replay one timestep
+        while (!eof) {
+            if (!reader.Read(mt)) {
+                eof = true;
+                break;
+            }
+
+            if (mt.type == MemTransfer::WRITE) {
+                AlignedIterator<LogBlock::SHIFT> iter(mt);
+                do {
+                    BlockState *block = &blocks[iter.blockId];
+
+                    block->lastWriteOffset = mt.offset;
+                    if (!block->wDirty) {
+                        block->firstWriteOffset = mt.offset;
+                        block->wDirty = true;
+                        dirtyList.push_back(iter.blockId);
+                    }
+
+                    memcpy(memory + (iter.blockId << LogBlock::SHIFT) + iter.blockOffset,
+                           &mt.buffer[iter.mtOffset], iter.len);
+                } while (iter.next());
+            }
+
+            index->AdvanceInstant(instant, mt);
+            transfersReplayed++;
+
+            eof = !reader.Next(mt);
+            if (eof || mt.offset >= prevOffset + LogIndex::TIMESTEP_SIZE)
+                break;
+        }
+
+        // Timestep boundary
+
+        if (!CheckSnapshots())
+            return;
+
+        if (instant.time != prevTime) {
+            if (row >= endRow && lastSegment) {
+                Diverge("No strata row for the timestep ending here");
+                return;
+            }
+            if (!CheckRow())
+                return;
+        }
+
+        {
+            wxCriticalSectionLocker locker(verifier->lock);
+            verifier->bytesReplayed += instant.offset - prevOffset;
+        }
+
+        prevTime = instant.time;
+        prevOffset = instant.offset;
+
+        if ((row >= endRow && !lastSegment) || verifier->ShouldStop(instant.transferId))
+            return;
+
+        if (eof)
+            break;
+    }
+
+    if (row < endRow) {
+        RowHeader &h = verifier->rows[row];
+        Diverge("The log ends, but the index has %d more strata rows, "
+                "starting at time %lld, transfer %lld",
+                (int)(endRow - row), (long long)h.time, (long long)h.transferId);
+    }
+}
+
+
+bool
+IndexVerifier::Segment::LoadStart()
+{
+    /*
+     * Start from the row before ours, and memory as of its newest
+     * block snapshots. The first segment starts from nothing.
+     */
+
+    if (row == 0)
+        return true;
+
+    RowHeader &h = verifier->rows[row - 1];
+    {
+        sqlite3_command cmd(db, "SELECT readTotals, writeTotals, zeroTotals "
+                            "FROM strata WHERE time = ?");
+        cmd.bind(1, (sqlite3x::int64_t) h.time);
+        sqlite3_cursor crsr = cmd.executecursor();
+        crsr.step();
+
+        int size;
+        const void *blob;
+
+        instant.time = h.time;
+        instant.offset = h.offset;
+        instant.transferId = h.transferId;
+
+        blob = crsr.getblob(0, size);
+        instant.readTotals.unpack((const uint8_t *)blob, size);
+        blob = crsr.getblob(1, size);
+        instant.writeTotals.unpack((const uint8_t *)blob, size);
+        blob = crsr.getblob(2, size);
+        instant.zeroTotals.unpack((const uint8_t *)blob, size);
+    }
+
+    mt = MemTransfer(h.offset, h.transferId);
+
+    sqlite3_command cmd(db, "SELECT data FROM wblocks WHERE block = ? AND time <= ? "
+                        "ORDER BY time DESC LIMIT 1");
+
+    for (int b = 0; b < numBlocks; b++) {
+        cmd.bind(1, b);
+        cmd.bind(2, (sqlite3x::int64_t) h.time);
+        sqlite3_cursor crsr = cmd.executecursor();
+
+        if (crsr.step()) {
+            int size;
+            const void *blob = crsr.getblob(0, size);
+
+            if (size != LogBlock::SIZE) {
+                Diverge("Block %d snapshot before the segment is %d bytes", b, size);
+                return false;
+            }
+            memcpy(memory + (b << LogBlock::SHIFT), blob, size);
+        }
+    }
+
+    return true;
+}
+
+
+bool
+IndexVerifier::Segment::CheckRow()
+{
+    RowHeader &h = verifier->rows[row];
+
+    if (h.time != instant.time || h.offset != instant.offset ||
+        h.transferId != instant.transferId) {
+        Diverge("Strata row is at time %lld, offset %lld, transfer %lld",
+                (long long)h.time, (long long)h.offset, (long long)h.transferId);
+        return false;
+    }
+
+    LogInstant stored(index->GetNumStrata());
+    {
+        sqlite3_command cmd(db, "SELECT readTotals, writeTotals, zeroTotals "
+                            "FROM strata WHERE time = ?");
+        cmd.bind(1, (sqlite3x::int64_t) h.time);
+        sqlite3_cursor crsr = cmd.executecursor();
+        crsr.step();
+
+        int size;
+        const void *blob;
+
+        blob = crsr.getblob(0, size);
+        stored.readTotals.unpack((const uint8_t *)blob, size);
+        blob = crsr.getblob(1, size);
+        stored.writeTotals.unpack((const uint8_t *)blob, size);
+        blob = crsr.getblob(2, size);
+        stored.zeroTotals.unpack((const uint8_t *)blob, size);
+    }
+
+    static const char *names[] = { "readTotals", "writeTotals", "zeroTotals" };
+    LogStrata *expected[] = { &instant.readTotals, &instant.writeTotals, &instant.zeroTotals };
+    LogStrata *actual[] = { &stored.readTotals, &stored.writeTotals, &stored.zeroTotals };
+
+    for (int t = 0; t < 3; t++) {
+        for (int s = 0; s < index->GetNumStrata(); s++) {
+            if (expected[t]->get(s) != actual[t]->get(s)) {
+                Diverge("Strata row has %s[%d] = %llu, replay has %llu",
+                        names[t], s, (unsigned long long)actual[t]->get(s),
+                        (unsigned long long)expected[t]->get(s));
+                return false;
+            }
+        }
+    }
+
+    row++;
+    rowsChecked++;
+    return true;
+}
+
+
+bool
+IndexVerifier::Segment::CheckSnapshots()
+{
+    /*
+     * The indexer writes a snapshot of every block written during the
+     * timestep, and no others. Walk its rows and our dirty list
+     * together, both in block order.
+     */
+
+    std::sort(dirtyList.begin(), dirtyList.end());
+    std::vector<int>::iterator dirty = dirtyList.begin();
+
+    sqlite3_command cmd(db, "SELECT block, firstOffset, lastOffset, data "
+                        "FROM wblocks WHERE time = ? ORDER BY block");
+    cmd.bind(1, (sqlite3x::int64_t) instant.time);
+    sqlite3_cursor crsr = cmd.executecursor();
+
+    while (crsr.step()) {
+        int b = crsr.getint(0);
+
+        if (dirty == dirtyList.end() || *dirty > b) {
+            Diverge("Block %d has a snapshot, but wasn't written", b);
+            return false;
+        }
+        if (*dirty < b) {
+            Diverge("Block %d was written, but has no snapshot", *dirty);
+            return false;
+        }
+
+        BlockState &block = blocks[b];
+        OffsetType first = crsr.getint64(1);
+        OffsetType last = crsr.getint64(2);
+
+        if (first != block.firstWriteOffset || last != block.lastWriteOffset) {
+            Diverge("Block %d snapshot has writes at offsets %lld-%lld, replay has %lld-%lld",
+                    b, (long long)first, (long long)last,
+                    (long long)block.firstWriteOffset, (long long)block.lastWriteOffset);
+            return false;
+        }
+
+        int size;
+        const uint8_t *data = (const uint8_t *) crsr.getblob(3, size);
+        const uint8_t *replay = memory + (b << LogBlock::SHIFT);
+
+        if (size != LogBlock::SIZE) {
+            Diverge("Block %d snapshot is %d bytes", b, size);
+            return false;
+        }
+        if (memcmp(data, replay, size)) {
+            int i = 0;
+            while (data[i] == replay[i])
+                i++;
+            Diverge("Block %d snapshot has 0x%02x at address 0x%08x, replay has 0x%02x",
+                    b, data[i], (b << LogBlock::SHIFT) + i, replay[i]);
+            return false;
+        }
+
+        block.wDirty = false;
+        snapshotsChecked++;
+        dirty++;
+    }
+
+    if (dirty != dirtyList.end()) {
+        Diverge("Block %d was written, but has no snapshot", *dirty);
+        return false;
+    }
+
+    dirtyList.clear();
+    return true;
+}
+
+
+void
+IndexVerifier::Segment::Diverge(const char *fmt, ...)
+{
+    char buffer[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buffer, sizeof buffer, fmt, ap);
+    va_end(ap);
+
+    Divergence d;
+    d.transferId = instant.transferId;
+    d.offset = instant.offset;
+    d.time = instant.time;
+    d.message = buffer;
+
+    verifier->Report(d);
+}
@@ -0,0 +1,124 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * index_verifier.h -- Checks a finished log index against a fresh replay
+ *                     of the log, in parallel.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __INDEX_VERIFIER_H
+#define __INDEX_VERIFIER_H
+
+#include <wx/thread.h>
+#include <string>
+#include <vector>
+
+#include "log_index.h"
+
+
+/*
+ * Replays the log exactly the way the indexer does, and compares
+ * every 'strata' row and every 'wblocks' snapshot in the index with
+ * what the replay produces.
+ *
+ * The strata rows are full snapshots, so the log can be split into
+ * segments at any row. Each segment starts from its first row (and
+ * from the newest block snapshots at or before it), and replays up
+ * to the next segment's first row. The rows a segment starts from
+ * are checked by the segment before it, so together the segments
+ * check everything, and the earliest divergence any of them finds
+ * is the first one in the index.
+ *
+ * The index must be COMPLETE. Segments are handed out to a pool of
+ * threads, each with its own LogReader and database connection.
+ */
+
+class IndexVerifier {
+public:
+    struct Divergence {
+        OffsetType transferId;     // Last transfer replayed before the mismatch
+        OffsetType offset;
+        ClockType time;
+        std::string message;
+    };
+
+    IndexVerifier(LogIndex *index);
+    ~IndexVerifier();
+
+    /*
+     * Start verifying in the background, then Wait() for the result.
+     * Wait() returns true if the index matches the log.
+     */
+    void Start(int numThreads);
+    bool Wait();
+
+    // Fraction of the log replayed so far, and whether every thread has finished
+    double GetProgress();
+    bool IsDone();
+
+    // Valid after Wait() returns false.
+    Divergence firstDivergence;
+
+    // Totals, valid after Wait().
+    uint64_t rowsChecked;
+    uint64_t snapshotsChecked;
+    uint64_t transfersReplayed;
+    int numSegments;
+
+private:
+    static const int SEGMENTS_PER_THREAD = 4;
+
+    struct RowHeader {
+        ClockType time;
+        OffsetType offset;
+        OffsetType transferId;
+    };
+
+    class Segment;
+
+    class WorkerThread : public wxThread {
+    public:
+        WorkerThread(IndexVerifier *_verifier)
+            : wxThread(wxTHREAD_JOINABLE), verifier(_verifier) {}
+        virtual ExitCode Entry();
+
+    private:
+        IndexVerifier *verifier;
+    };
+
+    bool NextSegment(int &segment);
+    void Report(const Divergence &d);
+    bool ShouldStop(OffsetType transferId);
+
+    LogIndex *index;
+    std::string dbPath;
+    std::vector<RowHeader> rows;
+    std::vector<WorkerThread*> threads;
+
+    wxCriticalSection lock;    // Protects everything below
+    int nextSegment;
+    int runningThreads;
+    bool diverged;
+    uint64_t bytesReplayed;
+};
+
+
+#endif /* __INDEX_VERIFIER_H */
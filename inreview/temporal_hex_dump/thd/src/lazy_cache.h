@@ -28,8 +28,9 @@
 #define __LAZY_CACHE_H
 
 #include <wx/thread.h>
-#include <boost/unordered_set.hpp>
-#include <list>
+#include <string.h>
+#include <algorithm>
+#include <vector>
 
 #include "lru_cache.h"
 
@@ -50,7 +51,8 @@ public:
         : size(_size),
           itemCount(0),
           keys(new Key[_size]),
-          slots(_size)
+          slots(_size),
+          map(_size)
     {}
 
     ~WorkQueue()
@@ -58,17 +60,22 @@ public:
         delete[] keys;
     }
 
-    void insert(Key &k)
+    // Returns true if the oldest key was dropped to make room.
+    bool insert(Key &k)
     {
-        if (map.find(k) == map.end()) {
+        int index;
+        bool dropped = false;
+
+        if (!map.find(k, index)) {
             // Inserting 'k' for the first time.
 
             // Oldest slot (may or may not be occupied)
-            int index = slots.head;
+            index = slots.head;
 
             if (itemCount == size) {
                 // Remove oldest item from the map
                 map.erase(keys[index]);
+                dropped = true;
             } else {
                 // Oldest slot was empty
                 itemCount++;
@@ -78,14 +85,15 @@ public:
             slots.moveToTail(index);
 
             // Remember the item's current slot
-            map[k] = index;
+            map.insert(k, index);
             keys[index] = k;
 
         } else {
             // 'k' is already in the list. Bump its priority
 
-            slots.moveToTail(map[k]);
+            slots.moveToTail(index);
         }
+        return dropped;
     }
 
     void clear()
@@ -99,6 +107,11 @@ public:
         return itemCount == 0;
     }
 
+    int count()
+    {
+        return itemCount;
+    }
+
     Key &oldest()
     {
         return keys[slots.head];
@@ -123,7 +136,7 @@ public:
     }
 
 private:
-    typedef boost::unordered_map<Key, int> map_t;
+    typedef OpenHashMap<Key> map_t;
 
     int size;
     int itemCount;
@@ -133,54 +146,176 @@ private:
 };
 
 
+/*
+ * The LazyCache is an LRUCache which never blocks on a miss. Missing
+ * keys are queued, and a pool of worker threads generates them in
+ * the background.
+ *
+ * All workers share one WorkQueue, so they always pick up the most
+ * recently requested key first no matter how many workers there
+ * are. A key that is already being generated by one worker is never
+ * picked up by another, so the generator must only be thread-safe
+ * with respect to distinct keys.
+ *
+ * Keys can also be queued speculatively with prefetch(). These only
+ * run when there's no real work at all, and any real cache miss
+ * cancels every speculative key that hasn't started yet. We keep
+ * track of how many prefetched values were actually used.
+ *
+ * GetCacheStats() reports the overall hit rate, how many values have
+ * been generated, and how much work is waiting, for tuning.
+ */
+
 template <typename Key, typename Value>
 class LazyCache : public LRUCache<Key, Value>
 {
 public:
     typedef CacheGenerator<Key, Value> generator_t;
 
-    LazyCache(int _size, generator_t *_generator)
+    struct PrefetchStats {
+        uint64_t generated;     // Speculative values stored in the cache
+        uint64_t hits;          // ...that were later requested by get()
+        uint64_t evicted;       // ...that were evicted without being used
+        uint64_t cancelled;     // Speculative keys dropped before they ran
+    };
+
+    struct CacheStats {
+        uint64_t hits;          // get() calls answered from the cache
+        uint64_t misses;        // ...and the ones that weren't
+        uint64_t generated;     // Values stored by the workers or by put()
+        int queued;             // Keys waiting in the work queue
+        int speculativeQueued;  // Keys waiting in the speculative queue
+        int inFlight;           // Keys being generated right now
+    };
+
+    LazyCache(int _size, generator_t *_generator, int numWorkers = 1)
         : LRUCache<Key, Value>(_size, _generator),
           workQueue(_size),
-          running(true)
+          speculativeQueue(_size),
+          inFlight(std::max(1, numWorkers)),
+          speculative(_size, false),
+          flights(_size),
+          running(true),
+          epoch(0)
     {
-        thread = new Thread(this);
-        thread->Create();
-        thread->Run();
+        memset(&prefetchStats, 0, sizeof prefetchStats);
+        memset(&cacheStats, 0, sizeof cacheStats);
+
+        for (int i = 0; i < std::max(1, numWorkers); i++) {
+            Thread *thread = new Thread(this);
+            thread->Create();
+            thread->Run();
+            threads.push_back(thread);
+        }
     }
 
     ~LazyCache()
     {
         quiesce();
+        {
+            wxCriticalSectionLocker locker(lock);
+            cancelSpeculation();
+        }
         running = false;
-        thread->wake();
-        thread->Wait();
-        delete thread;
+
+        for (size_t i = 0; i < threads.size(); i++)
+            sema.Post();
+
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i]->Wait();
+            delete threads[i];
+        }
     }
 
     /*
      * Returns NULL on cache miss.
-     * If 'insert' is true, inserts/repositions the work item in our thread's queue.
+     * If 'insert' is true, inserts/repositions the work item in our threads' queue.
      */
     Value *get(Key k, bool insert=true)
     {
         wxCriticalSectionLocker locker(lock);
         int index;
 
-        if (find(k, index)) {
+        if (this->find(k, index)) {
+            cacheStats.hits++;
+            if (speculative[index]) {
+                speculative[index] = false;
+                prefetchStats.hits++;
+            }
             return &LRUCache<Key, Value>::retrieve(index);
         } else {
+            cacheStats.misses++;
             if (insert) {
+                // Real demand always wins over speculation
+                cancelSpeculation();
+
                 workQueue.insert(k);
-                thread->wake();
+                sema.Post();
             }
         }
         return NULL;
     }
 
     /*
-     * Forget all current work item, lets the background thread go
-     * idle as soon as the current work item is finished.
+     * Queue a key at low priority, in case it's needed soon. Workers
+     * only generate it once the normal work queue is empty.
+     */
+    void prefetch(Key k)
+    {
+        wxCriticalSectionLocker locker(lock);
+        int index;
+
+        if (!this->find(k, index)) {
+            if (speculativeQueue.insert(k))
+                prefetchStats.cancelled++;
+            sema.Post();
+        }
+    }
+
+    PrefetchStats GetPrefetchStats()
+    {
+        wxCriticalSectionLocker locker(lock);
+        return prefetchStats;
+    }
+
+    CacheStats GetCacheStats()
+    {
+        wxCriticalSectionLocker locker(lock);
+        CacheStats stats = cacheStats;
+        stats.queued = workQueue.count();
+        stats.speculativeQueued = speculativeQueue.count();
+        stats.inFlight = inFlight.size();
+        return stats;
+    }
+
+    /*
+     * Store a value that was generated outside the worker threads,
+     * such as by a batch generator. 'valueEpoch' is what GetEpoch()
+     * returned before the value was generated; values from before an
+     * invalidate() are dropped. Keys that are already cached or being
+     * generated in this epoch are left alone.
+     */
+    void put(Key k, const Value &v, int valueEpoch)
+    {
+        wxCriticalSectionLocker locker(lock);
+        int index;
+
+        if (valueEpoch != epoch || this->find(k, index))
+            return;
+        if (inFlight.find(k, index) && flights[index].epoch == epoch)
+            return;
+
+        alloc(index, false) = v;
+        this->store(k, index);
+        cacheStats.generated++;
+    }
+
+    /*
+     * Forget all current work items, lets the background threads go
+     * idle as soon as their current work items are finished.
+     *
+     * Speculative keys are kept. Being idle is exactly when they're
+     * meant to run, and only real demand cancels them.
      */
     void quiesce()
     {
@@ -188,31 +323,71 @@ public:
         workQueue.clear();
     }
 
+    /*
+     * Forget every cached value and all queued work, because the
+     * generator would produce something different now. Values that
+     * are being generated right now are thrown away when they finish.
+     */
+    void invalidate()
+    {
+        wxCriticalSectionLocker locker(lock);
+        workQueue.clear();
+        cancelSpeculation();
+        this->forget();
+        epoch++;
+    }
+
+    int GetEpoch()
+    {
+        wxCriticalSectionLocker locker(lock);
+        return epoch;
+    }
+
+    int GetNumWorkers() const
+    {
+        return threads.size();
+    }
+
 private:
 
+    // Drop every speculative key that hasn't started. Caller holds the lock.
+    void cancelSpeculation()
+    {
+        prefetchStats.cancelled += speculativeQueue.count();
+        speculativeQueue.clear();
+    }
+
+    // Allocate a slot, keeping track of prefetched values that were never used.
+    Value &alloc(int &index, bool isSpeculative)
+    {
+        Value &v = LRUCache<Key, Value>::alloc(index);
+
+        if (speculative[index])
+            prefetchStats.evicted++;
+        speculative[index] = isSpeculative;
+
+        if (isSpeculative)
+            prefetchStats.generated++;
+        return v;
+    }
+
     class Thread : public wxThread
     {
     public:
         Thread(LazyCache<Key, Value> *_cache)
             : wxThread(wxTHREAD_JOINABLE),
-              cache(_cache),
-              sema()
+              cache(_cache)
         {}
 
         virtual ExitCode Entry()
         {
             while (cache->running && !TestDestroy()) {
-                sema.WaitTimeout(1000);
+                cache->sema.WaitTimeout(1000);
                 while (processWorkQueue());
             }
 			return 0;
         }
 
-        void wake()
-        {
-            sema.Post();
-        }
-
     private:
 
         // Returns true if there is more work, false if the queue is empty.
@@ -223,27 +398,51 @@ private:
              *
              * Currently we're extracting the most *recently* added
              * item, in order to improve interactive responsiveness.
+             * Speculative items only run when there's nothing else.
              */
 
             cache->lock.Enter();
 
-            if (cache->workQueue.empty()) {
+            WorkQueue<Key> *queue = &cache->workQueue;
+            if (queue->empty())
+                queue = &cache->speculativeQueue;
+
+            if (queue->empty()) {
                 cache->lock.Leave();
                 return false;
             }
 
-            Key k = cache->workQueue.newest();
-            cache->workQueue.removeNewest();
+            bool isSpeculative = queue == &cache->speculativeQueue;
+            Key k = queue->newest();
+            queue->removeNewest();
 
             int index;
             if (cache->find(k, index)) {
-                // Duplicate work item
+                // Duplicate work item, already finished
+                cache->lock.Leave();
+                return true;
+            }
+
+            if (cache->inFlight.find(k, index)) {
+                /*
+                 * Already in progress. If it started before the last
+                 * invalidate(), its result will be thrown away, so
+                 * that worker has to queue the key again when it's
+                 * done. Real demand wins over speculation here too.
+                 */
+                Flight &f = cache->flights[index];
+                if (f.epoch != cache->epoch && (!f.requeue || !isSpeculative))
+                    f.requeue = queue;
                 cache->lock.Leave();
                 return true;
             }
 
             // Allocate a spot for the result
-            Value &v = cache->alloc(index);
+            Value &v = cache->alloc(index, isSpeculative);
+            cache->inFlight.insert(k, index);
+            int epoch = cache->epoch;
+            cache->flights[index].epoch = epoch;
+            cache->flights[index].requeue = NULL;
 
             cache->lock.Leave();
 
@@ -259,20 +458,42 @@ private:
              */
 
             cache->lock.Enter();
-            cache->store(k, index);
+            if (epoch == cache->epoch) {
+                cache->store(k, index);
+                cache->cacheStats.generated++;
+            } else {
+                cache->release(index);
+                WorkQueue<Key> *requeue = cache->flights[index].requeue;
+                if (requeue && requeue->insert(k) && requeue == &cache->speculativeQueue)
+                    cache->prefetchStats.cancelled++;
+            }
+            cache->inFlight.erase(k);
             cache->lock.Leave();
 
             return true;
         }
 
-        wxSemaphore sema;
         LazyCache<Key, Value> *cache;
     };
 
-    Thread *thread;
+    // Per slot, while its value is being generated
+    struct Flight {
+        int epoch;                  // Cache epoch when generation started
+        WorkQueue<Key> *requeue;    // Asked for again since an invalidate()
+    };
+
+    std::vector<Thread*> threads;
+    wxSemaphore sema;
     wxCriticalSection lock;
     bool running;
+    int epoch;                      // Bumped by invalidate()
     WorkQueue<Key> workQueue;
+    WorkQueue<Key> speculativeQueue;
+    OpenHashMap<Key> inFlight;   // Keys currently being generated
+    std::vector<bool> speculative;  // Per slot: prefetched, and not used yet
+    std::vector<Flight> flights;
+    PrefetchStats prefetchStats;
+    CacheStats cacheStats;
 };
 
 #endif /* __LAZY_CACHE_H */
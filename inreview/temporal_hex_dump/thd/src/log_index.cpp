@@ -27,35 +27,53 @@
 #define __STDC_LIMIT_MACROS
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <wx/string.h>
+#include <wx/file.h>
+#include <wx/stopwatch.h>
+#include <wx/utils.h>
 #include <assert.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include "log_index.h"
 #include "varint.h"
+#include "trace_event.h"
 
 using namespace sqlite3x;
 
 wxEventType LogIndex::progressEvent = 0;
-
-/*
- * DEBUG: This enables very expensive debugging checks which verify the
- * integrity of the index. Don't enable them unless you suspect something
- * is wrong with the index, since the checks are extremely slow.
- */
-#define INDEX_DEBUG  0
-
+volatile ::int64_t LogIndex::lastUserActivity = 0;
 
 LogIndex::LogIndex()
     : progressReceiver(NULL),
       cmd_getInstantForTimestep(NULL),
       cmd_getTransferSummary(NULL),
+      cmd_getStrataTile(NULL),
+      cmd_getBuckets(NULL),
+      cmd_getWorkingSet(NULL),
+      cmd_getBlock(NULL),
+      cmd_getBlockStart(NULL),
       reader(NULL),
       lastInstant(GetInstantForTimestep(0)),
       instantCache(INSTANT_CACHE_SIZE, GetInstantForTimestep(0)),
-      transferCache(INSTANT_CACHE_SIZE, transferPtr_t(new TransferSummary()))
+      transferCache(INSTANT_CACHE_SIZE, transferPtr_t(new TransferSummary())),
+      tileCache(TILE_CACHE_SIZE, tilePtr_t(new StrataTile(0, -1, -1))),
+      nextSegmentId(1),
+      segmentGeneration(0),
+      havePriority(false),
+      segmentThread(NULL),
+      dbWaiters(0),
+      lowImpact(false),
+      longestPattern(-1)
 {
     if (!progressEvent)
         progressEvent = wxNewEventType();
 
+    memset(&cacheStats, 0, sizeof cacheStats);
+
     SetProgress(0.0, IDLE);
 }
 
@@ -77,14 +95,15 @@ LogIndex::Open(LogReader *reader)
         wxCriticalSectionLocker locker(dbLock);
 
         this->reader = reader;
+        readers.Open(reader);
         logFileSize = std::max<double>(1.0, reader->FileName().GetSize().ToDouble());
 
-        wxFileName indexFile = reader->FileName();
-        indexFile.SetExt(wxT("index"));
+        indexFile = FindIndexFile(reader->FileName(), &fingerprint);
         wxString indexPath = indexFile.GetFullPath();
 
         db.open(indexPath.fn_str());
         InitDB();
+        longestPattern = -1;
 
         /*
          * Is this index complete and up-to-date?
@@ -113,8 +132,115 @@ LogIndex::Open(LogReader *reader)
      * periodically by the indexer.
      */
     if (GetState() != INDEXING) {
-        lastInstant = GetInstantForTimestep(INT64_MAX);
+        SetLastInstant(GetInstantForTimestep(INT64_MAX));
+    }
+
+    /*
+     * Forget instants and strata tiles from any earlier log. With
+     * nothing closer in the cache, lookups start from the instant just
+     * after transfer 0. Like every LogInstant it includes the transfer
+     * at its offset, so walks forward from it start with transfer 1.
+     */
+    instantPtr_t first(new LogInstant(GetNumStrata()));
+    first->clear();
+    {
+        LogReaderPool::Handle handle(readers);
+        MemTransfer mt(0);
+        if (handle->Read(mt))
+            AdvanceInstant(*first, mt);
+    }
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+        instantCache.clear(first);
+        tileCache.clear(tilePtr_t(new StrataTile(0, -1, -1)));
+    }
+}
+
+
+wxFileName
+LogIndex::FindIndexFile(const wxFileName &logFile, wxString *fingerprint)
+{
+    const char *cacheDir = getenv("THD_INDEX_CACHE");
+
+    if (fingerprint)
+        fingerprint->Clear();
+
+    if (cacheDir && *cacheDir) {
+        wxString dir(cacheDir, wxConvUTF8);
+        wxString name = Fingerprint(logFile);
+
+        if (name.IsEmpty()) {
+            fprintf(stderr, "INDEX: Can't fingerprint the log, keeping its index next to it\n");
+        } else if (!wxDirExists(dir) && !wxFileName::Mkdir(dir, 0777, wxPATH_MKDIR_FULL)) {
+            fprintf(stderr, "INDEX: Can't create index cache '%s', keeping the index next to the log\n",
+                    cacheDir);
+        } else {
+            if (fingerprint)
+                *fingerprint = name;
+            return wxFileName(dir, name + wxT(".index"));
+        }
+    }
+
+    wxFileName indexFile = logFile;
+    indexFile.SetExt(wxT("index"));
+    return indexFile;
+}
+
+
+wxString
+LogIndex::Fingerprint(const wxFileName &logFile)
+{
+    /*
+     * 64-bit FNV-1a, over the file size and FINGERPRINT_SAMPLES
+     * chunks from evenly spaced offsets, the first at the beginning
+     * of the file and the last at the end. Small files are hashed
+     * whole. This reads a few megabytes no matter how big the log is,
+     * so it's cheap even on slow network storage, and any edit that
+     * changes the size or touches a sampled chunk changes the result.
+     */
+
+    wxFile file(logFile.GetFullPath());
+    if (!file.IsOpened())
+        return wxString();
+
+    wxFileOffset size = file.Length();
+    if (size == wxInvalidOffset)
+        return wxString();
+
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < 8; i++) {
+        hash ^= (uint8_t)((uint64_t)size >> (i * 8));
+        hash *= prime;
+    }
+
+    std::vector<uint8_t> buffer(FINGERPRINT_SAMPLE_SIZE);
+    wxFileOffset wholeSize = (wxFileOffset)FINGERPRINT_SAMPLES * FINGERPRINT_SAMPLE_SIZE;
+    int samples = size <= wholeSize ? (size + FINGERPRINT_SAMPLE_SIZE - 1) / FINGERPRINT_SAMPLE_SIZE
+                                    : FINGERPRINT_SAMPLES;
+
+    for (int i = 0; i < samples; i++) {
+        wxFileOffset offset;
+
+        if (size <= wholeSize)
+            offset = (wxFileOffset)i * FINGERPRINT_SAMPLE_SIZE;
+        else
+            offset = (size - FINGERPRINT_SAMPLE_SIZE) / (FINGERPRINT_SAMPLES - 1) * i;
+
+        size_t len = std::min<wxFileOffset>(FINGERPRINT_SAMPLE_SIZE, size - offset);
+
+        if (file.Seek(offset) != offset || file.Read(&buffer[0], len) != (ssize_t)len)
+            return wxString();
+
+        for (size_t j = 0; j < len; j++) {
+            hash ^= buffer[j];
+            hash *= prime;
+        }
     }
+
+    return wxString::Format(wxT("%016llx-%llu"), (unsigned long long) hash,
+                            (unsigned long long) size);
 }
 
 
@@ -132,15 +258,47 @@ LogIndex::DeleteCommands()
         delete cmd_getTransferSummary;
         cmd_getTransferSummary = NULL;
     }
+
+    if (cmd_getStrataTile) {
+        delete cmd_getStrataTile;
+        cmd_getStrataTile = NULL;
+    }
+
+    if (cmd_getBuckets) {
+        delete cmd_getBuckets;
+        cmd_getBuckets = NULL;
+    }
+
+    if (cmd_getWorkingSet) {
+        delete cmd_getWorkingSet;
+        cmd_getWorkingSet = NULL;
+    }
+
+    if (cmd_getBlock) {
+        delete cmd_getBlock;
+        cmd_getBlock = NULL;
+    }
+
+    if (cmd_getBlockStart) {
+        delete cmd_getBlockStart;
+        cmd_getBlockStart = NULL;
+    }
 }
 
 
 void
 LogIndex::Close()
 {
+    StopSegmentThread();
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+        segments.clear();
+    }
+
     wxCriticalSectionLocker locker(dbLock);
     DeleteCommands();
     db.close();
+    readers.Clear();
     reader = NULL;
 }
 
@@ -158,7 +316,8 @@ LogIndex::InitDB()
 
     // Stores state for Finish()/checkinished().
     db.executenonquery("CREATE TABLE IF NOT EXISTS logInfo ("
-                       "name, mtime, timestepSize, blockSize, stratumSize)");
+                       "name, mtime, timestepSize, blockSize, stratumSize, tileSize, "
+                       "bucketSize, fingerprint, sketchRegisters, patternVersion)");
 
     /*
      * The strata- thick layers of coarse but quick spatial stats.
@@ -176,6 +335,75 @@ LogIndex::InitDB()
                        "zeroTotals"
                        ")");
 
+    /*
+     * The strata pyramid: Per-stratum totals for fixed time ranges,
+     * at every power-of-two scale. See StrataTile. Tiles with no
+     * activity at all are left out.
+     */
+
+    db.executenonquery("CREATE TABLE IF NOT EXISTS pyramid ("
+                       "level,"
+                       "tile,"
+                       "readTotals,"
+                       "writeTotals,"
+                       "zeroTotals"
+                       ")");
+
+    /*
+     * Sparse fine totals below the strata, for each level 0 pyramid
+     * tile. There's one row per level for every stratum touched
+     * during the tile. The BLOB is a packed list of varints: a bitmask
+     * of the touched buckets within the stratum, then the read, write
+     * and zero totals for each of those buckets in order.
+     */
+
+    db.executenonquery("CREATE TABLE IF NOT EXISTS buckets ("
+                       "level,"
+                       "tile,"
+                       "stratum,"
+                       "totals"
+                       ")");
+
+    /*
+     * Working set sketches. 'wsteps' has a row for every timestep,
+     * including those where the time didn't change, so the steps are
+     * numbered consecutively. 'wsets' is the tree of sketches over
+     * them: level n, node i covers steps i << n through ((i + 1) << n) - 1.
+     * Nodes with no activity at all are left out. Each sketch is the
+     * raw array of WorkingSetSketch registers.
+     */
+
+    db.executenonquery("CREATE TABLE IF NOT EXISTS wsteps ("
+                       "step INTEGER PRIMARY KEY ASC,"
+                       "offset,"
+                       "transferId"
+                       ")");
+
+    db.executenonquery("CREATE TABLE IF NOT EXISTS wsets ("
+                       "level,"
+                       "node,"
+                       "readSketch,"
+                       "writeSketch"
+                       ")");
+
+    /*
+     * Access patterns, one row per run. See AccessPattern. Rows are
+     * stored as runs end, so they aren't in any particular order.
+     */
+
+    db.executenonquery("CREATE TABLE IF NOT EXISTS patterns ("
+                       "kind,"
+                       "type,"
+                       "beginTime,"
+                       "endTime,"
+                       "firstId,"
+                       "lastId,"
+                       "lowAddress,"
+                       "highAddress,"
+                       "stride,"
+                       "count"
+                       ")");
+
     // Snapshots of modified blocks at each timeslice
     db.executenonquery("CREATE TABLE IF NOT EXISTS wblocks ("
                        "time,"
@@ -208,16 +436,38 @@ LogIndex::Finish()
     db.executenonquery("CREATE UNIQUE INDEX IF NOT EXISTS wblockIdx2 "
                        "on wblocks (block, time)");
 
+    db.executenonquery("CREATE UNIQUE INDEX IF NOT EXISTS pyramidIdx "
+                       "on pyramid (level, tile)");
+    db.executenonquery("CREATE UNIQUE INDEX IF NOT EXISTS bucketIdx "
+                       "on buckets (level, tile, stratum)");
+
+    db.executenonquery("CREATE INDEX IF NOT EXISTS wstepIdx "
+                       "on wsteps (transferId)");
+    db.executenonquery("CREATE UNIQUE INDEX IF NOT EXISTS wsetIdx "
+                       "on wsets (level, node)");
+
+    db.executenonquery("CREATE INDEX IF NOT EXISTS patternIdx1 "
+                       "on patterns (beginTime)");
+    db.executenonquery("CREATE INDEX IF NOT EXISTS patternIdx2 "
+                       "on patterns (firstId)");
+    db.executenonquery("CREATE INDEX IF NOT EXISTS patternIdx3 "
+                       "on patterns (kind, firstId)");
+
     db.executenonquery("ANALYZE");
 
-    wxFileName indexFile = reader->FileName();
-    sqlite3_command cmd(db, "INSERT INTO logInfo VALUES(?,?,?,?,?)");
+    wxFileName logFile = reader->FileName();
+    sqlite3_command cmd(db, "INSERT INTO logInfo VALUES(?,?,?,?,?,?,?,?,?,?)");
 
-    cmd.bind(1, indexFile.GetName().fn_str());
-    cmd.bind(2, (sqlite3x::int64_t) indexFile.GetModificationTime().GetTicks());
+    cmd.bind(1, logFile.GetName().fn_str());
+    cmd.bind(2, (sqlite3x::int64_t) logFile.GetModificationTime().GetTicks());
     cmd.bind(3, TIMESTEP_SIZE);
     cmd.bind(4, LogBlock::SIZE);
     cmd.bind(5, STRATUM_SIZE);
+    cmd.bind(6, (sqlite3x::int64_t) GetTileSize(0));
+    cmd.bind(7, 1 << GetBucketShift(1));
+    cmd.bind(8, fingerprint.fn_str());
+    cmd.bind(9, WorkingSetSketch::REGISTERS);
+    cmd.bind(10, AccessClassifier::VERSION);
 
     cmd.executenonquery();
 
@@ -239,12 +489,12 @@ LogIndex::CheckFinished()
 {
     // Assumes dbLock is already locked.
 
-    wxFileName indexFile = reader->FileName();
+    wxFileName logFile = reader->FileName();
     sqlite3_command cmd(db, "SELECT * FROM logInfo");
     sqlite3_cursor reader = cmd.executecursor();
 
-    if (!reader.step()) {
-        // No loginfo data
+    if (!reader.step() || reader.colcount() < 10) {
+        // No loginfo data, or an index from before access patterns
         return false;
     }
 
@@ -253,12 +503,32 @@ LogIndex::CheckFinished()
     int timestepSize = reader.getint(2);
     int blockSize = reader.getint(3);
     int stratumSize = reader.getint(4);
+    sqlite3x::int64_t tileSize = reader.getint64(5);
+    int bucketSize = reader.getint(6);
+    wxString storedFingerprint(reader.getstring(7).c_str(), wxConvUTF8);
+    int sketchRegisters = reader.getint(8);
+    int patternVersion = reader.getint(9);
 
-    if (name == indexFile.GetName() &&
-        mtime == indexFile.GetModificationTime().GetTicks() &&
+    /*
+     * An index in THD_INDEX_CACHE belongs to any log with the same
+     * fingerprint. One next to the log belongs to that file, as long
+     * as it hasn't been modified.
+     */
+    bool sameLog;
+    if (fingerprint.IsEmpty())
+        sameLog = (name == logFile.GetName() &&
+                   mtime == logFile.GetModificationTime().GetTicks());
+    else
+        sameLog = storedFingerprint == fingerprint;
+
+    if (sameLog &&
         timestepSize == TIMESTEP_SIZE &&
         blockSize == LogBlock::SIZE &&
-        stratumSize == STRATUM_SIZE) {
+        stratumSize == STRATUM_SIZE &&
+        tileSize == (sqlite3x::int64_t) GetTileSize(0) &&
+        bucketSize == 1 << GetBucketShift(1) &&
+        sketchRegisters == WorkingSetSketch::REGISTERS &&
+        patternVersion == AccessClassifier::VERSION) {
         return true;
     } else {
         return false;
@@ -273,6 +543,63 @@ LogIndex::StartIndexing()
     indexer = new IndexerThread(this);
     indexer->Create();
     indexer->Run();
+
+    StopSegmentThread();
+    segmentThread = new SegmentThread(this);
+    segmentThread->Create();
+    segmentThread->Run();
+}
+
+
+void
+LogIndex::NoteUserActivity()
+{
+    lastUserActivity = wxGetLocalTimeMillis().GetValue();
+}
+
+
+bool
+LogIndex::IsThrottled()
+{
+    return dbWaiters > 0 ||
+        wxGetLocalTimeMillis().GetValue() - lastUserActivity < LOW_IMPACT_IDLE_MSEC;
+}
+
+
+static void
+lowerThreadPriority()
+{
+    /*
+     * Drop the calling thread to background priority, for both CPU
+     * and disk. Linux keeps a nice value and an I/O class per thread.
+     * Mac OS has a background band that covers both.
+     */
+
+#if defined(__linux__)
+    const int IOPRIO_WHO_PROCESS = 1;
+    const int IOPRIO_CLASS_IDLE = 3;
+    const int IOPRIO_CLASS_SHIFT = 13;
+
+    pid_t tid = syscall(SYS_gettid);
+
+    setpriority(PRIO_PROCESS, tid, 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#elif defined(__APPLE__)
+    setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG);
+#endif
+}
+
+
+void
+LogIndex::StopSegmentThread()
+{
+    if (segmentThread) {
+        segmentThread->running = false;
+        segmentThread->sema.Post();
+        segmentThread->Wait();
+        delete segmentThread;
+        segmentThread = NULL;
+    }
 }
 
 
@@ -305,6 +632,7 @@ LogIndex::StoreInstant(LogInstant &instant)
      * The caller must have already locked the database and started a transaction.
      */
 
+    TraceScope trace("StoreInstant");
     sqlite3_command cmd(db, "INSERT INTO strata VALUES(?,?,?,?,?,?)");
 
     cmd.bind(1, (sqlite3x::int64_t) instant.time);
@@ -327,187 +655,624 @@ LogIndex::StoreInstant(LogInstant &instant)
 
 
 void
-LogIndex::AdvanceInstant(LogInstant &instant, MemTransfer &mt, bool reverse)
+LogIndex::StoreTile(StrataTile &tile)
 {
     /*
-     * Advance a LogInstant forward or backward by processing one memory transfer.
+     * Store a StrataTile to the pyramid table.
+     * The caller must have already locked the database and started a transaction.
      */
 
-    if (INDEX_DEBUG)
-        printf("Advancing: inst(time=%lld offset=%lld) rev=%d "
-               "mt(type=%s, dur=%d, offset=%lld)\n",
-               instant.time, instant.offset,
-               reverse,
-               (const char *)mt.getTypeName().mb_str(),
-               mt.duration, mt.offset);
-
-    instant.updateTime(mt.duration, reverse);
-    instant.offset = mt.offset;
-    instant.transferId = mt.id;
+    sqlite3_command cmd(db, "INSERT INTO pyramid VALUES(?,?,?,?,?)");
 
-    if (mt.byteCount) {
-        AlignedIterator<STRATUM_SHIFT> iter(mt);
+    cmd.bind(1, tile.level);
+    cmd.bind(2, (sqlite3x::int64_t) tile.index);
 
-        do {
-            switch (mt.type) {
+    uint8_t buffer[GetNumStrata() * 8];   // Worst-case packed size
 
-            case MemTransfer::READ: {
-                instant.readTotals.update(iter.blockId, iter.len, reverse);
-                break;
-            }
+    tile.readTotals.pack(buffer);
+    cmd.bind(3, buffer, tile.readTotals.getPackedLen());
 
-            case MemTransfer::WRITE: {
-                LengthType numZeroes = 0;
-                
-                for (LengthType i = 0; i < iter.len; i++) {
-                    uint8_t byte = mt.buffer[i + iter.mtOffset];
-                    if (!byte)
-                        numZeroes++;
-                }
+    tile.writeTotals.pack(buffer);
+    cmd.bind(4, buffer, tile.writeTotals.getPackedLen());
 
-                instant.writeTotals.update(iter.blockId, iter.len, reverse);
-                instant.zeroTotals.update(iter.blockId, numZeroes, reverse);
-                break;
-            }
+    tile.zeroTotals.pack(buffer);
+    cmd.bind(5, buffer, tile.zeroTotals.getPackedLen());
 
-            default:
-                break;
-            }
-        } while (iter.next());
-    }
+    cmd.executenonquery();
 }
 
 
-wxThread::ExitCode
-LogIndex::IndexerThread::Entry()
+void
+LogIndex::StoreBuckets(sqlite3_command &cmd, int level, ::int64_t tile, int stratum,
+                       const BucketTotals &blocks)
 {
     /*
-     * Main loop for indexing thread.
+     * Store one stratum's worth of fine totals at 'level', given the
+     * per-block totals in 'blocks'. Buckets with no activity are
+     * left out, and so is the whole row if the stratum is idle.
+     *
+     * 'cmd' is an INSERT INTO buckets. The caller must have already
+     * locked the database and started a transaction.
      */
 
-    bool aborted = false;
-    bool running = true;
+    static const int MAX_BUCKETS = 1 << (STRATUM_SHIFT - LogBlock::SHIFT);
 
-    // Beginning of this timestep, end of previous timestep
-    OffsetType prevOffset = 0;
-    ClockType prevTime = 0;
+    int numBuckets = 1 << (STRATUM_SHIFT - GetBucketShift(level));
+    int blockShift = GetBucketShift(level) - LogBlock::SHIFT;
+    int firstBlock = stratum << (STRATUM_SHIFT - LogBlock::SHIFT);
 
-    /* Data about the current log instant */
-    LogInstant instant(index->GetNumStrata());
-    instant.clear();
+    const uint64_t *blockRead = blocks.readTotals.getArray();
+    const uint64_t *blockWrite = blocks.writeTotals.getArray();
+    const uint64_t *blockZero = blocks.zeroTotals.getArray();
 
-    /* State of each block */
-    struct BlockState {
-        uint64_t firstWriteOffset;
-        uint64_t lastWriteOffset;
-        bool wDirty;
-        uint8_t data[LogBlock::SIZE];
-    };
+    uint64_t read[MAX_BUCKETS], write[MAX_BUCKETS], zero[MAX_BUCKETS];
+    uint64_t mask = 0;
 
-    BlockState *blocks = new BlockState[index->GetNumBlocks()];
-    memset(blocks, 0, sizeof blocks[0] * index->GetNumBlocks());
+    for (int b = 0; b < numBuckets; b++) {
+        int begin = firstBlock + (b << blockShift);
+        int end = std::min(blocks.count, begin + (1 << blockShift));
 
-    /*
-     * Index the log. Read transactions, keeping track of the state of
-     * each memory block. When we cross a timestep boundary, flush any
-     * modified blocks to the database.
-     *
-     * The database is protected by a lock, but for the LogReader it's
-     * more efficient to just clone the log reader, giving us a
-     * separate buffer just for this thread.
-     */
+        read[b] = write[b] = zero[b] = 0;
+        for (int i = begin; i < end; i++) {
+            read[b] += blockRead[i];
+            write[b] += blockWrite[i];
+            zero[b] += blockZero[i];
+        }
 
-    LogReader reader(*index->reader);
-    MemTransfer mt(prevOffset);
+        if (read[b] || write[b])
+            mask |= (uint64_t)1 << b;
+    }
 
-    /*
-     * Periodically we should release our locks, commit the transaction,
-     * and inform the UI of our progress. We determine how often to do
-     * this by looking at the wallclock time between every two log
-     * timesteps.
-     */
+    if (!mask)
+        return;
 
-    const int updateHZ = 15;
-    const int maxMillisecPerUpdate = 1000 / updateHZ;
-    wxDateTime lastUpdateTime = wxDateTime::UNow();
+    uint8_t buffer[(1 + 3 * MAX_BUCKETS) * 9];   // Worst-case packed size
+    uint8_t *p = buffer;
 
+    varint::write(mask, p);
+    p += varint::len(mask);
+
+    for (int b = 0; b < numBuckets; b++) {
+        if (mask & ((uint64_t)1 << b)) {
+            varint::write(read[b], p);
+            p += varint::len(read[b]);
+            varint::write(write[b], p);
+            p += varint::len(write[b]);
+            varint::write(zero[b], p);
+            p += varint::len(zero[b]);
+        }
+    }
+
+    cmd.bind(1, level);
+    cmd.bind(2, (sqlite3x::int64_t) tile);
+    cmd.bind(3, stratum);
+    cmd.bind(4, buffer, p - buffer);
+    cmd.executenonquery();
+}
+
+
+void
+LogIndex::StoreWorkingSet(int level, ::int64_t node,
+                          const WorkingSetSketch &read, const WorkingSetSketch &write)
+{
     /*
-     * Loop over timesteps. We end transactions and unlock the dbLock
-     * between timesteps.
+     * Store one node of the working set tree.
+     * The caller must have already locked the database and started a transaction.
      */
-    while (running) {
-        bool eof;
 
-        wxCriticalSectionLocker locker(index->dbLock);
-        sqlite3_transaction transaction(index->db);
-        sqlite3_command wblockInsert(index->db, "INSERT INTO wblocks VALUES(?,?,?,?,?)");
-        wxDateTime now;
+    sqlite3_command cmd(db, "INSERT INTO wsets VALUES(?,?,?,?)");
 
-        // Loop over timesteps between one progress update
-        do {
+    cmd.bind(1, level);
+    cmd.bind(2, (sqlite3x::int64_t) node);
+    cmd.bind(3, read.getRegisters(), WorkingSetSketch::REGISTERS);
+    cmd.bind(4, write.getRegisters(), WorkingSetSketch::REGISTERS);
 
-            // Loop over memory transfers
-            do {
-                eof = !reader.Read(mt);
+    cmd.executenonquery();
+}
 
-                if (!eof) {
-                    if (mt.type == MemTransfer::WRITE) {
-                        AlignedIterator<LogBlock::SHIFT> iter(mt);
-                        do {
-                            BlockState *block = &blocks[iter.blockId];
 
-                            block->lastWriteOffset = mt.offset;
-                            if (!block->wDirty) {
-                                block->firstWriteOffset = block->lastWriteOffset;
-                                block->wDirty = true;
-                            }
+void
+LogIndex::StorePatterns(std::vector<AccessPattern> &patterns)
+{
+    /*
+     * Store the access patterns the classifier finished, and empty the list.
+     * The caller must have already locked the database and started a transaction.
+     */
 
-                            for (LengthType i = 0; i < iter.len; i++) {
-                                uint8_t byte = mt.buffer[i + iter.mtOffset];
-                                block->data[i + iter.blockOffset] = byte;
-                            }
-                        } while (iter.next());
-                    }
+    if (patterns.empty())
+        return;
+
+    sqlite3_command cmd(db, "INSERT INTO patterns VALUES(?,?,?,?,?,?,?,?,?,?)");
+
+    for (std::vector<AccessPattern>::iterator i = patterns.begin(); i != patterns.end(); i++) {
+        cmd.bind(1, (int) i->kind);
+        cmd.bind(2, (int) i->type);
+        cmd.bind(3, (sqlite3x::int64_t) i->beginTime);
+        cmd.bind(4, (sqlite3x::int64_t) i->endTime);
+        cmd.bind(5, (sqlite3x::int64_t) i->firstId);
+        cmd.bind(6, (sqlite3x::int64_t) i->lastId);
+        cmd.bind(7, (sqlite3x::int64_t) i->lowAddress);
+        cmd.bind(8, (sqlite3x::int64_t) i->highAddress);
+        cmd.bind(9, (sqlite3x::int64_t) i->stride);
+        cmd.bind(10, (sqlite3x::int64_t) i->count);
+        cmd.executenonquery();
+
+        if (longestPattern >= 0)
+            longestPattern = std::max(longestPattern, i->endTime - i->beginTime);
+    }
 
-                    index->AdvanceInstant(instant, mt);
-                    eof = !reader.Next(mt);
-                }
+    patterns.clear();
+}
 
-                if (eof)
-                    running = false;
 
-                if (INDEX_DEBUG)
-                    printf("Indexing at: %lld/%lld\n", instant.time, instant.offset);
+static void
+addToSketches(MemTransfer &mt, WorkingSetSketch &read, WorkingSetSketch &write)
+{
+    if (!mt.byteCount || (mt.type != MemTransfer::READ && mt.type != MemTransfer::WRITE))
+        return;
 
-                // Loop until end of timestep, or end of file.
-            } while (!eof && mt.offset < prevOffset + TIMESTEP_SIZE);
+    WorkingSetSketch &sketch = mt.type == MemTransfer::READ ? read : write;
+    AlignedIterator<LogBlock::SHIFT> iter(mt);
 
-            // Flush all blocks that have been touched.
+    do {
+        sketch.add(iter.blockId);
+    } while (iter.next());
+}
 
-            for (AddressType blockId = 0; blockId < index->GetNumBlocks(); blockId++) {
-                BlockState *block = &blocks[blockId];
-
-                if (block->wDirty) {
-                    wblockInsert.bind(1, (sqlite3x::int64_t) instant.time);
-                    wblockInsert.bind(2, (sqlite3x::int64_t) blockId);
-                    wblockInsert.bind(3, (sqlite3x::int64_t) block->firstWriteOffset);
-                    wblockInsert.bind(4, (sqlite3x::int64_t) block->lastWriteOffset);
-                    wblockInsert.bind(5, block->data, sizeof block->data);
-                    wblockInsert.executenonquery();
-                    block->wDirty = false;
-                }
-            }
 
-            // Store a LogInstant for this timestep
+LogIndex::PyramidBuilder::PyramidBuilder(LogIndex *_index)
+    : index(_index),
+      tileStart(_index->GetNumStrata(), 0, 0, true),
+      blocks(SPATIAL_LEVELS - 1, 0, _index->GetNumBlocks()),
+      strataTouched(_index->GetNumStrata(), false)
+{
+    for (int level = 0; level < PYRAMID_LEVELS; level++)
+        levels.push_back(new StrataTile(index->GetNumStrata(), level));
+}
 
-            if (instant.time != prevTime)
+
+LogIndex::PyramidBuilder::~PyramidBuilder()
+{
+    for (int level = 0; level < PYRAMID_LEVELS; level++)
+        delete levels[level];
+}
+
+
+void
+LogIndex::PyramidBuilder::NextTile(LogInstant &instant, ClockType nextTime)
+{
+    /*
+     * The next transfer ends in a different level 0 tile. Everything
+     * since 'tileStart', up to and including 'instant', belongs to
+     * the current tile.
+     */
+
+    StrataTile &tile = *levels[0];
+
+    FlushBuckets();
+    tile.setDifference(instant, tileStart);
+    Flush(0);
+
+    tileStart = instant;
+    tile.index = nextTime >> PYRAMID_SHIFT;
+}
+
+
+void
+LogIndex::PyramidBuilder::Flush(int level)
+{
+    /*
+     * Store a finished tile, and add it to its parent. Tiles arrive
+     * in order, so when a tile belongs to a different parent than
+     * the one we're accumulating, that parent is finished too.
+     */
+
+    StrataTile &tile = *levels[level];
+
+    if (tile.isEmpty())
+        return;
+
+    index->StoreTile(tile);
+
+    if (level + 1 < PYRAMID_LEVELS) {
+        StrataTile &parent = *levels[level + 1];
+        ::int64_t parentIndex = tile.index >> 1;
+
+        if (parent.index != parentIndex) {
+            Flush(level + 1);
+            parent.clear();
+            parent.index = parentIndex;
+        }
+        parent.add(tile);
+    }
+
+    tile.clear();
+}
+
+
+void
+LogIndex::PyramidBuilder::Finish(LogInstant &instant)
+{
+    // Store the partial tile we're in, then every partial tile above it.
+
+    FlushBuckets();
+    levels[0]->setDifference(instant, tileStart);
+    for (int level = 0; level < PYRAMID_LEVELS; level++)
+        Flush(level);
+}
+
+
+void
+LogIndex::PyramidBuilder::AddTransfer(MemTransfer &mt)
+{
+    // Count this transfer's blocks, and remember which strata it touched.
+
+    if (!mt.byteCount || (mt.type != MemTransfer::READ && mt.type != MemTransfer::WRITE))
+        return;
+
+    blocks.add(mt);
+
+    int first = mt.address >> STRATUM_SHIFT;
+    int last = (mt.address + mt.byteCount - 1) >> STRATUM_SHIFT;
+
+    for (int s = first; s <= last; s++) {
+        if (!strataTouched[s]) {
+            strataTouched[s] = true;
+            touchedList.push_back(s);
+        }
+    }
+}
+
+
+void
+LogIndex::PyramidBuilder::FlushBuckets()
+{
+    /*
+     * Store the fine totals for the level 0 tile we just finished,
+     * and reset only the blocks it touched.
+     */
+
+    if (touchedList.empty())
+        return;
+
+    std::sort(touchedList.begin(), touchedList.end());
+
+    sqlite3_command cmd(index->db, "INSERT INTO buckets VALUES(?,?,?,?)");
+    const int blocksPerStratum = 1 << (STRATUM_SHIFT - LogBlock::SHIFT);
+
+    for (std::vector<int>::iterator i = touchedList.begin(); i != touchedList.end(); i++) {
+        int s = *i;
+
+        for (int level = 1; level < SPATIAL_LEVELS; level++)
+            index->StoreBuckets(cmd, level, levels[0]->index, s, blocks);
+
+        int end = std::min(blocks.count, (s + 1) * blocksPerStratum);
+        for (int b = s * blocksPerStratum; b < end; b++) {
+            blocks.readTotals.set(b, 0);
+            blocks.writeTotals.set(b, 0);
+            blocks.zeroTotals.set(b, 0);
+        }
+
+        strataTouched[s] = false;
+    }
+
+    touchedList.clear();
+}
+
+
+LogIndex::WorkingSetBuilder::WorkingSetBuilder(LogIndex *_index)
+    : index(_index),
+      step(0),
+      read(WORKING_SET_LEVELS),
+      write(WORKING_SET_LEVELS)
+{}
+
+
+void
+LogIndex::WorkingSetBuilder::AddTransfer(MemTransfer &mt)
+{
+    addToSketches(mt, read[0], write[0]);
+}
+
+
+void
+LogIndex::WorkingSetBuilder::EndStep(LogInstant &instant)
+{
+    /*
+     * Number this timestep, then store it and every node it
+     * finishes. Level n is finished after every 2^n steps.
+     */
+
+    sqlite3_command cmd(index->db, "INSERT INTO wsteps VALUES(?,?,?)");
+
+    cmd.bind(1, (sqlite3x::int64_t) step);
+    cmd.bind(2, (sqlite3x::int64_t) instant.offset);
+    cmd.bind(3, (sqlite3x::int64_t) instant.transferId);
+    cmd.executenonquery();
+
+    for (int level = 0; level < WORKING_SET_LEVELS; level++) {
+        if ((step + 1) & ((1LL << level) - 1))
+            break;
+        Flush(level, step);
+    }
+
+    step++;
+}
+
+
+void
+LogIndex::WorkingSetBuilder::Finish()
+{
+    // Store the partial nodes above the last step.
+
+    for (int level = 1; level < WORKING_SET_LEVELS; level++)
+        Flush(level, step - 1);
+}
+
+
+void
+LogIndex::WorkingSetBuilder::Flush(int level, ::int64_t lastStep)
+{
+    // Store a node, and merge it into its parent.
+
+    if (read[level].isEmpty() && write[level].isEmpty())
+        return;
+
+    index->StoreWorkingSet(level, lastStep >> level, read[level], write[level]);
+
+    if (level + 1 < WORKING_SET_LEVELS) {
+        read[level + 1].merge(read[level]);
+        write[level + 1].merge(write[level]);
+    }
+
+    read[level].clear();
+    write[level].clear();
+}
+
+
+void
+LogIndex::AdvanceInstant(LogInstant &instant, MemTransfer &mt, bool reverse)
+{
+    /*
+     * Advance a LogInstant forward or backward by processing one memory transfer.
+     */
+
+    instant.updateTime(mt.duration, reverse);
+    instant.offset = mt.offset;
+    instant.transferId = mt.id;
+
+    if (mt.byteCount) {
+        AlignedIterator<STRATUM_SHIFT> iter(mt);
+
+        do {
+            switch (mt.type) {
+
+            case MemTransfer::READ: {
+                instant.readTotals.update(iter.blockId, iter.len, reverse);
+                break;
+            }
+
+            case MemTransfer::WRITE: {
+                LengthType numZeroes = 0;
+                
+                for (LengthType i = 0; i < iter.len; i++) {
+                    uint8_t byte = mt.buffer[i + iter.mtOffset];
+                    if (!byte)
+                        numZeroes++;
+                }
+
+                instant.writeTotals.update(iter.blockId, iter.len, reverse);
+                instant.zeroTotals.update(iter.blockId, numZeroes, reverse);
+                break;
+            }
+
+            default:
+                break;
+            }
+        } while (iter.next());
+    }
+}
+
+
+wxThread::ExitCode
+LogIndex::IndexerThread::Entry()
+{
+    /*
+     * Main loop for indexing thread.
+     */
+
+    TraceLog::setThreadName("Indexer");
+    TraceScope trace("IndexerThread::Entry");
+
+    bool aborted = false;
+    bool running = true;
+
+    // Beginning of this timestep, end of previous timestep
+    OffsetType prevOffset = 0;
+    ClockType prevTime = 0;
+
+    /* Data about the current log instant */
+    LogInstant instant(index->GetNumStrata());
+    instant.clear();
+
+    /* State of each block */
+    struct BlockState {
+        uint64_t firstWriteOffset;
+        uint64_t lastWriteOffset;
+        bool wDirty;
+        uint8_t data[LogBlock::SIZE];
+    };
+
+    BlockState *blocks = new BlockState[index->GetNumBlocks()];
+    memset(blocks, 0, sizeof blocks[0] * index->GetNumBlocks());
+
+    /*
+     * Index the log. Read transactions, keeping track of the state of
+     * each memory block. When we cross a timestep boundary, flush any
+     * modified blocks to the database.
+     *
+     * The database is protected by a lock, but for the LogReader it's
+     * more efficient to just clone the log reader, giving us a
+     * separate buffer just for this thread.
+     */
+
+    LogReader reader(*index->reader);
+    MemTransfer mt(prevOffset);
+    PyramidBuilder pyramid(index);
+    WorkingSetBuilder workingSet(index);
+    AccessClassifier classifier;
+    std::vector<AccessPattern> patterns;
+
+    // Next offset where a priority segment needs our attention
+    OffsetType segmentOffset = 0;
+
+    /*
+     * Periodically we should release our locks, commit the transaction,
+     * and inform the UI of our progress. We determine how often to do
+     * this by looking at the wallclock time between every two log
+     * timesteps.
+     */
+
+    const int updateHZ = 15;
+    const int maxMillisecPerUpdate = 1000 / updateHZ;
+    wxDateTime lastUpdateTime = wxDateTime::UNow();
+
+    /*
+     * Low-impact mode state. While throttled, we keep our average
+     * read rate since 'paceOffset' below LOW_IMPACT_BANDWIDTH.
+     */
+
+    bool lowPriority = false;
+    wxStopWatch paceTimer;
+    OffsetType paceOffset = 0;
+
+    /*
+     * Loop over timesteps. We end transactions and unlock the dbLock
+     * between timesteps.
+     */
+    while (running) {
+        bool eof;
+        bool throttled = false;
+
+        if (index->lowImpact) {
+            if (!lowPriority) {
+                lowerThreadPriority();
+                lowPriority = true;
+            }
+            throttled = index->IsThrottled();
+        }
+
+        if (throttled) {
+            TraceScope traceThrottle("Throttle");
+
+            for (;;) {
+                long ahead = (instant.offset - paceOffset) * 1000 / LOW_IMPACT_BANDWIDTH
+                    - paceTimer.Time();
+                if (ahead <= 0 || TestDestroy())
+                    break;
+                wxMilliSleep(std::min<long>(ahead, 50));
+            }
+        } else {
+            paceTimer.Start();
+            paceOffset = instant.offset;
+        }
+
+        TraceScope traceGroup("Index timesteps");
+        wxCriticalSectionLocker locker(index->dbLock);
+        sqlite3_transaction transaction(index->db);
+        sqlite3_command wblockInsert(index->db, "INSERT INTO wblocks VALUES(?,?,?,?,?)");
+        wxDateTime now;
+
+        // Loop over timesteps between one progress update
+        do {
+
+            // Loop over memory transfers
+            do {
+                eof = !reader.Read(mt);
+
+                if (!eof) {
+                    if (mt.type == MemTransfer::WRITE) {
+                        AlignedIterator<LogBlock::SHIFT> iter(mt);
+                        do {
+                            BlockState *block = &blocks[iter.blockId];
+
+                            block->lastWriteOffset = mt.offset;
+                            if (!block->wDirty) {
+                                block->firstWriteOffset = block->lastWriteOffset;
+                                block->wDirty = true;
+                            }
+
+                            for (LengthType i = 0; i < iter.len; i++) {
+                                uint8_t byte = mt.buffer[i + iter.mtOffset];
+                                block->data[i + iter.blockOffset] = byte;
+                            }
+                        } while (iter.next());
+                    }
+
+                    pyramid.Advance(instant, instant.time + mt.duration);
+                    pyramid.AddTransfer(mt);
+                    workingSet.AddTransfer(mt);
+                    index->AdvanceInstant(instant, mt);
+                    classifier.AddTransfer(mt, instant.time, patterns);
+
+                    if (instant.offset >= segmentOffset)
+                        segmentOffset = index->MergeSegments(instant);
+
+                    eof = !reader.Next(mt);
+                }
+
+                if (eof)
+                    running = false;
+
+                // Loop until end of timestep, or end of file.
+            } while (!eof && mt.offset < prevOffset + TIMESTEP_SIZE);
+
+            // Flush all blocks that have been touched.
+
+            {
+                TraceScope traceFlush("Flush wblocks");
+
+                for (AddressType blockId = 0; blockId < index->GetNumBlocks(); blockId++) {
+                    BlockState *block = &blocks[blockId];
+
+                    if (block->wDirty) {
+                        wblockInsert.bind(1, (sqlite3x::int64_t) instant.time);
+                        wblockInsert.bind(2, (sqlite3x::int64_t) blockId);
+                        wblockInsert.bind(3, (sqlite3x::int64_t) block->firstWriteOffset);
+                        wblockInsert.bind(4, (sqlite3x::int64_t) block->lastWriteOffset);
+                        wblockInsert.bind(5, block->data, sizeof block->data);
+                        wblockInsert.executenonquery();
+                        block->wDirty = false;
+                    }
+                }
+            }
+
+            // Store a LogInstant for this timestep
+
+            if (instant.time != prevTime)
                 index->StoreInstant(instant);
             prevTime = instant.time;
             prevOffset = instant.offset;
+            workingSet.EndStep(instant);
+
+            if (!running) {
+                pyramid.Finish(instant);
+                workingSet.Finish();
+                classifier.Finish(patterns);
+            }
+            index->StorePatterns(patterns);
 
-            // Are we finished with this group of timesteps?
+            /*
+             * Are we finished with this group of timesteps? Stop at
+             * EOF too, or we'd Read() and count the last transfer
+             * again on every remaining pass. In low-impact mode, stop
+             * early whenever a query is waiting for the dbLock, even
+             * if it only started waiting partway through this group.
+             */
             now = wxDateTime::UNow();
-        } while ((now - lastUpdateTime).GetMilliseconds() < maxMillisecPerUpdate);
+        } while (running &&
+                 (now - lastUpdateTime).GetMilliseconds() < maxMillisecPerUpdate &&
+                 !(index->lowImpact && index->dbWaiters));
         lastUpdateTime = now;
 
         // Finished a group of timesteps
@@ -517,7 +1282,8 @@ LogIndex::IndexerThread::Entry()
          * Periodic actions: Report progress, check for abort.
          */
 
-        index->lastInstant = instantPtr_t(new LogInstant(instant));
+        index->SetLastInstant(instantPtr_t(new LogInstant(instant)));
+        segmentOffset = index->MergeSegments(instant);
         index->SetProgress(instant.offset / index->logFileSize, INDEXING);
 
         if (TestDestroy()) {
@@ -547,12 +1313,28 @@ LogIndex::IndexerThread::Entry()
 instantPtr_t
 LogIndex::GetInstant(ClockType time, ClockType distance)
 {
-    wxCriticalSectionLocker dataLocker(dataLock);
+    ClockType duration = GetDuration();
+
+    if (time > duration) {
+        // Past the end of the index. Maybe a priority segment has it.
+        instantPtr_t inst = GetSegmentInstant(time, distance);
+        if (inst)
+            return inst;
+    }
+
+    time = std::min<ClockType>(time, duration);
 
-    time = std::min<ClockType>(time, GetDuration());
+    instantPtr_t inst;
+    ClockType dist;
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+        inst = instantCache.findClosest(time);
+        dist = instantCache.distance(inst->time, time);
 
-    instantPtr_t inst = instantCache.findClosest(time);
-    ClockType dist = instantCache.distance(inst->time, time);
+        cacheStats.instantLookups++;
+        if (dist <= distance)
+            cacheStats.instantHits++;
+    }
 
     /*
      * First try: Is there already a good instant in the cache?
@@ -568,7 +1350,10 @@ LogIndex::GetInstant(ClockType time, ClockType distance)
      */
 
     instantPtr_t dbInst = GetInstantForTimestep(time);
-    instantCache.store(dbInst->time, dbInst);
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+        instantCache.store(dbInst->time, dbInst);
+    }
 
     ClockType dbInstDist = instantCache.distance(dbInst->time, time);
     if (dbInstDist < dist) {
@@ -576,34 +1361,210 @@ LogIndex::GetInstant(ClockType time, ClockType distance)
     }
 
     /*
-     * Still no luck. Iterate forward/backward.
+     * Still no luck. Iterate forward/backward. This is the slow part,
+     * and it runs without any locks held, using a LogReader that
+     * belongs to this query alone.
      */
 
-    inst = LogIndex::GetInstantFromStartingPoint(inst, time, distance);
-    instantCache.store(inst->time, inst);
+    LogReaderPool::Handle reader(readers);
 
-    // DEBUG: Verify against another starting point
-    if (INDEX_DEBUG) {
-        instantPtr_t first = GetInstantForTimestep(0);
-        instantPtr_t check = GetInstantFromStartingPoint(first, dbInst->time);
-        printf("Checking %lld/%lld/%lld against %lld/%lld/%lld\n",
-               dbInst->time, dbInst->offset, dbInst->transferId,
-               check->time, check->offset, check->transferId);
-        assert(*check == *dbInst);
-    }
-    if (INDEX_DEBUG) {
-        instantPtr_t first = GetInstantForTimestep(0);
-        instantPtr_t check = GetInstantFromStartingPoint(first, inst->time);
-        assert(*check == *inst);
+    instantPtr_t start = inst;
+    inst = LogIndex::GetInstantFromStartingPoint(*reader, start, time, distance);
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+        instantCache.store(inst->time, inst);
+        CountWalk(start, inst);
     }
 
     return inst;
 }
 
 
+void
+LogIndex::SweepInstants(const std::vector<ClockType> &times, ClockType distance,
+                        InstantSweepReceiver &receiver)
+{
+    if (times.empty())
+        return;
+
+    /*
+     * Estimate how many clock cycles one timestep covers. A gap longer
+     * than this is cheaper to cross with one database lookup than by
+     * reading every transfer in between.
+     */
+
+    instantPtr_t last = GetLastInstant();
+    ClockType duration = last->time;
+    ClockType timestepClocks = last->offset ?
+        (ClockType)(duration * (double)TIMESTEP_SIZE / last->offset) : 0;
+
+    /*
+     * 'current' only ever moves forward. For each requested time we
+     * start from whichever is closest: the current instant, the best
+     * cached instant, or (for long gaps) the stored timestep. Usually
+     * that's 'current', and we just keep reading where we left off.
+     */
+
+    LogReaderPool::Handle reader(readers);
+    instantPtr_t current;
+
+    for (size_t i = 0; i < times.size(); i++) {
+        if (times[i] > duration) {
+            instantPtr_t inst = GetSegmentInstant(times[i], distance);
+            if (inst) {
+                if (!receiver.fn(i, inst))
+                    return;
+                continue;
+            }
+        }
+
+        ClockType time = std::min<ClockType>(times[i], duration);
+
+        if (!current || instantCache.distance(current->time, time) > distance) {
+            instantPtr_t start;
+            ClockType dist;
+            {
+                wxCriticalSectionLocker locker(cacheLock);
+                start = instantCache.findClosest(time);
+                if (current && instantCache.distance(current->time, time) <
+                    instantCache.distance(start->time, time)) {
+                    start = current;
+                }
+                dist = instantCache.distance(start->time, time);
+
+                cacheStats.instantLookups++;
+                if (dist <= distance)
+                    cacheStats.instantHits++;
+            }
+
+            if (dist > distance && (start->time > time || dist > timestepClocks)) {
+                instantPtr_t dbInst = GetInstantForTimestep(time);
+                if (instantCache.distance(dbInst->time, time) < dist)
+                    start = dbInst;
+            }
+
+            current = GetInstantFromStartingPoint(*reader, start, time, distance);
+            {
+                wxCriticalSectionLocker locker(cacheLock);
+                instantCache.store(current->time, current);
+                CountWalk(start, current);
+            }
+        } else {
+            wxCriticalSectionLocker locker(cacheLock);
+            cacheStats.instantLookups++;
+            cacheStats.instantHits++;
+        }
+
+        if (!receiver.fn(i, current))
+            return;
+    }
+}
+
+
+void
+LogIndex::SweepInstants(const std::vector<ClockType> &times, ClockType distance,
+                        std::vector<instantPtr_t> &results)
+{
+    struct Collector : public InstantSweepReceiver {
+        Collector(std::vector<instantPtr_t> &_results) : results(_results) {}
+
+        virtual bool fn(int i, instantPtr_t instant) {
+            results[i] = instant;
+            return true;
+        }
+
+        std::vector<instantPtr_t> &results;
+    };
+
+    results.resize(times.size());
+    Collector collector(results);
+    SweepInstants(times, distance, collector);
+}
+
+
+void
+LogIndex::GetInstants(const std::vector<ClockType> &times, ClockType distance,
+                      std::vector<instantPtr_t> &results, int numThreads)
+{
+    TraceScope trace("GetInstants");
+    int count = times.size();
+
+    results.resize(count);
+    if (!count)
+        return;
+
+    std::vector<std::pair<ClockType, int> > order(count);
+    for (int i = 0; i < count; i++)
+        order[i] = std::make_pair(times[i], i);
+    std::sort(order.begin(), order.end());
+
+    /*
+     * Cut the sorted times into runs of about the same length. Short
+     * runs aren't worth a thread, since each one pays for its own
+     * database lookup and walk to get started.
+     */
+
+    if (numThreads <= 0)
+        numThreads = wxThread::GetCPUCount();
+    int numRuns = std::max(1, std::min(numThreads, count / MIN_INSTANTS_PER_THREAD));
+
+    std::vector<InstantRun> runs(numRuns);
+    for (int r = 0; r < numRuns; r++) {
+        int first = (int)((::int64_t)count * r / numRuns);
+        int last = (int)((::int64_t)count * (r + 1) / numRuns);
+
+        for (int i = first; i < last; i++) {
+            runs[r].times.push_back(order[i].first);
+            runs[r].slots.push_back(order[i].second);
+        }
+    }
+
+    // The last run is ours. The rest get a thread each.
+
+    std::vector<InstantRunThread*> threads;
+    for (int r = 0; r < numRuns - 1; r++) {
+        InstantRunThread *thread = new InstantRunThread(this, &runs[r], distance, &results);
+        thread->Create();
+        thread->Run();
+        threads.push_back(thread);
+    }
+
+    SweepRun(runs[numRuns - 1], distance, results);
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->Wait();
+        delete threads[i];
+    }
+}
+
+
+void
+LogIndex::SweepRun(InstantRun &run, ClockType distance, std::vector<instantPtr_t> &results)
+{
+    // Each run only writes its own slots, so runs can share 'results'.
+
+    std::vector<instantPtr_t> found;
+    SweepInstants(run.times, distance, found);
+
+    for (size_t i = 0; i < found.size(); i++)
+        results[run.slots[i]] = found[i];
+}
+
+
+wxThread::ExitCode
+LogIndex::InstantRunThread::Entry()
+{
+    TraceLog::setThreadName("Instant lookup");
+    TraceScope trace("SweepRun");
+
+    index->SweepRun(*run, distance, *results);
+    return 0;
+}
+
+
 instantPtr_t
-LogIndex::GetInstantFromStartingPoint(instantPtr_t start, ClockType time,
-                                      ClockType distance)
+LogIndex::GetInstantFromStartingPoint(LogReader &reader, instantPtr_t start,
+                                      ClockType time, ClockType distance)
 {
     /*
      * Using 'start' as the starting point for iteration, find the
@@ -611,6 +1572,7 @@ LogIndex::GetInstantFromStartingPoint(instantPtr_t start, ClockType time,
      * that is within 'distance' from 'time'.
      */
 
+    TraceScope trace("GetInstantFromStartingPoint");
     ClockType dist = instantCache.distance(start->time, time);
 
     // Already close enough?
@@ -646,12 +1608,12 @@ LogIndex::GetInstantFromStartingPoint(instantPtr_t start, ClockType time,
         ClockType target = time + distance;
 
         do {
-            if (!reader->Read(mt)) {
+            if (!reader.Read(mt)) {
                 fprintf(stderr, indexErrFmt, "Read", "reverse-iterating",
                         newInst->time, target);
                 return newInst;
             }
-            if (!reader->Prev(mt)) {
+            if (!reader.Prev(mt)) {
                 // Reached the beginning of the log
                 return GetInstantForTimestep(0);
             }
@@ -677,11 +1639,11 @@ LogIndex::GetInstantFromStartingPoint(instantPtr_t start, ClockType time,
         ClockType target = time - distance;
 
         do {
-            if (!reader->Next(mt)) {
+            if (!reader.Next(mt)) {
                 // Reached the end of the log
                 break;
             }
-            if (!reader->Read(mt)) {
+            if (!reader.Read(mt)) {
                 fprintf(stderr, indexErrFmt, "Read", "advancing",
                         newInst->time, target);
                 return newInst;
@@ -689,9 +1651,6 @@ LogIndex::GetInstantFromStartingPoint(instantPtr_t start, ClockType time,
 
             AdvanceInstant(*newInst, mt);
 
-            if (INDEX_DEBUG)
-                printf("Forward: %lld -> %lld\n", newInst->time, target);
-
         } while (newInst->time < target);
 
         if (newInst->time > time) {
@@ -699,7 +1658,7 @@ LogIndex::GetInstantFromStartingPoint(instantPtr_t start, ClockType time,
              * Went too far. Back up a step.
              */
 
-            if (!reader->Prev(mt)) {
+            if (!reader.Prev(mt)) {
                 fprintf(stderr, indexErrFmt, "Seek", "backing up",
                         newInst->time, target);
                 return newInst;
@@ -708,14 +1667,376 @@ LogIndex::GetInstantFromStartingPoint(instantPtr_t start, ClockType time,
             // Reverse advance
             AdvanceInstant(*newInst, mt, true);
 
-            assert(newInst->time <= time);
+            assert(newInst->time <= time);
+        }
+    }
+
+    return newInst;
+}
+
+
+void
+LogIndex::CountWalk(instantPtr_t start, instantPtr_t result)
+{
+    /*
+     * A walk that got anywhere moved the transfer ID, one step per
+     * transfer read (plus one more for a forward walk that backed up).
+     */
+
+    if (result == start)
+        return;
+
+    uint64_t steps = result->transferId > start->transferId ?
+        result->transferId - start->transferId :
+        start->transferId - result->transferId;
+
+    if (steps) {
+        cacheStats.instantWalks++;
+        cacheStats.walkTransfers += steps;
+        cacheStats.walkMax = std::max(cacheStats.walkMax, steps);
+    }
+}
+
+
+double
+LogIndex::GetClocksPerByte()
+{
+    // Zero until the indexer has something to go on.
+
+    instantPtr_t last = GetLastInstant();
+    return last->offset > 0 ? last->time / (double)last->offset : 0;
+}
+
+
+ClockType
+LogIndex::GetEstimatedDuration()
+{
+    ClockType duration = GetDuration();
+
+    if (GetState() != INDEXING)
+        return duration;
+
+    return std::max<ClockType>(duration, (ClockType)(logFileSize * GetClocksPerByte()));
+}
+
+
+void
+LogIndex::SetPriorityRange(ClockType begin, ClockType end)
+{
+    if (GetState() != INDEXING || end <= GetDuration())
+        return;
+
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+        havePriority = true;
+        priorityBegin = begin;
+        priorityEnd = end;
+    }
+
+    if (segmentThread)
+        segmentThread->sema.Post();
+}
+
+
+static bool
+isBeforeInstant(ClockType time, const instantPtr_t &instant)
+{
+    return time < instant->time;
+}
+
+
+static instantPtr_t
+rebaseInstant(const LogInstant &instant, const LogInstant &delta)
+{
+    instantPtr_t result(new LogInstant(instant));
+
+    result->time += delta.time;
+    result->transferId += delta.transferId;
+    result->readTotals.add(delta.readTotals);
+    result->writeTotals.add(delta.writeTotals);
+    result->zeroTotals.add(delta.zeroTotals);
+    result->segment = 0;
+
+    return result;
+}
+
+
+instantPtr_t
+LogIndex::GetSegmentInstant(ClockType time, ClockType distance)
+{
+    /*
+     * Find the segment instant at or before 'time', and walk forward
+     * from there. We only look within a segment's published
+     * instants, so the walk never leaves the segment. Returns an
+     * empty pointer if no segment covers 'time'.
+     */
+
+    instantPtr_t start;
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+
+        for (std::map<int, Segment>::iterator i = segments.begin();
+             i != segments.end(); i++) {
+            std::vector<instantPtr_t> &v = i->second.instants;
+
+            if (v.front()->time <= time && time <= v.back()->time) {
+                start = *(std::upper_bound(v.begin(), v.end(), time, isBeforeInstant) - 1);
+                break;
+            }
+        }
+    }
+
+    if (!start)
+        return start;
+
+    LogReaderPool::Handle reader(readers);
+    return GetInstantFromStartingPoint(*reader, start, time, distance);
+}
+
+
+bool
+LogIndex::PublishSegment(int id, std::vector<instantPtr_t> &batch, OffsetType lastOffset)
+{
+    /*
+     * Add new instants to a segment. Returns false if the segment is
+     * gone, because the indexer caught up with it.
+     */
+
+    wxCriticalSectionLocker locker(cacheLock);
+    std::map<int, Segment>::iterator i = segments.find(id);
+
+    if (i == segments.end())
+        return false;
+
+    Segment &seg = i->second;
+
+    for (std::vector<instantPtr_t>::iterator b = batch.begin(); b != batch.end(); b++)
+        seg.instants.push_back(seg.rebased ? rebaseInstant(**b, *seg.delta) : *b);
+
+    seg.lastOffset = lastOffset;
+    segmentGeneration++;
+    batch.clear();
+    return true;
+}
+
+
+OffsetType
+LogIndex::MergeSegments(LogInstant &instant)
+{
+    /*
+     * The indexer calls this with its running instant, at the end of
+     * every group of timesteps, and whenever it has just added the
+     * transfer at the offset we returned last time. That's the first
+     * transfer of the next segment that hasn't been rebased.
+     *
+     * If the indexer lands exactly on a segment's first transfer, the
+     * difference between its instant and the segment's first instant
+     * rebases the whole segment. If it skips past one, either the
+     * segment resynced on something that wasn't really a transfer
+     * boundary, or it started too close behind the indexer for us to
+     * notice in time. Either way, we drop it. Rebased segments are
+     * dropped once the indexer has published an instant past their
+     * last transfer.
+     */
+
+    wxCriticalSectionLocker locker(cacheLock);
+    OffsetType next = INT64_MAX;
+    bool changed = false;
+
+    std::map<int, Segment>::iterator i = segments.begin();
+    while (i != segments.end()) {
+        Segment &seg = i->second;
+
+        if (!seg.rebased && seg.firstOffset == instant.offset) {
+            LogInstant &first = *seg.instants[0];
+            instantPtr_t delta(new LogInstant(GetNumStrata()));
+
+            delta->time = instant.time - first.time;
+            delta->transferId = instant.transferId - first.transferId;
+            delta->readTotals.setDifference(instant.readTotals, first.readTotals);
+            delta->writeTotals.setDifference(instant.writeTotals, first.writeTotals);
+            delta->zeroTotals.setDifference(instant.zeroTotals, first.zeroTotals);
+
+            for (size_t j = 0; j < seg.instants.size(); j++)
+                seg.instants[j] = rebaseInstant(*seg.instants[j], *delta);
+
+            seg.rebased = true;
+            seg.delta = delta;
+            changed = true;
+        }
+
+        bool passed = seg.rebased ? seg.lastOffset <= lastInstant->offset
+                                  : seg.firstOffset < instant.offset;
+        if (passed) {
+            segments.erase(i++);
+            changed = true;
+            continue;
+        }
+
+        if (!seg.rebased)
+            next = std::min(next, seg.firstOffset);
+        i++;
+    }
+
+    if (changed)
+        segmentGeneration++;
+
+    return next;
+}
+
+
+wxThread::ExitCode
+LogIndex::SegmentThread::Entry()
+{
+    TraceLog::setThreadName("Segment indexer");
+
+    while (running && index->GetState() == INDEXING) {
+        sema.WaitTimeout(1000);
+
+        /*
+         * Map the newest priority range to file offsets. We can't
+         * until the indexer has seen enough of the log to estimate
+         * its clocks per byte, so leave the range pending until then.
+         */
+
+        double clocksPerByte = index->GetClocksPerByte();
+        if (clocksPerByte <= 0)
+            continue;
+
+        ClockType begin, end;
+        {
+            wxCriticalSectionLocker locker(index->cacheLock);
+            if (!index->havePriority)
+                continue;
+            index->havePriority = false;
+            begin = index->priorityBegin;
+            end = index->priorityEnd;
+        }
+
+        OffsetType first = std::max<ClockType>(0, begin) / clocksPerByte;
+        OffsetType last = std::max<ClockType>(0, end) / clocksPerByte;
+
+        // Too wide? Index the middle of the range.
+        if (last - first > MAX_SEGMENT_SIZE) {
+            first = first + (last - first) / 2 - MAX_SEGMENT_SIZE / 2;
+            last = first + MAX_SEGMENT_SIZE;
+        }
+
+        IndexRange(first, std::min<OffsetType>(last, index->logFileSize));
+    }
+
+    return 0;
+}
+
+
+void
+LogIndex::SegmentThread::IndexRange(OffsetType begin, OffsetType end)
+{
+    TraceScope trace("Index segment");
+
+    /*
+     * Skip whatever the indexer or an existing segment already
+     * covers, and stop where the next segment starts.
+     */
+    {
+        wxCriticalSectionLocker locker(index->cacheLock);
+        bool moved;
+
+        begin = std::max(begin, index->lastInstant->offset);
+        do {
+            moved = false;
+            for (std::map<int, Segment>::iterator i = index->segments.begin();
+                 i != index->segments.end(); i++) {
+                Segment &seg = i->second;
+
+                if (seg.firstOffset <= begin && begin < seg.lastOffset) {
+                    begin = seg.lastOffset;
+                    moved = true;
+                }
+            }
+        } while (moved);
+
+        for (std::map<int, Segment>::iterator i = index->segments.begin();
+             i != index->segments.end(); i++)
+            if (i->second.firstOffset > begin)
+                end = std::min(end, i->second.firstOffset);
+    }
+
+    if (begin >= end)
+        return;
+
+    /*
+     * Resync at the next ADDR packet, and start a new segment with
+     * that transfer. Its time is estimated from its offset, the same
+     * way SetPriorityRange() offsets were estimated from times.
+     */
+
+    LogReader reader(*index->reader);
+    MemTransfer mt(begin);
+
+    if (!reader.Next(mt) || !reader.Read(mt) || mt.offset >= end)
+        return;
+    mt.id = 0;
+
+    int id;
+    LogInstant instant(index->GetNumStrata(), 0, 0, true);
+    {
+        wxCriticalSectionLocker locker(index->cacheLock);
+        id = index->nextSegmentId++;
+    }
+
+    instant.time = (ClockType)(mt.offset * index->GetClocksPerByte());
+    instant.segment = id;
+    index->AdvanceInstant(instant, mt);
+
+    {
+        wxCriticalSectionLocker locker(index->cacheLock);
+        Segment &seg = index->segments[id];
+
+        seg.firstOffset = mt.offset;
+        seg.lastOffset = mt.offset;
+        seg.instants.push_back(instantPtr_t(new LogInstant(instant)));
+        seg.rebased = false;
+        index->segmentGeneration++;
+    }
+
+    /*
+     * Keep an instant about once per timestep, like the indexer does,
+     * and publish them in batches. Stop at the end of the range, or
+     * when there's a newer priority range to work on.
+     */
+
+    std::vector<instantPtr_t> batch;
+    OffsetType lastStored = mt.offset;
+    OffsetType lastPublished = mt.offset;
+
+    while (running && mt.offset < end) {
+        if (!reader.Next(mt) || !reader.Read(mt))
+            break;
+
+        index->AdvanceInstant(instant, mt);
+
+        if (mt.offset >= lastStored + TIMESTEP_SIZE) {
+            batch.push_back(instantPtr_t(new LogInstant(instant)));
+            lastStored = mt.offset;
+        }
+
+        if (mt.offset >= lastPublished + SEGMENT_PUBLISH_SIZE) {
+            if (!index->PublishSegment(id, batch, lastStored))
+                return;
+            lastPublished = mt.offset;
 
-            if (INDEX_DEBUG)
-                printf("Backed up: %lld -> %lld\n", newInst->time, target);
+            wxCriticalSectionLocker locker(index->cacheLock);
+            if (index->havePriority)
+                break;
         }
     }
 
-    return newInst;
+    if (lastStored != instant.offset) {
+        batch.push_back(instantPtr_t(new LogInstant(instant)));
+        lastStored = instant.offset;
+    }
+    index->PublishSegment(id, batch, lastStored);
 }
 
 
@@ -732,8 +2053,9 @@ LogIndex::GetInstantForTimestep(ClockType upperBound)
      * end up returning an all-zero instant.
      */
 
+    TraceScope trace("GetInstantForTimestep");
     instantPtr_t instant(new LogInstant(GetNumStrata()));
-    wxCriticalSectionLocker locker(dbLock);
+    QueryLocker locker(this);
 
     if (db.db()) {
         sqlite3_command *cmd = cmd_getInstantForTimestep;
@@ -747,6 +2069,11 @@ LogIndex::GetInstantForTimestep(ClockType upperBound)
         cmd->bind(1, (sqlite3x::int64_t) upperBound);
         sqlite3_cursor crsr = cmd->executecursor();
 
+        {
+            wxCriticalSectionLocker locker(cacheLock);
+            cacheStats.instantQueries++;
+        }
+
         if (crsr.step()) {
             int size;
             const void *blob;
@@ -777,21 +2104,492 @@ LogIndex::GetInstantForTimestep(ClockType upperBound)
 
     MemTransfer mt;
     instant->clear();
-    if (reader)
+    if (reader) {
+        LogReaderPool::Handle reader(readers);
         reader->Read(mt);
+    }
     AdvanceInstant(*instant, mt);
     return instant;
 }
 
 
+int
+LogIndex::GetTileLevelForDistance(ClockType distance)
+{
+    int level = -1;
+    while (level + 1 < PYRAMID_LEVELS && GetTileSize(level + 1) <= distance)
+        level++;
+    return level;
+}
+
+
+tilePtr_t
+LogIndex::GetStrataTile(int level, ::int64_t index)
+{
+    // Cache key: the tile index, with the level in the low bits.
+    ::int64_t key = (index << 5) | level;
+
+    tilePtr_t tile;
+    bool hit;
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+        tile = tileCache.findClosest(key);
+        hit = tile->level == level && tile->index == index;
+
+        cacheStats.tileLookups++;
+        if (hit)
+            cacheStats.tileHits++;
+    }
+
+    if (hit)
+        return tile;
+
+    tile = tilePtr_t(new StrataTile(GetNumStrata(), level, index));
+
+    if (GetState() != COMPLETE) {
+        // The pyramid isn't finished. Don't cache this empty tile.
+        return tile;
+    }
+
+    {
+        QueryLocker locker(this);
+        sqlite3_command *cmd = cmd_getStrataTile;
+
+        if (!cmd) {
+            cmd = cmd_getStrataTile =
+                new sqlite3_command(db, "SELECT readTotals, writeTotals, zeroTotals "
+                                    "FROM pyramid WHERE level = ? AND tile = ?");
+        }
+
+        cmd->bind(1, level);
+        cmd->bind(2, (sqlite3x::int64_t) index);
+        sqlite3_cursor crsr = cmd->executecursor();
+
+        if (crsr.step()) {
+            int size;
+            const void *blob;
+
+            blob = crsr.getblob(0, size);
+            tile->readTotals.unpack((const uint8_t *)blob, size);
+
+            blob = crsr.getblob(1, size);
+            tile->writeTotals.unpack((const uint8_t *)blob, size);
+
+            blob = crsr.getblob(2, size);
+            tile->zeroTotals.unpack((const uint8_t *)blob, size);
+        }
+    }
+
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+        tileCache.store(key, tile);
+    }
+
+    return tile;
+}
+
+
+int
+LogIndex::GetBucketShift(int level)
+{
+    static const int shifts[SPATIAL_LEVELS] = {
+        STRATUM_SHIFT,
+        BUCKET_SHIFT_1,
+        LogBlock::SHIFT,
+    };
+    return shifts[level];
+}
+
+
+void
+LogIndex::GetBuckets(instantPtr_t begin, instantPtr_t end, BucketTotals &totals)
+{
+    /*
+     * Replay the transfers between two instants. This is the same
+     * walk GetInstantFromStartingPoint() makes, but we only need to
+     * count the transfers, not build another LogInstant.
+     */
+
+    totals.clear();
+
+    LogReaderPool::Handle reader(readers);
+    MemTransfer mt(begin->offset, begin->transferId);
+
+    while (mt.id < end->transferId) {
+        if (!reader->Next(mt) || !reader->Read(mt)) {
+            fprintf(stderr, "INDEX: Read error while counting buckets (clock: %lld -> %lld)\n",
+                    begin->time, end->time);
+            break;
+        }
+        totals.add(mt);
+    }
+}
+
+
+void
+LogIndex::GetBucketsFromTiles(::int64_t first, ::int64_t last, BucketTotals &totals)
+{
+    totals.clear();
+
+    if (GetState() != COMPLETE || first >= last)
+        return;
+
+    assert(totals.level > 0 && totals.level < SPATIAL_LEVELS);
+
+    int perStratumShift = STRATUM_SHIFT - GetBucketShift(totals.level);
+    int firstStratum = totals.first >> perStratumShift;
+    int lastStratum = (totals.first + totals.count - 1) >> perStratumShift;
+
+    QueryLocker locker(this);
+    sqlite3_command *cmd = cmd_getBuckets;
+
+    if (!cmd) {
+        cmd = cmd_getBuckets =
+            new sqlite3_command(db, "SELECT stratum, totals FROM buckets "
+                                "WHERE level = ? AND tile >= ? AND tile < ? "
+                                "AND stratum >= ? AND stratum <= ?");
+    }
+
+    cmd->bind(1, totals.level);
+    cmd->bind(2, (sqlite3x::int64_t) first);
+    cmd->bind(3, (sqlite3x::int64_t) last);
+    cmd->bind(4, firstStratum);
+    cmd->bind(5, lastStratum);
+    sqlite3_cursor crsr = cmd->executecursor();
+
+    while (crsr.step()) {
+        int stratum = crsr.getint(0);
+        int size;
+        const uint8_t *p = (const uint8_t *) crsr.getblob(1, size);
+        const uint8_t *fence = p + size;
+
+        uint64_t mask = varint::read(p, fence);
+        ::int64_t bucket = ((::int64_t)stratum << perStratumShift) - totals.first;
+
+        for (; mask; mask >>= 1, bucket++) {
+            if (!(mask & 1))
+                continue;
+
+            uint64_t read = varint::read(p, fence);
+            uint64_t write = varint::read(p, fence);
+            uint64_t zero = varint::read(p, fence);
+
+            if (bucket >= 0 && bucket < totals.count) {
+                totals.readTotals.update(bucket, read);
+                totals.writeTotals.update(bucket, write);
+                totals.zeroTotals.update(bucket, zero);
+            }
+        }
+    }
+}
+
+
+void
+LogIndex::ReplayWorkingSet(OffsetType offset, OffsetType beginId, OffsetType endId,
+                           WorkingSetSketch &read, WorkingSetSketch &write)
+{
+    // Add the transfers after 'beginId', up to and including 'endId', to the sketches.
+
+    LogReaderPool::Handle reader(readers);
+    MemTransfer mt(offset, beginId);
+
+    while (mt.id < endId) {
+        if (!reader->Next(mt) || !reader->Read(mt)) {
+            fprintf(stderr, "INDEX: Read error while sketching working set (transfer %lld)\n",
+                    (long long) mt.id);
+            break;
+        }
+        addToSketches(mt, read, write);
+    }
+}
+
+
+bool
+LogIndex::FindWorkingSetStep(OffsetType transferId, bool after, ::int64_t &step,
+                             OffsetType &offset, OffsetType &stepEnd)
+{
+    /*
+     * Find the first timestep that ends at or after 'transferId', or
+     * the last one that ends at or before it. 'offset' and 'stepEnd'
+     * are the offset and ID of the step's last transfer.
+     *
+     * Assumes dbLock is already locked.
+     */
+
+    sqlite3_command cmd(db, after ?
+                        "SELECT step, offset, transferId FROM wsteps WHERE transferId >= ? "
+                        "ORDER BY transferId ASC, step ASC LIMIT 1" :
+                        "SELECT step, offset, transferId FROM wsteps WHERE transferId <= ? "
+                        "ORDER BY transferId DESC, step DESC LIMIT 1");
+
+    cmd.bind(1, (sqlite3x::int64_t) transferId);
+    sqlite3_cursor crsr = cmd.executecursor();
+
+    if (!crsr.step())
+        return false;
+
+    step = crsr.getint64(0);
+    offset = crsr.getint64(1);
+    stepEnd = crsr.getint64(2);
+    return true;
+}
+
+
+void
+LogIndex::GetWorkingSetSketches(instantPtr_t begin, instantPtr_t end,
+                                WorkingSetSketch &read, WorkingSetSketch &write)
+{
+    TraceScope trace("GetWorkingSetSketches");
+
+    read.clear();
+    write.clear();
+
+    if (begin->segment != end->segment || end->transferId <= begin->transferId)
+        return;
+
+    /*
+     * Timesteps [first, last] lie wholly inside the window. Until the
+     * index is COMPLETE, or if there are none, replay the whole thing.
+     */
+
+    ::int64_t first = 0, last = -1;
+    OffsetType headEnd = 0, tailOffset = 0, tailBegin = 0;
+
+    if (begin->segment == 0 && GetState() == COMPLETE) {
+        QueryLocker locker(this);
+        OffsetType headOffset;
+
+        if (FindWorkingSetStep(begin->transferId, true, first, headOffset, headEnd) &&
+            FindWorkingSetStep(end->transferId, false, last, tailOffset, tailBegin)) {
+            // The step after the one containing 'begin' is the first whole one.
+            first++;
+        } else {
+            last = -1;
+        }
+
+        if (first <= last) {
+            sqlite3_command *cmd = cmd_getWorkingSet;
+            WorkingSetSketch sketch;
+
+            if (!cmd) {
+                cmd = cmd_getWorkingSet =
+                    new sqlite3_command(db, "SELECT readSketch, writeSketch FROM wsets "
+                                        "WHERE level = ? AND node = ?");
+            }
+
+            /*
+             * Cover the steps with the largest aligned nodes that fit,
+             * like a Fenwick tree. That's at most two per level.
+             */
+
+            for (::int64_t s = first; s <= last;) {
+                int level = 0;
+                while (level + 1 < WORKING_SET_LEVELS &&
+                       !(s & ((1LL << (level + 1)) - 1)) &&
+                       s + (1LL << (level + 1)) - 1 <= last)
+                    level++;
+
+                cmd->bind(1, level);
+                cmd->bind(2, (sqlite3x::int64_t) (s >> level));
+                sqlite3_cursor crsr = cmd->executecursor();
+
+                if (crsr.step()) {
+                    int size;
+                    const void *blob;
+
+                    blob = crsr.getblob(0, size);
+                    sketch.setRegisters(blob, size);
+                    read.merge(sketch);
+
+                    blob = crsr.getblob(1, size);
+                    sketch.setRegisters(blob, size);
+                    write.merge(sketch);
+                }
+
+                s += 1LL << level;
+            }
+        }
+    }
+
+    if (first <= last) {
+        ReplayWorkingSet(begin->offset, begin->transferId, headEnd, read, write);
+        ReplayWorkingSet(tailOffset, tailBegin, end->transferId, read, write);
+    } else {
+        ReplayWorkingSet(begin->offset, begin->transferId, end->transferId, read, write);
+    }
+}
+
+
+WorkingSet
+LogIndex::GetWorkingSet(instantPtr_t begin, instantPtr_t end)
+{
+    WorkingSetSketch read, write;
+    WorkingSet ws;
+
+    GetWorkingSetSketches(begin, end, read, write);
+
+    ws.read = read.estimate();
+    ws.written = write.estimate();
+    read.merge(write);
+    ws.touched = read.estimate();
+
+    return ws;
+}
+
+
+void
+LogIndex::ReadPattern(sqlite3_cursor &crsr, AccessPattern &pattern)
+{
+    // Columns in the order of the 'patterns' table.
+
+    pattern.kind = (AccessPattern::Kind) crsr.getint(0);
+    pattern.type = (MemTransfer::TypeEnum) crsr.getint(1);
+    pattern.beginTime = crsr.getint64(2);
+    pattern.endTime = crsr.getint64(3);
+    pattern.firstId = crsr.getint64(4);
+    pattern.lastId = crsr.getint64(5);
+    pattern.lowAddress = crsr.getint64(6);
+    pattern.highAddress = crsr.getint64(7);
+    pattern.stride = crsr.getint64(8);
+    pattern.count = crsr.getint64(9);
+}
+
+
+void
+LogIndex::GetAccessPatterns(ClockType begin, ClockType end,
+                            std::vector<AccessPattern> &patterns, int maxCount)
+{
+    TraceScope trace("GetAccessPatterns");
+
+    patterns.clear();
+
+    QueryLocker locker(this);
+
+    sqlite3_command cmd(db, "SELECT * FROM patterns "
+                        "WHERE beginTime >= ? AND beginTime <= ? AND endTime >= ? "
+                        "ORDER BY firstId LIMIT ?");
+
+    cmd.bind(1, (sqlite3x::int64_t) GetEarliestPatternBegin(begin));
+    cmd.bind(2, (sqlite3x::int64_t) end);
+    cmd.bind(3, (sqlite3x::int64_t) begin);
+    cmd.bind(4, maxCount);
+    sqlite3_cursor crsr = cmd.executecursor();
+
+    while (crsr.step()) {
+        patterns.push_back(AccessPattern());
+        ReadPattern(crsr, patterns.back());
+    }
+}
+
+
+void
+LogIndex::GetAccessPatternSpans(ClockType begin, ClockType end, ClockType resolution,
+                                std::vector<AccessPattern> &spans)
+{
+    TraceScope trace("GetAccessPatternSpans");
+
+    spans.clear();
+
+    QueryLocker locker(this);
+
+    /*
+     * Group the runs by kind, and by which 'resolution'-wide column
+     * of the range they start in. Runs that start before 'begin' all
+     * land in the first column.
+     */
+
+    sqlite3_command cmd(db, "SELECT kind, MIN(type), MIN(beginTime), MAX(endTime), "
+                        "MIN(firstId), MAX(lastId), MIN(lowAddress), MAX(highAddress), "
+                        "0, SUM(count) FROM patterns "
+                        "WHERE beginTime >= ? AND beginTime <= ? AND endTime >= ? "
+                        "GROUP BY kind, (MAX(beginTime, ?) - ?) / ?");
+
+    cmd.bind(1, (sqlite3x::int64_t) GetEarliestPatternBegin(begin));
+    cmd.bind(2, (sqlite3x::int64_t) end);
+    cmd.bind(3, (sqlite3x::int64_t) begin);
+    cmd.bind(4, (sqlite3x::int64_t) begin);
+    cmd.bind(5, (sqlite3x::int64_t) begin);
+    cmd.bind(6, (sqlite3x::int64_t) std::max<ClockType>(1, resolution));
+    sqlite3_cursor crsr = cmd.executecursor();
+
+    while (crsr.step()) {
+        spans.push_back(AccessPattern());
+        ReadPattern(crsr, spans.back());
+    }
+}
+
+
+ClockType
+LogIndex::GetEarliestPatternBegin(ClockType begin)
+{
+    /*
+     * The index is on beginTime, so bound that from below using the
+     * longest run: a run that starts any earlier has ended before
+     * 'begin'. After the first lookup, StorePatterns() keeps this up
+     * to date as the indexer adds runs. The caller must hold the
+     * dbLock.
+     */
+
+    if (longestPattern < 0) {
+        sqlite3_command cmd(db, "SELECT MAX(endTime - beginTime) FROM patterns");
+        sqlite3_cursor crsr = cmd.executecursor();
+        longestPattern = crsr.step() ? crsr.getint64(0) : 0;
+    }
+
+    return begin - longestPattern;
+}
+
+
+bool
+LogIndex::FindAccessPattern(OffsetType id, bool forward, AccessPattern::Kind kind,
+                            AccessPattern &pattern)
+{
+    static const char *queries[2][2] = {
+        { "SELECT * FROM patterns WHERE firstId < ? "
+          "ORDER BY firstId DESC LIMIT 1",
+          "SELECT * FROM patterns WHERE firstId > ? "
+          "ORDER BY firstId ASC LIMIT 1" },
+        { "SELECT * FROM patterns WHERE firstId < ? AND kind = ? "
+          "ORDER BY firstId DESC LIMIT 1",
+          "SELECT * FROM patterns WHERE firstId > ? AND kind = ? "
+          "ORDER BY firstId ASC LIMIT 1" },
+    };
+
+    bool anyKind = kind == AccessPattern::NUM_KINDS;
+
+    QueryLocker locker(this);
+    sqlite3_command cmd(db, queries[!anyKind][forward]);
+
+    cmd.bind(1, (sqlite3x::int64_t) id);
+    if (!anyKind)
+        cmd.bind(2, (int) kind);
+    sqlite3_cursor crsr = cmd.executecursor();
+
+    if (!crsr.step())
+        return false;
+
+    ReadPattern(crsr, pattern);
+    return true;
+}
+
+
 transferPtr_t
 LogIndex::GetTransferSummary(OffsetType id)
 {
+    instantPtr_t last = GetLastInstant();
+
     // Clamp ID to the end of the log
-    id = std::min<OffsetType>(id, GetNumTransfers() - 1);
+    id = std::min<OffsetType>(id, last->transferId);
+
+    transferPtr_t tp;
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+        tp = transferCache.findClosest(id);
 
-    wxCriticalSectionLocker dataLocker(dataLock);
-    transferPtr_t tp = transferCache.findClosest(id);
+        cacheStats.transferLookups++;
+        if (tp->id == id)
+            cacheStats.transferHits++;
+    }
 
     if (tp->id == id) {
         // Found it in the cache
@@ -815,8 +2613,8 @@ LogIndex::GetTransferSummary(OffsetType id)
         withinTimestep = false;
     } else {
         OffsetType idDistance = id > tp->id ? id - tp->id : tp->id - id;
-        OffsetType fileDistance = ((idDistance * (uint64_t)lastInstant->offset)
-                                   / lastInstant->transferId);
+        OffsetType fileDistance = ((idDistance * (uint64_t)last->offset)
+                                   / last->transferId);
         withinTimestep = fileDistance <= TIMESTEP_SIZE;
     }
 
@@ -846,7 +2644,7 @@ LogIndex::GetTransferSummary(OffsetType id)
         bool success;
 
         {
-            wxCriticalSectionLocker locker(dbLock);
+            QueryLocker locker(this);
             sqlite3_command *cmd = cmd_getTransferSummary;
 
             if (!cmd) {
@@ -892,6 +2690,7 @@ LogIndex::GetTransferSummary(OffsetType id)
      * searching for, then cache and return it.
      */
 
+    LogReaderPool::Handle reader(readers);
     MemTransfer mt(tp->offset, tp->id);
     const char *indexErrFmt = "INDEX: %s error while %s (ID: %lld -> %lld)\n";
 
@@ -960,7 +2759,10 @@ LogIndex::GetTransferSummary(OffsetType id)
     tp->offset = mt.offset;
     tp->id = mt.id;
 
-    transferCache.store(tp->id, tp);
+    {
+        wxCriticalSectionLocker locker(cacheLock);
+        transferCache.store(tp->id, tp);
+    }
     return tp;
 }
 
@@ -978,6 +2780,11 @@ LogIndex::GetClosestTransfer(ClockType time)
      */
 
     instantPtr_t prevInst = GetInstant(time, 0);
+
+    // Transfers past the end of the index don't have IDs yet.
+    if (prevInst->transferId > GetLastInstant()->transferId || prevInst->segment)
+        return transferPtr_t(new TransferSummary());
+
     transferPtr_t prevTransfer = GetTransferSummary(prevInst->transferId);
     transferPtr_t nextTransfer = GetTransferSummary(prevInst->transferId + 1);
 
@@ -988,6 +2795,87 @@ LogIndex::GetClosestTransfer(ClockType time)
 }
 
 
+blockPtr_t
+LogIndex::GetBlock(ClockType time, AddressType addr)
+{
+    /*
+     * The indexer saves a snapshot of every block that was written
+     * during a timestep, at the end of that timestep. So the newest
+     * snapshot at or before 'time' has every write up to the last
+     * timestep boundary before 'time', and we only need to replay
+     * the log from that boundary.
+     */
+
+    TraceScope trace("GetBlock");
+
+    int blockId = addr >> LogBlock::SHIFT;
+    blockPtr_t block(new LogBlock(blockId << LogBlock::SHIFT, time));
+
+    MemTransfer mt(0);
+    ClockType t = 0;
+    bool fromStart = true;
+
+    {
+        QueryLocker locker(this);
+
+        if (!db.db())
+            return block;
+
+        if (!cmd_getBlock) {
+            cmd_getBlock = new sqlite3_command(db, "SELECT data FROM wblocks WHERE block = ?"
+                                               " AND time <= ? ORDER BY time DESC LIMIT 1");
+        }
+        if (!cmd_getBlockStart) {
+            cmd_getBlockStart = new sqlite3_command(db, "SELECT time, offset, transferId"
+                                                    " FROM strata WHERE time <= ?"
+                                                    " ORDER BY time DESC LIMIT 1");
+        }
+
+        cmd_getBlock->bind(1, blockId);
+        cmd_getBlock->bind(2, (sqlite3x::int64_t) time);
+        {
+            sqlite3_cursor crsr = cmd_getBlock->executecursor();
+            if (crsr.step()) {
+                int size;
+                const void *blob = crsr.getblob(0, size);
+                if (size == LogBlock::SIZE)
+                    memcpy(&block->data[0], blob, size);
+            }
+        }
+
+        cmd_getBlockStart->bind(1, (sqlite3x::int64_t) time);
+        sqlite3_cursor crsr = cmd_getBlockStart->executecursor();
+        if (crsr.step()) {
+            t = crsr.getint64(0);
+            mt = MemTransfer(crsr.getint64(1), crsr.getint64(2));
+            fromStart = false;
+        }
+    }
+
+    // The boundary's own transfer is already in the snapshot.
+    LogReaderPool::Handle reader(readers);
+    bool more = fromStart || reader->Next(mt);
+
+    while (more && reader->Read(mt)) {
+        t += mt.duration;
+        if (t > time)
+            break;
+
+        if (mt.type == MemTransfer::WRITE && mt.byteCount) {
+            AlignedIterator<LogBlock::SHIFT> iter(mt);
+            do {
+                if ((int) iter.blockId == blockId)
+                    memcpy(&block->data[iter.blockOffset], &mt.buffer[iter.mtOffset], iter.len);
+            } while (iter.next());
+        }
+
+        more = reader->Next(mt);
+    }
+
+    return block;
+}
+
+
 size_t
 LogStrata::getPackedLen()
 {
@@ -1008,15 +2896,6 @@ LogStrata::pack(uint8_t *buffer)
         varint::write(values[i], p);
         p += varint::len(values[i]);
     }
-
-    // DEBUG: Verify pack/unpack
-    if (INDEX_DEBUG) {
-        const uint8_t *q = buffer;
-        const uint8_t *fence = buffer + getPackedLen();
-        for (int i = 0; i < count; i++) {
-            assert(values[i] == varint::read(q, fence));
-        }
-    }
 }
 
 
@@ -1037,6 +2916,59 @@ LogStrata::clear()
 }
 
 
+void
+StrataTile::setDifference(const LogInstant &end, const LogInstant &begin)
+{
+    readTotals.setDifference(end.readTotals, begin.readTotals);
+    writeTotals.setDifference(end.writeTotals, begin.writeTotals);
+    zeroTotals.setDifference(end.zeroTotals, begin.zeroTotals);
+}
+
+
+void
+BucketTotals::add(MemTransfer &mt)
+{
+    if (!mt.byteCount || (mt.type != MemTransfer::READ && mt.type != MemTransfer::WRITE))
+        return;
+
+    int shift = LogIndex::GetBucketShift(level);
+    ::int64_t firstBucket = (::int64_t)mt.address >> shift;
+    ::int64_t lastBucket = ((::int64_t)mt.address + mt.byteCount - 1) >> shift;
+
+    if (lastBucket < first || firstBucket >= first + count)
+        return;
+
+    /*
+     * Every level is a whole number of blocks, so split the transfer
+     * at block boundaries and count each piece in its bucket.
+     */
+
+    AlignedIterator<LogBlock::SHIFT> iter(mt);
+
+    do {
+        ::int64_t i = ((::int64_t)iter.blockId >> (shift - LogBlock::SHIFT)) - first;
+        if (i < 0 || i >= count)
+            continue;
+
+        if (mt.type == MemTransfer::READ) {
+            readTotals.update(i, iter.len);
+
+        } else {
+            LengthType numZeroes = 0;
+
+            for (LengthType j = 0; j < iter.len; j++) {
+                uint8_t byte = mt.buffer[j + iter.mtOffset];
+                if (!byte)
+                    numZeroes++;
+            }
+
+            writeTotals.update(i, iter.len);
+            zeroTotals.update(i, numZeroes);
+        }
+    } while (iter.next());
+}
+
+
 void
 LogInstant::clear()
 {
@@ -30,6 +30,7 @@
 #include <wx/thread.h>
 #include <wx/event.h>
 #include <boost/shared_ptr.hpp>
+#include <assert.h>
 #include <map>
 #include <vector>
 #include <algorithm>
@@ -38,14 +39,29 @@
 #include "mem_transfer.h"
 #include "log_reader.h"
 #include "lru_cache.h"
+#include "working_set.h"
+#include "access_pattern.h"
 
 class LogInstant;
 class LogBlock;
 class TransferSummary;
+class StrataTile;
 
 typedef boost::shared_ptr<LogInstant> instantPtr_t;
 typedef boost::shared_ptr<LogBlock> blockPtr_t;
 typedef boost::shared_ptr<TransferSummary> transferPtr_t;
+typedef boost::shared_ptr<StrataTile> tilePtr_t;
+
+
+/*
+ * Receives the results of LogIndex::SweepInstants(), one at a time
+ * and in order. 'i' is the index of the requested time. Return false
+ * to stop the sweep early.
+ */
+
+struct InstantSweepReceiver {
+    virtual bool fn(int i, instantPtr_t instant) = 0;
+};
 
 
 /*
@@ -70,6 +86,13 @@ public:
         delete[] values;
     }
 
+    LogStrata &operator =(const LogStrata &other)
+    {
+        assert(count == other.count);
+        std::copy(other.values, other.values + count, values);
+        return *this;
+    }
+
     bool operator ==(const LogStrata &other)
     {
         if (count != other.count)
@@ -85,6 +108,16 @@ public:
         return values[index];
     }
 
+    const uint64_t *getArray() const
+    {
+        return values;
+    }
+
+    int getCount() const
+    {
+        return count;
+    }
+
     void set(int index, uint64_t value)
     {
         values[index] = value;
@@ -98,6 +131,26 @@ public:
             values[index] += value;
     }
 
+    void add(const LogStrata &other)
+    {
+        for (int i = 0; i < count; i++)
+            values[i] += other.values[i];
+    }
+
+    void setDifference(const LogStrata &end, const LogStrata &begin)
+    {
+        for (int i = 0; i < count; i++)
+            values[i] = end.values[i] - begin.values[i];
+    }
+
+    bool isZero() const
+    {
+        for (int i = 0; i < count; i++)
+            if (values[i])
+                return false;
+        return true;
+    }
+
     size_t getPackedLen();
     void pack(uint8_t *buffer);
     void unpack(const uint8_t *buffer, size_t bufferLen);
@@ -125,7 +178,8 @@ public:
           writeTotals(numStrata),
           zeroTotals(numStrata),
           time(_time),
-          offset(_offset)
+          offset(_offset),
+          segment(0)
     {
         if (cleared)
             clear();
@@ -136,6 +190,7 @@ public:
         return time == other.time &&
                offset == other.offset &&
                transferId == other.transferId &&
+               segment == other.segment &&
                readTotals == other.readTotals &&
                writeTotals == other.writeTotals &&
                zeroTotals == other.zeroTotals;
@@ -147,6 +202,15 @@ public:
     OffsetType offset;
     OffsetType transferId;
 
+    /*
+     * Zero for instants from the index proper. Instants from a
+     * provisional segment (see LogIndex::SetPriorityRange()) carry
+     * its ID instead: their totals and transfer IDs only count from
+     * the start of that segment, so they can only be compared with
+     * instants from the same segment.
+     */
+    int segment;
+
     void updateTime(ClockType amount, bool reverse=false)
     {
         if (reverse)
@@ -161,6 +225,101 @@ public:
 };
 
 
+/*
+ * One tile of the strata pyramid. Where a LogInstant holds running
+ * totals, a tile holds the per-stratum byte counts for only those
+ * transfers which ended within one power-of-two aligned range of
+ * clock cycles. Level 0 tiles are LogIndex::GetTileSize(0) clocks
+ * wide, and each level up doubles that.
+ *
+ * Summing a few tiles covers any long time range without touching
+ * the log file, which is what zoomed-out timelines need.
+ */
+
+class StrataTile {
+public:
+    StrataTile(int numStrata, int _level = 0, int64_t _index = 0)
+        : level(_level),
+          index(_index),
+          readTotals(numStrata),
+          writeTotals(numStrata),
+          zeroTotals(numStrata)
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        readTotals.clear();
+        writeTotals.clear();
+        zeroTotals.clear();
+    }
+
+    bool isEmpty() const
+    {
+        return readTotals.isZero() && writeTotals.isZero();
+    }
+
+    void add(const StrataTile &other)
+    {
+        readTotals.add(other.readTotals);
+        writeTotals.add(other.writeTotals);
+        zeroTotals.add(other.zeroTotals);
+    }
+
+    // Totals for the transfers after 'begin', up to and including 'end'.
+    void setDifference(const LogInstant &end, const LogInstant &begin);
+
+    int level;
+    int64_t index;
+
+    LogStrata readTotals;
+    LogStrata writeTotals;
+    LogStrata zeroTotals;
+};
+
+
+/*
+ * Byte counts for a window of equal-sized address buckets, at one
+ * level of the LogIndex spatial hierarchy (see GetBucketShift()).
+ * Element 0 holds bucket number 'first', counting up from address
+ * zero. Only the buckets in the window are stored, so a narrow
+ * window costs little even at the finest level.
+ */
+
+class BucketTotals {
+public:
+    BucketTotals(int _level, int64_t _first, int _count)
+        : level(_level),
+          first(_first),
+          count(_count),
+          readTotals(_count),
+          writeTotals(_count),
+          zeroTotals(_count)
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        readTotals.clear();
+        writeTotals.clear();
+        zeroTotals.clear();
+    }
+
+    // Count the part of a transfer that falls within our window.
+    void add(MemTransfer &mt);
+
+    int level;
+    int64_t first;
+    int count;
+
+    LogStrata readTotals;
+    LogStrata writeTotals;
+    LogStrata zeroTotals;
+};
+
+
 /*
  * A summary of a single MemTransfer. These can be retrieved from a
  * LogIndex, and LogIndex caches them. This class is similar to
@@ -273,6 +432,20 @@ public:
     wxEventType GetProgressEvent() { return progressEvent; }
     void SetProgressReceiver(wxEvtHandler *handler);
 
+    /*
+     * Low-impact indexing, for interactive use. The indexer thread
+     * drops to the lowest CPU and I/O priority the OS offers, for the
+     * rest of the indexing, and gives up the dbLock at the end of any
+     * timestep where a query is waiting. While THD is in use, meaning
+     * there was user input in the last LOW_IMPACT_IDLE_MSEC or a query
+     * is waiting for the database, it also reads the log no faster
+     * than LOW_IMPACT_BANDWIDTH. Otherwise it reads flat out.
+     *
+     * The UI calls NoteUserActivity() on input events.
+     */
+    void SetLowImpact(bool enable) { lowImpact = enable; }
+    static void NoteUserActivity();
+
     /*
      * We keep a running total of the log's duration during
      * indexing, and after indexing is complete this is an
@@ -280,10 +453,10 @@ public:
      */
 
     ClockType GetDuration() {
-        return lastInstant->time;
+        return GetLastInstant()->time;
     }
     OffsetType GetNumTransfers() {
-        return lastInstant->transferId + 1;
+        return GetLastInstant()->transferId + 1;
     }
 
     /*
@@ -298,6 +471,29 @@ public:
     AddressType GetMemSize() const {
         return reader->MemSize();
     }
+    wxFileName GetLogFileName() const {
+        return reader->FileName();
+    }
+    wxFileName GetIndexFileName() const {
+        return indexFile;
+    }
+
+    /*
+     * Where the index for a log lives. Normally that's next to the
+     * log, with an ".index" extension.
+     *
+     * If THD_INDEX_CACHE names a directory, indexes are kept there
+     * instead, named after a fingerprint of the log: its size, and a
+     * hash of FINGERPRINT_SAMPLES chunks spread evenly through it. Any
+     * copy of the same log finds the same index, whatever it's called
+     * and wherever it is. The fingerprint is also stored in the index
+     * and checked in place of the log's name and mtime. It's empty
+     * when the index is next to the log.
+     */
+    static wxFileName FindIndexFile(const wxFileName &logFile, wxString *fingerprint = NULL);
+    wxString GetLogFingerprint() const {
+        return fingerprint;
+    }
     AddressType GetStratumFirstAddress(int s) const {
         return s << STRATUM_SHIFT;
     }
@@ -317,9 +513,125 @@ public:
      * particular cycle. So, the lookup can often be 'fuzzy'. We'll
      * return an instant that's no farther than 'distance' from the
      * specified time.
+     *
+     * This is safe to call from any thread. Concurrent lookups only
+     * serialize on the (brief) cache and database accesses; each
+     * caller iterates over the log using its own LogReader.
      */
     instantPtr_t GetInstant(ClockType time, ClockType distance = 0);
 
+    /*
+     * Look up instants for many times at once, with the same fuzz
+     * rules as GetInstant(). 'times' must be sorted in ascending
+     * order.
+     *
+     * Instead of an independent lookup per time, this makes a single
+     * forward pass over the log with one LogReader, only touching the
+     * database to skip over gaps longer than a timestep. Results are
+     * delivered in order as soon as they're found, and they're also
+     * added to the instant cache.
+     */
+    void SweepInstants(const std::vector<ClockType> &times, ClockType distance,
+                       InstantSweepReceiver &receiver);
+    void SweepInstants(const std::vector<ClockType> &times, ClockType distance,
+                       std::vector<instantPtr_t> &results);
+
+    /*
+     * Look up instants for many times at once, in any order. The
+     * times are sorted and cut into runs, up to one per thread (by
+     * default, one per CPU). Each run is a SweepInstants() on its own
+     * thread with its own LogReader, so neighbouring times share a
+     * walk and distant ones are looked up in parallel. results[i] is
+     * the instant for times[i]. This blocks until they're all found.
+     */
+    void GetInstants(const std::vector<ClockType> &times, ClockType distance,
+                     std::vector<instantPtr_t> &results, int numThreads = 0);
+
+    /*
+     * The strata pyramid is built by the indexer alongside the
+     * timestep table. Tile 'i' at 'level' covers the clock cycles
+     * from i * GetTileSize(level) up to (but not including) the next
+     * tile. Tiles are only available once indexing is COMPLETE;
+     * before that, and for times with no activity, GetStrataTile()
+     * returns an empty tile.
+     *
+     * GetTileLevelForDistance() returns the coarsest level whose
+     * tiles are no wider than 'distance', or -1 if even level 0
+     * tiles are too wide.
+     */
+    static ClockType GetTileSize(int level) {
+        return (ClockType)1 << (PYRAMID_SHIFT + level);
+    }
+    static int GetTileLevelForDistance(ClockType distance);
+    tilePtr_t GetStrataTile(int level, int64_t index);
+
+    /*
+     * The strata are the top of a small spatial hierarchy. Level 0
+     * buckets are the strata themselves, level 1 splits each one
+     * into 2 kB buckets, and level 2 splits those into 512-byte
+     * buckets, one per LogBlock.
+     *
+     * GetBuckets() totals the transfers after 'begin', up to and
+     * including 'end', by reading the log in between. For longer
+     * time ranges, the indexer stores fine totals for each level 0
+     * pyramid tile, but sparsely: only for the strata touched during
+     * that tile, and within each stratum only for the buckets that
+     * were touched. GetBucketsFromTiles() adds these up for tiles
+     * 'first' through 'last' - 1. Like GetStrataTile(), it finds
+     * nothing until indexing is COMPLETE.
+     *
+     * Both only fill in levels 1 and 2; level 0 is the pyramid.
+     */
+    static const int SPATIAL_LEVELS = 3;
+    static int GetBucketShift(int level);
+    void GetBuckets(instantPtr_t begin, instantPtr_t end, BucketTotals &totals);
+    void GetBucketsFromTiles(int64_t first, int64_t last, BucketTotals &totals);
+
+    /*
+     * Working set sketches: which 512-byte blocks were read, and
+     * which were written, by the transfers after 'begin', up to and
+     * including 'end'.
+     *
+     * The indexer keeps a pair of sketches for every timestep, and
+     * merges them into a binary tree of sketches over runs of 2^n
+     * timesteps, much like the strata pyramid. A window is answered
+     * by merging the few tree nodes that cover the timesteps lying
+     * wholly inside it, then replaying the log for the partial
+     * timesteps at each end. The instants must come from the same
+     * segment; if they don't, the sketches are empty.
+     *
+     * GetWorkingSet() returns the estimated sizes, in blocks.
+     */
+    void GetWorkingSetSketches(instantPtr_t begin, instantPtr_t end,
+                               WorkingSetSketch &read, WorkingSetSketch &write);
+    WorkingSet GetWorkingSet(instantPtr_t begin, instantPtr_t end);
+
+    /*
+     * Access patterns: sequential, strided, and polling runs of
+     * transfers, found by an AccessClassifier as the log is indexed.
+     *
+     * GetAccessPatterns() returns up to 'maxCount' runs that overlap
+     * the clock range [begin, end], in order of their first
+     * transfers. FindAccessPattern() finds the first run of 'kind'
+     * that starts after transfer 'id', or with 'forward' false, the
+     * last one that starts before it. NUM_KINDS matches any kind.
+     * It returns false if there's no such run. These only see runs
+     * the indexer has already stored.
+     *
+     * GetAccessPatternSpans() is for drawing: it merges the runs of
+     * each kind that start within the same 'resolution' clocks, so
+     * it returns at most one span per kind for each 'resolution' of
+     * the range, however many runs there are. A span's times, IDs,
+     * and addresses cover all of its runs, and its count is their
+     * total. Its type and stride aren't meaningful.
+     */
+    void GetAccessPatterns(ClockType begin, ClockType end,
+                           std::vector<AccessPattern> &patterns, int maxCount = 10000);
+    void GetAccessPatternSpans(ClockType begin, ClockType end, ClockType resolution,
+                               std::vector<AccessPattern> &spans);
+    bool FindAccessPattern(OffsetType id, bool forward, AccessPattern::Kind kind,
+                           AccessPattern &pattern);
+
     /*
      * Get a summary of a particular memory transfer. This includes
      * information about the transfer's type, offset, timestamp,
@@ -339,11 +651,69 @@ public:
     transferPtr_t GetClosestTransfer(ClockType time);
 
     /*
-     * Get the memory block contaning 'address', at the specified time.
+     * Get the memory block contaning 'address', at the specified time:
+     * its contents after every transfer that ended at or before
+     * 'time'. This starts from the newest snapshot the indexer saved
+     * of the block, and replays at most one timestep of the log.
      */
     blockPtr_t GetBlock(ClockType time, AddressType addr);
 
+    /*
+     * Running totals of how lookups were answered, for tuning. An
+     * instant lookup is a hit if the cache already held one close
+     * enough. Otherwise it may query the timestep table, and it may
+     * have to walk over the log, reading transfers one at a time.
+     */
+    struct CacheStats {
+        uint64_t instantLookups;
+        uint64_t instantHits;
+        uint64_t instantQueries;    // Timesteps read from the database
+        uint64_t instantWalks;      // Lookups that iterated over the log
+        uint64_t walkTransfers;     // Transfers read by all walks
+        uint64_t walkMax;           // Longest single walk, in transfers
+        uint64_t transferLookups;
+        uint64_t transferHits;
+        uint64_t tileLookups;
+        uint64_t tileHits;
+    };
+
+    CacheStats GetCacheStats() {
+        wxCriticalSectionLocker locker(cacheLock);
+        return cacheStats;
+    }
+
+    /*
+     * Out-of-order indexing. The indexer works from the front of the
+     * log to the back, but while it's INDEXING the UI can name a time
+     * range it wants to see now. We map the range to approximate file
+     * offsets, using the clocks per byte of the log indexed so far,
+     * and a second thread indexes up to MAX_SEGMENT_SIZE bytes there
+     * right away, as a separate segment that starts at the first ADDR
+     * packet it finds.
+     *
+     * Segment instants are provisional: their times are estimates,
+     * and their totals start from zero (see LogInstant::segment).
+     * GetInstant() returns them for times past GetDuration(). When
+     * the indexer reaches a segment's first transfer, the segment is
+     * rebased onto the indexer's running totals and becomes exact.
+     * Once the indexer has passed its last transfer, it's dropped.
+     *
+     * GetSegmentGeneration() changes whenever any of this happens, so
+     * anything drawn from segment instants can be thrown away.
+     * GetEstimatedDuration() is the whole log's duration, estimated
+     * the same way until indexing is COMPLETE.
+     */
+    void SetPriorityRange(ClockType begin, ClockType end);
+    ClockType GetEstimatedDuration();
+
+    int GetSegmentGeneration() {
+        wxCriticalSectionLocker locker(cacheLock);
+        return segmentGeneration;
+    }
+
 private:
+    friend class IndexVerifier;
+
     /*
      * Definitions:
      *
@@ -358,9 +728,13 @@ private:
      *   block -- A fine spatial unit used for storing logged data in manageable
      *            chunks. Any data that changes during a timestep is indexed with
      *            block granularity.
+     *
+     *   bucket -- One unit of the spatial hierarchy, from a whole stratum
+     *             (level 0) down to a single block (level 2).
      */
 
     static const int INSTANT_CACHE_SIZE = 1 << 15;
+    static const int TILE_CACHE_SIZE = 1 << 12;
 
     /*
      * XXX: Timestep size (index density) should be scaled more
@@ -372,10 +746,66 @@ private:
      */
     static const int TIMESTEP_SIZE = 96 * 1024;      // Timestep duration, in bytes
 
+    static const int MIN_INSTANTS_PER_THREAD = 64;    // Smallest GetInstants() run
+
+    static const int LOW_IMPACT_BANDWIDTH = 8 << 20;  // Log bytes per second
+    static const int LOW_IMPACT_IDLE_MSEC = 2000;
+
+    static const int FINGERPRINT_SAMPLES = 64;
+    static const int FINGERPRINT_SAMPLE_SIZE = 64 * 1024;
+
     static const int STRATUM_SHIFT = 14;             // 16 kB (1024 strata per 16MB)
     static const int STRATUM_SIZE = 1 << STRATUM_SHIFT;
     static const int STRATUM_MASK = STRATUM_SIZE - 1;
 
+    static const int PYRAMID_SHIFT = 20;             // Level 0 tiles are 1M clocks wide
+    static const int PYRAMID_LEVELS = 24;
+
+    static const int BUCKET_SHIFT_1 = 11;            // 2 kB (8 per stratum)
+
+    static const int WORKING_SET_LEVELS = 24;        // Level n sketches cover 2^n timesteps
+
+    static const int MAX_SEGMENT_SIZE = 64 << 20;    // Log bytes per priority segment
+    static const int SEGMENT_PUBLISH_SIZE = 4 << 20; // Publish segment instants this often
+
+    /*
+     * A provisional segment, indexed out of order. 'instants' are
+     * spaced about one timestep apart, and the first one includes
+     * the transfer at 'firstOffset'. Until 'rebased', they're
+     * relative to the start of the segment. Afterwards, 'delta' is
+     * what we added to make them exact, and we add it to any new
+     * instants too.
+     */
+    struct Segment {
+        OffsetType firstOffset;
+        OffsetType lastOffset;      // Last transfer indexed so far
+        std::vector<instantPtr_t> instants;
+        bool rebased;
+        instantPtr_t delta;
+    };
+
+    static wxString Fingerprint(const wxFileName &logFile);
+    bool IsThrottled();
+
+    /*
+     * Locks the dbLock for a query, while letting the indexer see
+     * that someone is waiting for it.
+     */
+    class QueryLocker {
+    public:
+        QueryLocker(LogIndex *_index) : index(_index) {
+            __sync_fetch_and_add(&index->dbWaiters, 1);
+            index->dbLock.Enter();
+            __sync_fetch_and_sub(&index->dbWaiters, 1);
+        }
+        ~QueryLocker() {
+            index->dbLock.Leave();
+        }
+
+    private:
+        LogIndex *index;
+    };
+
     void DeleteCommands();
     void InitDB();
     void Finish();
@@ -383,10 +813,87 @@ private:
     void SetProgress(double progress, State state);
     void StartIndexing();
     void StoreInstant(LogInstant &instant);
+    void StoreTile(StrataTile &tile);
+    void StoreBuckets(sqlite3x::sqlite3_command &cmd, int level, int64_t tile, int stratum,
+                      const BucketTotals &blocks);
+    void StoreWorkingSet(int level, int64_t node,
+                         const WorkingSetSketch &read, const WorkingSetSketch &write);
+    void StorePatterns(std::vector<AccessPattern> &patterns);
+    static void ReadPattern(sqlite3x::sqlite3_cursor &crsr, AccessPattern &pattern);
+    ClockType GetEarliestPatternBegin(ClockType begin);
     void AdvanceInstant(LogInstant &instant, MemTransfer &mt, bool reverse = false);
     instantPtr_t GetInstantForTimestep(ClockType upperBound);
-    instantPtr_t GetInstantFromStartingPoint(instantPtr_t start, ClockType time,
-                                             ClockType distance = 0);
+    bool FindWorkingSetStep(OffsetType transferId, bool after, int64_t &step,
+                            OffsetType &offset, OffsetType &stepEnd);
+    void ReplayWorkingSet(OffsetType offset, OffsetType beginId, OffsetType endId,
+                          WorkingSetSketch &read, WorkingSetSketch &write);
+    instantPtr_t GetInstantFromStartingPoint(LogReader &reader, instantPtr_t start,
+                                             ClockType time, ClockType distance = 0);
+
+    instantPtr_t GetLastInstant() {
+        wxCriticalSectionLocker locker(cacheLock);
+        return lastInstant;
+    }
+
+    void SetLastInstant(instantPtr_t instant) {
+        wxCriticalSectionLocker locker(cacheLock);
+        lastInstant = instant;
+    }
+
+    // Caller must hold the cacheLock.
+    void CountWalk(instantPtr_t start, instantPtr_t result);
+
+    double GetClocksPerByte();
+    instantPtr_t GetSegmentInstant(ClockType time, ClockType distance);
+    bool PublishSegment(int id, std::vector<instantPtr_t> &batch, OffsetType lastOffset);
+    OffsetType MergeSegments(LogInstant &instant);
+    void StopSegmentThread();
+
+    /*
+     * Indexes priority ranges into new segments, one at a time. A
+     * newer range interrupts the one in progress, but the instants
+     * published so far are kept.
+     */
+    class SegmentThread : public wxThread {
+    public:
+        SegmentThread(LogIndex *_index)
+            : wxThread(wxTHREAD_JOINABLE), running(true), index(_index) {}
+        virtual ExitCode Entry();
+
+        wxSemaphore sema;
+        volatile bool running;
+
+    private:
+        void IndexRange(OffsetType begin, OffsetType end);
+
+        LogIndex *index;
+    };
+
+    /*
+     * One run of a GetInstants() call: sorted times, and the slot in
+     * the results each one belongs in.
+     */
+    struct InstantRun {
+        std::vector<ClockType> times;
+        std::vector<int> slots;
+    };
+
+    void SweepRun(InstantRun &run, ClockType distance, std::vector<instantPtr_t> &results);
+
+    class InstantRunThread : public wxThread {
+    public:
+        InstantRunThread(LogIndex *_index, InstantRun *_run, ClockType _distance,
+                         std::vector<instantPtr_t> *_results)
+            : wxThread(wxTHREAD_JOINABLE), index(_index), run(_run),
+              distance(_distance), results(_results) {}
+        virtual ExitCode Entry();
+
+    private:
+        LogIndex *index;
+        InstantRun *run;
+        ClockType distance;
+        std::vector<instantPtr_t> *results;
+    };
 
     class IndexerThread : public wxThread {
     public:
@@ -397,21 +904,114 @@ private:
         LogIndex *index;
     };
 
-    // Always acquire locks in the order listed.
-    wxCriticalSection dataLock;  // Local data: reader, all caches, lastInstant
+    /*
+     * Builds the strata pyramid as the indexer moves forward. The
+     * indexer calls Advance() before adding each transfer to its
+     * LogInstant, then AddTransfer() with the same transfer, and
+     * Finish() after the last one. Tiles are written with
+     * StoreTile() and StoreBuckets(), so the caller must hold the
+     * dbLock and have a transaction open.
+     *
+     * Fine totals for the current level 0 tile are kept per block,
+     * along with a list of the strata touched so far, so storing
+     * them only costs as much as the tile's working set.
+     */
+    class PyramidBuilder {
+    public:
+        PyramidBuilder(LogIndex *index);
+        ~PyramidBuilder();
+
+        void Advance(LogInstant &instant, ClockType nextTime) {
+            if ((int64_t)(nextTime >> PYRAMID_SHIFT) != levels[0]->index)
+                NextTile(instant, nextTime);
+        }
+
+        void AddTransfer(MemTransfer &mt);
+        void Finish(LogInstant &instant);
+
+    private:
+        void NextTile(LogInstant &instant, ClockType nextTime);
+        void Flush(int level);
+        void FlushBuckets();
+
+        LogIndex *index;
+        LogInstant tileStart;
+        std::vector<StrataTile*> levels;
+        BucketTotals blocks;
+        std::vector<bool> strataTouched;
+        std::vector<int> touchedList;
+    };
+
+    /*
+     * Builds the working set sketches as the indexer moves forward.
+     * The indexer calls AddTransfer() for each transfer, EndStep()
+     * at the end of each timestep, and Finish() after the last one.
+     * Like PyramidBuilder, it writes to the database, so the caller
+     * must hold the dbLock and have a transaction open.
+     *
+     * Level 0 holds the current timestep. Each finished node is
+     * stored and merged into its parent, and a parent is stored once
+     * its last timestep is done, so the tree never has partial nodes
+     * except the ones Finish() stores at the end of the log.
+     */
+    class WorkingSetBuilder {
+    public:
+        WorkingSetBuilder(LogIndex *index);
+
+        void AddTransfer(MemTransfer &mt);
+        void EndStep(LogInstant &instant);
+        void Finish();
+
+    private:
+        void Flush(int level, int64_t step);
+
+        LogIndex *index;
+        int64_t step;
+        std::vector<WorkingSetSketch> read;
+        std::vector<WorkingSetSketch> write;
+    };
+
+    /*
+     * Locking: dbLock may be held while acquiring cacheLock, never the
+     * other way around. Neither lock is held while iterating over the
+     * log file; every query borrows its own LogReader from 'readers'.
+     */
     wxCriticalSection dbLock;    // Protects the database and cmd_*
+    volatile int dbWaiters;      // Queries waiting for the dbLock
+    wxCriticalSection cacheLock; // Protects all caches, lastInstant, cacheStats and segments
 
     sqlite3x::sqlite3_connection db;
     sqlite3x::sqlite3_command *cmd_getInstantForTimestep;
     sqlite3x::sqlite3_command *cmd_getTransferSummary;
-
-    LogReader *reader;
+    sqlite3x::sqlite3_command *cmd_getStrataTile;
+    sqlite3x::sqlite3_command *cmd_getBuckets;
+    sqlite3x::sqlite3_command *cmd_getWorkingSet;
+    sqlite3x::sqlite3_command *cmd_getBlock;
+    sqlite3x::sqlite3_command *cmd_getBlockStart;
+
+    LogReader *reader;           // Prototype reader, for file info and cloning
+    LogReaderPool readers;       // Per-query clones of 'reader'
     IndexerThread *indexer;
     double logFileSize;
+    wxFileName indexFile;
+    wxString fingerprint;        // Empty unless the index is in THD_INDEX_CACHE
+    volatile bool lowImpact;
+    ClockType longestPattern;    // Duration of the longest access pattern, or -1 if unknown
+    static volatile int64_t lastUserActivity;   // wxGetLocalTimeMillis()
 
     FuzzyCache<ClockType, instantPtr_t> instantCache;
     FuzzyCache<OffsetType, transferPtr_t> transferCache;
+    FuzzyCache<int64_t, tilePtr_t> tileCache;
     instantPtr_t lastInstant;
+    CacheStats cacheStats;
+
+    std::map<int, Segment> segments;
+    int nextSegmentId;
+    int segmentGeneration;
+    bool havePriority;           // Is there a new priority range?
+    ClockType priorityBegin;
+    ClockType priorityEnd;
+    SegmentThread *segmentThread;
 
     State state;
     double progress;
@@ -242,3 +242,41 @@ LogReader::GetDefaultClockHZ()
 {
     return RAM_CLOCK_HZ;
 }
+
+
+LogReader *
+LogReaderPool::Acquire()
+{
+    {
+        wxCriticalSectionLocker locker(lock);
+        if (!idle.empty()) {
+            LogReader *reader = idle.back();
+            idle.pop_back();
+            return reader;
+        }
+    }
+
+    // Opening a file is slow, so don't hold the lock for this part.
+    return new LogReader(*prototype);
+}
+
+
+void
+LogReaderPool::Release(LogReader *reader)
+{
+    wxCriticalSectionLocker locker(lock);
+    idle.push_back(reader);
+}
+
+
+void
+LogReaderPool::Clear()
+{
+    wxCriticalSectionLocker locker(lock);
+
+    for (std::vector<LogReader*>::iterator i = idle.begin(); i != idle.end(); i++) {
+        (*i)->Close();
+        delete *i;
+    }
+    idle.clear();
+}
@@ -29,6 +29,8 @@
 #define __LOG_READER_H
 
 #include <wx/filename.h>
+#include <wx/thread.h>
+#include <vector>
 
 #include "file_buffer.h"
 #include "mem_transfer.h"
@@ -75,4 +77,61 @@ private:
     FileBuffer file;
 };
 
+
+/*
+ * A LogReader holds a file position and a small read buffer, so it
+ * can only be used by one thread at a time. The LogReaderPool hands
+ * out private clones of a prototype LogReader, so that any number of
+ * threads can iterate over the same log concurrently. Clones are
+ * recycled, so we only open as many as we have concurrent users.
+ *
+ * Borrow a reader for the duration of one operation using
+ * LogReaderPool::Handle.
+ */
+
+class LogReaderPool {
+public:
+    LogReaderPool() : prototype(NULL) {}
+    ~LogReaderPool() { Clear(); }
+
+    // Start handing out clones of 'prototype'. Must not be in use.
+    void Open(LogReader *_prototype) {
+        Clear();
+        prototype = _prototype;
+    }
+
+    // Close all idle clones. Must not be in use.
+    void Clear();
+
+    LogReader *Acquire();
+    void Release(LogReader *reader);
+
+    class Handle {
+    public:
+        Handle(LogReaderPool &_pool)
+            : pool(_pool),
+              reader(_pool.Acquire())
+        {}
+
+        ~Handle() {
+            pool.Release(reader);
+        }
+
+        LogReader &operator *() { return *reader; }
+        LogReader *operator ->() { return reader; }
+
+    private:
+        Handle(const Handle &);
+        Handle &operator =(const Handle &);
+
+        LogReaderPool &pool;
+        LogReader *reader;
+    };
+
+private:
+    wxCriticalSection lock;
+    LogReader *prototype;
+    std::vector<LogReader*> idle;
+};
+
 #endif /* __LOG_READER_H */
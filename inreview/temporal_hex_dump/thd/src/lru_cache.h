@@ -26,8 +26,11 @@
 #ifndef __LRU_CACHE_H
 #define __LRU_CACHE_H
 
-#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include <stdint.h>
+#include <string.h>
 #include <vector>
+#include <map>
 
 
 /*
@@ -130,6 +133,165 @@ private:
 };
 
 
+/*
+ * A fixed-capacity hash table which maps Key to an integer slot
+ * number. This is the index we keep alongside a SlotList.
+ *
+ * It uses open addressing with Robin Hood probing, and all of its
+ * storage is allocated once in the constructor: insert() and erase()
+ * never touch the heap, unlike a node-based map. The table must never
+ * hold more than 'capacity' keys at once. We allocate at least twice
+ * that many buckets, so probe sequences stay very short.
+ *
+ * Keys are hashed with boost::hash (so any type with a hash_value()
+ * overload works), then scrambled with a multiplicative hash. Our
+ * clock-based keys tend to be multiples of a large round number,
+ * which would otherwise all land in the same few buckets.
+ */
+
+template <typename Key, typename tn = int>
+class OpenHashMap {
+public:
+    OpenHashMap(int capacity)
+        : shift(63),
+          count(0)
+    {
+        size_t buckets = 2;
+        while (buckets < (size_t)capacity * 2) {
+            buckets <<= 1;
+            shift--;
+        }
+
+        mask = buckets - 1;
+        keys = new Key[buckets];
+        values = new tn[buckets];
+        dists = new uint16_t[buckets];
+        memset(dists, 0, sizeof dists[0] * buckets);
+    }
+
+    ~OpenHashMap()
+    {
+        delete[] keys;
+        delete[] values;
+        delete[] dists;
+    }
+
+    bool find(const Key &k, tn &value) const
+    {
+        size_t i;
+        if (!lookup(k, i))
+            return false;
+        value = values[i];
+        return true;
+    }
+
+    // Insert a new key, or replace the value of an existing key.
+    void insert(const Key &k, tn value)
+    {
+        size_t i;
+        if (lookup(k, i)) {
+            values[i] = value;
+            return;
+        }
+
+        Key curKey = k;
+        tn curValue = value;
+        uint16_t curDist = 1;
+        i = bucket(k);
+
+        while (dists[i]) {
+            /*
+             * Robin Hood: If the resident key is closer to its home
+             * bucket than we are to ours, it gives up its bucket and
+             * keeps probing in our place.
+             */
+            if (dists[i] < curDist) {
+                std::swap(curKey, keys[i]);
+                std::swap(curValue, values[i]);
+                std::swap(curDist, dists[i]);
+            }
+            i = (i + 1) & mask;
+            curDist++;
+        }
+
+        keys[i] = curKey;
+        values[i] = curValue;
+        dists[i] = curDist;
+        count++;
+    }
+
+    // Returns false if the key wasn't present.
+    bool erase(const Key &k)
+    {
+        size_t i;
+        if (!lookup(k, i))
+            return false;
+
+        /*
+         * Backward-shift deletion: Slide the rest of this probe
+         * sequence down by one bucket, so we never need tombstones.
+         */
+
+        size_t next = (i + 1) & mask;
+        while (dists[next] > 1) {
+            keys[i] = keys[next];
+            values[i] = values[next];
+            dists[i] = dists[next] - 1;
+            i = next;
+            next = (next + 1) & mask;
+        }
+
+        dists[i] = 0;
+        count--;
+        return true;
+    }
+
+    void clear()
+    {
+        if (count) {
+            memset(dists, 0, sizeof dists[0] * (mask + 1));
+            count = 0;
+        }
+    }
+
+    int size() const
+    {
+        return count;
+    }
+
+private:
+    size_t bucket(const Key &k) const
+    {
+        boost::hash<Key> hasher;
+        return (size_t)(((uint64_t)hasher(k) * 0x9E3779B97F4A7C15ULL) >> shift) & mask;
+    }
+
+    bool lookup(const Key &k, size_t &index) const
+    {
+        size_t i = bucket(k);
+        uint16_t dist = 1;
+
+        // Any resident that's closer to home than us ends our search.
+        while (dists[i] >= dist) {
+            if (dists[i] == dist && keys[i] == k) {
+                index = i;
+                return true;
+            }
+            i = (i + 1) & mask;
+            dist++;
+        }
+        return false;
+    }
+
+    int shift;
+    int count;
+    size_t mask;
+    Key *keys;
+    tn *values;
+    uint16_t *dists;    // Probe distance plus one, or zero if the bucket is empty
+};
+
+
 /*
  * Creates a fixed-size cache which maps Key to Value, storing 'size'
  * values. When a value is missing, we generate it using the provided
@@ -146,6 +308,7 @@ public:
           values(new Value[_size]),
           keys(new Key[_size]),
           lru(_size),
+          map(_size),
           generator(_generator)
     {}
 
@@ -169,26 +332,29 @@ public:
 
 protected:
     bool find(Key k, int &index) {
-        iterator_t i = map.find(k);
-        if (i == map.end()) {
-            return false;
-        } else {
-            index = i->second;
-            return true;
-        }
+        return map.find(k, index);
     }
 
     // Allocate a fresh Value to fill in, freeing the oldest Value.
     Value &alloc(int &index) {
         index = lru.head;
-        map.erase(keys[index]);
+
+        /*
+         * Only forget the old key if it still refers to this slot. The
+         * slot may never have been stored, or the same key may have
+         * been stored again in a newer slot.
+         */
+        int mapped;
+        if (map.find(keys[index], mapped) && mapped == index)
+            map.erase(keys[index]);
+
         lru.remove(index);
         return values[index];
     }
 
     // After a value has been written to 'index', make it available to find.
     void store(Key k, int index) {
-        map[k] = index;
+        map.insert(k, index);
         keys[index] = k;
         lru.append(index);
     }
@@ -198,11 +364,20 @@ protected:
         return values[index];
     }
 
+    // Give back a slot from alloc() without storing anything in it.
+    void release(int index) {
+        lru.prepend(index);
+    }
+
+    // Forget every key. Their slots are reused oldest-first, as usual.
+    void forget() {
+        map.clear();
+    }
+
     generator_t *generator;
 
 private:
-    typedef typename boost::unordered_map<Key, int> map_t;
-    typedef typename boost::unordered_map<Key, int>::iterator iterator_t;
+    typedef OpenHashMap<Key> map_t;
 
     int size;
     Value *values;
@@ -236,17 +411,21 @@ public:
 
     Value &findClosest(Key k)
     {
-        iterator_t below = cacheMap.upper_bound(k);
+        // 'above' is the first key >= k, 'below' is the last key < k.
         iterator_t above = cacheMap.lower_bound(k);
-        bool belowExists = below != cacheMap.end();
+        iterator_t below = above;
         bool aboveExists = above != cacheMap.end();
+        bool belowExists = below != cacheMap.begin();
 
-        if (belowExists && (!aboveExists || (k - below->first <= above->first - k))) {
+        if (belowExists)
+            --below;
+
+        if (belowExists && (!aboveExists || (k - below->first < above->first - k))) {
             touch(below->first);
             return below->second;
         }
 
-        if (aboveExists && (!belowExists || (k - below->first >= above->first - k))) {
+        if (aboveExists) {
             touch(above->first);
             return above->second;
         }
@@ -257,6 +436,14 @@ public:
 
     void store(Key &k, Value &v)
     {
+        // Already cached? Replace the value in-place.
+        keyMapIter_t existing = keyMap.find(k);
+        if (existing != keyMap.end()) {
+            cacheMap[k] = v;
+            lru.moveToTail(existing->second);
+            return;
+        }
+
         // Recycle the oldest slot
         int slot = lru.head;
         lru.moveToTail(slot);
@@ -276,6 +463,15 @@ public:
         keyMap.insert(keyMapValue_t(k, slot));
     }
 
+    // Forget every item, and return '_defaultValue' for an empty cache from now on.
+    void clear(Value _defaultValue)
+    {
+        cacheMap.clear();
+        slotMap.clear();
+        keyMap.clear();
+        defaultValue = _defaultValue;
+    }
+
 private:
     void touch(Key k)
     {
@@ -0,0 +1,830 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * query_server.cpp -- Answers LogIndex queries from other processes, over a
+ *                     Unix domain socket.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <boost/weak_ptr.hpp>
+
+#include "query_server.h"
+#include "strata_query.h"
+#include "transfer_filter.h"
+#include "trace_event.h"
+
+
+// Items per batch, so one request can't ask for an unbounded response.
+static const uint32_t MAX_BATCH = 1 << 16;
+static const uint32_t MAX_TOTALS_BATCH = 1 << 10;
+
+
+/*
+ * Little-endian reading and writing of request and response bodies.
+ * A WireReader that runs off the end of its buffer returns zeroes
+ * and clears 'ok'.
+ */
+
+class WireReader {
+public:
+    WireReader(const std::vector<uint8_t> &buffer)
+        : p(buffer.empty() ? NULL : &buffer[0]),
+          end(p + buffer.size()),
+          ok(true)
+    {}
+
+    uint64_t get(int bytes) {
+        if (end - p < bytes) {
+            ok = false;
+            return 0;
+        }
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++)
+            value |= (uint64_t)p[i] << (8 * i);
+        p += bytes;
+        return value;
+    }
+
+    ClockType getClock() {
+        return (ClockType) get(8);
+    }
+
+    size_t remaining() const {
+        return end - p;
+    }
+
+    std::string getRest() {
+        std::string rest((const char *) p, end - p);
+        p = end;
+        return rest;
+    }
+
+    const uint8_t *p;
+    const uint8_t *end;
+    bool ok;
+};
+
+
+class WireWriter {
+public:
+    WireWriter(std::vector<uint8_t> &_out) : out(_out) {}
+
+    void put(uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++)
+            out.push_back(value >> (8 * i));
+    }
+
+    void putDouble(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof bits);
+        put(bits, 8);
+    }
+
+    void putBytes(const uint8_t *data, size_t size) {
+        out.insert(out.end(), data, data + size);
+    }
+
+    void putTransfer(const TransferSummary &tp) {
+        put(tp.id, 8);
+        put(tp.time, 8);
+        put(tp.offset, 8);
+        put(tp.address, 4);
+        put(tp.byteCount, 4);
+        put(tp.type, 4);
+    }
+
+    std::vector<uint8_t> &out;
+};
+
+
+/*
+ * One client. The reader thread reads requests and hands them to the
+ * server's queue, waiting whenever MAX_PIPELINE of them are still
+ * unanswered. Workers send responses whenever they're ready, one at
+ * a time under 'sendLock'.
+ */
+
+class QueryServer::Connection {
+public:
+    Connection(QueryServer *_server, int _fd)
+        : server(_server),
+          fd(_fd),
+          window(MAX_PIPELINE, MAX_PIPELINE),
+          thread(NULL),
+          closed(false)
+    {}
+
+    ~Connection() {
+        Join();
+        close(fd);
+    }
+
+    void Start(connectionPtr_t _self) {
+        self = _self;
+        thread = new ReaderThread(this);
+        thread->Create();
+        thread->Run();
+    }
+
+    // Stop reading requests. Ones already queued are still answered.
+    void Shutdown() {
+        shutdown(fd, SHUT_RDWR);
+    }
+
+    void Join() {
+        if (thread) {
+            thread->Wait();
+            delete thread;
+            thread = NULL;
+        }
+    }
+
+    bool IsClosed() {
+        wxCriticalSectionLocker locker(lock);
+        return closed;
+    }
+
+    void Send(uint32_t tag, uint16_t op, uint16_t status, const std::vector<uint8_t> &body);
+
+    // A request from this connection has been answered.
+    void Answered() {
+        window.Post();
+    }
+
+private:
+    class ReaderThread : public wxThread {
+    public:
+        ReaderThread(Connection *_connection)
+            : wxThread(wxTHREAD_JOINABLE), connection(_connection) {}
+        virtual ExitCode Entry();
+
+    private:
+        Connection *connection;
+    };
+
+    bool ReadFully(uint8_t *buffer, size_t size);
+    void ReadRequests();
+
+    QueryServer *server;
+    int fd;
+    boost::weak_ptr<Connection> self;
+    wxSemaphore window;
+    ReaderThread *thread;
+
+    wxCriticalSection sendLock;
+    wxCriticalSection lock;     // Protects 'closed'
+    bool closed;
+};
+
+
+wxThread::ExitCode
+QueryServer::Connection::ReaderThread::Entry()
+{
+    TraceLog::setThreadName("Query connection");
+    connection->ReadRequests();
+    return 0;
+}
+
+
+bool
+QueryServer::Connection::ReadFully(uint8_t *buffer, size_t size)
+{
+    while (size) {
+        ssize_t result = recv(fd, buffer, size, 0);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return false;
+        buffer += result;
+        size -= result;
+    }
+    return true;
+}
+
+
+void
+QueryServer::Connection::ReadRequests()
+{
+    while (1) {
+        uint8_t header[HEADER_SIZE];
+        if (!ReadFully(header, sizeof header))
+            break;
+
+        std::vector<uint8_t> headerBytes(header, header + sizeof header);
+        WireReader r(headerBytes);
+        uint32_t length = r.get(4);
+        uint32_t tag = r.get(4);
+        uint16_t op = r.get(2);
+        uint16_t flags = r.get(2);
+
+        if (length < HEADER_SIZE - 4 || length - (HEADER_SIZE - 4) > MAX_REQUEST) {
+            // We can't find the next request after this, so give up on the connection.
+            std::string message = "Bad request length";
+            Send(tag, op, BAD_REQUEST, std::vector<uint8_t>(message.begin(), message.end()));
+            break;
+        }
+
+        Request *request = new Request;
+        request->tag = tag;
+        request->op = op;
+        request->flags = flags;
+        request->body.resize(length - (HEADER_SIZE - 4));
+
+        if (!request->body.empty() && !ReadFully(&request->body[0], request->body.size())) {
+            delete request;
+            break;
+        }
+
+        window.Wait();
+        request->connection = self.lock();
+        server->Enqueue(request);
+    }
+
+    wxCriticalSectionLocker locker(lock);
+    closed = true;
+}
+
+
+void
+QueryServer::Connection::Send(uint32_t tag, uint16_t op, uint16_t status,
+                              const std::vector<uint8_t> &body)
+{
+    std::vector<uint8_t> frame;
+    frame.reserve(HEADER_SIZE + body.size());
+
+    WireWriter w(frame);
+    w.put(body.size() + HEADER_SIZE - 4, 4);
+    w.put(tag, 4);
+    w.put(op, 2);
+    w.put(status, 2);
+    if (!body.empty())
+        w.putBytes(&body[0], body.size());
+
+    // If the client has gone away, the response is dropped.
+
+    wxCriticalSectionLocker locker(sendLock);
+    const uint8_t *p = &frame[0];
+    size_t size = frame.size();
+
+    while (size) {
+        ssize_t result = send(fd, p, size, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            break;
+        p += result;
+        size -= result;
+    }
+}
+
+
+/*
+ * Answers requests. Each worker thread has one, with its own
+ * LogReader for searches.
+ */
+
+class QueryServer::Worker {
+public:
+    Worker(LogIndex *_index)
+        : index(_index),
+          query(_index),
+          reader(_index->GetLogFileName().GetFullPath().c_str())
+    {}
+
+    Status Answer(Request &request, std::vector<uint8_t> &response, std::string &error);
+
+private:
+    Status Info(WireReader &r, WireWriter &w, std::string &error);
+    Status Instants(WireReader &r, WireWriter &w, std::string &error, bool totals);
+    Status Transfers(WireReader &r, WireWriter &w, std::string &error);
+    Status Blocks(WireReader &r, WireWriter &w, std::string &error);
+    Status Search(WireReader &r, WireWriter &w, std::string &error);
+    Status Aggregate(WireReader &r, WireWriter &w, std::string &error);
+    Status Patterns(WireReader &r, WireWriter &w, std::string &error);
+
+    // Check that a batch of 'count' items of 'itemSize' bytes fills the rest of the request.
+    static bool CheckBatch(WireReader &r, uint32_t count, uint32_t maxCount, size_t itemSize,
+                           std::string &error);
+
+    LogIndex *index;
+    StrataQuery query;
+    LogReader reader;
+    MemTransfer mt;
+};
+
+
+QueryServer::Status
+QueryServer::Worker::Answer(Request &request, std::vector<uint8_t> &response,
+                            std::string &error)
+{
+    TraceScope trace("Query");
+
+    WireReader r(request.body);
+    WireWriter w(response);
+    Status status;
+
+    switch (request.op) {
+    case INFO:       status = Info(r, w, error); break;
+    case INSTANTS:   status = Instants(r, w, error, (request.flags & FLAG_TOTALS) != 0); break;
+    case TRANSFERS:  status = Transfers(r, w, error); break;
+    case BLOCKS:     status = Blocks(r, w, error); break;
+    case SEARCH:     status = Search(r, w, error); break;
+    case AGGREGATE:  status = Aggregate(r, w, error); break;
+    case PATTERNS:   status = Patterns(r, w, error); break;
+    default:
+        error = "Unknown op";
+        return UNKNOWN_OP;
+    }
+
+    if (status == OK && (!r.ok || r.remaining())) {
+        error = "Request is the wrong length";
+        status = BAD_REQUEST;
+    }
+    return status;
+}
+
+
+bool
+QueryServer::Worker::CheckBatch(WireReader &r, uint32_t count, uint32_t maxCount,
+                                size_t itemSize, std::string &error)
+{
+    if (!r.ok) {
+        error = "Request is too short";
+        return false;
+    }
+    if (count > maxCount) {
+        error = "Too many items in batch";
+        return false;
+    }
+    if (r.remaining() != count * itemSize) {
+        error = "Request is the wrong length";
+        return false;
+    }
+    return true;
+}
+
+
+QueryServer::Status
+QueryServer::Worker::Info(WireReader &r, WireWriter &w, std::string &error)
+{
+    w.put(index->GetDuration(), 8);
+    w.put(index->GetNumTransfers(), 8);
+    w.put(index->GetMemSize(), 4);
+    w.put(index->GetNumStrata(), 4);
+    w.put(index->GetStratumFirstAddress(1), 4);
+    w.put(LogBlock::SIZE, 4);
+    return OK;
+}
+
+
+QueryServer::Status
+QueryServer::Worker::Instants(WireReader &r, WireWriter &w, std::string &error, bool totals)
+{
+    ClockType distance = r.getClock();
+    uint32_t count = r.get(4);
+
+    if (!CheckBatch(r, count, totals ? MAX_TOTALS_BATCH : MAX_BATCH, 8, error))
+        return BAD_REQUEST;
+
+    std::vector<ClockType> times(count);
+    for (uint32_t i = 0; i < count; i++)
+        times[i] = r.getClock();
+
+    // One sweep; concurrency comes from answering requests in parallel.
+    std::vector<instantPtr_t> results;
+    index->GetInstants(times, std::max<ClockType>(0, distance), results, 1);
+
+    w.put(count, 4);
+    for (uint32_t i = 0; i < count; i++) {
+        LogInstant &instant = *results[i];
+
+        w.put(instant.time, 8);
+        w.put(instant.offset, 8);
+        w.put(instant.transferId, 8);
+
+        if (totals) {
+            LogStrata *strata[] = { &instant.readTotals, &instant.writeTotals,
+                                    &instant.zeroTotals };
+            for (int t = 0; t < 3; t++)
+                for (int s = 0; s < index->GetNumStrata(); s++)
+                    w.put(strata[t]->get(s), 8);
+        }
+    }
+    return OK;
+}
+
+
+QueryServer::Status
+QueryServer::Worker::Transfers(WireReader &r, WireWriter &w, std::string &error)
+{
+    uint32_t count = r.get(4);
+
+    if (!CheckBatch(r, count, MAX_BATCH, 8, error))
+        return BAD_REQUEST;
+
+    OffsetType numTransfers = index->GetNumTransfers();
+
+    w.put(count, 4);
+    for (uint32_t i = 0; i < count; i++) {
+        OffsetType id = r.get(8);
+
+        // GetTransferSummary() clamps IDs to the log, but a script wants to know.
+        if (id < numTransfers) {
+            w.putTransfer(*index->GetTransferSummary(id));
+        } else {
+            TransferSummary missing(-1, -1, id);
+            w.putTransfer(missing);
+        }
+    }
+    return OK;
+}
+
+
+QueryServer::Status
+QueryServer::Worker::Blocks(WireReader &r, WireWriter &w, std::string &error)
+{
+    uint32_t count = r.get(4);
+
+    if (!CheckBatch(r, count, MAX_BATCH, 12, error))
+        return BAD_REQUEST;
+
+    w.put(count, 4);
+    for (uint32_t i = 0; i < count; i++) {
+        ClockType time = r.getClock();
+        AddressType address = r.get(4);
+        blockPtr_t block = index->GetBlock(time, address);
+
+        w.put(block->address, 4);
+        w.put(block->time, 8);
+        w.putBytes(&block->data[0], block->data.size());
+    }
+    return OK;
+}
+
+
+QueryServer::Status
+QueryServer::Worker::Search(WireReader &r, WireWriter &w, std::string &error)
+{
+    OffsetType firstId = r.get(8);
+    uint32_t maxResults = std::min<uint32_t>(r.get(4), MAX_BATCH);
+    uint32_t maxScan = r.get(4);
+    std::string text = r.getRest();
+
+    if (!r.ok) {
+        error = "Request is too short";
+        return BAD_REQUEST;
+    }
+
+    TransferFilter::Criteria criteria;
+    if (!criteria.Parse(text.c_str(), error))
+        return BAD_REQUEST;
+
+    if (!maxScan || maxScan > MAX_SCAN)
+        maxScan = MAX_SCAN;
+
+    /*
+     * Start from the first transfer's summary, which has its offset
+     * and time. Times are at the end of each transfer, so the first
+     * one's duration is already counted.
+     */
+
+    OffsetType numTransfers = index->GetNumTransfers();
+    OffsetType nextId = std::min(firstId, numTransfers);
+    std::vector<TransferSummary> results;
+
+    if (firstId < numTransfers) {
+        transferPtr_t first = index->GetTransferSummary(firstId);
+        ClockType time = first->time;
+        uint32_t scanned = 0;
+
+        mt = MemTransfer(first->offset, first->id);
+
+        while (scanned < maxScan && results.size() < maxResults) {
+            if (scanned && !reader.Next(mt))
+                break;
+            if (!reader.Read(mt))
+                break;
+            if (scanned)
+                time += mt.duration;
+
+            scanned++;
+            nextId = mt.id + 1;
+
+            if (criteria.Matches(mt)) {
+                TransferSummary tp(time, mt.offset, mt.id);
+                tp.type = mt.type;
+                tp.address = mt.address;
+                tp.byteCount = mt.byteCount;
+                results.push_back(tp);
+            }
+        }
+
+        if (scanned < maxScan && results.size() < maxResults)
+            nextId = numTransfers;     // Reached the end of the log
+    }
+
+    w.put(nextId, 8);
+    w.put(results.size(), 4);
+    for (size_t i = 0; i < results.size(); i++)
+        w.putTransfer(results[i]);
+    return OK;
+}
+
+
+QueryServer::Status
+QueryServer::Worker::Aggregate(WireReader &r, WireWriter &w, std::string &error)
+{
+    ClockType begin = r.getClock();
+    ClockType end = r.getClock();
+    uint32_t numWindows = r.get(4);
+    uint32_t topCount = std::min<uint32_t>(r.get(4), index->GetNumStrata());
+    uint32_t metric = r.get(4);
+
+    if (!r.ok || end <= begin || !numWindows || numWindows > MAX_WINDOWS ||
+        metric > StrataQuery::ZERO) {
+        error = "Bad time range, window count, or metric";
+        return BAD_REQUEST;
+    }
+
+    std::vector<StrataQuery::Window> windows;
+    std::vector<StrataQuery::HotStratum> hot;
+    query.GetEvenWindows(begin, end, numWindows, windows, 0, 1);
+
+    w.put(windows.size(), 4);
+    for (size_t i = 0; i < windows.size(); i++) {
+        StrataQuery::Window &window = windows[i];
+
+        w.put(window.begin, 8);
+        w.put(window.end, 8);
+        w.put(window.numTransfers, 8);
+        w.put(window.readBytes, 8);
+        w.put(window.writeBytes, 8);
+        w.put(window.zeroBytes, 8);
+        w.putDouble(window.workingSet.touched);
+        w.putDouble(window.workingSet.read);
+        w.putDouble(window.workingSet.written);
+
+        StrataQuery::GetHotStrata(window, (StrataQuery::Metric) metric, topCount, hot);
+        w.put(hot.size(), 4);
+        for (size_t h = 0; h < hot.size(); h++) {
+            w.put(hot[h].stratum, 4);
+            w.put(hot[h].bytes, 8);
+        }
+    }
+    return OK;
+}
+
+
+QueryServer::Status
+QueryServer::Worker::Patterns(WireReader &r, WireWriter &w, std::string &error)
+{
+    ClockType begin = r.getClock();
+    ClockType end = r.getClock();
+    uint32_t maxCount = std::min<uint32_t>(r.get(4), MAX_BATCH);
+    uint32_t kind = r.get(4);
+
+    if (!r.ok || kind > AccessPattern::NUM_KINDS) {
+        error = "Bad pattern kind";
+        return BAD_REQUEST;
+    }
+
+    std::vector<AccessPattern> patterns;
+    index->GetAccessPatterns(begin, end, patterns, maxCount);
+
+    std::vector<AccessPattern> matching;
+    for (size_t i = 0; i < patterns.size(); i++)
+        if (kind == AccessPattern::NUM_KINDS || patterns[i].kind == (AccessPattern::Kind) kind)
+            matching.push_back(patterns[i]);
+
+    w.put(matching.size(), 4);
+    for (size_t i = 0; i < matching.size(); i++) {
+        AccessPattern &p = matching[i];
+
+        w.put(p.kind, 4);
+        w.put(p.type, 4);
+        w.put(p.beginTime, 8);
+        w.put(p.endTime, 8);
+        w.put(p.firstId, 8);
+        w.put(p.lastId, 8);
+        w.put(p.lowAddress, 4);
+        w.put(p.highAddress, 4);
+        w.put(p.stride, 8);
+        w.put(p.count, 8);
+    }
+    return OK;
+}
+
+
+QueryServer::QueryServer(LogIndex *_index)
+    : connectionsAccepted(0),
+      requestsAnswered(0),
+      index(_index),
+      listenFd(-1),
+      stopping(0)
+{}
+
+
+QueryServer::~QueryServer()
+{
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+}
+
+
+bool
+QueryServer::Listen(const char *path, std::string &error)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof addr.sun_path) {
+        error = "Socket path is too long";
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error = strerror(errno);
+        return false;
+    }
+
+    /*
+     * A socket left behind by a server that died is in the way. If
+     * nobody answers on it, replace it.
+     */
+
+    struct stat st;
+    if (!stat(path, &st) && S_ISSOCK(st.st_mode)) {
+        if (!connect(fd, (struct sockaddr *) &addr, sizeof addr)) {
+            close(fd);
+            error = "Another server is already listening there";
+            return false;
+        }
+        close(fd);
+        unlink(path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof addr) || listen(fd, 16)) {
+        error = strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    listenFd = fd;
+    socketPath = path;
+    return true;
+}
+
+
+void
+QueryServer::Run(int numThreads)
+{
+    for (int i = 0; i < std::max(1, numThreads); i++) {
+        WorkerThread *thread = new WorkerThread(this);
+        thread->Create();
+        thread->Run();
+        workers.push_back(thread);
+    }
+
+    // Poll, rather than block in accept(), so we notice Stop().
+
+    while (!stopping) {
+        struct pollfd pfd;
+        pfd.fd = listenFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        int ready = poll(&pfd, 1, 250);
+        Reap(false);
+        if (ready <= 0)
+            continue;
+
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        connectionPtr_t connection(new Connection(this, fd));
+        connection->Start(connection);
+        connections.push_back(connection);
+        connectionsAccepted++;
+    }
+
+    /*
+     * Stop reading requests, and let the workers finish the ones
+     * already queued before they see their NULLs.
+     */
+
+    for (size_t i = 0; i < connections.size(); i++)
+        connections[i]->Shutdown();
+    Reap(true);
+
+    {
+        wxCriticalSectionLocker locker(lock);
+        for (size_t i = 0; i < workers.size(); i++) {
+            queue.push_back(NULL);
+            pending.Post();
+        }
+    }
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->Wait();
+        delete workers[i];
+    }
+    workers.clear();
+}
+
+
+void
+QueryServer::Reap(bool all)
+{
+    // Forget connections whose clients are gone. Workers may still hold references.
+
+    std::vector<connectionPtr_t> open;
+
+    for (size_t i = 0; i < connections.size(); i++) {
+        if (all || connections[i]->IsClosed())
+            connections[i]->Join();
+        else
+            open.push_back(connections[i]);
+    }
+    connections.swap(open);
+}
+
+
+void
+QueryServer::Enqueue(Request *request)
+{
+    wxCriticalSectionLocker locker(lock);
+    queue.push_back(request);
+    pending.Post();
+}
+
+
+wxThread::ExitCode
+QueryServer::WorkerThread::Entry()
+{
+    TraceLog::setThreadName("Query worker");
+
+    Worker worker(server->index);
+
+    while (1) {
+        Request *request;
+
+        server->pending.Wait();
+        {
+            wxCriticalSectionLocker locker(server->lock);
+            request = server->queue.front();
+            server->queue.pop_front();
+        }
+        if (!request)
+            break;
+
+        std::vector<uint8_t> response;
+        std::string error;
+        Status status = worker.Answer(*request, response, error);
+
+        if (status != OK)
+            response.assign(error.begin(), error.end());
+
+        request->connection->Send(request->tag, request->op, status, response);
+        request->connection->Answered();
+        delete request;
+
+        wxCriticalSectionLocker locker(server->lock);
+        server->requestsAnswered++;
+    }
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * query_server.h -- Answers LogIndex queries from other processes, over a
+ *                   Unix domain socket.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __QUERY_SERVER_H
+#define __QUERY_SERVER_H
+
+#include <wx/thread.h>
+#include <boost/shared_ptr.hpp>
+#include <signal.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "log_index.h"
+
+
+/*
+ * A query server shares one LogIndex, with its caches, among any
+ * number of client processes. Clients connect to a Unix domain socket
+ * and send binary requests. Each request is a batch (many instants,
+ * many transfers, many blocks) so a script doesn't pay a round trip
+ * per item, and requests can be pipelined: a client may send up to
+ * MAX_PIPELINE of them before reading any responses.
+ *
+ * Each connection has a thread that reads its requests and queues
+ * them for a pool of worker threads. Responses are sent as soon as
+ * they're ready, so they can come back in a different order than the
+ * requests. Each response carries its request's tag.
+ *
+ * Workers have their own LogReader, so the parts of a request that
+ * read the log (walking to an instant, replaying a block, a search)
+ * run in parallel. Everything that touches the index database goes
+ * through the LogIndex's one connection under its dbLock, like any
+ * other LogIndex user, so those lookups take turns. Requests that are
+ * mostly database lookups, such as BLOCKS, PATTERNS, and INSTANTS
+ * that miss the instant cache, don't get faster with more workers.
+ *
+ * Every integer is little-endian. A request is a 12-byte header and
+ * a body, and so is a response:
+ *
+ *   Request    uint32 length (of the rest), uint32 tag, uint16 op, uint16 flags, body
+ *   Response   uint32 length (of the rest), uint32 tag, uint16 op, uint16 status, body
+ *
+ * A response with a status other than OK has an error message as its
+ * body. Requests (->) and responses (<-) by op:
+ *
+ *   INFO        -> nothing
+ *               <- int64 duration, uint64 transfers, uint32 memory size,
+ *                  uint32 strata, uint32 stratum size, uint32 block size
+ *
+ *   INSTANTS    -> int64 distance, uint32 n, int64 time[n]
+ *               <- uint32 n, n * { int64 time, uint64 offset, uint64 transfer ID }
+ *                  With FLAG_TOTALS, each instant is followed by its
+ *                  cumulative read, write, and zero totals, one
+ *                  uint64 per stratum each. See LogIndex::GetInstant().
+ *
+ *   TRANSFERS   -> uint32 n, uint64 id[n]
+ *               <- uint32 n, n * TRANSFER
+ *
+ *   BLOCKS      -> uint32 n, n * { int64 time, uint32 address }
+ *               <- uint32 n, n * { uint32 address, int64 time, 512 bytes }
+ *                  See LogIndex::GetBlock().
+ *
+ *   SEARCH      -> uint64 first ID, uint32 max results, uint32 max scanned,
+ *                  filter text (the rest of the body)
+ *               <- uint64 next ID, uint32 n, n * TRANSFER
+ *                  Reads the log forward from the first ID for transfers
+ *                  matching a TransferFilter. It stops after 'max
+ *                  results' matches or 'max scanned' transfers (zero for
+ *                  the default of MAX_SCAN), and 'next ID' is where to
+ *                  continue from.
+ *
+ *   AGGREGATE   -> int64 begin, int64 end, uint32 windows, uint32 hot strata k,
+ *                  uint32 metric (StrataQuery::Metric)
+ *               <- uint32 n, n * { int64 begin, int64 end, uint64 transfers,
+ *                  uint64 read, uint64 written, uint64 zero, float64 touched,
+ *                  float64 blocks read, float64 blocks written, uint32 k,
+ *                  k * { uint32 stratum, uint64 bytes } }
+ *                  See StrataQuery.
+ *
+ *   PATTERNS    -> int64 begin, int64 end, uint32 max count, uint32 kind
+ *                  (AccessPattern::Kind, NUM_KINDS for all)
+ *               <- uint32 n, n * { uint32 kind, uint32 type, int64 begin time,
+ *                  int64 end time, uint64 first ID, uint64 last ID,
+ *                  uint32 low address, uint32 high address, int64 stride,
+ *                  uint64 count }
+ *
+ *   TRANSFER is { uint64 id, int64 time, uint64 offset, uint32 address,
+ *                 uint32 length, uint32 type (MemTransfer::TypeEnum) }
+ *
+ * The server expects a COMPLETE index.
+ */
+
+class QueryServer {
+public:
+    enum Op {
+        INFO,
+        INSTANTS,
+        TRANSFERS,
+        BLOCKS,
+        SEARCH,
+        AGGREGATE,
+        PATTERNS,
+    };
+
+    enum Status {
+        OK,
+        BAD_REQUEST,
+        UNKNOWN_OP,
+    };
+
+    static const int FLAG_TOTALS = 1 << 0;
+
+    static const int HEADER_SIZE = 12;
+    static const uint32_t MAX_REQUEST = 16 << 20;   // Bytes, after the length
+    static const int MAX_PIPELINE = 64;             // Requests in flight per connection
+    static const uint32_t MAX_SCAN = 1 << 24;       // Transfers per SEARCH
+    static const uint32_t MAX_WINDOWS = 1 << 16;
+
+    QueryServer(LogIndex *index);
+    ~QueryServer();
+
+    // Create the socket. Returns false and sets 'error' if we can't.
+    bool Listen(const char *path, std::string &error);
+
+    /*
+     * Serve clients on 'numThreads' worker threads until Stop(). Stop()
+     * only sets a flag, so it's safe to call from a signal handler.
+     */
+    void Run(int numThreads);
+    void Stop() { stopping = 1; }
+
+    // Totals, for the log.
+    uint64_t connectionsAccepted;
+    uint64_t requestsAnswered;
+
+private:
+    class Connection;
+    typedef boost::shared_ptr<Connection> connectionPtr_t;
+
+    struct Request {
+        connectionPtr_t connection;
+        uint32_t tag;
+        uint16_t op;
+        uint16_t flags;
+        std::vector<uint8_t> body;
+    };
+
+    class WorkerThread : public wxThread {
+    public:
+        WorkerThread(QueryServer *_server)
+            : wxThread(wxTHREAD_JOINABLE), server(_server) {}
+        virtual ExitCode Entry();
+
+    private:
+        QueryServer *server;
+    };
+
+    class Worker;
+
+    void Enqueue(Request *request);
+    void Reap(bool all);
+
+    LogIndex *index;
+    std::string socketPath;
+    int listenFd;
+    volatile sig_atomic_t stopping;
+
+    std::vector<connectionPtr_t> connections;
+    std::vector<WorkerThread*> workers;
+
+    wxSemaphore pending;       // Posted once per queued request
+    wxCriticalSection lock;    // Protects everything below
+    std::deque<Request*> queue;
+};
+
+#endif /* __QUERY_SERVER_H */
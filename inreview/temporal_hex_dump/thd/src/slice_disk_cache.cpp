@@ -0,0 +1,309 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * slice_disk_cache.cpp -- Persistent storage for rendered timeline slices.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <wx/filename.h>
+#include <string.h>
+
+#include "slice_disk_cache.h"
+#include "varint.h"
+
+using namespace sqlite3x;
+
+
+SliceDiskCache::SliceDiskCache()
+    : isOpen(false),
+      cmd_load(NULL)
+{}
+
+
+SliceDiskCache::~SliceDiskCache()
+{
+    Close();
+}
+
+
+void
+SliceDiskCache::Open(LogIndex *index)
+{
+    wxCriticalSectionLocker locker(lock);
+
+    if (isOpen)
+        return;
+
+    wxFileName cacheFile = index->GetIndexFileName();
+    cacheFile.SetExt(wxT("slices"));
+    wxString cachePath = cacheFile.GetFullPath();
+
+    /*
+     * Identify the log the same way the index does: by fingerprint
+     * in THD_INDEX_CACHE, or else by name and mtime.
+     */
+    wxString name = index->GetLogFingerprint();
+    sqlite3x::int64_t mtime = 0;
+
+    if (name.IsEmpty()) {
+        wxFileName logFile = index->GetLogFileName();
+        name = logFile.GetName();
+        mtime = logFile.GetModificationTime().GetTicks();
+    }
+
+    db.open(cachePath.fn_str());
+    InitDB();
+
+    if (!CheckInfo(name, mtime)) {
+        // Stale or unrecognized. Start over with an empty cache.
+
+        db.close();
+        wxRemoveFile(cachePath);
+        db.open(cachePath.fn_str());
+        InitDB();
+
+        sqlite3_command cmd(db, "INSERT INTO cacheInfo VALUES(?,?,?)");
+        cmd.bind(1, name.fn_str());
+        cmd.bind(2, mtime);
+        cmd.bind(3, FORMAT_VERSION);
+        cmd.executenonquery();
+    }
+
+    cmd_load = new sqlite3_command(db, "SELECT slice FROM slices "
+                                   "WHERE timeBegin = ? AND timeEnd = ? "
+                                   "AND addrBegin = ? AND addrEnd = ?");
+    isOpen = true;
+}
+
+
+void
+SliceDiskCache::Close()
+{
+    wxCriticalSectionLocker locker(lock);
+
+    if (!isOpen)
+        return;
+
+    FlushLocked();
+
+    delete cmd_load;
+    cmd_load = NULL;
+    db.close();
+    isOpen = false;
+}
+
+
+void
+SliceDiskCache::InitDB()
+{
+    // Assumes lock is already locked.
+
+    // Like the index, this can be regenerated at any time.
+    db.executenonquery("PRAGMA journal_mode = OFF");
+    db.executenonquery("PRAGMA synchronous = OFF");
+    db.executenonquery("PRAGMA legacy_file_format = OFF");
+
+    db.executenonquery("CREATE TABLE IF NOT EXISTS cacheInfo (name, mtime, version)");
+
+    db.executenonquery("CREATE TABLE IF NOT EXISTS slices ("
+                       "timeBegin INTEGER,"
+                       "timeEnd INTEGER,"
+                       "addrBegin INTEGER,"
+                       "addrEnd INTEGER,"
+                       "slice BLOB,"
+                       "PRIMARY KEY (timeBegin, timeEnd, addrBegin, addrEnd)"
+                       ")");
+}
+
+
+bool
+SliceDiskCache::CheckInfo(const wxString &logName, sqlite3x::int64_t logMtime)
+{
+    // Assumes lock is already locked.
+
+    sqlite3_command cmd(db, "SELECT * FROM cacheInfo");
+    sqlite3_cursor reader = cmd.executecursor();
+
+    if (!reader.step() || reader.colcount() < 3)
+        return false;
+
+    wxString name(reader.getstring(0).c_str(), wxConvUTF8);
+    sqlite3x::int64_t mtime = reader.getint64(1);
+    int version = reader.getint(2);
+
+    return (name == logName &&
+            mtime == logMtime &&
+            version == FORMAT_VERSION);
+}
+
+
+bool
+SliceDiskCache::Load(const SliceKey &key, SliceRenderer::SliceValue &value)
+{
+    if (!isOpen)
+        return false;
+
+    wxCriticalSectionLocker locker(lock);
+
+    if (!isOpen)
+        return false;
+
+    cmd_load->bind(1, (sqlite3x::int64_t) key.begin);
+    cmd_load->bind(2, (sqlite3x::int64_t) key.end);
+    cmd_load->bind(3, (sqlite3x::int64_t) key.addrBegin);
+    cmd_load->bind(4, (sqlite3x::int64_t) key.addrEnd);
+
+    sqlite3_cursor crsr = cmd_load->executecursor();
+    if (!crsr.step())
+        return false;
+
+    int size;
+    const uint8_t *blob = (const uint8_t*) crsr.getblob(0, size);
+    return Decode(blob, size, value);
+}
+
+
+void
+SliceDiskCache::Store(const SliceKey &key, const SliceRenderer::SliceValue &value)
+{
+    if (!isOpen)
+        return;
+
+    PendingSlice slice;
+    slice.key = key;
+    Encode(value, slice.blob);
+
+    wxCriticalSectionLocker locker(lock);
+
+    if (!isOpen)
+        return;
+
+    pending.push_back(slice);
+    if (pending.size() >= FLUSH_COUNT)
+        FlushLocked();
+}
+
+
+void
+SliceDiskCache::Flush()
+{
+    wxCriticalSectionLocker locker(lock);
+
+    if (isOpen)
+        FlushLocked();
+}
+
+
+void
+SliceDiskCache::FlushLocked()
+{
+    // Assumes lock is already locked.
+
+    if (pending.empty())
+        return;
+
+    sqlite3_transaction transaction(db);
+    sqlite3_command cmd(db, "INSERT OR REPLACE INTO slices VALUES(?,?,?,?,?)");
+
+    for (std::vector<PendingSlice>::iterator i = pending.begin(); i != pending.end(); i++) {
+        cmd.bind(1, (sqlite3x::int64_t) i->key.begin);
+        cmd.bind(2, (sqlite3x::int64_t) i->key.end);
+        cmd.bind(3, (sqlite3x::int64_t) i->key.addrBegin);
+        cmd.bind(4, (sqlite3x::int64_t) i->key.addrEnd);
+        cmd.bind(5, i->blob.data(), i->blob.size());
+        cmd.executenonquery();
+    }
+
+    transaction.commit();
+    pending.clear();
+}
+
+
+/*
+ * Slices are mostly long runs of background color, so we store the
+ * pixels run-length encoded, as pairs of varints: a run length and a
+ * color. The bandwidths are stored first, as raw doubles.
+ */
+
+void
+SliceDiskCache::Encode(const SliceRenderer::SliceValue &value, std::string &blob)
+{
+    static const int HEADER_SIZE = 3 * sizeof(double);
+    uint8_t buffer[HEADER_SIZE + SliceRenderer::SLICE_HEIGHT * 2 * 9];
+    uint8_t *p = buffer;
+
+    memcpy(p, &value.readBandwidth, sizeof(double));
+    p += sizeof(double);
+    memcpy(p, &value.writeBandwidth, sizeof(double));
+    p += sizeof(double);
+    memcpy(p, &value.zeroBandwidth, sizeof(double));
+    p += sizeof(double);
+
+    int y = 0;
+    while (y < SliceRenderer::SLICE_HEIGHT) {
+        uint32_t color = value.pixels[y].value;
+        int run = 1;
+
+        while (y + run < SliceRenderer::SLICE_HEIGHT &&
+               value.pixels[y + run].value == color)
+            run++;
+
+        varint::write(run, p);
+        p += varint::len(run);
+        varint::write(color, p);
+        p += varint::len(color);
+
+        y += run;
+    }
+
+    blob.assign((const char*) buffer, p - buffer);
+}
+
+
+bool
+SliceDiskCache::Decode(const uint8_t *blob, int size, SliceRenderer::SliceValue &value)
+{
+    static const int HEADER_SIZE = 3 * sizeof(double);
+    const uint8_t *fence = blob + size;
+
+    if (size < HEADER_SIZE)
+        return false;
+
+    memcpy(&value.readBandwidth, blob, sizeof(double));
+    memcpy(&value.writeBandwidth, blob + sizeof(double), sizeof(double));
+    memcpy(&value.zeroBandwidth, blob + 2 * sizeof(double), sizeof(double));
+    blob += HEADER_SIZE;
+
+    int y = 0;
+    while (y < SliceRenderer::SLICE_HEIGHT) {
+        varint::varint_t run = varint::read(blob, fence);
+        varint::varint_t color = varint::read(blob, fence);
+
+        if (run > varint::MAX || color > varint::MAX ||
+            run == 0 || run > (varint::varint_t)(SliceRenderer::SLICE_HEIGHT - y))
+            return false;
+
+        for (int i = 0; i < (int)run; i++)
+            value.pixels[y++] = (uint32_t) color;
+    }
+
+    return blob == fence;
+}
@@ -0,0 +1,94 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * slice_disk_cache.h -- Persistent storage for rendered timeline slices.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __SLICE_DISK_CACHE_H
+#define __SLICE_DISK_CACHE_H
+
+#include <wx/thread.h>
+#include <string>
+#include <vector>
+
+#include "sqlite3x.h"
+#include "log_index.h"
+#include "slice_renderer.h"
+
+
+/*
+ * Once a log's index is COMPLETE, the log and the index never change,
+ * and neither does any slice rendered from them. The SliceDiskCache
+ * keeps those slices in a small database next to the index (with a
+ * ".slices" extension, in THD_INDEX_CACHE if that's where the index
+ * is), keyed by their time and address ranges, so
+ * reopening a log doesn't have to render everything all over again.
+ *
+ * Like the index, the cache remembers which log it belongs to, and
+ * it's thrown away if the log changes or if FORMAT_VERSION doesn't
+ * match. Bump FORMAT_VERSION whenever the SliceRenderer starts
+ * drawing slices differently.
+ *
+ * New slices are written in batches. All methods are thread-safe,
+ * and Load() and Store() do nothing until Open() is called.
+ */
+
+class SliceDiskCache {
+public:
+    SliceDiskCache();
+    ~SliceDiskCache();
+
+    // Only open the cache for a COMPLETE index.
+    void Open(LogIndex *index);
+    void Close();
+    bool IsOpen() { return isOpen; }
+
+    bool Load(const SliceKey &key, SliceRenderer::SliceValue &value);
+    void Store(const SliceKey &key, const SliceRenderer::SliceValue &value);
+
+    // Write out any slices that are waiting for a batch to fill up.
+    void Flush();
+
+private:
+    static const int FORMAT_VERSION = 2;
+    static const int FLUSH_COUNT = 256;
+
+    struct PendingSlice {
+        SliceKey key;
+        std::string blob;
+    };
+
+    void InitDB();
+    bool CheckInfo(const wxString &logName, sqlite3x::int64_t logMtime);
+    void FlushLocked();
+
+    static void Encode(const SliceRenderer::SliceValue &value, std::string &blob);
+    static bool Decode(const uint8_t *blob, int size, SliceRenderer::SliceValue &value);
+
+    wxCriticalSection lock;     // Protects everything below
+    volatile bool isOpen;
+    sqlite3x::sqlite3_connection db;
+    sqlite3x::sqlite3_command *cmd_load;
+    std::vector<PendingSlice> pending;
+};
+
+#endif /* __SLICE_DISK_CACHE_H */
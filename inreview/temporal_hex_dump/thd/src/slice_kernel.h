@@ -0,0 +1,207 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * slice_kernel.h -- Inner loops for turning strata totals into timeline slices.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __SLICE_KERNEL_H
+#define __SLICE_KERNEL_H
+
+#include <stdint.h>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "color_rgb.h"
+
+
+/*
+ * The per-slice arithmetic behind THDTimeline, kept apart from
+ * LogIndex and the widget so it can be benchmarked on its own.
+ *
+ * Strata totals are passed as raw, contiguous arrays. sumRows()
+ * subtracts and reduces all three totals in a single pass over each
+ * pixel row's range of strata, two strata at a time with SSE2 where
+ * it's available. colorRows() then blends every row's color as a
+ * batch, in a form the compiler can vectorize.
+ */
+
+struct SliceKernel {
+    struct Strata {
+        const uint64_t *read;
+        const uint64_t *write;
+        const uint64_t *zero;
+    };
+
+    struct Totals {
+        uint64_t read;
+        uint64_t write;
+        uint64_t zero;
+    };
+
+    /*
+     * For each of 'numRows' rows, add up (end - begin) over strata
+     * rowBounds[r] through rowBounds[r+1] - 1, storing the results
+     * in 'rows'. If 'begin' is NULL, 'end' is used as-is. Returns the
+     * totals over every row.
+     */
+    static Totals sumRows(const Strata &end, const Strata *begin,
+                          const int *rowBounds, int numRows, Totals *rows)
+    {
+        Totals all = { 0, 0, 0 };
+
+        for (int r = 0; r < numRows; r++) {
+            if (begin)
+                rows[r] = sumRange<true>(end, *begin, rowBounds[r], rowBounds[r+1]);
+            else
+                rows[r] = sumRange<false>(end, end, rowBounds[r], rowBounds[r+1]);
+
+            all.read += rows[r].read;
+            all.write += rows[r].write;
+            all.zero += rows[r].zero;
+        }
+
+        return all;
+    }
+
+    /*
+     * Color each row according to its mix of reads, writes, and zero
+     * writes. Rows with no activity get 'background'. The result is
+     * identical to blending with ColorRGB's saturating operators.
+     */
+    static void colorRows(const Totals *rows, int numRows, ColorRGB *pixels,
+                          ColorRGB background, ColorRGB read,
+                          ColorRGB write, ColorRGB zero)
+    {
+        /*
+         * Most rows are usually idle, so first gather the active ones
+         * into a batch. The remaining stages run over plain arrays, one
+         * at a time, so that the division, multiplies, and truncation
+         * all vectorize.
+         */
+
+        static const int BATCH = 64;
+        int index[BATCH];
+        double readD[BATCH], writeD[BATCH], zeroD[BATCH], totalD[BATCH];
+        float readAlpha[BATCH], writeAlpha[BATCH], zeroAlpha[BATCH];
+
+        int row = 0;
+        while (row < numRows) {
+            int count = 0;
+
+            for (; row < numRows && count < BATCH; row++) {
+                const Totals &t = rows[row];
+
+                if (!(t.read | t.write | t.zero)) {
+                    pixels[row] = background;
+                    continue;
+                }
+
+                index[count] = row;
+                readD[count] = t.read;
+                writeD[count] = t.write - t.zero;
+                zeroD[count] = t.zero;
+                totalD[count] = t.read + t.write;
+                count++;
+            }
+
+            for (int i = 0; i < count; i++) {
+                readAlpha[i] = readD[i] / totalD[i];
+                writeAlpha[i] = writeD[i] / totalD[i];
+                zeroAlpha[i] = zeroD[i] / totalD[i];
+            }
+
+            for (int i = 0; i < count; i++) {
+                uint32_t r = blendChannel(readAlpha[i], writeAlpha[i], zeroAlpha[i],
+                                          read.red(), write.red(), zero.red());
+                uint32_t g = blendChannel(readAlpha[i], writeAlpha[i], zeroAlpha[i],
+                                          read.green(), write.green(), zero.green());
+                uint32_t b = blendChannel(readAlpha[i], writeAlpha[i], zeroAlpha[i],
+                                          read.blue(), write.blue(), zero.blue());
+                pixels[index[i]] = (r << 16) | (g << 8) | b;
+            }
+        }
+    }
+
+private:
+    template <bool subtract>
+    static Totals sumRange(const Strata &end, const Strata &begin, int first, int last)
+    {
+        Totals t = { 0, 0, 0 };
+        int s = first;
+
+#ifdef __SSE2__
+        if (last - first >= 2) {
+            __m128i r = _mm_setzero_si128();
+            __m128i w = _mm_setzero_si128();
+            __m128i z = _mm_setzero_si128();
+
+            for (; s + 2 <= last; s += 2) {
+                __m128i er = _mm_loadu_si128((const __m128i *)(end.read + s));
+                __m128i ew = _mm_loadu_si128((const __m128i *)(end.write + s));
+                __m128i ez = _mm_loadu_si128((const __m128i *)(end.zero + s));
+
+                if (subtract) {
+                    er = _mm_sub_epi64(er, _mm_loadu_si128((const __m128i *)(begin.read + s)));
+                    ew = _mm_sub_epi64(ew, _mm_loadu_si128((const __m128i *)(begin.write + s)));
+                    ez = _mm_sub_epi64(ez, _mm_loadu_si128((const __m128i *)(begin.zero + s)));
+                }
+
+                r = _mm_add_epi64(r, er);
+                w = _mm_add_epi64(w, ew);
+                z = _mm_add_epi64(z, ez);
+            }
+
+            uint64_t lanes[2];
+            _mm_storeu_si128((__m128i *)lanes, r);
+            t.read = lanes[0] + lanes[1];
+            _mm_storeu_si128((__m128i *)lanes, w);
+            t.write = lanes[0] + lanes[1];
+            _mm_storeu_si128((__m128i *)lanes, z);
+            t.zero = lanes[0] + lanes[1];
+        }
+#endif
+
+        for (; s < last; s++) {
+            t.read += end.read[s] - (subtract ? begin.read[s] : 0);
+            t.write += end.write[s] - (subtract ? begin.write[s] : 0);
+            t.zero += end.zero[s] - (subtract ? begin.zero[s] : 0);
+        }
+
+        return t;
+    }
+
+    /*
+     * Matches (ColorRGB(read) * readAlpha) + (ColorRGB(write) * writeAlpha)
+     * + (ColorRGB(zero) * zeroAlpha) for one channel: each product
+     * truncates toward zero, and the sum saturates.
+     */
+    static uint32_t blendChannel(float ra, float wa, float za, int rc, int wc, int zc)
+    {
+        int sum = (int)(ra * rc) + (int)(wa * wc) + (int)(za * zc);
+        return std::min(255, sum);
+    }
+};
+
+#endif /* __SLICE_KERNEL_H */
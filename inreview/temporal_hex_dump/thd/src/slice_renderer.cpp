@@ -0,0 +1,403 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * slice_renderer.cpp -- Draws timeline slices from a LogIndex, independent
+ *                     of any widget.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include "slice_renderer.h"
+
+
+bool operator == (SliceKey const &a, SliceKey const &b)
+{
+    return (a.begin == b.begin && a.end == b.end &&
+            a.addrBegin == b.addrBegin && a.addrEnd == b.addrEnd);
+}
+
+std::size_t hash_value(SliceKey const &k)
+{
+    std::size_t seed = 0;
+    boost::hash_combine(seed, k.begin);
+    boost::hash_combine(seed, k.end);
+    boost::hash_combine(seed, k.addrBegin);
+    boost::hash_combine(seed, k.addrEnd);
+    return seed;
+}
+
+
+SliceKey
+SliceRenderer::getSliceKeyForSubpixel(ClockType origin, ClockType scale,
+                                      AddressType addrBegin, AddressType addrEnd,
+                                      int x, int subpix)
+{
+    ClockType clk = origin + scale * x;
+    clk <<= SUBPIXEL_SHIFT;
+    clk += scale * subpix;
+    SliceKey key = { clk >> SUBPIXEL_SHIFT, (clk + scale) >> SUBPIXEL_SHIFT,
+                     addrBegin, addrEnd };
+    return key;
+}
+
+
+BucketWindow
+SliceRenderer::getBucketWindow(const SliceKey &key)
+{
+    int64_t addrEnd = std::min<int64_t>(key.addrEnd, index->GetMemSize());
+    BucketWindow w;
+
+    for (w.level = 0; w.level < LogIndex::SPATIAL_LEVELS; w.level++) {
+        int shift = LogIndex::GetBucketShift(w.level);
+
+        w.first = key.addrBegin >> shift;
+        w.count = ((addrEnd + (1 << shift) - 1) >> shift) - w.first;
+
+        if (w.count >= SLICE_STRATA_ROWS)
+            break;
+    }
+
+    // Even the finest level is too coarse. Let some rows go empty.
+    w.level = std::min(w.level, LogIndex::SPATIAL_LEVELS - 1);
+    return w;
+}
+
+
+BucketRange
+SliceRenderer::getBucketRangeForPixel(const SliceKey &key, int y)
+{
+    BucketWindow w = getBucketWindow(key);
+    y -= SLICE_STRATA_TOP;
+
+    BucketRange range;
+
+    range.begin = w.first + ((int64_t)y * w.count + SLICE_STRATA_ROWS/2) / SLICE_STRATA_ROWS;
+    range.end = w.first + ((int64_t)(y+1) * w.count + SLICE_STRATA_ROWS/2) / SLICE_STRATA_ROWS;
+
+    return range;
+}
+
+
+AddressType
+SliceRenderer::getAddressForPixel(const SliceKey &key, int y)
+{
+    BucketWindow w = getBucketWindow(key);
+    return getBucketRangeForPixel(key, y).begin << LogIndex::GetBucketShift(w.level);
+}
+
+
+int
+SliceRenderer::getPixelForAddress(const SliceKey &key, AddressType addr)
+{
+    BucketWindow w = getBucketWindow(key);
+    int64_t bucket = addr >> LogIndex::GetBucketShift(w.level);
+
+    return (bucket - w.first) * SLICE_STRATA_ROWS / w.count + SLICE_STRATA_TOP;
+}
+
+
+void
+SliceRenderer::generate(SliceKey &key, SliceValue &value)
+{
+    /*
+     * Retrieve cached LogInstants for the beginning and end of this slice.
+     */
+
+    // Allowable deviation from correct begin/end timestamps
+    ClockType fuzz = (key.end - key.begin) >> 2;
+
+    /*
+     * Zoomed far enough out, the strata pyramid has tiles that fit
+     * within our fuzz. Summing a few of those is much cheaper than
+     * finding two instants, which may mean reading the log.
+     */
+
+    int level = LogIndex::GetTileLevelForDistance(fuzz);
+    if (level >= 0 && index->GetState() == LogIndex::COMPLETE) {
+        renderFromPyramid(key, level, value);
+        return;
+    }
+
+    instantPtr_t begin = index->GetInstant(key.begin, fuzz);
+    instantPtr_t end = index->GetInstant(key.end, fuzz);
+
+    render(key, begin, end, value);
+}
+
+
+void
+SliceRenderer::renderFromPyramid(SliceKey &key, int level, SliceValue &value)
+{
+    /*
+     * Round both ends of the slice to the nearest tile boundary at
+     * 'level', and add up all tiles in between.
+     */
+
+    ClockType tileSize = LogIndex::GetTileSize(level);
+    ClockType duration = index->GetDuration();
+
+    int64_t first = (key.begin + tileSize / 2) / tileSize;
+    int64_t last = (key.end + tileSize / 2) / tileSize;
+
+    ClockType timeDiff = (std::min<ClockType>(last * tileSize, duration) -
+                          std::min<ClockType>(first * tileSize, duration));
+
+    BucketWindow w = getBucketWindow(key);
+
+    if (w.level == 0) {
+        StrataTile totals(index->GetNumStrata());
+        for (int64_t i = first; i < last; i++)
+            totals.add(*index->GetStrataTile(level, i));
+
+        render(key, totals, timeDiff, value);
+
+    } else {
+        // Finer buckets are only stored for level 0 tiles.
+
+        BucketTotals totals(w.level, w.first, w.count);
+        index->GetBucketsFromTiles(first << level, last << level, totals);
+
+        render(key, totals, timeDiff, value);
+    }
+}
+
+
+void
+SliceRenderer::render(const SliceKey &key, instantPtr_t begin, instantPtr_t end,
+                      SliceValue &value)
+{
+    /*
+     * Draw one slice, given the LogInstants at its beginning and end.
+     * At the strata level, the kernel subtracts the running totals as
+     * it goes. Below that, the instants only hold strata totals, so
+     * count the transfers in between.
+     *
+     * Instants from different segments (or a segment and the index)
+     * can't be subtracted until the indexer has rebased the segment,
+     * so until then the slice is empty.
+     */
+
+    if (begin->segment != end->segment)
+        begin = end;
+
+    BucketWindow w = getBucketWindow(key);
+
+    if (w.level > 0) {
+        BucketTotals totals(w.level, w.first, w.count);
+        index->GetBuckets(begin, end, totals);
+
+        render(key, totals, end->time - begin->time, value);
+        return;
+    }
+
+    SliceKernel::Strata e = { end->readTotals.getArray(),
+                              end->writeTotals.getArray(),
+                              end->zeroTotals.getArray() };
+    SliceKernel::Strata b = { begin->readTotals.getArray(),
+                              begin->writeTotals.getArray(),
+                              begin->zeroTotals.getArray() };
+
+    render(key, e, &b, 0, end->time - begin->time, value);
+}
+
+
+void
+SliceRenderer::render(const SliceKey &key, StrataTile &totals, ClockType timeDiff,
+                      SliceValue &value)
+{
+    /*
+     * Draw one slice, given the strata totals for the transfers
+     * within it and the number of clock cycles it spans.
+     */
+
+    SliceKernel::Strata t = { totals.readTotals.getArray(),
+                              totals.writeTotals.getArray(),
+                              totals.zeroTotals.getArray() };
+
+    render(key, t, NULL, 0, timeDiff, value);
+}
+
+
+void
+SliceRenderer::render(const SliceKey &key, BucketTotals &totals, ClockType timeDiff,
+                      SliceValue &value)
+{
+    /*
+     * Draw one slice from fine bucket totals. These only cover the
+     * buckets in the key's window.
+     */
+
+    SliceKernel::Strata t = { totals.readTotals.getArray(),
+                              totals.writeTotals.getArray(),
+                              totals.zeroTotals.getArray() };
+
+    render(key, t, NULL, totals.first, timeDiff, value);
+}
+
+
+void
+SliceRenderer::render(const SliceKey &key, const SliceKernel::Strata &end,
+                      const SliceKernel::Strata *begin, int64_t arrayFirst,
+                      ClockType timeDiff, SliceValue &value)
+{
+    /*
+     * Rescale the visible buckets to fit in the available pixels. The
+     * pixel rows partition the buckets, so the same pass also gives
+     * us the totals for the bandwidth graph. When we're zoomed in
+     * vertically, that graph only counts the visible addresses.
+     */
+
+    static const int STRATA_ROWS = SLICE_STRATA_ROWS;
+
+    BucketWindow w = getBucketWindow(key);
+    int64_t offset = w.first - arrayFirst;
+
+    int rowBounds[STRATA_ROWS + 1];
+    for (int row = 0; row <= STRATA_ROWS; row++)
+        rowBounds[row] = offset + ((int64_t)row * w.count + STRATA_ROWS/2) / STRATA_ROWS;
+
+    SliceKernel::Totals rows[STRATA_ROWS];
+    SliceKernel::Totals all = SliceKernel::sumRows(end, begin, rowBounds,
+                                                   STRATA_ROWS, rows);
+
+    int y;
+    for (y = 0; y < SLICE_STRATA_TOP; y++)
+        value.pixels[y] = COLOR_BG_TOP;
+
+    /*
+     * If anything at all is happening in a pixel, we want it to be
+     * obvious- so use a color that stands out against a white
+     * background. But we'll shift the color to indicate how much of
+     * the transfer within this pixel is made up of reads, writes, or
+     * zero writes.
+     */
+
+    SliceKernel::colorRows(rows, STRATA_ROWS, value.pixels + y,
+                           COLOR_BG_TOP, COLOR_READ, COLOR_WRITE, COLOR_ZERO);
+    y += STRATA_ROWS;
+
+    for (; y < SLICE_BANDWIDTH_TOP; y++)
+        value.pixels[y] = COLOR_BG_TOP;
+
+    /*
+     * Calculate and graph the bandwidth in this slice, as a stacked
+     * graph showing read/write/zero bandwidth.
+     */
+
+    value.readBandwidth = timeDiff ? all.read / (double)timeDiff : 0;
+    value.writeBandwidth = timeDiff ? all.write / (double)timeDiff : 0;
+    value.zeroBandwidth = timeDiff ? all.zero / (double)timeDiff : 0;
+
+    const double vScale = (SLICE_BANDWIDTH_BOTTOM - SLICE_BANDWIDTH_TOP) * -0.5;
+    int origin = SLICE_BANDWIDTH_BOTTOM;
+    int rH = origin + value.readBandwidth * vScale + 0.5;
+    int rwH = origin + (value.readBandwidth +
+                        value.writeBandwidth -
+                        value.zeroBandwidth) * vScale + 0.5;
+    int rwzH = origin + (value.readBandwidth +
+                         value.writeBandwidth) * vScale + 0.5;
+
+    for (; y < rwzH; y++)
+        value.pixels[y] = COLOR_BG_BOTTOM;
+    for (; y < rwH; y++)
+        value.pixels[y] = COLOR_ZERO;
+    for (; y < rH; y++)
+        value.pixels[y] = COLOR_WRITE;
+    for (; y < origin; y++)
+        value.pixels[y] = COLOR_READ;
+}
+
+
+void
+SliceRenderer::composite(SliceValue *slices[], bool grid, ColorRGB *column)
+{
+    ColorAccumulator acc[SLICE_HEIGHT];
+
+    for (int s = 0; s < SUBPIXEL_COUNT; s++)
+        for (int y = 0; y < SLICE_HEIGHT; y++)
+            acc[y] += slices[s]->pixels[y];
+
+    for (int y = 0; y < SLICE_HEIGHT; y++) {
+        ColorAccumulator a = acc[y];
+        a >>= SUBPIXEL_SHIFT;
+        ColorRGB c(a);
+
+        /*
+         * Edge emphasis:
+         *
+         * Our transfers are plotted as instantaneous events, so
+         * as you zoom into a single transfer, it gets very light
+         * and hard to see. We'd like to make individual transfers
+         * very visible, but to still preserve the visual
+         * intensity distinctions that arise from our
+         * supersampling and blending.
+         *
+         * This is a simple algorithm that tries to accomplish
+         * that goal:
+         *
+         *   - Any edge pixel (non-background color, bordered on either
+         *     side by background) is emphasized using ColorRGB::increaseContrast().
+         *     This can saturate the color and lose intensity precision, but it
+         *     makes the pixel easy to see.
+         *
+         *   - An edge pixel's original pre-emphasis color will
+         *     'bleed' onto the neighbouring background
+         *     pixel(s). This makes the pixel easier to see still,
+         *     plus it restores some of the lost intensity
+         *     resolution, since very intense original pixels will
+         *     now be even darker, whereas very light original
+         *     pixels will see little effect from the color bleed.
+         */
+        {
+            static const float EMPHASIS = 4.0f;
+
+            ColorAccumulator above = acc[std::max(0,y-1)];
+            ColorAccumulator below = acc[std::min(SLICE_HEIGHT-1,y+1)];
+
+            above >>= SUBPIXEL_SHIFT;
+            below >>= SUBPIXEL_SHIFT;
+
+            ColorRGB ca(above);
+            ColorRGB cb(below);
+
+            if (c.value == COLOR_BG_TOP) {
+                // This is a background pixel
+
+                if (ca.value != COLOR_BG_TOP) {
+                    // Bleed color from the pixel above
+                    c = ca;
+                } else if (cb.value != COLOR_BG_TOP) {
+                    // Bleed color from the pixel below
+                    c = cb;
+                }
+            } else if (ca.value == COLOR_BG_TOP || cb.value == COLOR_BG_TOP) {
+                // This pixel is an edge. Emphasize it.
+                c = c.increaseContrast(COLOR_BG_TOP, EMPHASIS);
+            }
+        }
+
+        // Draw grid lines
+        if (grid)
+            c = c.blend(COLOR_GRID);
+
+        column[y] = c;
+    }
+}
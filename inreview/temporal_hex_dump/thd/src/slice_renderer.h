@@ -0,0 +1,181 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * slice_renderer.h -- Draws timeline slices from a LogIndex, independent
+ *                     of any widget.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __SLICE_RENDERER_H
+#define __SLICE_RENDERER_H
+
+#include "log_index.h"
+#include "color_rgb.h"
+#include "slice_kernel.h"
+
+
+/*
+ * Support for hashable slice keys, used in the slice cache. A slice
+ * covers a range of time, and the range of addresses from addrBegin
+ * up to (but not including) addrEnd.
+ */
+
+struct SliceKey {
+    ClockType begin;
+    ClockType end;
+    AddressType addrBegin;
+    AddressType addrEnd;
+
+    ClockType getCenter()
+    {
+        return (begin + end) >> 1;
+    }
+};
+
+bool operator == (SliceKey const &a, SliceKey const &b);
+std::size_t hash_value(SliceKey const &k);
+
+
+/*
+ * The buckets drawn in the strata rows of a slice: 'count' buckets at
+ * one level of the LogIndex spatial hierarchy, starting with 'first'.
+ */
+
+struct BucketWindow {
+    int level;
+    int64_t first;
+    int count;
+};
+
+
+/*
+ * The range of buckets represented by each vertical pixel
+ */
+
+struct BucketRange {
+    int64_t begin;
+    int64_t end;
+};
+
+
+/*
+ * The SliceRenderer turns a time range of the log into one column of
+ * timeline pixels. It owns the slice layout and color scheme, and
+ * keeps no other state, so any number of threads may share one.
+ *
+ * THDTimeline uses it to fill its slice cache, and thd-render uses it
+ * to draw whole timelines without a GUI.
+ */
+
+class SliceRenderer {
+public:
+    static const int SLICE_HEIGHT = 256;
+
+    // Horizontal supersampling
+    static const int SUBPIXEL_SHIFT = 2;
+    static const int SUBPIXEL_COUNT = 1 << SUBPIXEL_SHIFT;
+
+    // Vertical positions within a slice. Might want to make these dynamic later.
+    static const int SLICE_STRATA_TOP       = 1;
+    static const int SLICE_STRATA_BOTTOM    = 192;
+    static const int SLICE_BANDWIDTH_TOP    = 193;
+    static const int SLICE_BANDWIDTH_BOTTOM = 255;
+    static const int SLICE_STRATA_ROWS      = SLICE_STRATA_BOTTOM - SLICE_STRATA_TOP;
+
+    // Smallest address range worth zooming into: one LogBlock per row
+    static const int MIN_ADDRESS_SPAN = SLICE_STRATA_ROWS << LogBlock::SHIFT;
+
+    // Slice color scheme
+    static const int COLOR_BG_TOP     =   0xffffff;
+    static const int COLOR_BG_BOTTOM  =   0xcccccc;
+    static const int COLOR_READ       =   0x2d7db3;
+    static const int COLOR_WRITE      =   0xcb0c29;
+    static const int COLOR_ZERO       =   0xc57d0c;
+    static const int COLOR_GRID       = 0x44888888;
+
+    struct SliceValue {
+        // Unique ID for this cached slice
+        uint32_t cookie;
+
+        // Calculated bandwidths
+        double readBandwidth;
+        double writeBandwidth;
+        double zeroBandwidth;
+
+        // Slice image, without supersampling or emphasis
+        ColorRGB pixels[SLICE_HEIGHT];
+    };
+
+    SliceRenderer(LogIndex *_index) : index(_index) {}
+
+    /*
+     * Key for subpixel 'subpix' of pixel column 'x', in a view that
+     * starts at 'origin' and spans 'scale' clock cycles per pixel,
+     * showing addresses 'addrBegin' through 'addrEnd' - 1.
+     */
+    static SliceKey getSliceKeyForSubpixel(ClockType origin, ClockType scale,
+                                           AddressType addrBegin, AddressType addrEnd,
+                                           int x, int subpix);
+
+    /*
+     * Vertical layout. The strata rows are drawn from the coarsest
+     * level of the index's spatial hierarchy that still has at least
+     * one bucket per row in the key's address range, so zooming in
+     * vertically moves from strata down to single blocks. The rows
+     * divide that level's buckets evenly.
+     */
+    BucketWindow getBucketWindow(const SliceKey &key);
+    BucketRange getBucketRangeForPixel(const SliceKey &key, int y);
+    AddressType getAddressForPixel(const SliceKey &key, int y);
+    int getPixelForAddress(const SliceKey &key, AddressType addr);
+
+    // Generate one slice on its own, using the pyramid if we can. Leaves 'cookie' alone.
+    void generate(SliceKey &key, SliceValue &value);
+
+    void renderFromPyramid(SliceKey &key, int level, SliceValue &value);
+    void render(const SliceKey &key, instantPtr_t begin, instantPtr_t end,
+                SliceValue &value);
+    void render(const SliceKey &key, StrataTile &totals, ClockType timeDiff,
+                SliceValue &value);
+    void render(const SliceKey &key, BucketTotals &totals, ClockType timeDiff,
+                SliceValue &value);
+
+    /*
+     * The common part of every render(). Element 0 of the arrays in
+     * 'end' and 'begin' is bucket number 'arrayFirst' at the key's
+     * level.
+     */
+    void render(const SliceKey &key, const SliceKernel::Strata &end,
+                const SliceKernel::Strata *begin, int64_t arrayFirst,
+                ClockType timeDiff, SliceValue &value);
+
+    /*
+     * Combine one pixel's SUBPIXEL_COUNT slices into a finished
+     * column of SLICE_HEIGHT pixels, with edge emphasis and an
+     * optional grid line.
+     */
+    static void composite(SliceValue *slices[], bool grid, ColorRGB *column);
+
+private:
+    LogIndex *index;
+};
+
+#endif /* __SLICE_RENDERER_H */
@@ -0,0 +1,268 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * strata_query.cpp -- Windowed totals and hot regions, from the strata index.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <algorithm>
+#include "strata_query.h"
+#include "trace_event.h"
+#include "varint.h"
+
+const char StrataQuery::COLUMNAR_MAGIC[9] = "THDSTAT1";
+
+
+static bool
+isHotter(const StrataQuery::HotStratum &a, const StrataQuery::HotStratum &b)
+{
+    if (a.bytes != b.bytes)
+        return a.bytes > b.bytes;
+    return a.stratum < b.stratum;
+}
+
+
+void
+StrataQuery::GetWindows(const std::vector<ClockType> &boundaries, std::vector<Window> &windows,
+                        ClockType distance, int numThreads)
+{
+    TraceScope trace("StrataQuery::GetWindows");
+
+    windows.clear();
+    if (boundaries.size() < 2)
+        return;
+
+    std::vector<instantPtr_t> instants;
+    index->GetInstants(boundaries, distance, instants, numThreads);
+
+    windows.assign(boundaries.size() - 1, Window(index->GetNumStrata()));
+
+    for (size_t i = 0; i < windows.size(); i++) {
+        Window &w = windows[i];
+        instantPtr_t begin = instants[i];
+        instantPtr_t end = instants[i + 1];
+
+        /*
+         * Totals from different segments can't be subtracted (see
+         * LogInstant::segment), so leave those windows empty.
+         */
+        if (begin->segment != end->segment)
+            begin = end;
+
+        w.begin = begin->time;
+        w.end = end->time;
+        w.numTransfers = end->transferId - begin->transferId;
+        w.totals.setDifference(*end, *begin);
+        w.workingSet = index->GetWorkingSet(begin, end);
+        Reduce(w);
+    }
+}
+
+
+void
+StrataQuery::GetWindow(ClockType begin, ClockType end, Window &window, ClockType distance)
+{
+    std::vector<ClockType> boundaries;
+    std::vector<Window> windows;
+
+    boundaries.push_back(begin);
+    boundaries.push_back(end);
+    GetWindows(boundaries, windows, distance, 1);
+
+    window = windows[0];
+}
+
+
+void
+StrataQuery::GetEvenWindows(ClockType begin, ClockType end, int count,
+                            std::vector<Window> &windows, ClockType distance,
+                            int numThreads)
+{
+    std::vector<ClockType> boundaries;
+
+    count = std::max(1, count);
+    for (int i = 0; i <= count; i++)
+        boundaries.push_back(begin + (ClockType)((end - begin) * (double)i / count));
+
+    GetWindows(boundaries, windows, distance, numThreads);
+}
+
+
+void
+StrataQuery::Reduce(Window &window)
+{
+    int count = window.totals.readTotals.getCount();
+    const uint64_t *read = window.totals.readTotals.getArray();
+    const uint64_t *write = window.totals.writeTotals.getArray();
+    const uint64_t *zero = window.totals.zeroTotals.getArray();
+    uint64_t readSum = 0, writeSum = 0, zeroSum = 0;
+
+    for (int i = 0; i < count; i++) {
+        readSum += read[i];
+        writeSum += write[i];
+        zeroSum += zero[i];
+    }
+
+    window.readBytes = readSum;
+    window.writeBytes = writeSum;
+    window.zeroBytes = zeroSum;
+}
+
+
+void
+StrataQuery::GetHotStrata(const Window &window, Metric metric, int k,
+                          std::vector<HotStratum> &hot)
+{
+    int count = window.totals.readTotals.getCount();
+    const uint64_t *read = window.totals.readTotals.getArray();
+    const uint64_t *write = window.totals.writeTotals.getArray();
+    const uint64_t *zero = window.totals.zeroTotals.getArray();
+
+    std::vector<uint64_t> score(count);
+
+    switch (metric) {
+    case TOTAL:
+        for (int i = 0; i < count; i++)
+            score[i] = read[i] + write[i];
+        break;
+    case READ:
+        std::copy(read, read + count, score.begin());
+        break;
+    case WRITE:
+        std::copy(write, write + count, score.begin());
+        break;
+    case ZERO:
+        std::copy(zero, zero + count, score.begin());
+        break;
+    }
+
+    // Only the strata with traffic are candidates.
+
+    hot.clear();
+    for (int i = 0; i < count; i++)
+        if (score[i]) {
+            HotStratum h = { i, score[i] };
+            hot.push_back(h);
+        }
+
+    k = std::min<int>(std::max(0, k), hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + k, hot.end(), isHotter);
+    hot.resize(k);
+}
+
+
+bool
+StrataQuery::WriteCSV(FILE *file, const std::vector<Window> &windows)
+{
+    fprintf(file, "window,begin,end,transfers,stratum,firstAddress,lastAddress,"
+            "read,written,zero\n");
+
+    for (size_t w = 0; w < windows.size(); w++) {
+        const Window &window = windows[w];
+        int count = window.totals.readTotals.getCount();
+        const uint64_t *read = window.totals.readTotals.getArray();
+        const uint64_t *write = window.totals.writeTotals.getArray();
+        const uint64_t *zero = window.totals.zeroTotals.getArray();
+
+        for (int s = 0; s < count; s++) {
+            if (!read[s] && !write[s])
+                continue;
+
+            fprintf(file, "%d,%lld,%lld,%lld,%d,0x%08x,0x%08x,%llu,%llu,%llu\n",
+                    (int) w, (long long) window.begin, (long long) window.end,
+                    (long long) window.numTransfers, s,
+                    (unsigned) index->GetStratumFirstAddress(s),
+                    (unsigned) index->GetStratumLastAddress(s),
+                    (unsigned long long) read[s], (unsigned long long) write[s],
+                    (unsigned long long) zero[s]);
+        }
+    }
+
+    return !ferror(file);
+}
+
+
+static void
+putTotals(std::vector<uint8_t> &column, uint64_t &zeroes, const uint64_t *totals, int count)
+{
+    // Add one window's strata to a totals column. See strata_query.h.
+
+    for (int s = 0; s < count; s++) {
+        if (!totals[s]) {
+            zeroes++;
+            continue;
+        }
+        varint::append(zeroes, column);
+        varint::append(totals[s], column);
+        zeroes = 0;
+    }
+}
+
+
+bool
+StrataQuery::WriteColumnar(FILE *file, const std::vector<Window> &windows)
+{
+    std::vector<uint8_t> columns[NUM_COLUMNS];
+    uint64_t zeroes[NUM_COLUMNS] = { 0 };
+    ClockType prevEnd = 0;
+
+    for (size_t w = 0; w < windows.size(); w++) {
+        const Window &window = windows[w];
+        int64_t delta = window.begin - prevEnd;
+        int count = window.totals.readTotals.getCount();
+
+        varint::append(((uint64_t) delta << 1) ^ (uint64_t)(delta >> 63), columns[BEGIN]);
+        varint::append(window.end - window.begin, columns[LENGTH]);
+        varint::append(window.numTransfers, columns[TRANSFERS]);
+        varint::append(llround(window.workingSet.read), columns[WSET]);
+        varint::append(llround(window.workingSet.written), columns[WSET]);
+        varint::append(llround(window.workingSet.touched), columns[WSET]);
+
+        putTotals(columns[READ_TOTALS], zeroes[READ_TOTALS],
+                  window.totals.readTotals.getArray(), count);
+        putTotals(columns[WRITE_TOTALS], zeroes[WRITE_TOTALS],
+                  window.totals.writeTotals.getArray(), count);
+        putTotals(columns[ZERO_TOTALS], zeroes[ZERO_TOTALS],
+                  window.totals.zeroTotals.getArray(), count);
+
+        prevEnd = window.end;
+    }
+
+    for (int c = READ_TOTALS; c <= ZERO_TOTALS; c++)
+        if (zeroes[c])
+            varint::append(zeroes[c], columns[c]);
+
+    std::vector<uint8_t> header(COLUMNAR_MAGIC, COLUMNAR_MAGIC + 8);
+    varint::append(COLUMNAR_VERSION, header);
+    varint::append(index->GetNumStrata(), header);
+    varint::append(index->GetStratumFirstAddress(1), header);
+    varint::append(windows.size(), header);
+    for (int c = 0; c < NUM_COLUMNS; c++)
+        varint::append(columns[c].size(), header);
+
+    fwrite(&header[0], header.size(), 1, file);
+    for (int c = 0; c < NUM_COLUMNS; c++)
+        if (!columns[c].empty())
+            fwrite(&columns[c][0], columns[c].size(), 1, file);
+
+    return !ferror(file);
+}
@@ -0,0 +1,170 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * strata_query.h -- Windowed totals and hot regions, from the strata index.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __STRATA_QUERY_H
+#define __STRATA_QUERY_H
+
+#include <stdio.h>
+#include <vector>
+
+#include "log_index.h"
+
+
+/*
+ * Aggregate queries over the cumulative strata totals in a LogIndex.
+ *
+ * Every LogInstant holds running totals of the bytes read, written,
+ * and written as zero in each stratum since the start of the log. The
+ * totals for any window of time are the difference between the
+ * instants at its ends, so a window costs two instant lookups and one
+ * subtraction per stratum, no matter how long it is. Windows are
+ * looked up in batches with LogIndex::GetInstants(), so a series of
+ * windows shares each boundary and the lookups run in parallel.
+ *
+ * The reductions (sums over all strata, and ranking strata by
+ * traffic) are plain loops over the LogStrata arrays, which the
+ * compiler vectorizes.
+ *
+ * Working set sizes don't subtract like the totals do, so each
+ * window also asks LogIndex::GetWorkingSetSketches() for its own.
+ */
+
+class StrataQuery {
+public:
+    enum Metric {
+        TOTAL,      // Bytes read plus bytes written
+        READ,
+        WRITE,
+        ZERO,       // Bytes written as zero
+    };
+
+    struct Window {
+        Window(int numStrata) : totals(numStrata) {}
+
+        ClockType begin;            // Times of the instants we measured between
+        ClockType end;
+        OffsetType numTransfers;    // Transfers after 'begin', up to and including 'end'
+        StrataTile totals;
+
+        // Sums over all strata
+        uint64_t readBytes;
+        uint64_t writeBytes;
+        uint64_t zeroBytes;
+
+        // Distinct 512-byte blocks, estimated from the working set sketches
+        WorkingSet workingSet;
+    };
+
+    struct HotStratum {
+        int stratum;
+        uint64_t bytes;             // By the ranking metric
+    };
+
+    StrataQuery(LogIndex *_index) : index(_index) {}
+
+    /*
+     * Totals for the windows between consecutive 'boundaries', which
+     * must be in ascending order. N+1 boundaries make N windows. As
+     * with GetInstant(), 'distance' lets each boundary move by that
+     * many clock cycles, which saves reading the log.
+     */
+    void GetWindows(const std::vector<ClockType> &boundaries, std::vector<Window> &windows,
+                    ClockType distance = 0, int numThreads = 0);
+
+    // Just one window.
+    void GetWindow(ClockType begin, ClockType end, Window &window, ClockType distance = 0);
+
+    // Divide [begin, end) into 'count' windows of equal length.
+    void GetEvenWindows(ClockType begin, ClockType end, int count,
+                        std::vector<Window> &windows, ClockType distance = 0,
+                        int numThreads = 0);
+
+    /*
+     * The 'k' strata with the most traffic in a window by 'metric',
+     * busiest first. Strata with none at all are left out, so there
+     * may be fewer than 'k'.
+     */
+    static void GetHotStrata(const Window &window, Metric metric, int k,
+                             std::vector<HotStratum> &hot);
+
+    /*
+     * Write windows as CSV, one row per window and stratum, with a
+     * header row. Strata that weren't touched in a window are left
+     * out. Returns false on a write error.
+     */
+    bool WriteCSV(FILE *file, const std::vector<Window> &windows);
+
+    /*
+     * Write windows in the columnar format below. Returns false on a
+     * write error.
+     */
+    bool WriteColumnar(FILE *file, const std::vector<Window> &windows);
+
+    /*
+     * The columnar format.
+     *
+     * A file is the 8 bytes "THDSTAT1", a header of varints (see
+     * varint.h), and the columns, back to back in column order:
+     *
+     *   Header    version, strata count, bytes per stratum, window
+     *             count, and the encoded size of each of NUM_COLUMNS
+     *             columns
+     *
+     *   BEGIN          zigzag(begin - previous window's end), one
+     *                  per window
+     *   LENGTH         end - begin
+     *   TRANSFERS      numTransfers
+     *   WSET           Working set estimates, rounded to whole blocks:
+     *                  read, written, touched
+     *   READ_TOTALS    Strata totals: every stratum of the first
+     *   WRITE_TOTALS   window, then of the next, and so on, as
+     *   ZERO_TOTALS    varint(zero count), varint(nonzero total),
+     *                  repeated until every stratum of every window
+     *                  is accounted for
+     *
+     * Evenly spaced windows are all a zero and a constant, and the
+     * strata a window didn't touch cost next to nothing.
+     */
+    enum Column {
+        BEGIN,
+        LENGTH,
+        TRANSFERS,
+        WSET,
+        READ_TOTALS,
+        WRITE_TOTALS,
+        ZERO_TOTALS,
+        NUM_COLUMNS,
+    };
+
+    static const uint32_t COLUMNAR_VERSION = 1;
+    static const char COLUMNAR_MAGIC[9];
+
+private:
+    static void Reduce(Window &window);
+
+    LogIndex *index;
+};
+
+#endif /* __STRATA_QUERY_H */
@@ -0,0 +1,544 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * synth_log.cpp -- Generates synthetic memtrace logs, for benchmarks.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "synth_log.h"
+#include "memtrace_fmt.h"
+
+
+SynthLogParams::SynthLogParams()
+    : transfers(1000000),
+      seed(1),
+      memSize(16 * 1024 * 1024),
+      bandwidth(0.25),
+      writeRatio(0.3),
+      locality(0.8),
+      localityRange(4096),
+      meanBurst(8),
+      zeroRatio(0.2),
+      sequential(0),
+      polling(0),
+      syncErrors(0),
+      checksumErrors(0)
+{}
+
+
+/*
+ * A small, fast PRNG (xorshift64*). We don't use rand(), so that a
+ * seed produces the same log on every platform.
+ */
+
+class SynthRandom {
+public:
+    SynthRandom(uint32_t seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+
+    uint32_t below(uint32_t n) {
+        return n ? (uint32_t)((next() >> 32) % n) : 0;
+    }
+
+    double uniform() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    bool chance(double p) {
+        return uniform() < p;
+    }
+
+private:
+    uint64_t state;
+};
+
+
+/*
+ * The raw bytes of one packet under construction.
+ */
+
+struct PacketBits {
+    static const int NUM_BITS = sizeof(MemPacket) * 8;
+
+    PacketBits() {
+        memset(bytes, 0, sizeof bytes);
+    }
+
+    void flip(int bit) {
+        bytes[bit >> 3] ^= 1 << (bit & 7);
+    }
+
+    void flip(const PacketBits &mask) {
+        for (unsigned i = 0; i < sizeof bytes; i++)
+            bytes[i] ^= mask.bytes[i];
+    }
+
+    MemPacket packet() {
+        return MemPacket_FromBytes(bytes);
+    }
+
+    bool isValid() {
+        MemPacket p = packet();
+        return (MemPacket_IsAligned(p) && MemPacket_IsChecksumCorrect(p) &&
+                !MemPacket_IsOverflow(p));
+    }
+
+    uint8_t bytes[sizeof(MemPacket)];
+};
+
+
+/*
+ * Everything the decoder tells us about one packet.
+ */
+
+struct PacketFields {
+    PacketFields(PacketBits &bits) {
+        MemPacket p = bits.packet();
+        type = MemPacket_GetType(p);
+        duration = MemPacket_GetDuration(p);
+        payload = MemPacket_GetPayload(p);
+        word = MemPacket_RW_Word(p);
+        ub = MemPacket_RW_UpperByte(p);
+        lb = MemPacket_RW_LowerByte(p);
+    }
+
+    int type;
+    uint32_t duration;
+    uint32_t payload;
+    uint32_t word;
+    bool ub;
+    bool lb;
+};
+
+
+/*
+ * Encodes packets of one type, using a layout learned from the decoder.
+ *
+ * Learn() starts from a packet of the right type and flips one bit at
+ * a time, to see which bit of which field it controls. Bits that no
+ * field uses hold the sync pattern and the checksum. We search those
+ * for a pattern that makes the all-zero packet valid, then, for each
+ * field bit, for the extra free bits to flip along with it to keep
+ * the packet valid. If the checksum is linear (as XOR and CRC style
+ * checksums are), these fixups combine, and Encode() is a handful of
+ * XORs. Otherwise it falls back to a search for each packet.
+ */
+
+class PacketEncoder {
+public:
+    bool Learn(int type);
+    bool Encode(PacketBits &bits, uint32_t duration, uint32_t payload,
+                uint32_t word, bool ub, bool lb);
+
+    uint32_t MaxDuration() const {
+        return (1 << std::min<int>(durationBits.size(), 16)) - 1;
+    }
+
+private:
+    static const int MAX_SEARCH_BITS = 24;
+
+    bool learnBits(std::vector<int> &bits, uint32_t PacketFields::*field,
+                   PacketFields &before, PacketFields &after, int bit);
+    bool searchFree(PacketBits &bits);
+    bool matches(PacketBits &bits, uint32_t duration, uint32_t payload,
+                 uint32_t word, bool ub, bool lb);
+    bool setField(PacketBits &bits, const std::vector<int> &field, uint32_t value);
+
+    int type;
+    PacketBits base;
+    std::vector<int> durationBits;
+    std::vector<int> payloadBits;
+    std::vector<int> wordBits;
+    std::vector<int> ubBits;
+    std::vector<int> lbBits;
+    std::vector<int> freeBits;
+    std::vector<PacketBits> fixups;
+};
+
+
+bool
+PacketEncoder::Learn(int _type)
+{
+    type = _type;
+
+    // Which bits select the packet type?
+    PacketBits zero;
+    PacketFields zeroFields(zero);
+    std::vector<int> typeBits;
+
+    for (int i = 0; i < PacketBits::NUM_BITS; i++) {
+        PacketBits p = zero;
+        p.flip(i);
+        if (PacketFields(p).type != zeroFields.type)
+            typeBits.push_back(i);
+    }
+
+    if (typeBits.size() > 8)
+        return false;
+
+    bool found = false;
+    for (uint32_t k = 0; k < (1U << typeBits.size()) && !found; k++) {
+        base = zero;
+        for (size_t j = 0; j < typeBits.size(); j++)
+            if (k & (1 << j))
+                base.flip(typeBits[j]);
+        found = PacketFields(base).type == type;
+    }
+    if (!found)
+        return false;
+
+    // Map every other bit to a field bit, or call it free.
+    PacketFields before(base);
+
+    for (int i = 0; i < PacketBits::NUM_BITS; i++) {
+        if (std::find(typeBits.begin(), typeBits.end(), i) != typeBits.end())
+            continue;
+
+        PacketBits p = base;
+        p.flip(i);
+        PacketFields after(p);
+
+        // Leave alone anything that changes the type or flags an overflow
+        if (after.type != type || MemPacket_IsOverflow(p.packet()))
+            continue;
+
+        bool used = false;
+        if (!learnBits(durationBits, &PacketFields::duration, before, after, i) ||
+            !learnBits(payloadBits, &PacketFields::payload, before, after, i) ||
+            !learnBits(wordBits, &PacketFields::word, before, after, i))
+            return false;
+
+        if (after.duration != before.duration || after.payload != before.payload ||
+            after.word != before.word)
+            used = true;
+
+        if (after.ub != before.ub) {
+            ubBits.push_back(i);
+            used = true;
+        }
+        if (after.lb != before.lb) {
+            lbBits.push_back(i);
+            used = true;
+        }
+
+        if (!used)
+            freeBits.push_back(i);
+    }
+
+    // A valid packet with every field zero
+    if (!searchFree(base))
+        return false;
+
+    // The free bits to flip along with each field bit
+    fixups.resize(PacketBits::NUM_BITS);
+    for (int i = 0; i < PacketBits::NUM_BITS; i++) {
+        if (std::find(freeBits.begin(), freeBits.end(), i) != freeBits.end())
+            continue;
+
+        PacketBits p = base;
+        p.flip(i);
+        if (!searchFree(p))
+            continue;
+
+        for (unsigned j = 0; j < sizeof p.bytes; j++)
+            fixups[i].bytes[j] = p.bytes[j] ^ base.bytes[j];
+        fixups[i].flip(i);
+    }
+
+    return true;
+}
+
+
+bool
+PacketEncoder::learnBits(std::vector<int> &bits, uint32_t PacketFields::*field,
+                         PacketFields &before, PacketFields &after, int bit)
+{
+    // Returns false if the bit changes the field in some way other than one bit.
+
+    uint32_t diff = after.*field ^ before.*field;
+    if (!diff)
+        return true;
+    if (diff & (diff - 1))
+        return false;
+
+    int n = 0;
+    while (!(diff & 1)) {
+        diff >>= 1;
+        n++;
+    }
+
+    if ((int)bits.size() <= n)
+        bits.resize(n + 1, -1);
+    bits[n] = bit;
+    return true;
+}
+
+
+bool
+PacketEncoder::searchFree(PacketBits &bits)
+{
+    /*
+     * Try patterns of free bits until the packet is valid. Only
+     * flips free bits, so the fields are left alone. The patterns go
+     * in Gray code order, so each one is a single flip away from the
+     * last.
+     */
+
+    int n = std::min<int>(freeBits.size(), MAX_SEARCH_BITS);
+    PacketBits start = bits;
+
+    if (bits.isValid())
+        return true;
+
+    for (uint32_t k = 1; k < (1U << n); k++) {
+        bits.flip(freeBits[__builtin_ctz(k)]);
+        if (bits.isValid())
+            return true;
+    }
+
+    bits = start;
+    return false;
+}
+
+
+bool
+PacketEncoder::setField(PacketBits &bits, const std::vector<int> &field, uint32_t value)
+{
+    // Returns false if the field has no bit for some bit of 'value'.
+
+    for (size_t i = 0; i < field.size() && value; i++, value >>= 1) {
+        if (value & 1) {
+            if (field[i] < 0)
+                return false;
+            bits.flip(field[i]);
+            bits.flip(fixups[field[i]]);
+        }
+    }
+    return !value;
+}
+
+
+bool
+PacketEncoder::matches(PacketBits &bits, uint32_t duration, uint32_t payload,
+                       uint32_t word, bool ub, bool lb)
+{
+    PacketFields f(bits);
+
+    if (f.type != type || f.duration != duration || !bits.isValid())
+        return false;
+    if (type == MEMPKT_ADDR)
+        return f.payload == payload;
+    return f.word == word && f.ub == ub && f.lb == lb;
+}
+
+
+bool
+PacketEncoder::Encode(PacketBits &bits, uint32_t duration, uint32_t payload,
+                      uint32_t word, bool ub, bool lb)
+{
+    bits = base;
+    bool ok = setField(bits, durationBits, duration);
+
+    if (type == MEMPKT_ADDR) {
+        ok = ok && setField(bits, payloadBits, payload);
+    } else {
+        ok = ok && setField(bits, wordBits, word);
+        ok = ok && setField(bits, ubBits, ub);
+        ok = ok && setField(bits, lbBits, lb);
+    }
+
+    if (!ok)
+        return false;
+    if (matches(bits, duration, payload, word, ub, lb))
+        return true;
+
+    // The fixups didn't combine. Search again for this packet alone.
+    return searchFree(bits) && matches(bits, duration, payload, word, ub, lb);
+}
+
+
+bool
+SynthLog::Write(const char *path)
+{
+    static const char *typeNames[] = { "address", "read", "write" };
+    static const int types[] = { MEMPKT_ADDR, MEMPKT_READ, MEMPKT_WRITE };
+    PacketEncoder encoders[3];
+
+    for (int i = 0; i < 3; i++) {
+        if (!encoders[i].Learn(types[i])) {
+            fprintf(stderr, "synth: Can't work out how to encode %s packets\n",
+                    typeNames[i]);
+            return false;
+        }
+    }
+
+    PacketEncoder &addrEncoder = encoders[0];
+    uint32_t maxDuration = addrEncoder.MaxDuration();
+    uint32_t maxWords = MemTransfer::MAX_LENGTH / 2;
+    uint32_t memWords = params.memSize / 2;
+
+    if (!maxDuration || params.meanBurst < 1 || memWords < maxWords) {
+        fprintf(stderr, "synth: Bad parameters\n");
+        return false;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "synth: Can't open '%s' for writing\n", path);
+        return false;
+    }
+
+    memset(&stats, 0, sizeof stats);
+    SynthRandom rng(params.seed);
+    std::vector<PacketBits> packets;
+    uint32_t lastEnd = 0;
+    bool lastWrite = false;
+
+    bool encoded = true;
+    double burstP = 1.0 / params.meanBurst;
+    double idleRatio = params.bandwidth > 0 ?
+        (1.0 - std::min(1.0, params.bandwidth)) / params.bandwidth : 0;
+
+    for (uint64_t t = 0; t < params.transfers && encoded; t++) {
+        packets.clear();
+
+        // Burst length: geometric, with the requested mean
+        uint32_t words = 1;
+        if (burstP < 1)
+            words += (uint32_t)(log(1.0 - rng.uniform()) / log(1.0 - burstP));
+        words = std::min(words, maxWords);
+
+        // The pattern knobs only draw random numbers when they're on, so old logs stay the same.
+        bool poll = params.polling > 0 && rng.chance(params.polling);
+        bool sequential = !poll && params.sequential > 0 && rng.chance(params.sequential) &&
+            lastEnd <= memWords - words;
+        if (poll)
+            words = 1;
+
+        // Start address, in words
+        uint32_t addr;
+        if (poll) {
+            addr = memWords - 1;
+        } else if (sequential) {
+            addr = lastEnd;
+        } else if (rng.chance(params.locality)) {
+            uint32_t range = std::max<uint32_t>(1, params.localityRange / 2);
+            addr = lastEnd + rng.below(range) - range / 2;
+        } else {
+            addr = rng.below(memWords);
+        }
+        if (addr > memWords - words)
+            addr = rng.below(memWords - words);
+        if (!poll)
+            lastEnd = addr + words;
+
+        /*
+         * Each data packet takes one clock. The idle time before the
+         * next transfer goes on the address packet, as far as its
+         * duration field allows.
+         */
+
+        double idle = -log(1.0 - rng.uniform()) * idleRatio * words;
+        uint32_t addrDuration = std::min<uint32_t>(maxDuration,
+                                                   (uint32_t)(idle + 0.5));
+
+        PacketBits p;
+        encoded = addrEncoder.Encode(p, addrDuration, addr, 0, false, false);
+        packets.push_back(p);
+
+        bool write;
+        if (poll)
+            write = false;
+        else if (sequential)
+            write = lastWrite;
+        else
+            write = rng.chance(params.writeRatio);
+        if (!poll)
+            lastWrite = write;
+        PacketEncoder &dataEncoder = encoders[write ? 2 : 1];
+
+        for (uint32_t w = 0; w < words && encoded; w++) {
+            uint32_t word = rng.next() >> 48;
+            if (write && rng.chance(params.zeroRatio))
+                word = 0;
+
+            encoded = dataEncoder.Encode(p, 1, 0, word, true, true);
+            packets.push_back(p);
+        }
+
+        // Corrupt one packet's fields without fixing its checksum.
+        if (rng.chance(params.checksumErrors)) {
+            PacketBits &victim = packets[rng.below(packets.size())];
+            for (int i = 0; i < PacketBits::NUM_BITS; i++) {
+                PacketBits bad = victim;
+                bad.flip(i);
+                MemPacket bp = bad.packet();
+                if (MemPacket_IsAligned(bp) && !MemPacket_IsOverflow(bp) &&
+                    !MemPacket_IsChecksumCorrect(bp)) {
+                    victim = bad;
+                    stats.checksumErrors++;
+                    break;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < packets.size(); i++)
+            fwrite(packets[i].bytes, sizeof packets[i].bytes, 1, f);
+
+        // Lose sync: a few garbage bytes between transfers.
+        if (rng.chance(params.syncErrors)) {
+            int n = 1 + rng.below(sizeof(MemPacket) - 1);
+            for (int i = 0; i < n; i++)
+                fputc(rng.below(256), f);
+            stats.bytes += n;
+            stats.syncErrors++;
+        }
+
+        stats.transfers++;
+        stats.packets += packets.size();
+        stats.bytes += packets.size() * sizeof(MemPacket);
+        stats.clocks += addrDuration + words;
+    }
+
+    if (!encoded) {
+        fprintf(stderr, "synth: A packet didn't decode back to the same fields\n");
+        fclose(f);
+        return false;
+    }
+
+    if (fclose(f)) {
+        fprintf(stderr, "synth: Error writing '%s'\n", path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * synth_log.h -- Generates synthetic memtrace logs, for benchmarks.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __SYNTH_LOG_H
+#define __SYNTH_LOG_H
+
+#include <stdint.h>
+#include "mem_transfer.h"
+
+
+/*
+ * Shape of the generated traffic. Rates are probabilities, from 0 to 1.
+ */
+
+struct SynthLogParams {
+    SynthLogParams();
+
+    uint64_t transfers;         // Number of transfers to write
+    uint32_t seed;
+    uint32_t memSize;           // Addresses are below this
+    double bandwidth;           // Fraction of clock cycles spent moving data
+    double writeRatio;          // Fraction of transfers that are writes
+    double locality;            // Chance that a transfer starts near the last one
+    uint32_t localityRange;     // ...within this many bytes
+    double meanBurst;           // Mean words per transfer
+    double zeroRatio;           // Fraction of written words that are zero
+    double sequential;          // Chance that a transfer continues the last one, same type
+    double polling;             // Chance of a one-word read of a fixed status address
+    double syncErrors;          // Chance of garbage bytes after a transfer
+    double checksumErrors;      // Chance of one corrupted packet in a transfer
+};
+
+
+struct SynthLogStats {
+    uint64_t transfers;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t syncErrors;
+    uint64_t checksumErrors;
+    ClockType clocks;
+};
+
+
+/*
+ * Writes a log of MemPackets with the traffic described by a
+ * SynthLogParams. The same parameters and seed always produce the
+ * same log.
+ *
+ * Only the decoding half of the packet format is available to THD,
+ * so the generator works out how to encode packets by probing the
+ * decoder. Every packet it writes is decoded again and checked, and
+ * Write() fails rather than writing a log that wouldn't read back.
+ */
+
+class SynthLog {
+public:
+    SynthLog(const SynthLogParams &_params) : params(_params) {}
+
+    // Returns false and prints an error if the log can't be written.
+    bool Write(const char *path);
+
+    SynthLogStats stats;
+
+private:
+    SynthLogParams params;
+};
+
+#endif /* __SYNTH_LOG_H */
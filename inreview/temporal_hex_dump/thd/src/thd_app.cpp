@@ -62,4 +62,19 @@ THDApp::MacOpenFile(const wxString &fileName)
     newFrame->Open(fileName);
 }
 
+int
+THDApp::FilterEvent(wxEvent &event)
+{
+    /*
+     * Any keyboard or mouse input means someone's using THD, so
+     * low-impact indexers should stay out of the way for a while.
+     */
+
+    if (event.IsKindOf(CLASSINFO(wxKeyEvent)) ||
+        event.IsKindOf(CLASSINFO(wxMouseEvent)))
+        LogIndex::NoteUserActivity();
+
+    return -1;
+}
+
 IMPLEMENT_APP(THDApp)
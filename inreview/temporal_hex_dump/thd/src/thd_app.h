@@ -34,6 +34,7 @@ class THDApp : public wxApp {
 public:
     virtual bool OnInit();
     virtual void MacOpenFile(const wxString &fileName);
+    virtual int FilterEvent(wxEvent &event);
 
 private:
     THDMainWindow *frame;
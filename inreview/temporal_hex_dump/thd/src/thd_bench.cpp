@@ -0,0 +1,808 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * thd_bench.cpp -- Command line benchmarks for THD's internal data structures.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <wx/init.h>
+#include <wx/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <vector>
+
+#include "mem_transfer.h"
+#include "lazy_cache.h"
+#include "slice_kernel.h"
+#include "log_reader.h"
+#include "log_index.h"
+#include "slice_renderer.h"
+#include "synth_log.h"
+#include "transfer_filter.h"
+#include "cli_util.h"
+
+
+/*
+ * Wallclock time in microseconds. wxDateTime only has millisecond
+ * resolution, which isn't enough for timing individual frames.
+ */
+static double
+usecNow()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+
+/*
+ * Slice cache churn.
+ *
+ * This mimics what THDTimeline does while the user pans at a steady
+ * rate: Every frame, we look up each subpixel slice in the view. Any
+ * misses go into a WorkQueue, and a fixed number of queued slices are
+ * generated and stored per frame, newest first. The slice keys and
+ * cache geometry match the timeline's, but the slices themselves are
+ * trivial, so this measures only the cache and queue bookkeeping.
+ */
+
+struct BenchSliceKey {
+    ClockType begin;
+    ClockType end;
+};
+
+static bool operator == (BenchSliceKey const &a, BenchSliceKey const &b)
+{
+    return a.begin == b.begin && a.end == b.end;
+}
+
+static std::size_t hash_value(BenchSliceKey const &k)
+{
+    std::size_t seed = 0;
+    boost::hash_combine(seed, k.begin);
+    boost::hash_combine(seed, k.end);
+    return seed;
+}
+
+struct BenchSliceValue {
+    uint32_t cookie;
+    uint32_t pixels[256];
+};
+
+struct BenchSliceGenerator : public CacheGenerator<BenchSliceKey, BenchSliceValue> {
+    BenchSliceGenerator() : nextCookie(0) {}
+
+    virtual void fn(BenchSliceKey &key, BenchSliceValue &value) {
+        value.cookie = nextCookie++;
+        value.pixels[0] = key.begin;
+    }
+
+    uint32_t nextCookie;
+};
+
+class BenchSliceCache : public LRUCache<BenchSliceKey, BenchSliceValue> {
+public:
+    BenchSliceCache(int size, generator_t *generator)
+        : LRUCache<BenchSliceKey, BenchSliceValue>(size, generator)
+    {}
+
+    // Same lookup and work split as LazyCache, minus the thread.
+    BenchSliceValue *peek(BenchSliceKey k) {
+        int index;
+        if (find(k, index))
+            return &retrieve(index);
+        return NULL;
+    }
+
+    void generate(BenchSliceKey k) {
+        int index;
+        if (find(k, index))
+            return;
+        BenchSliceValue &v = alloc(index);
+        generator->fn(k, v);
+        store(k, index);
+    }
+};
+
+static void
+benchCache(int argc, char **argv)
+{
+    static const int CACHE_SIZE = 1 << 16;      // THDTimeline::SLICE_CACHE_SIZE
+    static const int SUBPIXEL_SHIFT = 2;        // SliceRenderer::SUBPIXEL_SHIFT
+    static const int SUBPIXEL_COUNT = 1 << SUBPIXEL_SHIFT;
+    static const int FPS = 60;
+
+    int width = argc > 0 ? atoi(argv[0]) : 2000;
+    int panPixels = argc > 1 ? atoi(argv[1]) : 16;
+    int slicesPerFrame = argc > 2 ? atoi(argv[2]) : 2000;
+    int frames = argc > 3 ? atoi(argv[3]) : FPS * 10;
+
+    BenchSliceGenerator generator;
+    BenchSliceCache cache(CACHE_SIZE, &generator);
+    WorkQueue<BenchSliceKey> workQueue(CACHE_SIZE);
+
+    const ClockType scale = 100000;
+    ClockType origin = 0;
+
+    std::vector<double> frameTimes;
+    uint64_t lookups = 0, hits = 0, generated = 0;
+
+    for (int frame = 0; frame < frames; frame++) {
+        double start = usecNow();
+
+        for (int x = 0; x < width; x++) {
+            for (int s = 0; s < SUBPIXEL_COUNT; s++) {
+                ClockType clk = ((origin + scale * x) << SUBPIXEL_SHIFT) + scale * s;
+                BenchSliceKey key = { clk >> SUBPIXEL_SHIFT,
+                                      (clk + scale) >> SUBPIXEL_SHIFT };
+
+                lookups++;
+                if (cache.peek(key))
+                    hits++;
+                else
+                    workQueue.insert(key);
+            }
+        }
+
+        for (int i = 0; i < slicesPerFrame && !workQueue.empty(); i++) {
+            BenchSliceKey k = workQueue.newest();
+            workQueue.removeNewest();
+            cache.generate(k);
+            generated++;
+        }
+
+        frameTimes.push_back(usecNow() - start);
+        origin += panPixels * scale;
+    }
+
+    std::sort(frameTimes.begin(), frameTimes.end());
+    double total = 0;
+    for (size_t i = 0; i < frameTimes.size(); i++)
+        total += frameTimes[i];
+
+    const double budget = 1e6 / FPS;
+    double mean = total / frameTimes.size();
+    double p99 = frameTimes[frameTimes.size() * 99 / 100];
+
+    printf("cache: %d px wide, %d subpixels, pan %d px/frame, %d frames\n",
+           width, SUBPIXEL_COUNT, panPixels, frames);
+    printf("cache: %.0f ns/lookup, %.1f%% hit rate, %llu slices generated\n",
+           total * 1000.0 / lookups, hits * 100.0 / lookups,
+           (unsigned long long) generated);
+    printf("cache: frame mean %.3f ms, p99 %.3f ms, max %.3f ms "
+           "(%.1f%% of the %.2f ms budget at %d fps)\n",
+           mean / 1000.0, p99 / 1000.0, frameTimes.back() / 1000.0,
+           mean * 100.0 / budget, budget / 1000.0, FPS);
+}
+
+
+/*
+ * Slice kernel.
+ *
+ * Times SliceKernel against the straightforward per-stratum loops it
+ * replaced, on random running totals shaped like a LogInstant pair:
+ * most strata idle, a few busy. Both versions must produce the same
+ * pixels and totals.
+ */
+
+static SliceKernel::Totals
+referenceSlice(const SliceKernel::Strata &end, const SliceKernel::Strata &begin,
+               const int *rowBounds, int numRows, int numStrata, ColorRGB *pixels)
+{
+    static const int COLOR_BG = 0xffffff;
+    static const int COLOR_READ = 0x2d7db3;
+    static const int COLOR_WRITE = 0xcb0c29;
+    static const int COLOR_ZERO = 0xc57d0c;
+
+    for (int y = 0; y < numRows; y++) {
+        uint64_t readDelta = 0, writeDelta = 0, zeroDelta = 0;
+
+        for (int s = rowBounds[y]; s < rowBounds[y+1]; s++) {
+            readDelta += end.read[s] - begin.read[s];
+            writeDelta += end.write[s] - begin.write[s];
+            zeroDelta += end.zero[s] - begin.zero[s];
+        }
+
+        ColorRGB color(0);
+
+        if (readDelta || writeDelta || zeroDelta) {
+            double total = readDelta + writeDelta;
+            float readAlpha = readDelta / total;
+            float writeAlpha = (writeDelta - zeroDelta) / total;
+            float zeroAlpha = zeroDelta / total;
+
+            color += ColorRGB(COLOR_READ) * readAlpha;
+            color += ColorRGB(COLOR_WRITE) * writeAlpha;
+            color += ColorRGB(COLOR_ZERO) * zeroAlpha;
+        } else {
+            color = COLOR_BG;
+        }
+
+        pixels[y] = color;
+    }
+
+    SliceKernel::Totals all = { 0, 0, 0 };
+    for (int s = 0; s < numStrata; s++) {
+        all.read += end.read[s] - begin.read[s];
+        all.write += end.write[s] - begin.write[s];
+        all.zero += end.zero[s] - begin.zero[s];
+    }
+    return all;
+}
+
+static void
+benchKernel(int argc, char **argv)
+{
+    static const int NUM_ROWS = 191;    // SliceRenderer's strata rows
+    static const int NUM_PAIRS = 64;
+
+    int numStrata = argc > 0 ? atoi(argv[0]) : 1024;
+    int slices = argc > 1 ? atoi(argv[1]) : 200000;
+
+    // Row boundaries, exactly as SliceRenderer::render() computes them
+    std::vector<int> rowBounds(NUM_ROWS + 1);
+    for (int y = 0; y <= NUM_ROWS; y++)
+        rowBounds[y] = (y * numStrata + NUM_ROWS/2) / NUM_ROWS;
+
+    // A pool of random begin/end pairs, so we aren't just timing one cache-hot pair
+    std::vector<uint64_t> data(NUM_PAIRS * 6 * numStrata);
+    srand(1);
+    for (int p = 0; p < NUM_PAIRS; p++) {
+        uint64_t *d = &data[p * 6 * numStrata];
+        for (int s = 0; s < numStrata; s++) {
+            bool busy = rand() % 8 == 0;
+            uint64_t r = rand(), w = rand(), z = rand() % (w + 1);
+            d[s] = r;
+            d[numStrata + s] = w;
+            d[2*numStrata + s] = z;
+            d[3*numStrata + s] = r + (busy ? rand() % 5000 : 0);
+            d[4*numStrata + s] = w + (busy ? rand() % 5000 : 0);
+            d[5*numStrata + s] = z + (busy ? rand() % 500 : 0);
+            d[5*numStrata + s] = std::min(d[5*numStrata + s], d[4*numStrata + s] - w + z);
+        }
+    }
+
+    std::vector<ColorRGB> refPixels(NUM_ROWS), newPixels(NUM_ROWS);
+    SliceKernel::Totals rows[NUM_ROWS];
+    double refTime = 0, newTime = 0;
+    uint64_t mismatches = 0, checksum = 0;
+
+    for (int i = 0; i < slices; i++) {
+        const uint64_t *d = &data[(i % NUM_PAIRS) * 6 * numStrata];
+        SliceKernel::Strata begin = { d, d + numStrata, d + 2*numStrata };
+        SliceKernel::Strata end = { d + 3*numStrata, d + 4*numStrata, d + 5*numStrata };
+
+        double t0 = usecNow();
+        SliceKernel::Totals refAll = referenceSlice(end, begin, &rowBounds[0], NUM_ROWS,
+                                                    numStrata, &refPixels[0]);
+        double t1 = usecNow();
+        SliceKernel::Totals newAll = SliceKernel::sumRows(end, &begin, &rowBounds[0],
+                                                          NUM_ROWS, rows);
+        SliceKernel::colorRows(rows, NUM_ROWS, &newPixels[0],
+                               0xffffff, 0x2d7db3, 0xcb0c29, 0xc57d0c);
+        double t2 = usecNow();
+
+        refTime += t1 - t0;
+        newTime += t2 - t1;
+
+        if (refAll.read != newAll.read || refAll.write != newAll.write ||
+            refAll.zero != newAll.zero)
+            mismatches++;
+        for (int y = 0; y < NUM_ROWS; y++) {
+            if (refPixels[y].value != newPixels[y].value)
+                mismatches++;
+            checksum += newPixels[y].value;
+        }
+    }
+
+    printf("kernel: %d strata, %d rows, %d slices (checksum %llx)\n",
+           numStrata, NUM_ROWS, slices, (unsigned long long) checksum);
+    printf("kernel: reference %.0f ns/slice, kernel %.0f ns/slice (%.2fx)\n",
+           refTime * 1000.0 / slices, newTime * 1000.0 / slices, refTime / newTime);
+    printf("kernel: %llu mismatched pixels or totals\n", (unsigned long long) mismatches);
+}
+
+
+/*
+ * Synthetic logs.
+ *
+ * Writes a log with SynthLog. Any parameter can be overridden with
+ * name=value arguments after the transfer count.
+ */
+
+static void
+benchGen(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        double SynthLogParams::*value;
+    } doubleParams[] = {
+        { "bandwidth", &SynthLogParams::bandwidth },
+        { "writes", &SynthLogParams::writeRatio },
+        { "locality", &SynthLogParams::locality },
+        { "burst", &SynthLogParams::meanBurst },
+        { "zeros", &SynthLogParams::zeroRatio },
+        { "sequential", &SynthLogParams::sequential },
+        { "polling", &SynthLogParams::polling },
+        { "syncerr", &SynthLogParams::syncErrors },
+        { "csumerr", &SynthLogParams::checksumErrors },
+    };
+    static const int numDoubleParams = sizeof doubleParams / sizeof doubleParams[0];
+
+    if (argc < 1) {
+        fprintf(stderr, "gen: Missing output file\n");
+        exit(1);
+    }
+
+    SynthLogParams params;
+    if (argc > 1)
+        params.transfers = strtoull(argv[1], NULL, 0);
+
+    for (int i = 2; i < argc; i++) {
+        char *eq = strchr(argv[i], '=');
+        bool known = false;
+
+        if (eq) {
+            *eq = '\0';
+            double v = atof(eq + 1);
+
+            for (int j = 0; j < numDoubleParams; j++) {
+                if (!strcmp(argv[i], doubleParams[j].name)) {
+                    params.*doubleParams[j].value = v;
+                    known = true;
+                }
+            }
+            if (!strcmp(argv[i], "seed")) {
+                params.seed = (uint32_t) v;
+                known = true;
+            }
+            if (!strcmp(argv[i], "mem")) {
+                params.memSize = (uint32_t) v;
+                known = true;
+            }
+            if (!strcmp(argv[i], "range")) {
+                params.localityRange = (uint32_t) v;
+                known = true;
+            }
+        }
+
+        if (!known) {
+            fprintf(stderr, "gen: Unknown parameter '%s'. Try: seed mem range", argv[i]);
+            for (int j = 0; j < numDoubleParams; j++)
+                fprintf(stderr, " %s", doubleParams[j].name);
+            fprintf(stderr, "\n");
+            exit(1);
+        }
+    }
+
+    SynthLog log(params);
+    double start = usecNow();
+    if (!log.Write(argv[0]))
+        exit(1);
+    double seconds = (usecNow() - start) / 1e6;
+
+    SynthLogStats &st = log.stats;
+    printf("gen: %llu transfers, %llu packets, %.1f MB in %.3f s\n",
+           (unsigned long long) st.transfers, (unsigned long long) st.packets,
+           st.bytes / 1e6, seconds);
+    printf("gen: %llu clocks, %.1f%% busy, %llu sync errors, %llu checksum errors\n",
+           (unsigned long long) st.clocks,
+           st.clocks ? (st.packets - st.transfers) * 100.0 / st.clocks : 0.0,
+           (unsigned long long) st.syncErrors, (unsigned long long) st.checksumErrors);
+}
+
+
+/*
+ * Helpers for the benchmarks that read a log.
+ */
+
+static void
+openLog(LogReader &reader, LogIndex &index, const char *path)
+{
+    // Opens the log, and waits for its index to be COMPLETE.
+
+    if (!openLogIndex(path, reader, index, true))
+        exit(1);
+}
+
+
+static void
+printLatencies(const char *bench, const char *what, std::vector<double> &times)
+{
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for (size_t i = 0; i < times.size(); i++)
+        total += times[i];
+
+    size_t n = times.size();
+    printf("%s: %-24s mean %9.1f us, p50 %9.1f, p90 %9.1f, p99 %9.1f, max %9.1f\n",
+           bench, what, total / n, times[n / 2], times[n * 9 / 10],
+           times[n * 99 / 100], times.back());
+}
+
+
+/*
+ * LogReader decoding.
+ *
+ * Reads every transfer in the log once, in order, the way the
+ * indexer does.
+ */
+
+static void
+benchDecode(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "decode: Missing log file\n");
+        exit(1);
+    }
+
+    LogReader reader;
+    reader.Open(wxString(argv[0], wxConvUTF8).c_str());
+
+    MemTransfer mt;
+    uint64_t transfers = 0, bytes = 0;
+    uint64_t types[MemTransfer::ERROR_UNAVAIL + 1] = { 0 };
+
+    double start = usecNow();
+    while (reader.Read(mt)) {
+        transfers++;
+        types[mt.type]++;
+        bytes += mt.byteCount;
+        if (!reader.Next(mt))
+            break;
+    }
+    double seconds = (usecNow() - start) / 1e6;
+
+    double logBytes = reader.FileName().GetSize().ToDouble();
+
+    printf("decode: %llu transfers, %.1f MB of log in %.3f s\n",
+           (unsigned long long) transfers, logBytes / 1e6, seconds);
+    printf("decode: %.2f M transfers/s, %.1f MB/s of log, %.1f MB/s of data\n",
+           transfers / seconds / 1e6, logBytes / seconds / 1e6, bytes / seconds / 1e6);
+    printf("decode: %llu sync, %llu checksum, %llu overflow, %llu protocol errors\n",
+           (unsigned long long) types[MemTransfer::ERROR_SYNC],
+           (unsigned long long) types[MemTransfer::ERROR_CHECKSUM],
+           (unsigned long long) types[MemTransfer::ERROR_OVERFLOW],
+           (unsigned long long) types[MemTransfer::ERROR_PROTOCOL]);
+}
+
+
+/*
+ * Index build.
+ *
+ * Throws away the log's index, if it has one, and times building it
+ * again from scratch.
+ */
+
+static void
+benchIndex(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "index: Missing log file\n");
+        exit(1);
+    }
+
+    wxFileName indexFile = LogIndex::FindIndexFile(wxFileName(wxString(argv[0], wxConvUTF8)));
+    if (indexFile.FileExists())
+        wxRemoveFile(indexFile.GetFullPath());
+
+    LogReader reader;
+    LogIndex index;
+
+    double start = usecNow();
+    openLog(reader, index, argv[0]);
+    double seconds = (usecNow() - start) / 1e6;
+
+    double logBytes = reader.FileName().GetSize().ToDouble();
+    double indexBytes = indexFile.GetSize().ToDouble();
+
+    printf("index: %llu transfers, %.1f MB of log in %.3f s\n",
+           (unsigned long long) index.GetNumTransfers(), logBytes / 1e6, seconds);
+    printf("index: %.2f M transfers/s, %.1f MB/s, index is %.1f MB (%.1f%% of the log)\n",
+           index.GetNumTransfers() / seconds / 1e6, logBytes / seconds / 1e6,
+           indexBytes / 1e6, indexBytes * 100.0 / logBytes);
+}
+
+
+/*
+ * Query latency.
+ *
+ * Looks up random instants and transfers, first on a freshly opened
+ * LogIndex (cold caches), then the same ones again in a different
+ * order (warm caches). Instant lookups use the fuzz that a 2048 pixel
+ * wide timeline of the whole log would. The OS file cache is warm in
+ * both cases, since the index was just opened or built.
+ */
+
+static void
+benchQuery(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "query: Missing log file\n");
+        exit(1);
+    }
+    int lookups = argc > 1 ? atoi(argv[1]) : 2000;
+
+    LogReader reader;
+    LogIndex index;
+    openLog(reader, index, argv[0]);
+
+    ClockType duration = index.GetDuration();
+    ClockType distance = duration / (2048 * SliceRenderer::SUBPIXEL_COUNT);
+    OffsetType numTransfers = index.GetNumTransfers();
+
+    std::vector<ClockType> times(lookups);
+    std::vector<OffsetType> ids(lookups);
+    srand(1);
+    for (int i = 0; i < lookups; i++) {
+        times[i] = (ClockType)(duration * (rand() / (RAND_MAX + 1.0)));
+        ids[i] = (OffsetType)(numTransfers * (rand() / (RAND_MAX + 1.0)));
+    }
+
+    printf("query: %llu transfers, %d lookups, instant fuzz %lld clocks\n",
+           (unsigned long long) numTransfers, lookups, (long long) distance);
+
+    for (int pass = 0; pass < 2; pass++) {
+        std::vector<double> latencies(lookups);
+
+        for (int i = 0; i < lookups; i++) {
+            double start = usecNow();
+            index.GetInstant(times[i], distance);
+            latencies[i] = usecNow() - start;
+        }
+        printLatencies("query", pass ? "GetInstant, warm" : "GetInstant, cold", latencies);
+
+        for (int i = 0; i < lookups; i++) {
+            double start = usecNow();
+            index.GetTransferSummary(ids[i]);
+            latencies[i] = usecNow() - start;
+        }
+        printLatencies("query", pass ? "GetTransferSummary, warm" :
+                       "GetTransferSummary, cold", latencies);
+
+        std::reverse(times.begin(), times.end());
+        std::reverse(ids.begin(), ids.end());
+    }
+
+    LogIndex::CacheStats stats = index.GetCacheStats();
+    printf("query: %llu log walks, %.0f transfers avg, %llu max\n",
+           (unsigned long long) stats.instantWalks,
+           stats.instantWalks ? stats.walkTransfers / (double) stats.instantWalks : 0.0,
+           (unsigned long long) stats.walkMax);
+}
+
+
+/*
+ * Batched instant lookups.
+ *
+ * Looks up the same random times three ways: one GetInstant() call
+ * per time, then GetInstants() on one thread, then GetInstants() on
+ * every thread. Each way starts from a freshly opened LogIndex, so
+ * all three start with cold caches.
+ */
+
+static void
+benchBatch(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "batch: Missing log file\n");
+        exit(1);
+    }
+    int lookups = argc > 1 ? atoi(argv[1]) : 20000;
+    int threads = argc > 2 ? atoi(argv[2]) : wxThread::GetCPUCount();
+
+    std::vector<ClockType> times(lookups);
+    std::vector<instantPtr_t> results;
+    ClockType distance = 0;
+
+    for (int way = 0; way < 3; way++) {
+        LogReader reader;
+        LogIndex index;
+        openLog(reader, index, argv[0]);
+
+        if (way == 0) {
+            ClockType duration = index.GetDuration();
+            distance = duration / (2048 * SliceRenderer::SUBPIXEL_COUNT);
+
+            srand(1);
+            for (int i = 0; i < lookups; i++)
+                times[i] = (ClockType)(duration * (rand() / (RAND_MAX + 1.0)));
+
+            printf("batch: %d lookups, instant fuzz %lld clocks\n",
+                   lookups, (long long) distance);
+        }
+
+        double start = usecNow();
+        const char *name;
+
+        if (way == 0) {
+            name = "GetInstant";
+            for (int i = 0; i < lookups; i++)
+                index.GetInstant(times[i], distance);
+        } else if (way == 1) {
+            name = "GetInstants, 1 thread";
+            index.GetInstants(times, distance, results, 1);
+        } else {
+            name = "GetInstants, all threads";
+            index.GetInstants(times, distance, results, threads);
+        }
+
+        double seconds = (usecNow() - start) / 1e6;
+        LogIndex::CacheStats stats = index.GetCacheStats();
+        printf("batch: %-26s %8.3f s, %8.0f lookups/s, %llu log walks, %.0f transfers avg\n",
+               name, seconds, lookups / seconds, (unsigned long long) stats.instantWalks,
+               stats.instantWalks ? stats.walkTransfers / (double) stats.instantWalks : 0.0);
+    }
+}
+
+
+/*
+ * Transfer filter scan.
+ *
+ * Times a TransferFilter reading the whole log, the way the transfer
+ * list does when the user types a filter. The remaining arguments
+ * are the filter's terms.
+ */
+
+static void
+benchFilter(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "filter: Missing log file\n");
+        exit(1);
+    }
+
+    std::string text, error;
+    for (int i = 1; i < argc; i++) {
+        if (i > 1)
+            text += " ";
+        text += argv[i];
+    }
+
+    TransferFilter::Criteria criteria;
+    if (!criteria.Parse(text.c_str(), error)) {
+        fprintf(stderr, "filter: %s\n", error.c_str());
+        exit(1);
+    }
+
+    LogReader reader;
+    LogIndex index;
+    openLog(reader, index, argv[0]);
+
+    TransferFilter filter(&index, criteria);
+    double start = usecNow();
+    double firstRow = 0;
+
+    filter.Start();
+    while (!filter.IsDone()) {
+        if (!firstRow && filter.GetCount())
+            firstRow = usecNow() - start;
+        wxMilliSleep(1);
+    }
+    double seconds = (usecNow() - start) / 1e6;
+    if (!firstRow && filter.GetCount())
+        firstRow = seconds * 1e6;
+
+    OffsetType count = filter.GetCount();
+    OffsetType total = index.GetNumTransfers();
+
+    printf("filter: '%s' matched %llu of %llu transfers in %.3f s, first rows after %.1f ms\n",
+           text.c_str(), (unsigned long long) count, (unsigned long long) total,
+           seconds, firstRow / 1e3);
+    printf("filter: %.2f M transfers/s, ID set is %.1f kB (%.2f bytes per match)\n",
+           total / seconds / 1e6, filter.GetMemoryUsed() / 1e3,
+           count ? filter.GetMemoryUsed() / (double) count : 0.0);
+}
+
+
+/*
+ * Slice generation.
+ *
+ * Generates every subpixel slice of a timeline of the whole log, one
+ * at a time on one thread, the way a single slice cache worker
+ * would. The second pass repeats it with warm caches.
+ */
+
+static void
+benchSlices(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "slices: Missing log file\n");
+        exit(1);
+    }
+    int width = argc > 1 ? atoi(argv[1]) : 512;
+
+    LogReader reader;
+    LogIndex index;
+    openLog(reader, index, argv[0]);
+
+    SliceRenderer renderer(&index);
+    ClockType scale = std::max<ClockType>(1, (index.GetDuration() + width - 1) / width);
+    int count = width * SliceRenderer::SUBPIXEL_COUNT;
+    SliceRenderer::SliceValue value;
+
+    printf("slices: %d pixels wide, %d slices, %lld clocks per pixel\n",
+           width, count, (long long) scale);
+
+    for (int pass = 0; pass < 2; pass++) {
+        std::vector<double> latencies(count);
+        double start = usecNow();
+
+        for (int i = 0; i < count; i++) {
+            SliceKey key = SliceRenderer::getSliceKeyForSubpixel(
+                0, scale, 0, index.GetMemSize(),
+                i >> SliceRenderer::SUBPIXEL_SHIFT, i & (SliceRenderer::SUBPIXEL_COUNT - 1));
+
+            double t = usecNow();
+            renderer.generate(key, value);
+            latencies[i] = usecNow() - t;
+        }
+
+        double seconds = (usecNow() - start) / 1e6;
+        printf("slices: %s, %.0f slices/s\n", pass ? "warm" : "cold", count / seconds);
+        printLatencies("slices", pass ? "generate, warm" : "generate, cold", latencies);
+    }
+}
+
+
+static const struct {
+    const char *name;
+    const char *args;
+    void (*fn)(int argc, char **argv);
+} benchmarks[] = {
+    { "cache", "[width] [pan] [slices/frame] [frames]", benchCache },
+    { "kernel", "[strata] [slices]", benchKernel },
+    { "gen", "<log> [transfers] [name=value...]", benchGen },
+    { "decode", "<log>", benchDecode },
+    { "index", "<log>", benchIndex },
+    { "query", "<log> [lookups]", benchQuery },
+    { "slices", "<log> [width]", benchSlices },
+    { "batch", "<log> [lookups] [threads]", benchBatch },
+    { "filter", "<log> [terms...]", benchFilter },
+};
+
+static const int numBenchmarks = sizeof benchmarks / sizeof benchmarks[0];
+
+
+int
+main(int argc, char **argv)
+{
+    wxInitializer initializer;
+    if (!initializer.IsOk()) {
+        fprintf(stderr, "Failed to initialize wxWidgets\n");
+        return 1;
+    }
+
+    for (int i = 0; i < numBenchmarks; i++) {
+        if (argc >= 2 && !strcmp(argv[1], benchmarks[i].name)) {
+            benchmarks[i].fn(argc - 2, argv + 2);
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "usage: %s <benchmark> [args...]\n\nBenchmarks:\n", argv[0]);
+    for (int i = 0; i < numBenchmarks; i++)
+        fprintf(stderr, "  %s %s\n", benchmarks[i].name, benchmarks[i].args);
+    return 1;
+}
@@ -0,0 +1,220 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * thd_export.cpp -- Command-line tool for exporting transfers from a log,
+ *                   and for reading columnar exports back as CSV.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <wx/init.h>
+#include <wx/utils.h>
+#include <wx/stopwatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+#include "log_reader.h"
+#include "log_index.h"
+#include "cli_util.h"
+#include "transfer_export.h"
+
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options] <log file> <output file>\n"
+            "       %s -r [-t <begin>:<end>] <export file>\n"
+            "\n"
+            "Writes the time, ID, type, address, and length of every transfer\n"
+            "in the log to a file in THD's columnar format, or as CSV. Use '-'\n"
+            "for stdout. The log is indexed first if it doesn't have an\n"
+            "up-to-date index. With -r, reads a columnar export and prints it\n"
+            "as CSV.\n"
+            "\n"
+            "Options:\n"
+            "  -c                Write CSV instead of the columnar format\n"
+            "  -d                Include the data of each read and write\n"
+            "  -f <terms>        Only transfers matching a filter, with the same\n"
+            "                    terms as the transfer list's filter box\n"
+            "  -j <threads>      Encoder threads (default one per CPU)\n"
+            "  -r                Read an export instead of writing one\n"
+            "  -t <begin>:<end>  With -r, only transfers in this clock range\n",
+            argv0, argv0);
+}
+
+
+static int
+readExport(const char *path, long long timeBegin, long long timeEnd)
+{
+    /*
+     * Prints a columnar export as CSV, the same as exporting with -c
+     * would. The row group index lets us skip straight to the first
+     * row group in the time range.
+     */
+
+    ExportFileReader reader;
+    std::string error;
+
+    if (!reader.Open(path, error)) {
+        fprintf(stderr, "%s: %s\n", path, error.c_str());
+        return 1;
+    }
+
+    const std::vector<ExportRowGroup> &groups = reader.GetRowGroups();
+    std::vector<ExportRow> rows;
+    std::vector<uint8_t> payload;
+    std::string out;
+
+    ExportRow::writeCSVHeader(out, reader.HasPayload());
+    fwrite(out.data(), out.size(), 1, stdout);
+
+    for (size_t g = reader.FindRowGroup(timeBegin);
+         g < groups.size() && groups[g].firstTime <= timeEnd; g++) {
+
+        if (!reader.ReadRowGroup(g, rows, payload, error)) {
+            fprintf(stderr, "%s: row group %d: %s\n", path, (int) g, error.c_str());
+            return 1;
+        }
+
+        const uint8_t *data = NULL;
+        if (reader.HasPayload())
+            data = payload.empty() ? (const uint8_t *) "" : &payload[0];
+
+        out.clear();
+        for (size_t i = 0; i < rows.size(); i++)
+            if (rows[i].time >= timeBegin && rows[i].time <= timeEnd)
+                rows[i].writeCSV(out, data);
+
+        if (!out.empty() && fwrite(out.data(), out.size(), 1, stdout) != 1) {
+            fprintf(stderr, "Error writing to stdout\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    TransferExporter::Options options;
+    long long timeBegin = 0, timeEnd = -1;
+    bool readMode = false;
+    int numThreads = 0;
+    std::string error;
+    int c;
+
+    while ((c = getopt(argc, argv, "cdf:j:rt:h")) != -1) {
+        switch (c) {
+        case 'c': options.format = TransferExporter::CSV; break;
+        case 'd': options.payload = true; break;
+        case 'f':
+            if (!options.criteria.Parse(optarg, error)) {
+                fprintf(stderr, "Bad filter: %s\n", error.c_str());
+                return 1;
+            }
+            break;
+        case 'j': numThreads = atoi(optarg); break;
+        case 'r': readMode = true; break;
+        case 't':
+            if (sscanf(optarg, "%lld:%lld", &timeBegin, &timeEnd) != 2 || timeEnd <= timeBegin) {
+                fprintf(stderr, "Bad time range '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (readMode) {
+        if (argc - optind != 1) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (timeEnd < 0)
+            timeEnd = (~0ULL) >> 1;
+        return readExport(argv[optind], timeBegin, timeEnd);
+    }
+
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *logPath = argv[optind];
+    const char *outPath = argv[optind + 1];
+
+    wxInitializer initializer;
+    if (!initializer.IsOk()) {
+        fprintf(stderr, "Failed to initialize wxWidgets\n");
+        return 1;
+    }
+
+    if (numThreads <= 0)
+        numThreads = std::max(1, wxThread::GetCPUCount());
+
+    LogReader reader;
+    LogIndex index;
+
+    if (!openLogIndex(logPath, reader, index))
+        return 1;
+
+    bool toStdout = !strcmp(outPath, "-");
+    FILE *file = toStdout ? stdout : fopen(outPath, "wb");
+    if (!file) {
+        fprintf(stderr, "Can't open '%s' for writing\n", outPath);
+        return 1;
+    }
+
+    wxStopWatch timer;
+    TransferExporter exporter(&index, options);
+    exporter.Start(file, numThreads);
+
+    if (isatty(fileno(stderr))) {
+        while (!exporter.IsDone()) {
+            fprintf(stderr, "\rExporting... %5.1f%%", exporter.GetProgress() * 100.0);
+            wxMilliSleep(100);
+        }
+        fprintf(stderr, "\r%20s\r", "");
+    }
+
+    bool ok = exporter.Wait();
+    if (!toStdout && fclose(file))
+        ok = false;
+
+    if (!ok) {
+        fprintf(stderr, "Error writing '%s'\n", outPath);
+        return 1;
+    }
+
+    double seconds = timer.Time() / 1000.0;
+    fprintf(stderr, "Exported %llu transfers in %d row groups, %.1f MB, in %.3f s on %d threads\n",
+            (unsigned long long) exporter.rowsWritten, exporter.numRowGroups,
+            exporter.bytesWritten / 1e6, seconds, numThreads);
+    return 0;
+}
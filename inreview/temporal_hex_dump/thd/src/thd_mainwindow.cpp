@@ -27,7 +27,10 @@
 #include "thd_mainwindow.h"
 #include "thd_timeline.h"
 
+#define ID_FILTER_BOX  1
+
 BEGIN_EVENT_TABLE(THDMainWindow, wxFrame)
+    EVT_TEXT_ENTER(ID_FILTER_BOX, THDMainWindow::OnFilter)
 END_EVENT_TABLE()
 
 static const wxString windowName = wxT("Temporal Hex Dump");
@@ -42,6 +45,7 @@ THDMainWindow::THDMainWindow()
     Connect(index.GetProgressEvent(),
             wxCommandEventHandler(THDMainWindow::OnIndexProgress));
     index.SetProgressReceiver(this);
+    index.SetLowImpact(true);
 
     statusBar = new ProgressStatusBar(this);
     SetStatusBar(statusBar);
@@ -60,13 +64,22 @@ THDMainWindow::THDMainWindow()
     vbox->Add(hbox, 1, wxEXPAND);
 
     /*
-     * Horizontal split: Transfers and contents
+     * Horizontal split: Transfers (under their filter box) and contents
      */
 
+    filterBox = new wxTextCtrl(this, ID_FILTER_BOX, wxEmptyString,
+                               wxDefaultPosition, wxDefaultSize, wxTE_PROCESS_ENTER);
+    filterBox->SetToolTip(wxT("Filter transfers: any of read, write, error, "
+                              "addr:A[-B], len:N[-M]. Press Enter to apply."));
+
     transferGrid = new THDTransferGrid(this, &model);
     contentGrid = new THDContentGrid(this, &model);
 
-    hbox->Add(transferGrid, 0, wxEXPAND);
+    wxSizer *transferBox = new wxBoxSizer(wxVERTICAL);
+    transferBox->Add(filterBox, 0, wxEXPAND);
+    transferBox->Add(transferGrid, 1, wxEXPAND);
+
+    hbox->Add(transferBox, 0, wxEXPAND);
     hbox->Add(6, 6);
     hbox->Add(contentGrid, 1, wxEXPAND);
 
@@ -80,6 +93,7 @@ THDMainWindow::~THDMainWindow()
     delete statusBar;
     delete timeline;
     delete transferGrid;
+    delete filterBox;
     delete contentGrid;
 }
 
@@ -87,6 +101,10 @@ THDMainWindow::~THDMainWindow()
 void
 THDMainWindow::Open(wxString fileName)
 {
+    // A filter belongs to the log it was started on.
+    transferGrid->SetFilter(filterPtr_t());
+    filterBox->Clear();
+
     index.Close();
     reader.Close();
     reader.Open(fileName);
@@ -110,6 +128,25 @@ THDMainWindow::RefreshTables()
 }
 
 
+void
+THDMainWindow::OnFilter(wxCommandEvent& WXUNUSED(event))
+{
+    wxString text = filterBox->GetValue();
+    TransferFilter::Criteria criteria;
+    std::string error;
+
+    if (!criteria.Parse(text.mb_str(wxConvUTF8), error)) {
+        statusBar->SetStatusText(wxString(error.c_str(), wxConvUTF8));
+        return;
+    }
+
+    if (text.Strip(wxString::both).IsEmpty())
+        transferGrid->SetFilter(filterPtr_t());
+    else
+        transferGrid->SetFilter(filterPtr_t(new TransferFilter(&index, criteria)));
+}
+
+
 void
 THDMainWindow::OnIndexProgress(wxCommandEvent& WXUNUSED(event))
 {
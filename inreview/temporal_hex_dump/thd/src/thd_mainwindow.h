@@ -28,6 +28,7 @@
 
 #include <wx/frame.h>
 #include <wx/grid.h>
+#include <wx/textctrl.h>
 
 #include "progress_status_bar.h"
 #include "log_reader.h"
@@ -46,6 +47,7 @@ public:
     void Open(wxString fileName);
 
     void OnIndexProgress(wxCommandEvent &event);
+    void OnFilter(wxCommandEvent &event);
 
     DECLARE_EVENT_TABLE();
 
@@ -57,6 +59,7 @@ private:
     ProgressStatusBar *statusBar;
     THDTimeline *timeline;
     THDTransferGrid *transferGrid;
+    wxTextCtrl *filterBox;
     THDContentGrid *contentGrid;
 
     THDModel model;
@@ -100,6 +100,18 @@ struct THDModel {
         if (cursor.transferId != cursor.NO_TRANSFER)
             moveCursorToId(cursor.transferId + increment);
     }
+
+    // Jump to the first transfer of the next (or previous) access pattern.
+    void cursorNextPattern(bool forward = true)
+    {
+        OffsetType id = cursor.transferId;
+        AccessPattern pattern;
+
+        if (id == cursor.NO_TRANSFER)
+            id = 0;
+        if (index->FindAccessPattern(id, forward, AccessPattern::NUM_KINDS, pattern))
+            moveCursorToId(pattern.firstId);
+    }
 };
 
 #endif /* __THD_MODEL_H */
@@ -0,0 +1,395 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * thd_render.cpp -- Command-line timeline renderer, for producing timeline
+ *                   images without the GUI.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <wx/init.h>
+#include <wx/image.h>
+#include <wx/stopwatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "log_reader.h"
+#include "log_index.h"
+#include "cli_util.h"
+#include "slice_renderer.h"
+
+
+/*
+ * Everything the render threads share. Each thread owns a
+ * contiguous range of pixel columns, and only writes to the slices
+ * and output pixels for those columns.
+ */
+
+struct RenderJob {
+    RenderJob(LogIndex *_index) : index(_index), renderer(_index) {}
+
+    void generateSlices(int xMin, int xMax);
+    void compositeColumns(int xMin, int xMax);
+
+    SliceKey getKey(int i) {
+        return SliceRenderer::getSliceKeyForSubpixel(origin, scale, addrBegin, addrEnd,
+                                                     i >> SliceRenderer::SUBPIXEL_SHIFT,
+                                                     i & (SliceRenderer::SUBPIXEL_COUNT - 1));
+    }
+
+    LogIndex *index;
+    SliceRenderer renderer;
+    ClockType origin;
+    ClockType scale;
+    AddressType addrBegin;
+    AddressType addrEnd;
+    int width;
+
+    std::vector<SliceRenderer::SliceValue> slices;  // SUBPIXEL_COUNT per column
+    std::vector<uint8_t> rgb;                       // Packed 24-bit rows
+};
+
+
+class RenderThread : public wxThread {
+public:
+    enum Phase {
+        SLICES,
+        COMPOSITE,
+    };
+
+    RenderThread(RenderJob *_job, Phase _phase, int _xMin, int _xMax)
+        : wxThread(wxTHREAD_JOINABLE),
+          job(_job), phase(_phase), xMin(_xMin), xMax(_xMax)
+    {}
+
+    virtual ExitCode Entry()
+    {
+        if (phase == SLICES)
+            job->generateSlices(xMin, xMax);
+        else
+            job->compositeColumns(xMin, xMax);
+        return 0;
+    }
+
+    /*
+     * Split columns [0, width) evenly over 'numThreads' threads, run
+     * one phase of the job on all of them, and wait for them to finish.
+     */
+    static void runPhase(RenderJob *job, Phase phase, int numThreads)
+    {
+        std::vector<RenderThread*> threads;
+
+        for (int i = 0; i < numThreads; i++) {
+            int xMin = (int64_t)job->width * i / numThreads;
+            int xMax = (int64_t)job->width * (i + 1) / numThreads;
+            if (xMin == xMax)
+                continue;
+
+            RenderThread *thread = new RenderThread(job, phase, xMin, xMax);
+            thread->Create();
+            thread->Run();
+            threads.push_back(thread);
+        }
+
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i]->Wait();
+            delete threads[i];
+        }
+    }
+
+private:
+    RenderJob *job;
+    Phase phase;
+    int xMin;
+    int xMax;
+};
+
+
+void
+RenderJob::generateSlices(int xMin, int xMax)
+{
+    int first = xMin << SliceRenderer::SUBPIXEL_SHIFT;
+    int last = xMax << SliceRenderer::SUBPIXEL_SHIFT;
+
+    /*
+     * Every slice is the same width, give or take a clock cycle, so
+     * they all get the same fuzz. The SliceRenderer's own rules
+     * decide when the strata pyramid is close enough.
+     */
+
+    ClockType fuzz = (scale >> SliceRenderer::SUBPIXEL_SHIFT) >> 2;
+
+    if (LogIndex::GetTileLevelForDistance(fuzz) >= 0) {
+        for (int i = first; i < last; i++) {
+            SliceKey key = getKey(i);
+            renderer.generate(key, slices[i]);
+        }
+        return;
+    }
+
+    /*
+     * Otherwise, make one forward pass over our part of the log. Our
+     * slices are contiguous, so each slice's end is the next one's
+     * beginning, and each slice can be drawn as soon as its end
+     * instant arrives.
+     */
+
+    std::vector<ClockType> times;
+    times.reserve(last - first + 1);
+    for (int i = first; i < last; i++)
+        times.push_back(getKey(i).begin);
+    times.push_back(getKey(last - 1).end);
+
+    struct Receiver : public InstantSweepReceiver {
+        virtual bool fn(int i, instantPtr_t instant) {
+            if (i > 0)
+                job->renderer.render(job->getKey(first + i - 1), prev, instant,
+                                     job->slices[first + i - 1]);
+            prev = instant;
+            return true;
+        }
+
+        RenderJob *job;
+        int first;
+        instantPtr_t prev;
+    };
+
+    Receiver receiver;
+    receiver.job = this;
+    receiver.first = first;
+
+    index->SweepInstants(times, fuzz, receiver);
+}
+
+
+void
+RenderJob::compositeColumns(int xMin, int xMax)
+{
+    SliceRenderer::SliceValue *subpixels[SliceRenderer::SUBPIXEL_COUNT];
+    ColorRGB column[SliceRenderer::SLICE_HEIGHT];
+
+    for (int x = xMin; x < xMax; x++) {
+        for (int s = 0; s < SliceRenderer::SUBPIXEL_COUNT; s++)
+            subpixels[s] = &slices[(x << SliceRenderer::SUBPIXEL_SHIFT) + s];
+
+        SliceRenderer::composite(subpixels, false, column);
+
+        for (int y = 0; y < SliceRenderer::SLICE_HEIGHT; y++) {
+            uint8_t *pixel = &rgb[(y * width + x) * 3];
+            pixel[0] = column[y].red();
+            pixel[1] = column[y].green();
+            pixel[2] = column[y].blue();
+        }
+    }
+}
+
+
+static bool
+writePPM(const char *path, RenderJob &job)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    fprintf(f, "P6\n%d %d\n255\n", job.width, SliceRenderer::SLICE_HEIGHT);
+    bool ok = fwrite(&job.rgb[0], job.rgb.size(), 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok)
+        fprintf(stderr, "Error writing '%s'\n", path);
+    return ok;
+}
+
+
+static bool
+writePNG(const char *path, RenderJob &job)
+{
+    wxImage::AddHandler(new wxPNGHandler);
+
+    wxImage image(job.width, SliceRenderer::SLICE_HEIGHT, false);
+    memcpy(image.GetData(), &job.rgb[0], job.rgb.size());
+
+    if (!image.SaveFile(wxString(path, wxConvUTF8), wxBITMAP_TYPE_PNG)) {
+        fprintf(stderr, "Error writing '%s'\n", path);
+        return false;
+    }
+    return true;
+}
+
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options] <log file> <output.png|output.ppm>\n"
+            "\n"
+            "Renders the whole log, or part of it, as a timeline image.\n"
+            "The log is indexed first if it doesn't have an index yet.\n"
+            "\n"
+            "Options:\n"
+            "  -w <pixels>   Image width (default 2048)\n"
+            "  -b <seconds>  Start time (default 0)\n"
+            "  -e <seconds>  End time (default end of log)\n"
+            "  -a <addr>:<addr>\n"
+            "                Address range (default all of memory)\n"
+            "  -j <threads>  Render threads (default one per CPU)\n",
+            argv0);
+}
+
+
+static void
+printPhase(const char *name, wxStopWatch &timer)
+{
+    printf("%-12s %10.3f s\n", name, timer.Time() / 1000.0);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int width = 2048;
+    double beginSec = 0;
+    double endSec = -1;
+    int numThreads = 0;
+    unsigned long addrBegin = 0;
+    unsigned long addrEnd = 0;
+    char *colon;
+    int c;
+
+    while ((c = getopt(argc, argv, "w:b:e:a:j:h")) != -1) {
+        switch (c) {
+        case 'w': width = atoi(optarg); break;
+        case 'b': beginSec = atof(optarg); break;
+        case 'e': endSec = atof(optarg); break;
+        case 'j': numThreads = atoi(optarg); break;
+        case 'a':
+            addrBegin = strtoul(optarg, &colon, 0);
+            if (*colon == ':')
+                addrEnd = strtoul(colon + 1, NULL, 0);
+            if (addrEnd <= addrBegin) {
+                fprintf(stderr, "Bad address range '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2 || width <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *logPath = argv[optind];
+    const char *outPath = argv[optind + 1];
+    const char *ext = strrchr(outPath, '.');
+    bool png = ext && !strcasecmp(ext, ".png");
+
+    if (!(png || (ext && !strcasecmp(ext, ".ppm")))) {
+        fprintf(stderr, "Output file must end in .png or .ppm\n");
+        return 1;
+    }
+
+    wxInitializer initializer;
+    if (!initializer.IsOk()) {
+        fprintf(stderr, "Failed to initialize wxWidgets\n");
+        return 1;
+    }
+
+    if (numThreads <= 0)
+        numThreads = std::max(1, wxThread::GetCPUCount());
+
+    wxStopWatch total;
+    wxStopWatch timer;
+
+    /*
+     * Open the log and wait for its index. This is instant if an
+     * up-to-date index already exists.
+     */
+
+    LogReader reader;
+    LogIndex index;
+
+    if (!openLogIndex(logPath, reader, index))
+        return 1;
+
+    printPhase("index", timer);
+
+    /*
+     * Lay out the view, just like THDTimeline's: 'scale' clock
+     * cycles per pixel, starting at 'origin'.
+     */
+
+    double clockHz = LogReader::GetDefaultClockHZ();
+    ClockType duration = index.GetDuration();
+    ClockType begin = std::min<ClockType>(duration, beginSec * clockHz);
+    ClockType end = endSec < 0 ? duration : (ClockType)(endSec * clockHz);
+
+    if (end <= begin) {
+        fprintf(stderr, "Empty time range\n");
+        return 1;
+    }
+
+    if (!addrEnd || addrEnd > index.GetMemSize())
+        addrEnd = index.GetMemSize();
+    if (addrBegin >= addrEnd) {
+        fprintf(stderr, "Address range is outside of memory\n");
+        return 1;
+    }
+
+    RenderJob job(&index);
+    job.width = width;
+    job.origin = begin;
+    job.scale = std::max<ClockType>(1, (end - begin + width - 1) / width);
+    job.addrBegin = addrBegin;
+    job.addrEnd = addrEnd;
+    job.slices.resize(width << SliceRenderer::SUBPIXEL_SHIFT);
+    job.rgb.resize(width * SliceRenderer::SLICE_HEIGHT * 3);
+
+    printf("%d transfers, %.6fs, rendering %.6fs - %.6fs, 0x%08lx - 0x%08lx "
+           "at %dx%d on %d threads\n",
+           (int)index.GetNumTransfers(), duration / clockHz,
+           begin / clockHz, (begin + job.scale * width) / clockHz,
+           addrBegin, addrEnd, width, SliceRenderer::SLICE_HEIGHT, numThreads);
+
+    timer.Start();
+    RenderThread::runPhase(&job, RenderThread::SLICES, numThreads);
+    printPhase("slices", timer);
+
+    timer.Start();
+    RenderThread::runPhase(&job, RenderThread::COMPOSITE, numThreads);
+    printPhase("composite", timer);
+
+    timer.Start();
+    if (!(png ? writePNG(outPath, job) : writePPM(outPath, job)))
+        return 1;
+    printPhase("write", timer);
+
+    printPhase("total", total);
+    return 0;
+}
@@ -0,0 +1,132 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * thd_serve.cpp -- Command-line daemon that serves LogIndex queries over a
+ *                  Unix domain socket.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <wx/init.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+#include "log_reader.h"
+#include "log_index.h"
+#include "cli_util.h"
+#include "query_server.h"
+
+
+static QueryServer *server;
+
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options] <log file> <socket>\n"
+            "\n"
+            "Opens the log and its index once, then answers batched queries\n"
+            "from scripts on a Unix domain socket until interrupted. The log\n"
+            "is indexed first if it doesn't have an up-to-date index. The\n"
+            "protocol is described in src/query_server.h.\n"
+            "\n"
+            "Options:\n"
+            "  -j <threads>  Worker threads (default one per CPU)\n",
+            argv0);
+}
+
+
+static void
+handleSignal(int sig)
+{
+    server->Stop();
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int numThreads = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "j:h")) != -1) {
+        switch (c) {
+        case 'j': numThreads = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *logPath = argv[optind];
+    const char *socketPath = argv[optind + 1];
+
+    wxInitializer initializer;
+    if (!initializer.IsOk()) {
+        fprintf(stderr, "Failed to initialize wxWidgets\n");
+        return 1;
+    }
+
+    if (numThreads <= 0)
+        numThreads = std::max(1, wxThread::GetCPUCount());
+
+    LogReader reader;
+    LogIndex index;
+
+    if (!openLogIndex(logPath, reader, index))
+        return 1;
+
+    QueryServer queryServer(&index);
+    std::string error;
+
+    if (!queryServer.Listen(socketPath, error)) {
+        fprintf(stderr, "Can't listen on '%s': %s\n", socketPath, error.c_str());
+        return 1;
+    }
+
+    server = &queryServer;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_handler = handleSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    fprintf(stderr, "Serving %lld transfers from '%s' on '%s', %d threads\n",
+            (long long)index.GetNumTransfers(), logPath, socketPath, numThreads);
+
+    queryServer.Run(numThreads);
+
+    fprintf(stderr, "Answered %llu requests on %llu connections\n",
+            (unsigned long long)queryServer.requestsAnswered,
+            (unsigned long long)queryServer.connectionsAccepted);
+    return 0;
+}
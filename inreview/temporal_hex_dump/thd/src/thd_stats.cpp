@@ -0,0 +1,288 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * thd_stats.cpp -- Command-line windowed traffic totals and hot regions.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <wx/init.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "log_reader.h"
+#include "log_index.h"
+#include "cli_util.h"
+#include "strata_query.h"
+
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options] <log file>\n"
+            "\n"
+            "Reports the bytes read, written, and written as zero in each\n"
+            "window of time, the estimated number of distinct 512-byte blocks\n"
+            "touched, and the busiest 16 kB strata in each window.\n"
+            "The log is indexed first if it doesn't have an up-to-date index.\n"
+            "\n"
+            "Options:\n"
+            "  -t <begin>:<end>  Clock range to report on (default whole log)\n"
+            "  -n <windows>      Split the range into this many windows (default 1)\n"
+            "  -k <count>        Hot strata to list per window (default 10)\n"
+            "  -m <metric>       Rank strata by total, read, write, or zero (default total)\n"
+            "  -p <kind>         List sequential, strided, or polling access patterns\n"
+            "                    in each window, or all of them\n"
+            "  -c <file>         Also write every stratum of every window as CSV,\n"
+            "                    '-' for stdout (replaces the report)\n"
+            "  -b <file>         Same, in the columnar format described in\n"
+            "                    src/strata_query.h\n"
+            "  -j <threads>      Lookup threads (default one per CPU)\n",
+            argv0);
+}
+
+
+static bool
+parseMetric(const char *name, StrataQuery::Metric &metric)
+{
+    static const struct {
+        const char *name;
+        StrataQuery::Metric metric;
+    } metrics[] = {
+        { "total", StrataQuery::TOTAL },
+        { "read", StrataQuery::READ },
+        { "write", StrataQuery::WRITE },
+        { "zero", StrataQuery::ZERO },
+    };
+
+    for (size_t i = 0; i < sizeof metrics / sizeof metrics[0]; i++)
+        if (!strcmp(name, metrics[i].name)) {
+            metric = metrics[i].metric;
+            return true;
+        }
+    return false;
+}
+
+
+static bool
+parsePatternKind(const char *name, AccessPattern::Kind &kind)
+{
+    if (!strcmp(name, "all")) {
+        kind = AccessPattern::NUM_KINDS;
+        return true;
+    }
+
+    for (int k = 0; k < AccessPattern::NUM_KINDS; k++)
+        if (!strcmp(name, AccessPattern::getKindName((AccessPattern::Kind) k))) {
+            kind = (AccessPattern::Kind) k;
+            return true;
+        }
+    return false;
+}
+
+
+static void
+printPatterns(LogIndex &index, StrataQuery::Window &window, AccessPattern::Kind kind)
+{
+    std::vector<AccessPattern> patterns;
+    index.GetAccessPatterns(window.begin, window.end, patterns);
+
+    for (size_t i = 0; i < patterns.size(); i++) {
+        AccessPattern &p = patterns[i];
+
+        if (kind != AccessPattern::NUM_KINDS && p.kind != kind)
+            continue;
+
+        printf("  %-10s %-5s clocks %lld to %lld, 0x%08x-0x%08x, stride %lld, %llu transfers\n",
+               AccessPattern::getKindName(p.kind),
+               p.type == MemTransfer::READ ? "read" : "write",
+               (long long) p.beginTime, (long long) p.endTime,
+               (unsigned) p.lowAddress, (unsigned) p.highAddress,
+               (long long) p.stride, (unsigned long long) p.count);
+    }
+}
+
+
+static void
+printReport(LogIndex &index, std::vector<StrataQuery::Window> &windows,
+            StrataQuery::Metric metric, const char *metricName, int topCount,
+            bool showPatterns, AccessPattern::Kind patternKind)
+{
+    std::vector<StrataQuery::HotStratum> hot;
+
+    for (size_t w = 0; w < windows.size(); w++) {
+        StrataQuery::Window &window = windows[w];
+        uint64_t total;
+
+        switch (metric) {
+        case StrataQuery::READ:  total = window.readBytes; break;
+        case StrataQuery::WRITE: total = window.writeBytes; break;
+        case StrataQuery::ZERO:  total = window.zeroBytes; break;
+        default:                 total = window.readBytes + window.writeBytes; break;
+        }
+
+        printf("Window %d: clocks %lld to %lld, %lld transfers\n",
+               (int) w, (long long) window.begin, (long long) window.end,
+               (long long) window.numTransfers);
+        printf("  %llu bytes read, %llu written, %llu of them zero\n",
+               (unsigned long long) window.readBytes,
+               (unsigned long long) window.writeBytes,
+               (unsigned long long) window.zeroBytes);
+        printf("  Working set ~%.0f blocks (%.0f read, %.0f written), ~%.1f kB\n",
+               window.workingSet.touched, window.workingSet.read,
+               window.workingSet.written, window.workingSet.touched * 512 / 1024.0);
+
+        if (showPatterns)
+            printPatterns(index, window, patternKind);
+
+        StrataQuery::GetHotStrata(window, metric, topCount, hot);
+        if (hot.empty())
+            continue;
+
+        printf("  Hottest strata by %s:\n", metricName);
+        for (size_t i = 0; i < hot.size(); i++)
+            printf("  %4d. 0x%08x-0x%08x %12llu bytes %6.2f%%\n", (int) i + 1,
+                   (unsigned) index.GetStratumFirstAddress(hot[i].stratum),
+                   (unsigned) index.GetStratumLastAddress(hot[i].stratum),
+                   (unsigned long long) hot[i].bytes,
+                   total ? hot[i].bytes * 100.0 / total : 0.0);
+    }
+}
+
+
+static bool
+writeWindows(StrataQuery &query, std::vector<StrataQuery::Window> &windows,
+             const char *path, bool columnar)
+{
+    bool toStdout = !strcmp(path, "-");
+    FILE *file = toStdout ? stdout : fopen(path, columnar ? "wb" : "w");
+    if (!file) {
+        fprintf(stderr, "Can't open '%s' for writing\n", path);
+        return false;
+    }
+
+    bool ok = columnar ? query.WriteColumnar(file, windows) : query.WriteCSV(file, windows);
+    if (!toStdout && fclose(file))
+        ok = false;
+
+    if (!ok)
+        fprintf(stderr, "Error writing '%s'\n", path);
+    return ok;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    long long timeBegin = 0, timeEnd = -1;
+    int numWindows = 1;
+    int topCount = 10;
+    int numThreads = 0;
+    const char *metricName = "total";
+    const char *csvPath = NULL;
+    const char *columnarPath = NULL;
+    StrataQuery::Metric metric = StrataQuery::TOTAL;
+    bool showPatterns = false;
+    AccessPattern::Kind patternKind = AccessPattern::NUM_KINDS;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:n:k:m:p:c:b:j:h")) != -1) {
+        switch (c) {
+        case 't':
+            if (sscanf(optarg, "%lld:%lld", &timeBegin, &timeEnd) != 2 || timeEnd <= timeBegin) {
+                fprintf(stderr, "Bad time range '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'n': numWindows = std::max(1, atoi(optarg)); break;
+        case 'k': topCount = std::max(0, atoi(optarg)); break;
+        case 'm':
+            if (!parseMetric(optarg, metric)) {
+                fprintf(stderr, "Unknown metric '%s'\n", optarg);
+                return 1;
+            }
+            metricName = optarg;
+            break;
+        case 'p':
+            if (!parsePatternKind(optarg, patternKind)) {
+                fprintf(stderr, "Unknown access pattern '%s'\n", optarg);
+                return 1;
+            }
+            showPatterns = true;
+            break;
+        case 'c': csvPath = optarg; break;
+        case 'b': columnarPath = optarg; break;
+        case 'j': numThreads = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *logPath = argv[optind];
+
+    wxInitializer initializer;
+    if (!initializer.IsOk()) {
+        fprintf(stderr, "Failed to initialize wxWidgets\n");
+        return 1;
+    }
+
+    LogReader reader;
+    LogIndex index;
+
+    if (!openLogIndex(logPath, reader, index))
+        return 1;
+
+    if (timeEnd < 0)
+        timeEnd = index.GetDuration();
+
+    StrataQuery query(&index);
+    std::vector<StrataQuery::Window> windows;
+    query.GetEvenWindows(timeBegin, timeEnd, numWindows, windows, 0, numThreads);
+
+    bool csvToStdout = csvPath && !strcmp(csvPath, "-");
+    bool columnarToStdout = columnarPath && !strcmp(columnarPath, "-");
+
+    if (csvToStdout && columnarToStdout) {
+        fprintf(stderr, "Only one of -c and -b can write to stdout\n");
+        return 1;
+    }
+
+    if (!csvToStdout && !columnarToStdout)
+        printReport(index, windows, metric, metricName, topCount,
+                    showPatterns, patternKind);
+
+    if (csvPath && !writeWindows(query, windows, csvPath, false))
+        return 1;
+    if (columnarPath && !writeWindows(query, windows, columnarPath, true))
+        return 1;
+
+    return 0;
+}
@@ -26,8 +26,11 @@
 #include <wx/dcbuffer.h>
 #include <boost/bind.hpp>
 #include <algorithm>
+#include <stdio.h>
 #include <string.h>
+#include <sys/time.h>
 #include "thd_timeline.h"
+#include "trace_event.h"
 
 #define ID_REFRESH_TIMER  1
 
@@ -42,15 +45,20 @@ BEGIN_EVENT_TABLE(THDTimeline, wxPanel)
 END_EVENT_TABLE()
 
 
-bool operator == (SliceKey const &a, SliceKey const &b)
+// Zoom step for one click of the mouse wheel
+static const double WHEEL_ZOOM_FACTOR = 1.2;
+
+static bool sliceEndLess(SliceKey const &a, SliceKey const &b)
 {
-    return a.begin == b.begin && a.end == b.end;
+    return a.end < b.end;
 }
 
-std::size_t hash_value(SliceKey const &k)
+// Wallclock time in microseconds, for the stats overlay
+static double usecNow()
 {
-    boost::hash<uint64_t> intHasher;
-    return intHasher(k.begin);
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
 }
 
 
@@ -58,22 +66,49 @@ THDTimeline::THDTimeline(wxWindow *_parent, THDModel *_model)
     : wxPanel(_parent, wxID_ANY, wxPoint(0, 0), wxSize(800, SLICE_HEIGHT)),
       model(_model),
       index(_model->index),
+      renderer(_model->index),
       sliceGenerator(this),
-      sliceCache(SLICE_CACHE_SIZE, &sliceGenerator),
+      sliceCache(SLICE_CACHE_SIZE, &sliceGenerator,
+                 std::max(1, wxThread::GetCPUCount())),
       refreshTimer(this, ID_REFRESH_TIMER),
       allocated(false),
       slicesDirty(true),
       needSliceEnqueue(true),
+      prefetchQueued(false),
       isDragging(false),
-      hasFocus(false)
+      hasFocus(false),
+      showStats(false),
+      showPatterns(false),
+      patternsDirty(true),
+      viewedAhead(false),
+      segmentGeneration(0),
+      patternsTime(0)
 {
     SetBackgroundStyle(wxBG_STYLE_CUSTOM);
+    TraceLog::setThreadName("UI");
+
+    lastSweepBegin.begin = lastSweepBegin.end = 0;
+    lastSweepBegin.addrBegin = lastSweepBegin.addrEnd = 0;
+    lastSweepEnd = lastSweepBegin;
+
+    sweepThread = new SweepThread(this);
+    sweepThread->Create();
+    sweepThread->Run();
 
     // Attach model signals
     model->cursorChanged.connect(boost::bind(&THDTimeline::modelCursorChanged, this));
 }
 
 
+THDTimeline::~THDTimeline()
+{
+    // The sweep thread writes into sliceCache, so it must go first.
+    sweepThread->stop();
+    sweepThread->Wait();
+    delete sweepThread;
+}
+
+
 void
 THDTimeline::OnMouseEvent(wxMouseEvent &event)
 {
@@ -90,8 +125,12 @@ THDTimeline::OnMouseEvent(wxMouseEvent &event)
         isDragging = false;
     }
 
-    if (event.Dragging() && cursor.x != dragOrigin.x) {
-        pan(dragOrigin.x - cursor.x);
+    if (event.Dragging() && cursor != dragOrigin) {
+        // Drag horizontally to pan through time, vertically to pan through memory.
+        if (cursor.x != dragOrigin.x)
+            pan(dragOrigin.x - cursor.x);
+        if (cursor.y != dragOrigin.y)
+            panAddress(dragOrigin.y - cursor.y);
         dragOrigin = cursor;
         isDragging = true;
     }
@@ -112,15 +151,21 @@ THDTimeline::OnMouseEvent(wxMouseEvent &event)
         if (event.GetWheelRotation() > 0)
             pan(-WHEEL_PAN);
 
+    } else if (event.ControlDown()) {
+        // Ctrl-wheel: Zooming the address axis
+
+        if (event.GetWheelRotation() < 0)
+            zoomAddress(WHEEL_ZOOM_FACTOR, cursor.y);
+        if (event.GetWheelRotation() > 0)
+            zoomAddress(1 / WHEEL_ZOOM_FACTOR, cursor.y);
+
     } else {
         // Wheel: Zooming
 
-        static const double ZOOM_FACTOR = 1.2;
-
         if (event.GetWheelRotation() < 0)
-            zoom(ZOOM_FACTOR, cursor.x);
+            zoom(WHEEL_ZOOM_FACTOR, cursor.x);
         if (event.GetWheelRotation() > 0)
-            zoom(1 / ZOOM_FACTOR, cursor.x);
+            zoom(1 / WHEEL_ZOOM_FACTOR, cursor.x);
     }
 
     if (event.Leaving()) {
@@ -152,9 +197,26 @@ THDTimeline::zoom(double factor, int xPivot)
      * image buffer and bufferAges.
      */
 
-    ClockType newScale = view.scale * factor + 0.5;
     TimelineView oldView = view;
 
+    view = getZoomedView(factor, xPivot);
+
+    viewChanged();
+    updateBitmapForViewChange(oldView, view);
+}
+
+
+TimelineView
+THDTimeline::getZoomedView(double factor, int xPivot)
+{
+    /*
+     * Work out the view that zoom() would switch to, without
+     * clamping it yet.
+     */
+
+    ClockType newScale = view.scale * factor + 0.5;
+    TimelineView newView = view;
+
     /*
      * If scale is very small (single-digits) the multiplicative zoom
      * may not change it by a whole number. In these cases, make sure it
@@ -175,11 +237,10 @@ THDTimeline::zoom(double factor, int xPivot)
     if (newScale > maxScale)
         newScale = maxScale;
 
-    view.origin += xPivot * (view.scale - newScale);
-    view.scale = newScale;
+    newView.origin += xPivot * (view.scale - newScale);
+    newView.scale = newScale;
 
-    viewChanged();
-    updateBitmapForViewChange(oldView, view);
+    return newView;
 }
 
 
@@ -262,14 +323,93 @@ THDTimeline::panTo(ClockType focus)
 }
 
 
+void
+THDTimeline::zoomAddress(double factor, int yPivot)
+{
+    /*
+     * Zoom the address axis in/out, keeping the address at 'yPivot'
+     * (in pixels from the top of the widget) in place. Zoomed in far
+     * enough, the SliceRenderer switches from strata to 2 kB and then
+     * 512-byte buckets, which the index keeps for just this purpose.
+     */
+
+    int row = std::max(0, std::min(SLICE_STRATA_ROWS, yPivot - SLICE_STRATA_TOP));
+
+    int64_t span = (int64_t)view.addrEnd - view.addrBegin;
+    int64_t pivot = view.addrBegin + span * row / SLICE_STRATA_ROWS;
+    int64_t newSpan = span * factor + 0.5;
+
+    setAddressRange(pivot - newSpan * row / SLICE_STRATA_ROWS, newSpan);
+}
+
+
+void
+THDTimeline::panAddress(int pixels)
+{
+    /*
+     * Slide the address axis. Moves the graph up by 'pixels', which
+     * may be negative.
+     */
+
+    int64_t span = (int64_t)view.addrEnd - view.addrBegin;
+    setAddressRange(view.addrBegin + span * pixels / SLICE_STRATA_ROWS, span);
+}
+
+
+void
+THDTimeline::panToAddress(AddressType focus)
+{
+    // If 'focus' is out of view, center it without changing the zoom.
+
+    if (focus >= view.addrBegin && focus < view.addrEnd)
+        return;
+
+    int64_t span = (int64_t)view.addrEnd - view.addrBegin;
+    setAddressRange((int64_t)focus - span / 2, span);
+}
+
+
+void
+THDTimeline::showAllAddresses()
+{
+    setAddressRange(0, (AddressType) -1);
+}
+
+
+void
+THDTimeline::setAddressRange(int64_t begin, int64_t span)
+{
+    /*
+     * Common part of all vertical zooming and panning. The range is
+     * clamped by viewChanged(). Every column has to be redrawn, but
+     * updateBitmapForViewChange() keeps the old pixels on screen
+     * until the new ones arrive.
+     */
+
+    TimelineView oldView = view;
+
+    begin = std::max<int64_t>(0, begin);
+    span = std::max<int64_t>(1, span);
+
+    view.addrBegin = std::min<int64_t>(begin, (AddressType) -1);
+    view.addrEnd = std::min<int64_t>(begin + span, (AddressType) -1);
+
+    if (view.addrBegin == oldView.addrBegin && view.addrEnd == oldView.addrEnd)
+        return;
+
+    viewChanged();
+    updateBitmapForViewChange(oldView, view);
+}
+
+
 void
 THDTimeline::updateBitmapForViewChange(TimelineView &oldView, TimelineView &newView)
 {
     /*
-     * Update the bufferBitmap and bufferAges to account for a view change.
-     * Every column in the new view is populated using the closest available
-     * column in the old view, or it is explicitly expired if no matching
-     * column is available.
+     * Update the bufferBitmap, bufferAges, and bufferQuality to account
+     * for a view change. Every column in the new view is populated
+     * using the closest available column in the old view, or it is
+     * explicitly expired if no matching column is available.
      *
      * This is a generalization of the buffer update we perform for
      * both zooming and panning. It's not the most efficient thing
@@ -293,8 +433,19 @@ THDTimeline::updateBitmapForViewChange(TimelineView &oldView, TimelineView &newV
     ClockType clock = newView.origin;
     std::vector<uint8_t> newAges(width);
     std::vector<uint32_t> newCookies(width);
+    std::vector<uint8_t> newQuality(width);
     std::vector<int> oldColumns(width);
 
+    /*
+     * Columns moved by a pan are still exactly right. After a zoom,
+     * or any change to the address range, they're only a rough
+     * stand-in, and anything we can render for the new view (even a
+     * coarse slice) is an improvement.
+     */
+    bool sameScale = (newView.scale == oldView.scale &&
+                      newView.addrBegin == oldView.addrBegin &&
+                      newView.addrEnd == oldView.addrEnd);
+
     for (int col = 0; col < width; col++) {
         int64_t oldClock = clock - oldView.origin + (oldView.scale >> 1);
         int oldCol = oldClock / (int64_t)oldView.scale;
@@ -303,12 +454,14 @@ THDTimeline::updateBitmapForViewChange(TimelineView &oldView, TimelineView &newV
             // No corresponding old column
             newAges[col] = 0xFF;
             newCookies[col] = 0;
+            newQuality[col] = QUALITY_NONE;
             oldColumns[col] = -1;
 
         } else {
             // Transfer the old column
             newAges[col] = bufferAges[oldCol];
             newCookies[col] = bufferCookies[oldCol];
+            newQuality[col] = sameScale ? bufferQuality[oldCol] : QUALITY_NONE;
             oldColumns[col] = oldCol;
         }
 
@@ -317,6 +470,7 @@ THDTimeline::updateBitmapForViewChange(TimelineView &oldView, TimelineView &newV
 
     bufferAges = newAges;
     bufferCookies = newCookies;
+    bufferQuality = newQuality;
 
     /*
      * Step 2: Make a new image for the buffer bitmap, resampling it from the
@@ -352,11 +506,44 @@ THDTimeline::updateBitmapForViewChange(TimelineView &oldView, TimelineView &newV
 void
 THDTimeline::OnPaint(wxPaintEvent &event)
 {
+    TraceScope trace("THDTimeline::OnPaint");
     wxAutoBufferedPaintDC dc(this);
+    double paintStart = usecNow();
+    double renderTime = 0;
 
     int width, height;
     GetSize(&width, &height);
 
+    /*
+     * Once the index is finished, slices can be kept on disk for
+     * the next time this log is opened.
+     */
+
+    if (!diskCache.IsOpen() && index->GetState() == index->COMPLETE)
+        diskCache.Open(index);
+
+    /*
+     * Slices drawn past the end of a partial index came from priority
+     * segments, or from nothing at all. Redraw them whenever the
+     * segments change, and once more when indexing finishes.
+     */
+
+    int generation = index->GetSegmentGeneration();
+    bool finished = viewedAhead && index->GetState() == index->COMPLETE;
+
+    if (generation != segmentGeneration || finished) {
+        sliceCache.invalidate();
+        segmentGeneration = generation;
+
+        // Any sweep in progress is rendering stale data; start a new one.
+        lastSweepBegin.begin = lastSweepBegin.end = 0;
+        lastSweepBegin.addrBegin = lastSweepBegin.addrEnd = 0;
+        lastSweepEnd = lastSweepBegin;
+        viewedAhead = viewedAhead && !finished;
+        slicesDirty = true;
+        needSliceEnqueue = true;
+    }
+
     /*
      * Step 1: Update the bufferBitmap, where we store fully rendered slices.
      *         This bitmap contains the graph proper, but not any overlays.
@@ -375,7 +562,9 @@ THDTimeline::OnPaint(wxPaintEvent &event)
             update++;
         }
 
+        double renderStart = usecNow();
         bool complete = renderSliceRange(bufferBitmap, minSlice, maxSlice);
+        renderTime = usecNow() - renderStart;
 
         /*
          * If we just evaluated every slice, we can use 'complete' to
@@ -386,6 +575,13 @@ THDTimeline::OnPaint(wxPaintEvent &event)
          */
         if (minSlice <= 0 && maxSlice >= width - 1) {
             slicesDirty = !complete;
+
+            // The view is finished. Guess what the user will want next.
+            if (complete && !prefetchQueued) {
+                diskCache.Flush();
+                prefetchNeighbours();
+                prefetchQueued = true;
+            }
         }
 
         /*
@@ -416,7 +612,15 @@ THDTimeline::OnPaint(wxPaintEvent &event)
         dc.DrawBitmap(bufferBitmap, 0, 0, false);
 
     /*
-     * Step 3: Draw overlay. This is a position indicator crosshair
+     * Step 3: Optional access pattern band, along the top of the
+     *         graph. Drawn directly, since it isn't part of any slice.
+     */
+
+    if (showPatterns)
+        paintPatterns(dc, width);
+
+    /*
+     * Step 4: Draw overlay. This is a position indicator crosshair
      *         plus some text. If the overlay was incomplete, give
      *         it an additional update.
      */
@@ -426,6 +630,16 @@ THDTimeline::OnPaint(wxPaintEvent &event)
 
     overlay.Paint(dc, hasFocus);
 
+    /*
+     * Step 5: Optional stats overlay. The time spent drawing it
+     *         counts toward the next frame.
+     */
+
+    if (showStats)
+        paintStats(dc);
+
+    countFrame(usecNow() - paintStart, renderTime);
+
     event.Skip();
 }
 
@@ -447,6 +661,9 @@ THDTimeline::renderSliceRange(pixelData_t &data, int xMin, int xMax)
     int focus = overlay.pos.x;
     bool complete = true;
 
+    if (needSliceEnqueue)
+        requestSweep(xMin, xMax);
+
     if (focus >= xMax) {
         // Focus past right edge: Render left to right
 
@@ -486,6 +703,9 @@ THDTimeline::renderSliceRange(pixelData_t &data, int xMin, int xMax)
         }
     }
 
+    if (needSliceEnqueue && !complete)
+        requestCoarseSlices(xMin, xMax);
+
     return complete;
 }
 
@@ -498,6 +718,142 @@ THDTimeline::renderSliceRange(wxBitmap &bmp, int xMin, int xMax)
 }
 
 
+void
+THDTimeline::requestSweep(int xMin, int xMax)
+{
+    /*
+     * If a lot of the slices in this range are missing, generate
+     * them in bulk on the SweepThread. Each sliceCache worker does
+     * two random-access instant lookups per slice, which is what
+     * makes cold-cache repaints slow; the sweep visits the same
+     * boundaries in one sequential pass.
+     *
+     * We're called on every enqueueing paint, which includes every
+     * paint during indexing. Don't restart a sweep that's already
+     * working on this same range.
+     */
+
+    SliceKey first = getSliceKeyForSubpixel(xMin, 0);
+    SliceKey last = getSliceKeyForSubpixel(xMax, SUBPIXEL_COUNT - 1);
+
+    // Slices that come from the strata pyramid are cheap already.
+    if (index->GetState() == index->COMPLETE &&
+        LogIndex::GetTileLevelForDistance((first.end - first.begin) >> 2) >= 0)
+        return;
+
+    if (first == lastSweepBegin && last == lastSweepEnd)
+        return;
+
+    std::vector<SliceKey> keys;
+
+    for (int x = xMin; x <= xMax; x++) {
+        for (int s = 0; s < SUBPIXEL_COUNT; s++) {
+            SliceKey key = getSliceKeyForSubpixel(x, s);
+            if (!sliceCache.get(key, false))
+                keys.push_back(key);
+        }
+    }
+
+    if (keys.size() < MIN_SWEEP_SLICES)
+        return;
+
+    lastSweepBegin = first;
+    lastSweepEnd = last;
+    sweepThread->request(keys);
+}
+
+
+void
+THDTimeline::requestCoarseSlices(int xMin, int xMax)
+{
+    /*
+     * Queue a coarse slice for every column that doesn't have
+     * precise data yet. These go in after the precise slices, so the
+     * workers get to them first, and there are only a few of them:
+     * each one covers COARSE_COUNT columns. So a rough version of the
+     * whole range shows up quickly, then it's refined in place.
+     *
+     * Like renderSliceRange(), go from the outside in, so the coarse
+     * slices nearest the focus are the newest.
+     */
+
+    int focus = std::max(xMin, std::min(xMax, overlay.pos.x));
+
+    for (int i = std::max(focus - xMin, xMax - focus); i >= 0; i--) {
+        int columns[] = { focus - i, focus + i };
+
+        for (int c = 0; c < (i ? 2 : 1); c++) {
+            int x = columns[c];
+            if (x >= xMin && x <= xMax && bufferQuality[x] != QUALITY_FINE)
+                sliceCache.get(getCoarseSliceKey(x));
+        }
+    }
+}
+
+
+void
+THDTimeline::prefetchNeighbours()
+{
+    /*
+     * Once the current view is completely drawn, the cache workers
+     * go idle. Put them to work on the views we're most likely to
+     * switch to next: one mouse wheel step in or out around the
+     * cursor, and half a screen of panning in either direction.
+     *
+     * This is all low-priority speculative work, which the cache
+     * drops as soon as any slice for a real view is missing. The
+     * newest requests run first, so queue the least likely slices
+     * first: pans before zooms, and within each view, columns far
+     * from the cursor before nearby ones. Together this is about
+     * three screens worth of slices, well within SLICE_CACHE_SIZE
+     * for any reasonable window.
+     */
+
+    int width, height;
+    GetSize(&width, &height);
+
+    int focus = std::max(0, std::min(width - 1, overlay.pos.x));
+    int halfWidth = width / 2;
+
+    for (int x = -halfWidth; x < 0; x++)
+        prefetchColumn(view, x);
+    for (int x = width + halfWidth - 1; x >= width; x--)
+        prefetchColumn(view, x);
+
+    TimelineView zoomOut = getZoomedView(WHEEL_ZOOM_FACTOR, focus);
+    TimelineView zoomIn = getZoomedView(1 / WHEEL_ZOOM_FACTOR, focus);
+    clampView(zoomOut);
+    clampView(zoomIn);
+
+    for (int i = std::max(focus, width - 1 - focus); i >= 0; i--) {
+        int columns[] = { focus - i, focus + i };
+
+        for (int c = 0; c < (i ? 2 : 1); c++) {
+            int x = columns[c];
+            if (x >= 0 && x < width) {
+                prefetchColumn(zoomOut, x);
+                prefetchColumn(zoomIn, x);
+            }
+        }
+    }
+}
+
+
+void
+THDTimeline::prefetchColumn(const TimelineView &v, int x)
+{
+    // Skip columns outside the log, as when we're panned to one end.
+    int64_t clock = (int64_t)v.origin + (int64_t)v.scale * x;
+    if (clock < 0 || clock >= (int64_t)index->GetEstimatedDuration())
+        return;
+
+    for (int s = 0; s < SUBPIXEL_COUNT; s++)
+        sliceCache.prefetch(SliceRenderer::getSliceKeyForSubpixel(v.origin, v.scale,
+                                                                  v.addrBegin, v.addrEnd,
+                                                                  x, s));
+}
+
+
 void
 THDTimeline::updateRefreshTimer(bool waitingForData)
 {
@@ -519,6 +875,10 @@ THDTimeline::updateRefreshTimer(bool waitingForData)
              * no longer need.
              */
             sliceCache.quiesce();
+
+            // Keep the stats overlay ticking along, slowly.
+            if (showStats)
+                refreshTimer.Start(1000 / STATS_FPS, wxTIMER_ONE_SHOT);
         }
     }
 }
@@ -552,8 +912,7 @@ THDTimeline::updateOverlay(THDTimelineOverlay::style_t style)
         if (cursor.y >= SLICE_STRATA_TOP && cursor.y < SLICE_STRATA_BOTTOM) {
             // Cursor is in strata range. Show address.
 
-            StrataRange strata = getStrataRangeForPixel(cursor.y);
-            AddressType addr = index->GetStratumFirstAddress(strata.begin);
+            AddressType addr = renderer.getAddressForPixel(sliceKey, cursor.y);
             newOverlay.addLabel(wxString::Format(wxT("0x%08x"), addr));
         }
 
@@ -616,7 +975,11 @@ THDTimeline::updateOverlay(THDTimelineOverlay::style_t style)
             // Park just out of view.
             newOverlay.pos.y = -2;
         } else {
-            newOverlay.pos.y = getPixelForAddress(model->cursor.address);
+            if (model->cursor.address >= view.addrBegin &&
+                model->cursor.address < view.addrEnd)
+                newOverlay.pos.y = getPixelForAddress(model->cursor.address);
+            else
+                newOverlay.pos.y = -2;
             newOverlay.addLabel(wxString::Format(wxT("0x%08x"), model->cursor.address));
         }
 
@@ -640,71 +1003,271 @@ THDTimeline::updateOverlay(THDTimelineOverlay::style_t style)
 }
 
 
-SliceKey
-THDTimeline::getSliceKeyForPixel(int x)
+THDTimeline::Stats::Stats()
+    : sampleTime(usecNow()),
+      frames(0),
+      paintTime(0),
+      paintMax(0),
+      renderTime(0),
+      totalFrames(0),
+      totalPaintTime(0),
+      totalRenderTime(0)
 {
-    ClockType clk = view.origin + view.scale * x;
-    SliceKey key = { clk, clk + view.scale };
-    return key;
+    memset(&slices, 0, sizeof slices);
+    memset(&prefetch, 0, sizeof prefetch);
+    memset(&index, 0, sizeof index);
 }
 
 
-SliceKey
-THDTimeline::getSliceKeyForSubpixel(int x, int subpix)
+void
+THDTimeline::countFrame(double paintTime, double renderTime)
 {
-    ClockType clk = view.origin + view.scale * x;
-    clk <<= SUBPIXEL_SHIFT;
-    clk += view.scale * subpix;
-    SliceKey key = { clk >> SUBPIXEL_SHIFT, (clk + view.scale) >> SUBPIXEL_SHIFT };
-    return key;
+    stats.frames++;
+    stats.paintTime += paintTime;
+    stats.paintMax = std::max(stats.paintMax, paintTime);
+    stats.renderTime += renderTime;
+
+    stats.totalFrames++;
+    stats.totalPaintTime += paintTime;
+    stats.totalRenderTime += renderTime;
+
+    double now = usecNow();
+    if (now - stats.sampleTime >= STATS_INTERVAL * 1000.0)
+        sampleStats(now);
 }
 
 
-StrataRange
-THDTimeline::getStrataRangeForPixel(int y)
+static wxString
+formatHits(uint64_t hits, uint64_t lookups)
 {
-    // TODO: Eventually the first/last strata will be dynamic, so we can zoom in.
-    const int strataBegin = 0;
-    const int strataEnd = index->GetNumStrata();
+    if (!lookups)
+        return wxT("-");
+    return wxString::Format(wxT("%.1f%% of %llu"), hits * 100.0 / lookups,
+                            (unsigned long long) lookups);
+}
 
-    const int pixelHeight = SLICE_STRATA_BOTTOM - SLICE_STRATA_TOP;
-    const int strataCount = strataEnd - strataBegin;
 
-    y -= SLICE_STRATA_TOP;
+void
+THDTimeline::sampleStats(double now)
+{
+    /*
+     * Everything on the overlay covers just the last interval, except
+     * for the longest walk, which LogIndex only tracks overall.
+     */
 
-    StrataRange range;
+    sliceCache_t::CacheStats slices = sliceCache.GetCacheStats();
+    sliceCache_t::PrefetchStats prefetch = sliceCache.GetPrefetchStats();
+    LogIndex::CacheStats idx = index->GetCacheStats();
+    sliceCache_t::CacheStats &ps = stats.slices;
+    sliceCache_t::PrefetchStats &pp = stats.prefetch;
+    LogIndex::CacheStats &pi = stats.index;
+    double seconds = (now - stats.sampleTime) / 1e6;
+
+    uint64_t walks = idx.instantWalks - pi.instantWalks;
+    uint64_t walked = idx.walkTransfers - pi.walkTransfers;
+
+    stats.labels.clear();
+    stats.labels.push_back(wxString::Format(
+        wxT("Paint: %.1f ms avg, %.1f ms max, slices %.1f ms avg (%d frames)"),
+        stats.paintTime / stats.frames / 1000.0, stats.paintMax / 1000.0,
+        stats.renderTime / stats.frames / 1000.0, stats.frames));
+    stats.labels.push_back(wxString::Format(
+        wxT("Slices: %.0f/s, %d queued, %d speculative, %d running"),
+        (slices.generated - ps.generated) / seconds,
+        slices.queued, slices.speculativeQueued, slices.inFlight));
+    stats.labels.push_back(wxT("Slice cache: ") +
+        formatHits(slices.hits - ps.hits,
+                   slices.hits + slices.misses - ps.hits - ps.misses));
+    stats.labels.push_back(wxT("Prefetch used: ") +
+        formatHits(prefetch.hits - pp.hits, prefetch.generated - pp.generated) +
+        wxString::Format(wxT(", %llu evicted unused, %llu cancelled"),
+                         (unsigned long long) (prefetch.evicted - pp.evicted),
+                         (unsigned long long) (prefetch.cancelled - pp.cancelled)));
+    stats.labels.push_back(wxT("Instant cache: ") +
+        formatHits(idx.instantHits - pi.instantHits,
+                   idx.instantLookups - pi.instantLookups) +
+        wxString::Format(wxT(", %llu timesteps read"),
+                         (unsigned long long) (idx.instantQueries - pi.instantQueries)));
+    stats.labels.push_back(wxString::Format(
+        wxT("Log walks: %llu, %.0f transfers avg, %llu max"),
+        (unsigned long long) walks, walks ? walked / (double)walks : 0.0,
+        (unsigned long long) idx.walkMax));
+    stats.labels.push_back(wxT("Transfer cache: ") +
+        formatHits(idx.transferHits - pi.transferHits,
+                   idx.transferLookups - pi.transferLookups) +
+        wxT(", tile cache: ") +
+        formatHits(idx.tileHits - pi.tileHits, idx.tileLookups - pi.tileLookups));
+
+    stats.slices = slices;
+    stats.prefetch = prefetch;
+    stats.index = idx;
+    stats.sampleTime = now;
+    stats.frames = 0;
+    stats.paintTime = 0;
+    stats.paintMax = 0;
+    stats.renderTime = 0;
+}
 
-    range.begin = (y * strataCount + pixelHeight/2) / pixelHeight;
-    range.end = ((y+1) * strataCount + pixelHeight/2) / pixelHeight;
 
-    return range;
+void
+THDTimeline::paintStats(wxDC &dc)
+{
+    static const int MARGIN = 4;
+    static const int PAD = 3;
+
+    wxCoord width = 0, height = 0;
+    for (std::vector<wxString>::iterator i = stats.labels.begin();
+         i != stats.labels.end(); i++) {
+        wxCoord w, h;
+        dc.GetTextExtent(*i, &w, &h);
+        width = std::max(width, w);
+        height += h;
+    }
+
+    if (!height)
+        return;
+
+    dc.SetBrush(wxBrush(ColorRGB(COLOR_BOX_BG), wxSOLID));
+    dc.SetPen(wxPen(ColorRGB(COLOR_BOX_BORDER), 1, wxSOLID));
+    dc.DrawRectangle(MARGIN, MARGIN, width + PAD * 2, height + PAD * 2);
+
+    int y = MARGIN + PAD;
+    for (std::vector<wxString>::iterator i = stats.labels.begin();
+         i != stats.labels.end(); i++) {
+        wxCoord h;
+        dc.DrawText(*i, MARGIN + PAD, y);
+        dc.GetTextExtent(*i, NULL, &h);
+        y += h;
+    }
 }
 
 
-int
-THDTimeline::getPixelForClock(ClockType clock)
+void
+THDTimeline::paintPatterns(wxDC &dc, int width)
 {
-    return (clock - view.origin + view.scale / 2) / view.scale;
+    /*
+     * One row per kind of access pattern, with a bar for each run in
+     * view. Runs that start in the same pixel column are merged, so
+     * the lookup returns at most a few spans per column however far
+     * out we're zoomed. Look them up again when the view changes, and
+     * every PATTERN_INTERVAL while the indexer may still be adding
+     * new ones.
+     */
+
+    static const int colors[AccessPattern::NUM_KINDS] = {
+        COLOR_SEQUENTIAL, COLOR_STRIDED, COLOR_POLLING,
+    };
+
+    double now = usecNow();
+
+    if (patternsDirty || (index->GetState() != LogIndex::COMPLETE &&
+                          now - patternsTime >= PATTERN_INTERVAL * 1000.0)) {
+        index->GetAccessPatternSpans(view.origin, view.origin + view.scale * width,
+                                     view.scale, patterns);
+        patternsDirty = false;
+        patternsTime = now;
+    }
+
+    dc.SetPen(*wxTRANSPARENT_PEN);
+
+    for (int kind = 0; kind < AccessPattern::NUM_KINDS; kind++) {
+        dc.SetBrush(wxBrush(ColorRGB(colors[kind]), wxSOLID));
+
+        for (std::vector<AccessPattern>::iterator i = patterns.begin();
+             i != patterns.end(); i++) {
+            if (i->kind != kind)
+                continue;
+
+            int x0 = getPixelForClock(i->beginTime);
+            int x1 = std::max(x0 + 1, getPixelForClock(i->endTime));
+            dc.DrawRectangle(x0, kind * PATTERN_ROW_HEIGHT, x1 - x0, PATTERN_ROW_HEIGHT);
+        }
+    }
 }
 
 
-int
-THDTimeline::getPixelForStratum(int s)
+void
+THDTimeline::dumpStats()
 {
-    const int strataBegin = 0;
-    const int strataEnd = index->GetNumStrata();
+    /*
+     * One line of space-separated name=value pairs on stdout. All
+     * counters are totals since startup, so two dumps can be
+     * subtracted to measure any stretch of interaction.
+     */
+
+    sliceCache_t::CacheStats slices = sliceCache.GetCacheStats();
+    sliceCache_t::PrefetchStats prefetch = sliceCache.GetPrefetchStats();
+    LogIndex::CacheStats idx = index->GetCacheStats();
+
+    printf("thd-stats time=%.0f frames=%llu paint_us=%.0f render_us=%.0f "
+           "slice_hits=%llu slice_misses=%llu slices_generated=%llu "
+           "slice_queued=%d slice_speculative=%d slice_running=%d "
+           "prefetch_generated=%llu prefetch_hits=%llu "
+           "prefetch_evicted=%llu prefetch_cancelled=%llu "
+           "instant_lookups=%llu instant_hits=%llu instant_queries=%llu "
+           "instant_walks=%llu walk_transfers=%llu walk_max=%llu "
+           "transfer_lookups=%llu transfer_hits=%llu "
+           "tile_lookups=%llu tile_hits=%llu\n",
+           usecNow(), (unsigned long long) stats.totalFrames,
+           stats.totalPaintTime, stats.totalRenderTime,
+           (unsigned long long) slices.hits, (unsigned long long) slices.misses,
+           (unsigned long long) slices.generated,
+           slices.queued, slices.speculativeQueued, slices.inFlight,
+           (unsigned long long) prefetch.generated, (unsigned long long) prefetch.hits,
+           (unsigned long long) prefetch.evicted, (unsigned long long) prefetch.cancelled,
+           (unsigned long long) idx.instantLookups, (unsigned long long) idx.instantHits,
+           (unsigned long long) idx.instantQueries, (unsigned long long) idx.instantWalks,
+           (unsigned long long) idx.walkTransfers, (unsigned long long) idx.walkMax,
+           (unsigned long long) idx.transferLookups, (unsigned long long) idx.transferHits,
+           (unsigned long long) idx.tileLookups, (unsigned long long) idx.tileHits);
+    fflush(stdout);
+}
+
+
+SliceKey
+THDTimeline::getSliceKeyForPixel(int x)
+{
+    ClockType clk = view.origin + view.scale * x;
+    SliceKey key = { clk, clk + view.scale, view.addrBegin, view.addrEnd };
+    return key;
+}
+
+
+SliceKey
+THDTimeline::getSliceKeyForSubpixel(int x, int subpix)
+{
+    return SliceRenderer::getSliceKeyForSubpixel(view.origin, view.scale,
+                                                 view.addrBegin, view.addrEnd, x, subpix);
+}
+
+
+SliceKey
+THDTimeline::getCoarseSliceKey(int x)
+{
+    /*
+     * Coarse slices are aligned to multiples of their own width
+     * rather than to the view origin, so they stay useful while
+     * panning at the same scale.
+     */
+
+    ClockType width = view.scale << COARSE_SHIFT;
+    ClockType begin = (view.origin + view.scale * x) / width * width;
+    SliceKey key = { begin, begin + width, view.addrBegin, view.addrEnd };
+    return key;
+}
 
-    const int pixelHeight = SLICE_STRATA_BOTTOM - SLICE_STRATA_TOP;
-    const int strataCount = strataEnd - strataBegin;
 
-    return (s - strataBegin) * pixelHeight / strataCount + SLICE_STRATA_TOP;
+int
+THDTimeline::getPixelForClock(ClockType clock)
+{
+    return (clock - view.origin + view.scale / 2) / view.scale;
 }
 
 
 int
 THDTimeline::getPixelForAddress(AddressType addr)
 {
-    return getPixelForStratum(index->GetStratumForAddress(addr));
+    return renderer.getPixelForAddress(getSliceKeyForPixel(0), addr);
 }
 
 
@@ -714,24 +1277,23 @@ THDTimeline::renderSlice(pixelData_t &data, int x)
     /*
      * Render one vertical slice to the provided data buffer.
      * If the slice is available, returns true. If no data
-     * is ready yet, draws placeholder data and returns false.
+     * is ready yet, draws a coarse approximation or placeholder
+     * data and returns false.
      */
 
-    pixelData_t::Iterator pixOut(data);
-    pixOut.OffsetX(data, x);
-
     /*
      * Get this pixel's slices from the cache, and merge them into
      * the bufferBitmap.
      */
 
     bool haveAllSlices = true;
-    ColorAccumulator acc[SLICE_HEIGHT];
+    SliceValue *slices[SUBPIXEL_COUNT];
     uint32_t sliceCookie = 0;
 
     for (int s = 0; s < SUBPIXEL_COUNT; s++) {
         SliceValue *slice = sliceCache.get(getSliceKeyForSubpixel(x, s),
                                            needSliceEnqueue);
+        slices[s] = slice;
 
         if (slice) {
             if (s == 0) {
@@ -745,95 +1307,44 @@ THDTimeline::renderSlice(pixelData_t &data, int x)
                 if (sliceCookie == bufferCookies[x])
                     return true;
             }
-
-            // Store this slice in the accumulator
-            for (int y = 0; y < SLICE_HEIGHT; y++) {
-                acc[y] += slice->pixels[y];
-            }
         } else {
             haveAllSlices = false;
         }
     }
 
-    TimelineGrid grid(this);
-
     if (haveAllSlices) {
-        bool xGrid = grid.testX(x);
+        paintColumn(data, x, slices);
 
-        for (int y = 0; y < SLICE_HEIGHT; y++) {
-            ColorAccumulator a = acc[y];
-            a >>= SUBPIXEL_SHIFT;
-            ColorRGB c(a);
+        // This slice is up to date
+        bufferAges[x] = 0;
+        bufferCookies[x] = sliceCookie;
+        bufferQuality[x] = QUALITY_FINE;
 
-            /*
-             * Edge emphasis:
-             *
-             * Our transfers are plotted as instantaneous events, so
-             * as you zoom into a single transfer, it gets very light
-             * and hard to see. We'd like to make individual transfers
-             * very visible, but to still preserve the visual
-             * intensity distinctions that arise from our
-             * supersampling and blending.
-             *
-             * This is a simple algorithm that tries to accomplish
-             * that goal:
-             *
-             *   - Any edge pixel (non-background color, bordered on either
-             *     side by background) is emphasized using ColorRGB::increaseContrast().
-             *     This can saturate the color and lose intensity precision, but it
-             *     makes the pixel easy to see.
-             *
-             *   - An edge pixel's original pre-emphasis color will
-             *     'bleed' onto the neighbouring background
-             *     pixel(s). This makes the pixel easier to see still,
-             *     plus it restores some of the lost intensity
-             *     resolution, since very intense original pixels will
-             *     now be even darker, whereas very light original
-             *     pixels will see little effect from the color bleed.
-             */
-            {
-                static const float EMPHASIS = 4.0f;
-
-                ColorAccumulator above = acc[std::max(0,y-1)];
-                ColorAccumulator below = acc[std::min(SLICE_HEIGHT-1,y+1)];
-
-                above >>= SUBPIXEL_SHIFT;
-                below >>= SUBPIXEL_SHIFT;
-
-                ColorRGB ca(above);
-                ColorRGB cb(below);
-
-                if (c.value == COLOR_BG_TOP) {
-                    // This is a background pixel
-
-                    if (ca.value != COLOR_BG_TOP) {
-                        // Bleed color from the pixel above
-                        c = ca;
-                    } else if (cb.value != COLOR_BG_TOP) {
-                        // Bleed color from the pixel below
-                        c = cb;
-                    }
-                } else if (ca.value == COLOR_BG_TOP || cb.value == COLOR_BG_TOP) {
-                    // This pixel is an edge. Emphasize it.
-                    c = c.increaseContrast(COLOR_BG_TOP, EMPHASIS);
-                }
-            }
+        return true;
+    }
 
-            // Draw grid lines
-            if (xGrid)
-                c = c.blend(COLOR_GRID);
+    /*
+     * Until the precise slices arrive, fill in with this column's
+     * coarse slice if we have it. It's stretched over several columns,
+     * but it's much better than a checkerboard. Don't let it replace
+     * precise data we already have, though, such as columns kept
+     * after a pan.
+     */
 
-            pixOut.Red() = c.red();
-            pixOut.Green() = c.green();
-            pixOut.Blue() = c.blue();
-            pixOut.OffsetY(data, 1);
+    SliceValue *coarse = sliceCache.get(getCoarseSliceKey(x), false);
+
+    if (coarse && bufferQuality[x] <= QUALITY_COARSE) {
+        if (bufferQuality[x] != QUALITY_COARSE || bufferCookies[x] != coarse->cookie) {
+            SliceValue *stretched[SUBPIXEL_COUNT];
+            std::fill(stretched, stretched + SUBPIXEL_COUNT, coarse);
+            paintColumn(data, x, stretched);
         }
 
-        // This slice is up to date
         bufferAges[x] = 0;
-        bufferCookies[x] = sliceCookie;
+        bufferCookies[x] = coarse->cookie;
+        bufferQuality[x] = QUALITY_COARSE;
 
-        return true;
+        return false;
 
     } else {
         /*
@@ -854,6 +1365,11 @@ THDTimeline::renderSlice(pixelData_t &data, int x)
         } else {
             // Checkerboard
 
+            bufferQuality[x] = QUALITY_NONE;
+
+            pixelData_t::Iterator pixOut(data);
+            pixOut.OffsetX(data, x);
+
             for (int y = 0; y < SLICE_HEIGHT; y++) {
                 uint8_t shade = (x ^ y) & 8 ? SHADE_CHECKER_1 : SHADE_CHECKER_2;
                 pixOut.Red() = shade;
@@ -868,6 +1384,24 @@ THDTimeline::renderSlice(pixelData_t &data, int x)
 }
 
 
+void
+THDTimeline::paintColumn(pixelData_t &data, int x, SliceValue **slices)
+{
+    ColorRGB column[SLICE_HEIGHT];
+    SliceRenderer::composite(slices, TimelineGrid(this).testX(x), column);
+
+    pixelData_t::Iterator pixOut(data);
+    pixOut.OffsetX(data, x);
+
+    for (int y = 0; y < SLICE_HEIGHT; y++) {
+        pixOut.Red() = column[y].red();
+        pixOut.Green() = column[y].green();
+        pixOut.Blue() = column[y].blue();
+        pixOut.OffsetY(data, 1);
+    }
+}
+
+
 void
 THDTimeline::OnSize(wxSizeEvent &event)
 {
@@ -892,6 +1426,7 @@ THDTimeline::OnSize(wxSizeEvent &event)
          */
         bufferAges = std::vector<uint8_t>(roundedWidth, 0xFF);
         bufferCookies = std::vector<uint32_t>(roundedWidth, 0);
+        bufferQuality = std::vector<uint8_t>(roundedWidth, QUALITY_NONE);
 
         allocated = true;
     }
@@ -950,6 +1485,45 @@ THDTimeline::OnKeyDown(wxKeyEvent &event)
         updateOverlay(overlay.style);
         break;
 
+    case '[':
+        zoomAddress(ZOOM_FACTOR, overlay.pos.y);
+        updateOverlay(overlay.style);
+        break;
+
+    case ']':
+        zoomAddress(1 / ZOOM_FACTOR, overlay.pos.y);
+        updateOverlay(overlay.style);
+        break;
+
+    case WXK_HOME:
+        showAllAddresses();
+        updateOverlay(overlay.style);
+        break;
+
+    case WXK_END:
+        panTo(index->GetEstimatedDuration());
+        updateOverlay(overlay.style);
+        break;
+
+    case 'S':
+        showStats = !showStats;
+        Refresh();
+        break;
+
+    case 'D':
+        dumpStats();
+        break;
+
+    case 'P':
+        showPatterns = !showPatterns;
+        patternsDirty = true;
+        Refresh();
+        break;
+
+    case 'N':
+        model->cursorNextPattern(!event.ShiftDown());
+        break;
+
     default:
         event.Skip();
     }
@@ -975,6 +1549,8 @@ THDTimeline::modelCursorChanged()
      */
 
     panTo(model->cursor.time);
+    if (model->cursor.address != THDModelCursor::NO_ADDRESS)
+        panToAddress(model->cursor.address);
     updateOverlay(THDTimelineOverlay::STYLE_MODEL_CURSOR);
 }
 
@@ -985,39 +1561,80 @@ THDTimeline::viewChanged()
     /*
      * The view changed. We need to:
      *
-     *   1. Clamp the current TimelineView to the allowed range
+     *   1. Clamp the current TimelineView to the allowed ranges
      *   2. Remember to enqueue new slices to draw on the next paint
      *   3. Queue up a repaint
      */
 
-    ClockType duration = index->GetDuration();
+    clampView(view);
+
+    /*
+     * While indexing, ask the index to look ahead at whatever part
+     * of the log we're showing.
+     */
+
+    if (index->GetState() == LogIndex::INDEXING) {
+        int width, height;
+        GetSize(&width, &height);
+
+        ClockType end = view.origin + view.scale * width;
+        if (end > index->GetDuration())
+            viewedAhead = true;
+        index->SetPriorityRange(view.origin, end);
+    }
+
+    needSliceEnqueue = true;
+    slicesDirty = true;
+    prefetchQueued = false;
+    patternsDirty = true;
+
+    Refresh();
+}
+
+
+void
+THDTimeline::clampView(TimelineView &v)
+{
+    ClockType duration = index->GetEstimatedDuration();
 
     int width, height;
     GetSize(&width, &height);
 
-    ClockType clkWidth = width * view.scale;
+    ClockType clkWidth = width * v.scale;
 
     if (duration > clkWidth) {
         // Clamp to end of log, if the log isn't smaller than the widget
 
         ClockType clkMax = duration - clkWidth;
 
-        if (view.origin > clkMax)
-            view.origin = clkMax;
+        if (v.origin > clkMax)
+            v.origin = clkMax;
 
         // Clamp to the beginning
-        if ((int64_t)view.origin < 0)
-            view.origin = 0;
+        if ((int64_t)v.origin < 0)
+            v.origin = 0;
 
     } else {
         // Log is smaller than the widget, always display it at the left side
-        view.origin = 0;
+        v.origin = 0;
     }
 
-    needSliceEnqueue = true;
-    slicesDirty = true;
+    /*
+     * Keep the address range within memory, and no narrower than one
+     * block per pixel row. We don't know the memory size until a log
+     * is open.
+     */
 
-    Refresh();
+    if (index->GetState() != LogIndex::IDLE) {
+        int64_t memSize = index->GetMemSize();
+        int64_t span = (int64_t)v.addrEnd - v.addrBegin;
+
+        span = std::max<int64_t>(span, SliceRenderer::MIN_ADDRESS_SPAN);
+        span = std::min<int64_t>(span, memSize);
+
+        v.addrBegin = std::min<int64_t>(v.addrBegin, memSize - span);
+        v.addrEnd = v.addrBegin + span;
+    }
 }
 
 
@@ -1028,119 +1645,181 @@ THDTimeline::SliceGenerator::fn(SliceKey &key, SliceValue &value)
      * Assign a unique cookie to this generated slice. This helps us
      * avoid duplication in our Paint handler by detecting which
      * slices are the same from frame to frame.
+     *
+     * We run on several LazyCache worker threads at once, so the
+     * cookie counter must be incremented atomically.
      */
-    value.cookie = nextCookie++;
+    TraceLog::setThreadName("Slice worker");
+    TraceScope trace("SliceGenerator::fn");
+
+    value.cookie = __sync_fetch_and_add(&nextCookie, 1);
 
     /*
-     * Retrieve cached LogInstants for the beginning and end of this slice.
+     * The disk cache only opens once the index is COMPLETE. Check
+     * first, so we never save a slice rendered from a partial index.
      */
 
-    // Allowable deviation from correct begin/end timestamps
-    ClockType fuzz = (key.end - key.begin) >> 2;
+    SliceDiskCache &diskCache = timeline->diskCache;
+    bool persistent = diskCache.IsOpen();
+
+    if (persistent && diskCache.Load(key, value))
+        return;
+
+    timeline->renderer.generate(key, value);
 
-    instantPtr_t begin = timeline->index->GetInstant(key.begin, fuzz);
-    instantPtr_t end = timeline->index->GetInstant(key.end, fuzz);
+    if (persistent)
+        diskCache.Store(key, value);
+}
 
-    int numStrata = timeline->index->GetNumStrata();
-    ClockType timeDiff = end->time - begin->time;
 
+void
+THDTimeline::SliceGenerator::fnBatch(std::vector<SliceKey> &keys,
+                                     SweepThread *sweeper, uint32_t generation,
+                                     int cacheEpoch)
+{
     /*
-     * Rescale the log strata to fit in the available pixels.
+     * Collect every slice boundary into one sorted list. Adjacent
+     * subpixel slices share a boundary, so for a contiguous run of
+     * slices this is only one longer than 'keys'. All keys come from
+     * the same view, so they're (almost exactly) the same width;
+     * use the smallest fuzz of any of them.
      */
 
-    int y;
-    for (y = 0; y < SLICE_STRATA_TOP; y++)
-        value.pixels[y] = COLOR_BG_TOP;
+    TraceScope trace("SliceGenerator::fnBatch");
+    SliceDiskCache &diskCache = timeline->diskCache;
+    bool persistent = diskCache.IsOpen();
 
-    for (; y < SLICE_STRATA_BOTTOM; y++) {
-        /*
-         * Which log stratum is the bottom of this pixel in?
-         */
+    if (persistent) {
+        // Anything we rendered in an earlier session only needs loading.
 
-        uint64_t readDelta = 0;
-        uint64_t writeDelta = 0;
-        uint64_t zeroDelta = 0;
+        std::vector<SliceKey> missing;
+        SliceValue value;
 
-        StrataRange range = timeline->getStrataRangeForPixel(y);
+        for (std::vector<SliceKey>::iterator i = keys.begin(); i != keys.end(); i++) {
+            if (diskCache.Load(*i, value)) {
+                value.cookie = __sync_fetch_and_add(&nextCookie, 1);
+                timeline->sliceCache.put(*i, value, cacheEpoch);
+            } else {
+                missing.push_back(*i);
+            }
 
-        for (int current = range.begin; current < range.end; current++) {
-            readDelta += end->readTotals.get(current) -
-                begin->readTotals.get(current);
-            writeDelta += end->writeTotals.get(current) -
-                begin->writeTotals.get(current);
-            zeroDelta += end->zeroTotals.get(current) -
-                begin->zeroTotals.get(current);
+            if (!sweeper->isCurrent(generation))
+                return;
         }
 
-        /*
-         * Calculate a color for this pixel
-         */
-
-        ColorRGB color(0);
-
-        if (readDelta || writeDelta || zeroDelta) {
-            /*
-             * If anything at all is happening in this pixel, we want
-             * it to be obvious- so use a color that stands out
-             * against a white background. But we'll shift the color
-             * to indicate how much of the transfer within this pixel
-             * is made up of reads, writes, or zero writes.
-             */
+        keys.swap(missing);
+        if (keys.empty())
+            return;
+    }
 
-            double total = readDelta + writeDelta;
-            float readAlpha = readDelta / total;
-            float writeAlpha = (writeDelta - zeroDelta) / total;
-            float zeroAlpha = zeroDelta / total;
+    std::sort(keys.begin(), keys.end(), sliceEndLess);
 
-            color += ColorRGB(COLOR_READ) * readAlpha;
-            color += ColorRGB(COLOR_WRITE) * writeAlpha;
-            color += ColorRGB(COLOR_ZERO) * zeroAlpha;
-        } else {
-            color = COLOR_BG_TOP;
-        }
+    std::vector<ClockType> times;
+    ClockType fuzz = (ClockType) -1;
+    times.reserve(keys.size() * 2);
 
-        value.pixels[y] = color;
+    for (std::vector<SliceKey>::iterator i = keys.begin(); i != keys.end(); i++) {
+        times.push_back(i->begin);
+        times.push_back(i->end);
+        fuzz = std::min<ClockType>(fuzz, (i->end - i->begin) >> 2);
     }
 
-    for (; y < SLICE_BANDWIDTH_TOP; y++)
-        value.pixels[y] = COLOR_BG_TOP;
+    std::sort(times.begin(), times.end());
+    times.erase(std::unique(times.begin(), times.end()), times.end());
 
     /*
-     * Calculate and graph the bandwidth in this slice, as a stacked
-     * graph showing read/write/zero bandwidth.
+     * Sweep forward over the log. As soon as we have the instant for
+     * a slice's end boundary, we have both of its boundaries, so we
+     * can render it and hand it to the cache right away.
      */
 
-    uint64_t readTotal = 0;
-    uint64_t writeTotal = 0;
-    uint64_t zeroTotal = 0;
+    struct Receiver : public InstantSweepReceiver {
+        virtual bool fn(int i, instantPtr_t instant) {
+            instants[i] = instant;
 
-    for (int s = 0; s < numStrata; s++) {
-        readTotal += end->readTotals.get(s) - begin->readTotals.get(s);
-        writeTotal += end->writeTotals.get(s) - begin->writeTotals.get(s);
-        zeroTotal += end->zeroTotals.get(s) - begin->zeroTotals.get(s);
-    }
+            while (nextKey < keys->size() && (*keys)[nextKey].end <= (*times)[i]) {
+                SliceKey &key = (*keys)[nextKey++];
+                int b = std::lower_bound(times->begin(), times->end(), key.begin)
+                    - times->begin();
 
-    value.readBandwidth = timeDiff ? readTotal / (double)timeDiff : 0;
-    value.writeBandwidth = timeDiff ? writeTotal / (double)timeDiff : 0;
-    value.zeroBandwidth = timeDiff ? zeroTotal / (double)timeDiff : 0;
-
-    const double vScale = (SLICE_BANDWIDTH_BOTTOM - SLICE_BANDWIDTH_TOP) * -0.5;
-    int origin = SLICE_BANDWIDTH_BOTTOM;
-    int rH = origin + value.readBandwidth * vScale + 0.5;
-    int rwH = origin + (value.readBandwidth +
-                        value.writeBandwidth -
-                        value.zeroBandwidth) * vScale + 0.5;
-    int rwzH = origin + (value.readBandwidth +
-                         value.writeBandwidth) * vScale + 0.5;
-
-    for (; y < rwzH; y++)
-        value.pixels[y] = COLOR_BG_BOTTOM;
-    for (; y < rwH; y++)
-        value.pixels[y] = COLOR_ZERO;
-    for (; y < rH; y++)
-        value.pixels[y] = COLOR_WRITE;
-    for (; y < origin; y++)
-        value.pixels[y] = COLOR_READ;
+                value.cookie = __sync_fetch_and_add(&generator->nextCookie, 1);
+                generator->timeline->renderer.render(key, instants[b], instant, value);
+                generator->timeline->sliceCache.put(key, value, cacheEpoch);
+                if (persistent)
+                    generator->timeline->diskCache.Store(key, value);
+            }
+
+            return sweeper->isCurrent(generation);
+        }
+
+        SliceGenerator *generator;
+        SweepThread *sweeper;
+        uint32_t generation;
+        int cacheEpoch;
+        bool persistent;
+        std::vector<SliceKey> *keys;
+        std::vector<ClockType> *times;
+        std::vector<instantPtr_t> instants;
+        size_t nextKey;
+        SliceValue value;
+    };
+
+    Receiver receiver;
+    receiver.generator = this;
+    receiver.sweeper = sweeper;
+    receiver.generation = generation;
+    receiver.cacheEpoch = cacheEpoch;
+    receiver.persistent = persistent;
+    receiver.keys = &keys;
+    receiver.times = &times;
+    receiver.instants.resize(times.size());
+    receiver.nextKey = 0;
+
+    timeline->index->SweepInstants(times, fuzz, receiver);
+}
+
+
+void
+THDTimeline::SweepThread::request(std::vector<SliceKey> &keys)
+{
+    wxCriticalSectionLocker locker(lock);
+    pending.swap(keys);
+    pendingEpoch = timeline->sliceCache.GetEpoch();
+    __sync_fetch_and_add(&generation, 1);
+    sema.Post();
+}
+
+
+void
+THDTimeline::SweepThread::stop()
+{
+    running = false;
+    sema.Post();
+}
+
+
+wxThread::ExitCode
+THDTimeline::SweepThread::Entry()
+{
+    TraceLog::setThreadName("Slice sweep");
+
+    while (running && !TestDestroy()) {
+        sema.WaitTimeout(1000);
+
+        std::vector<SliceKey> keys;
+        uint32_t gen;
+        int epoch;
+        {
+            wxCriticalSectionLocker locker(lock);
+            keys.swap(pending);
+            gen = generation;
+            epoch = pendingEpoch;
+        }
+
+        if (!keys.empty())
+            timeline->sliceGenerator.fnBatch(keys, this, gen, epoch);
+    }
+    return 0;
 }
 
 
@@ -36,46 +36,24 @@
 #include "log_index.h"
 #include "lazy_cache.h"
 #include "color_rgb.h"
+#include "slice_renderer.h"
+#include "slice_disk_cache.h"
 
 class THDTimeline;
 
 
 /*
- * Support for hashable slice keys, used in the slice cache.
- */
-
-struct SliceKey {
-    ClockType begin;
-    ClockType end;
-
-    ClockType getCenter()
-    {
-        return (begin + end) >> 1;
-    }
-};
-
-bool operator == (SliceKey const &a, SliceKey const &b);
-std::size_t hash_value(SliceKey const &k);
-
-
-/*
- * The range of log strata represented by each vertical pixel
- */
-
-struct StrataRange {
-    int begin;
-    int end;
-};
-
-
-/*
- * View origin and scale for the timeline
+ * View origin and scale for the timeline, and the range of addresses
+ * shown vertically. The address range starts out larger than any
+ * log's memory, and THDTimeline::clampView() trims it down to fit.
  */
 
 struct TimelineView {
-    TimelineView() : origin(0), scale(100000) {}
+    TimelineView() : origin(0), scale(100000), addrBegin(0), addrEnd((AddressType) -1) {}
     ClockType origin;
     ClockType scale;
+    AddressType addrBegin;
+    AddressType addrEnd;
 };
 
 
@@ -156,6 +134,7 @@ private:
 class THDTimeline : public wxPanel, public boost::signals2::trackable {
 public:
     THDTimeline(wxWindow *parent, THDModel *model);
+    ~THDTimeline();
 
     void OnPaint(wxPaintEvent &event);
     void OnSize(wxSizeEvent &event);
@@ -170,108 +149,212 @@ private:
     friend class THDTimelineOverlay;
     friend class TimelineGrid;
 
-    static const int SLICE_HEIGHT      = 256;
+    static const int SLICE_HEIGHT      = SliceRenderer::SLICE_HEIGHT;
     static const int SLICE_CACHE_SIZE  = 1 << 16;
     static const int REFRESH_FPS       = 20;
     static const int MAX_SLICE_AGE     = 30;
     static const int INDEXING_FPS      = 5;
+    static const int MIN_SWEEP_SLICES  = 64;
+    static const int STATS_FPS         = 2;
+    static const int STATS_INTERVAL    = 1000;  // Milliseconds between samples
+    static const int PATTERN_INTERVAL  = 1000;  // Milliseconds between pattern lookups while indexing
+
+    // Columns covered by each slice of the coarse approximation
+    static const int COARSE_SHIFT = 3;
+    static const int COARSE_COUNT = 1 << COARSE_SHIFT;
+
+    // What each column of the bufferBitmap holds, from worst to best
+    enum Quality {
+        QUALITY_NONE,       // Placeholder, or stale pixels from another scale
+        QUALITY_COARSE,     // A stretched coarse slice
+        QUALITY_FINE,       // Fully supersampled slices
+    };
 
-    // Horizontal supersampling
-    static const int SUBPIXEL_SHIFT = 2;
-    static const int SUBPIXEL_COUNT = 1 << SUBPIXEL_SHIFT;
-
-    // Vertical positions within a slice. Might want to make these dynamic later.
-    static const int SLICE_STRATA_TOP       = 1;
-    static const int SLICE_STRATA_BOTTOM    = 192;
-    static const int SLICE_BANDWIDTH_TOP    = 193;
-    static const int SLICE_BANDWIDTH_BOTTOM = 255;
+    // Slice layout is shared with the SliceRenderer
+    static const int SUBPIXEL_SHIFT         = SliceRenderer::SUBPIXEL_SHIFT;
+    static const int SUBPIXEL_COUNT         = SliceRenderer::SUBPIXEL_COUNT;
+    static const int SLICE_STRATA_TOP       = SliceRenderer::SLICE_STRATA_TOP;
+    static const int SLICE_STRATA_BOTTOM    = SliceRenderer::SLICE_STRATA_BOTTOM;
+    static const int SLICE_STRATA_ROWS      = SliceRenderer::SLICE_STRATA_ROWS;
+    static const int SLICE_BANDWIDTH_TOP    = SliceRenderer::SLICE_BANDWIDTH_TOP;
+    static const int SLICE_BANDWIDTH_BOTTOM = SliceRenderer::SLICE_BANDWIDTH_BOTTOM;
 
     // Timeline color scheme
-    static const int COLOR_BG_TOP     =   0xffffff;
-    static const int COLOR_BG_BOTTOM  =   0xcccccc;
-    static const int COLOR_READ       =   0x2d7db3;
-    static const int COLOR_WRITE      =   0xcb0c29;
-    static const int COLOR_ZERO       =   0xc57d0c;
-    static const int COLOR_GRID       = 0x44888888;
     static const int COLOR_BOX_BORDER =   0x88dd88;
     static const int COLOR_BOX_BG     =   0xddffdd;
     static const int COLOR_FOCUS      =   0x448844;
     static const int COLOR_OUTLINES   =   0xdddddd;
     static const int COLOR_CURSOR     =   0xff4444;
 
+    // Access pattern band, one row per AccessPattern::Kind
+    static const int PATTERN_ROW_HEIGHT = 3;
+    static const int COLOR_SEQUENTIAL =   0x3366ff;
+    static const int COLOR_STRIDED    =   0xff9900;
+    static const int COLOR_POLLING    =   0xcc33cc;
+
     static const int SHADE_CHECKER_1  = 0xaa;
     static const int SHADE_CHECKER_2  = 0xbb;
 
-    struct SliceValue {
-        // Unique ID for this cached slice
-        uint32_t cookie;
-
-        // Calculated bandwidths
-        double readBandwidth;
-        double writeBandwidth;
-        double zeroBandwidth;
-
-        // Slice image, without supersampling or emphasis
-        ColorRGB pixels[SLICE_HEIGHT];
-    };
-
+    typedef SliceRenderer::SliceValue SliceValue;
     typedef LazyCache<SliceKey, SliceValue> sliceCache_t;
     typedef wxNativePixelFormat pixelFormat_t;
     typedef wxPixelData<wxBitmap, pixelFormat_t> pixelData_t;
 
+    class SweepThread;
+
+    /*
+     * Performance counters for the optional stats overlay. Paint
+     * times accumulate per frame. Every STATS_INTERVAL we sample the
+     * slice cache and LogIndex counters, and turn the difference
+     * since the last sample into 'labels'.
+     */
+    struct Stats {
+        Stats();
+
+        double sampleTime;          // Microseconds, at the last sample
+        int frames;                 // Since the last sample
+        double paintTime;
+        double paintMax;
+        double renderTime;
+
+        uint64_t totalFrames;       // Since the widget was created
+        double totalPaintTime;
+        double totalRenderTime;
+
+        sliceCache_t::CacheStats slices;    // At the last sample
+        sliceCache_t::PrefetchStats prefetch;
+        LogIndex::CacheStats index;
+        std::vector<wxString> labels;
+    };
+
     struct SliceGenerator : public sliceCache_t::generator_t {
         SliceGenerator(THDTimeline *_timeline)
             : timeline(_timeline),
               nextCookie(0)
         {}
 
+        // Called concurrently by every sliceCache worker thread.
         virtual void fn(SliceKey &key, SliceValue &value);
+
+        // Generate many slices with one pass over the log. Runs on the SweepThread.
+        void fnBatch(std::vector<SliceKey> &keys, SweepThread *sweeper,
+                     uint32_t generation, int cacheEpoch);
+
+        THDTimeline *timeline;
+        volatile uint32_t nextCookie;
+    };
+
+    /*
+     * When a repaint finds many slices missing, we hand the whole
+     * list to this thread. It generates them in time order using a
+     * single LogIndex::SweepInstants() pass, while the sliceCache
+     * workers keep filling in slices near the focus point. A newer
+     * request cancels the one in progress.
+     */
+    class SweepThread : public wxThread {
+    public:
+        SweepThread(THDTimeline *_timeline)
+            : wxThread(wxTHREAD_JOINABLE),
+              timeline(_timeline),
+              generation(0),
+              pendingEpoch(0),
+              running(true)
+        {}
+
+        virtual ExitCode Entry();
+        void request(std::vector<SliceKey> &keys);
+        void stop();
+
+        bool isCurrent(uint32_t gen) {
+            return running && gen == generation;
+        }
+
+    private:
         THDTimeline *timeline;
-        uint32_t nextCookie;
+        wxCriticalSection lock;
+        wxSemaphore sema;
+        std::vector<SliceKey> pending;  // Protected by 'lock'
+        int pendingEpoch;               // sliceCache epoch of 'pending'
+        volatile uint32_t generation;
+        volatile bool running;
     };
 
     void zoom(double factor, int xPivot);
     void pan(int pixels);
     void panTo(ClockType focus);
+    TimelineView getZoomedView(double factor, int xPivot);
+    void clampView(TimelineView &v);
+
+    void zoomAddress(double factor, int yPivot);
+    void panAddress(int pixels);
+    void panToAddress(AddressType focus);
+    void showAllAddresses();
+    void setAddressRange(int64_t begin, int64_t span);
 
     void modelCursorChanged();
     void viewChanged();
     void updateBitmapForViewChange(TimelineView &oldView, TimelineView &newView);
 
+    void requestSweep(int xMin, int xMax);
+    void requestCoarseSlices(int xMin, int xMax);
+    void prefetchNeighbours();
+    void prefetchColumn(const TimelineView &v, int x);
     bool renderSlice(pixelData_t &data, int x);
+    void paintColumn(pixelData_t &data, int x, SliceValue **slices);
     bool renderSliceRange(pixelData_t &data, int xMin, int xMax);
     bool renderSliceRange(wxBitmap &bmp, int xMin, int xMax);
 
     void updateRefreshTimer(bool waitingForData);
     void updateOverlay(THDTimelineOverlay::style_t style);
 
+    void countFrame(double paintTime, double renderTime);
+    void sampleStats(double now);
+    void paintStats(wxDC &dc);
+    void paintPatterns(wxDC &dc, int width);
+    void dumpStats();
+
     SliceKey getSliceKeyForPixel(int x);
     SliceKey getSliceKeyForSubpixel(int x, int subpix);
-    StrataRange getStrataRangeForPixel(int y);
+    SliceKey getCoarseSliceKey(int x);
     int getPixelForClock(ClockType clock);
-    int getPixelForStratum(int s);
     int getPixelForAddress(AddressType addr);
 
     THDModel *model;
     LogIndex *index;
+    SliceRenderer renderer;
+    SliceDiskCache diskCache;   // Must outlive the sliceCache workers
     sliceCache_t sliceCache;
     SliceGenerator sliceGenerator;
+    SweepThread *sweepThread;
+    SliceKey lastSweepBegin;
+    SliceKey lastSweepEnd;
     wxBitmap bufferBitmap;
     std::vector<uint8_t> bufferAges;
     std::vector<uint32_t> bufferCookies;
+    std::vector<uint8_t> bufferQuality;
     wxTimer refreshTimer;
 
     bool allocated;         // Is our buffer allocated?
     bool slicesDirty;       // Are any slices potentially not up to date on our bitmap?
     bool needSliceEnqueue;  // Should we request slice rendering?
+    bool prefetchQueued;    // Already prefetched around this view?
     bool isDragging;        // Was this mouse event a drag?
     bool hasFocus;          // Have keyboard focus?
+    bool showStats;         // Draw the stats overlay?
+    bool showPatterns;      // Draw the access pattern band?
+    bool patternsDirty;     // Does 'patterns' need to be looked up again?
+    bool viewedAhead;       // Panned past the end of a partial index?
+    int segmentGeneration;  // Index segments our cached slices were drawn from
+
+    std::vector<AccessPattern> patterns;   // Spans in view, one pixel wide or more, for the band
+    double patternsTime;                   // usecNow() at the last lookup
 
     wxPoint dragOrigin;
     wxPoint cursor;
 
     TimelineView view;
     THDTimelineOverlay overlay;
+    Stats stats;
 };
 
 #endif /* __THD_TIMELINE_H */
@@ -30,14 +30,20 @@
 #include "color_rgb.h"
 #include "thd_transfertable.h"
 
+#define ID_FILTER_TIMER  1
+
 BEGIN_EVENT_TABLE(THDTransferGrid, wxGrid)
     EVT_GRID_SELECT_CELL(THDTransferGrid::OnSelectCell)
+    EVT_TIMER(ID_FILTER_TIMER, THDTransferGrid::OnFilterTimer)
 END_EVENT_TABLE()
 
 
-THDTransferTable::THDTransferTable(THDModel *_model)
-    : model(_model)
+THDTransferTable::THDTransferTable(THDModel *_model, filterPtr_t _filter)
+    : model(_model),
+      filter(_filter)
 {
+    numRows = filter ? CountFilterRows() : model->index->GetNumTransfers();
+
     wxFont defaultFont = wxSystemSettings::GetFont(wxSYS_SYSTEM_FONT);
     wxFont fixedFont = wxFont(defaultFont.GetPointSize(),
                               wxFONTFAMILY_MODERN,  // Fixed width
@@ -180,7 +186,52 @@ THDTransferTable::AutoSizeColumn(wxGrid &grid, int col, wxString prototype)
 int
 THDTransferTable::GetNumberRows()
 {
-    return model->index->GetNumTransfers();
+    return numRows;
+}
+
+OffsetType
+THDTransferTable::GetTransferId(int row)
+{
+    return filter ? filter->GetId(row) : row;
+}
+
+int
+THDTransferTable::GetRowForTransfer(OffsetType id)
+{
+    /*
+     * With a filter, this is the first row at or after 'id'. Returns
+     * -1 if that row isn't in the table yet.
+     */
+
+    OffsetType row = filter ? filter->GetRow(id) : id;
+    return row < (OffsetType)numRows ? (int)row : -1;
+}
+
+void
+THDTransferTable::UpdateRows()
+{
+    if (!filter || !GetView())
+        return;
+
+    int count = CountFilterRows();
+    if (count > numRows) {
+        wxGridTableMessage msg(this, wxGRIDTABLE_NOTIFY_ROWS_APPENDED, count - numRows);
+        numRows = count;
+        GetView()->ProcessTableMessage(msg);
+    }
+}
+
+int
+THDTransferTable::CountFilterRows()
+{
+    /*
+     * The filter reads the log much faster than the indexer does, so
+     * while indexing it finds transfers we can't look up yet. Only
+     * count the rows the index can already summarize; the rest show
+     * up as the indexer reaches them.
+     */
+
+    return filter->GetRow(model->index->GetNumTransfers());
 }
 
 int
@@ -199,7 +250,7 @@ THDTransferTable::IsEmptyCell(int row, int col)
 wxString
 THDTransferTable::GetValue(int row, int col)
 {
-    transferPtr_t tp = model->index->GetTransferSummary(row);
+    transferPtr_t tp = model->index->GetTransferSummary(GetTransferId(row));
 
     switch (col) {
 
@@ -248,7 +299,7 @@ THDTransferTable::GetAttr(int row, int col,
      * and calculate our own cell attributes on-demand right here.
      */
 
-    transferPtr_t tp = model->index->GetTransferSummary(row);
+    transferPtr_t tp = model->index->GetTransferSummary(GetTransferId(row));
     wxGridCellAttr *attr = defaultAttr;
 
     switch (col) {
@@ -284,7 +335,10 @@ THDTransferTable::GetAttr(int row, int col,
 
 THDTransferGrid::THDTransferGrid(wxWindow *_parent, THDModel *_model)
     : wxGrid(_parent, wxID_ANY),
-      model(_model)
+      model(_model),
+      table(NULL),
+      filterTimer(this, ID_FILTER_TIMER),
+      followingModel(false)
 {
     Refresh();
 
@@ -294,6 +348,14 @@ THDTransferGrid::THDTransferGrid(wxWindow *_parent, THDModel *_model)
 }
 
 
+THDTransferGrid::~THDTransferGrid()
+{
+    filterTimer.Stop();
+    if (filter)
+        filter->Stop();
+}
+
+
 void
 THDTransferGrid::Refresh()
 {
@@ -306,8 +368,8 @@ THDTransferGrid::Refresh()
      * be destroyed at the proper time. If we destroyed it in
      * our destructor, that would be too early.
      */
-    THDTransferTable *table = new THDTransferTable(model);
-    
+    table = new THDTransferTable(model, filter);
+
     SetTable(table, true, wxGrid::wxGridSelectRows);
     SetRowLabelSize(0);
 
@@ -334,14 +396,52 @@ THDTransferGrid::Refresh()
 }
 
 
+void
+THDTransferGrid::SetFilter(filterPtr_t _filter)
+{
+    filterTimer.Stop();
+    if (filter)
+        filter->Stop();
+
+    filter = _filter;
+    Refresh();
+
+    if (filter) {
+        filter->Start();
+        filterTimer.Start(1000 / FILTER_UPDATE_HZ);
+    }
+
+    if (model->cursor.transferId != model->cursor.NO_TRANSFER)
+        modelCursorChanged();
+}
+
+
+void
+THDTransferGrid::OnFilterTimer(wxTimerEvent &event)
+{
+    // Show the rows the filter found since the last update, until
+    // both the filter and the indexer are finished.
+
+    if (!filter)
+        return;
+
+    bool done = (filter->IsDone() &&
+                 model->index->GetState() == LogIndex::COMPLETE);
+    table->UpdateRows();
+
+    if (done)
+        filterTimer.Stop();
+}
+
+
 void
 THDTransferGrid::OnSelectCell(wxGridEvent &event)
 {
-    int row = event.GetRow();
+    OffsetType id = table->GetTransferId(event.GetRow());
 
-    if (row != model->cursor.transferId) {
+    if (!followingModel && id != model->cursor.transferId) {
 		boost::signals2::shared_connection_block blocker(modelCursorChangeConn);
-        model->moveCursorToId(row);
+        model->moveCursorToId(id);
     }
 
     event.Skip();
@@ -353,13 +453,20 @@ THDTransferGrid::modelCursorChanged()
 {
     /*
      * Another widget changed the THDModel's cursor. Move the cursor
-     * to this cell and hilight it.
+     * to this cell and hilight it. With a filter, that's the first
+     * matching transfer at or after the model's cursor, but the
+     * model's cursor stays where it is.
      */
 
-    int row = model->cursor.transferId;
+    int row = table->GetRowForTransfer(model->cursor.transferId);
     int col = GetGridCursorCol();
 
+    if (row < 0)
+        return;
+
+    followingModel = true;
     SetGridCursor(row, col);
     SelectRow(row);
     MakeCellVisible(row, col);
+    followingModel = false;
 }
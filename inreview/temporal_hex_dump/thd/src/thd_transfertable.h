@@ -28,17 +28,34 @@
 #define __THD_TRANSFERTABLE_H
 
 #include <wx/grid.h>
+#include <wx/timer.h>
 #include "log_index.h"
 #include "thd_model.h"
+#include "transfer_filter.h"
 
 
+/*
+ * Rows are transfers, in order. With a TransferFilter, only the
+ * transfers it has found so far, up to where the indexer has reached.
+ * The row count is a snapshot, taken when the table is created and
+ * advanced by UpdateRows(), since wxGrid has to be told about every
+ * row it gains.
+ */
+
 class THDTransferTable : public wxGridTableBase {
 public:
-    THDTransferTable(THDModel *model);
+    THDTransferTable(THDModel *model, filterPtr_t filter);
     ~THDTransferTable();
 
     int AutoSizeColumns(wxGrid &grid);
 
+    // Row <-> transfer ID mapping
+    OffsetType GetTransferId(int row);
+    int GetRowForTransfer(OffsetType id);
+
+    // Tell wxGrid about any indexed rows the filter found since last time.
+    void UpdateRows();
+
     virtual int GetNumberRows();
     virtual int GetNumberCols();
 
@@ -62,6 +79,7 @@ public:
 
 private:
     int AutoSizeColumn(wxGrid &grid, int col, wxString prototype);
+    int CountFilterRows();
 
     wxGridCellAttr *defaultAttr;
     wxGridCellAttr *numericAttr;
@@ -70,22 +88,35 @@ private:
     wxGridCellAttr *errorAttrs[ERROR_WIDTH];
 
     THDModel *model;
+    filterPtr_t filter;
+    int numRows;
 };
 
 
 class THDTransferGrid : public wxGrid {
 public:
     THDTransferGrid(wxWindow *parent, THDModel *model);
+    ~THDTransferGrid();
     void Refresh();
 
+    // Show only the transfers 'filter' finds, or all of them if it's empty. Starts the filter.
+    void SetFilter(filterPtr_t filter);
+
     void OnSelectCell(wxGridEvent &event);
+    void OnFilterTimer(wxTimerEvent &event);
 
     DECLARE_EVENT_TABLE();
 
 private:
+    static const int FILTER_UPDATE_HZ = 4;
+
     void modelCursorChanged();
 
     THDModel *model;
+    THDTransferTable *table;
+    filterPtr_t filter;
+    wxTimer filterTimer;
+    bool followingModel;    // Moving our cursor to match the model's?
     boost::signals2::connection modelCursorChangeConn;
 };
 
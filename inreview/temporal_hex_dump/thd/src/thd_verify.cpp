@@ -0,0 +1,127 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * thd_verify.cpp -- Command-line index verifier.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <wx/init.h>
+#include <wx/utils.h>
+#include <wx/stopwatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "log_reader.h"
+#include "log_index.h"
+#include "cli_util.h"
+#include "index_verifier.h"
+
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options] <log file>\n"
+            "\n"
+            "Checks the log's index against a fresh replay of the log, and\n"
+            "reports the first place where they differ. The log is indexed\n"
+            "first if it doesn't have an up-to-date index.\n"
+            "\n"
+            "Options:\n"
+            "  -j <threads>  Verifier threads (default one per CPU)\n",
+            argv0);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int numThreads = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "j:h")) != -1) {
+        switch (c) {
+        case 'j': numThreads = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *logPath = argv[optind];
+
+    wxInitializer initializer;
+    if (!initializer.IsOk()) {
+        fprintf(stderr, "Failed to initialize wxWidgets\n");
+        return 1;
+    }
+
+    if (numThreads <= 0)
+        numThreads = std::max(1, wxThread::GetCPUCount());
+
+    LogReader reader;
+    LogIndex index;
+
+    if (!openLogIndex(logPath, reader, index))
+        return 1;
+
+    wxStopWatch timer;
+    IndexVerifier verifier(&index);
+    verifier.Start(numThreads);
+
+    printf("Verifying %lld transfers in %d segments on %d threads\n",
+           (long long)index.GetNumTransfers(), verifier.numSegments, numThreads);
+
+    if (isatty(fileno(stderr))) {
+        while (!verifier.IsDone()) {
+            fprintf(stderr, "\rVerifying... %5.1f%%", verifier.GetProgress() * 100.0);
+            wxMilliSleep(100);
+        }
+        fprintf(stderr, "\r%20s\r", "");
+    }
+
+    bool ok = verifier.Wait();
+    double seconds = timer.Time() / 1000.0;
+
+    printf("Checked %llu strata rows and %llu block snapshots, "
+           "replayed %llu transfers in %.3f s\n",
+           (unsigned long long)verifier.rowsChecked,
+           (unsigned long long)verifier.snapshotsChecked,
+           (unsigned long long)verifier.transfersReplayed, seconds);
+
+    if (ok) {
+        printf("Index OK\n");
+        return 0;
+    }
+
+    IndexVerifier::Divergence &d = verifier.firstDivergence;
+    printf("First divergence after transfer %lld (offset %lld, time %lld):\n  %s\n",
+           (long long)d.transferId, (long long)d.offset, (long long)d.time,
+           d.message.c_str());
+    return 2;
+}
@@ -0,0 +1,187 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * trace_event.cpp -- Optional scoped timers, written out as Chrome
+ *                    trace events for profiling.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <wx/thread.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include "trace_event.h"
+
+
+bool TraceLog::enabled = false;
+
+
+/*
+ * The trace file and its bookkeeping. A single static instance opens
+ * the file before main() runs and finishes it after main() returns.
+ *
+ * Threads are numbered in the order they first write an event, since
+ * wxThread IDs are too big to read comfortably in a trace viewer.
+ */
+
+class TraceFile {
+public:
+    TraceFile();
+    ~TraceFile();
+
+    double now();
+    void write(const char *name, double start, double end);
+    void setThreadName(const char *name);
+
+private:
+    struct ThreadInfo {
+        int tid;
+        const char *name;
+    };
+
+    ThreadInfo &currentThread();
+
+    wxCriticalSection lock;
+    FILE *file;
+    double origin;
+    bool first;
+    std::map<unsigned long, ThreadInfo> threads;
+};
+
+static TraceFile traceFile;
+
+
+TraceFile::TraceFile()
+    : file(NULL),
+      origin(0),
+      first(true)
+{
+    const char *path = getenv("THD_TRACE");
+    if (!path || !*path)
+        return;
+
+    file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "TRACE: Can't open '%s' for writing\n", path);
+        return;
+    }
+
+    origin = now();
+    fprintf(file, "[");
+    TraceLog::enabled = true;
+}
+
+
+TraceFile::~TraceFile()
+{
+    wxCriticalSectionLocker locker(lock);
+
+    if (file) {
+        TraceLog::enabled = false;
+        fprintf(file, "\n]\n");
+        fclose(file);
+        file = NULL;
+    }
+}
+
+
+double
+TraceFile::now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec - origin;
+}
+
+
+TraceFile::ThreadInfo &
+TraceFile::currentThread()
+{
+    // Caller must hold the lock.
+
+    unsigned long id = wxThread::GetCurrentId();
+    std::map<unsigned long, ThreadInfo>::iterator i = threads.find(id);
+
+    if (i == threads.end()) {
+        ThreadInfo info = { (int) threads.size() + 1, NULL };
+        i = threads.insert(std::make_pair(id, info)).first;
+    }
+    return i->second;
+}
+
+
+void
+TraceFile::write(const char *name, double start, double end)
+{
+    wxCriticalSectionLocker locker(lock);
+
+    if (!file)
+        return;
+
+    fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"thd\",\"ph\":\"X\","
+            "\"ts\":%.0f,\"dur\":%.0f,\"pid\":1,\"tid\":%d}",
+            first ? "" : ",", name, start, end - start, currentThread().tid);
+    first = false;
+}
+
+
+void
+TraceFile::setThreadName(const char *name)
+{
+    wxCriticalSectionLocker locker(lock);
+
+    if (!file)
+        return;
+
+    ThreadInfo &thread = currentThread();
+    if (thread.name && !strcmp(thread.name, name))
+        return;
+    thread.name = name;
+
+    fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",", thread.tid, name);
+    first = false;
+}
+
+
+double
+TraceLog::now()
+{
+    return traceFile.now();
+}
+
+
+void
+TraceLog::complete(const char *name, double start)
+{
+    traceFile.write(name, start, now());
+}
+
+
+void
+TraceLog::setThreadName(const char *name)
+{
+    if (enabled)
+        traceFile.setThreadName(name);
+}
@@ -0,0 +1,84 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * trace_event.h -- Optional scoped timers, written out as Chrome
+ *                  trace events for profiling.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __TRACE_EVENT_H
+#define __TRACE_EVENT_H
+
+
+/*
+ * If the THD_TRACE environment variable names a file, every
+ * TraceScope writes one complete ("X") event to it when it goes out
+ * of scope, in the Chrome trace-event JSON format. Load the file
+ * into chrome://tracing or a compatible viewer to see where each
+ * thread spends its time.
+ *
+ * Scope names must be string literals, or at least outlive the
+ * process; we keep the pointer and don't escape them.
+ *
+ * Without THD_TRACE, a TraceScope only tests one global flag when it
+ * starts and again when it ends.
+ */
+
+class TraceLog {
+public:
+    static bool enabled;
+
+    // Microseconds since the trace started
+    static double now();
+
+    static void complete(const char *name, double start);
+
+    /*
+     * Label the calling thread in the trace viewer. Cheap to call
+     * repeatedly; we only write the name when it changes.
+     */
+    static void setThreadName(const char *name);
+};
+
+
+class TraceScope {
+public:
+    TraceScope(const char *_name)
+        : name(_name),
+          active(TraceLog::enabled)
+    {
+        if (active)
+            start = TraceLog::now();
+    }
+
+    ~TraceScope()
+    {
+        if (active)
+            TraceLog::complete(name, start);
+    }
+
+private:
+    const char *name;
+    bool active;
+    double start;
+};
+
+#endif /* __TRACE_EVENT_H */
@@ -0,0 +1,767 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * transfer_export.cpp -- Streams transfers out of a log, as CSV or as a
+ *                        compact columnar file.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "transfer_export.h"
+#include "trace_event.h"
+#include "varint.h"
+
+using namespace sqlite3x;
+
+
+const char ExportRowGroup::MAGIC[9] = "THDCOLS1";
+
+
+const char *
+ExportRow::getTypeName(MemTransfer::TypeEnum type)
+{
+    // Short names, the same ones TransferFilter uses where it has them.
+
+    switch (type) {
+    case MemTransfer::READ:           return "read";
+    case MemTransfer::WRITE:          return "write";
+    case MemTransfer::ERROR_OVERFLOW: return "overflow";
+    case MemTransfer::ERROR_SYNC:     return "sync";
+    case MemTransfer::ERROR_CHECKSUM: return "checksum";
+    case MemTransfer::ERROR_PROTOCOL: return "protocol";
+    case MemTransfer::ERROR_UNAVAIL:  return "unavail";
+    default:                          return "invalid";
+    }
+}
+
+
+void
+ExportRow::writeCSVHeader(std::string &out, bool payloadColumn)
+{
+    out += payloadColumn ? "time,id,type,address,length,data\n"
+                         : "time,id,type,address,length\n";
+}
+
+
+void
+ExportRow::writeCSV(std::string &out, const uint8_t *payload) const
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[128];
+
+    snprintf(line, sizeof line, "%lld,%llu,%s,0x%08x,%u",
+             (long long) time, (unsigned long long) id, getTypeName(type),
+             (unsigned) address, (unsigned) length);
+    out += line;
+
+    if (payload) {
+        out += ',';
+        if (hasPayload()) {
+            const uint8_t *p = payload + payloadOffset;
+            for (LengthType i = 0; i < length; i++) {
+                out += hex[p[i] >> 4];
+                out += hex[p[i] & 15];
+            }
+        }
+    }
+
+    out += '\n';
+}
+
+
+static void
+putLE(uint8_t *p, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = value >> (8 * i);
+}
+
+
+static uint64_t
+getLE(const uint8_t *p, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+
+/*
+ * Builds one row group's columns, a transfer at a time. See
+ * transfer_export.h for the encodings.
+ */
+
+class TransferExporter::ColumnEncoder {
+public:
+    static const int MIN_ZERO_RUN = 4;    // Shorter runs of zeroes stay in the literals
+
+    ColumnEncoder(bool _payload)
+        : payload(_payload),
+          prevTime(0),
+          prevId(0),
+          nextAddress(0)
+    {}
+
+    void Add(const MemTransfer &mt, ClockType time);
+    void Finish(ExportRowGroup &group, std::string &out);
+
+private:
+    struct Runs {
+        Runs() : value(0), count(0) {}
+
+        void add(uint64_t v, std::vector<uint8_t> &column) {
+            if (count && v != value)
+                flush(column);
+            value = v;
+            count++;
+        }
+
+        void flush(std::vector<uint8_t> &column) {
+            if (count) {
+                varint::append(value, column);
+                varint::append(count, column);
+            }
+            count = 0;
+        }
+
+        uint64_t value;
+        uint64_t count;
+    };
+
+    void EncodePayload();
+
+    bool payload;
+    ClockType prevTime;
+    OffsetType prevId;
+    AddressType nextAddress;
+    Runs idRuns, typeRuns, lengthRuns;
+    std::vector<uint8_t> columns[ExportRowGroup::NUM_COLUMNS];
+    std::vector<uint8_t> rawPayload;
+};
+
+
+void
+TransferExporter::ColumnEncoder::Add(const MemTransfer &mt, ClockType time)
+{
+    varint::append(time - prevTime, columns[ExportRowGroup::TIME]);
+    idRuns.add(mt.id - prevId, columns[ExportRowGroup::ID]);
+    typeRuns.add(mt.type, columns[ExportRowGroup::TYPE]);
+    lengthRuns.add(mt.byteCount, columns[ExportRowGroup::LENGTH]);
+
+    ::int64_t delta = (::int64_t) mt.address - (::int64_t) nextAddress;
+    varint::append(((uint64_t) delta << 1) ^ (uint64_t)(delta >> 63),
+                   columns[ExportRowGroup::ADDRESS]);
+
+    if (payload && (mt.type == MemTransfer::READ || mt.type == MemTransfer::WRITE))
+        rawPayload.insert(rawPayload.end(), mt.buffer, mt.buffer + mt.byteCount);
+
+    prevTime = time;
+    prevId = mt.id;
+    nextAddress = mt.address + mt.byteCount;
+}
+
+
+void
+TransferExporter::ColumnEncoder::EncodePayload()
+{
+    std::vector<uint8_t> &column = columns[ExportRowGroup::PAYLOAD];
+    size_t size = rawPayload.size();
+    size_t pos = 0;
+
+    while (pos < size) {
+        // Literals up to the next long enough run of zeroes
+        size_t literal = pos, zeroes = pos;
+        while (literal < size) {
+            zeroes = literal;
+            while (zeroes < size && !rawPayload[zeroes])
+                zeroes++;
+            if (zeroes - literal >= MIN_ZERO_RUN || zeroes == size)
+                break;
+            literal = zeroes + 1;
+        }
+        literal = std::min(literal, size);
+        zeroes = std::max(zeroes, literal);
+
+        varint::append(literal - pos, column);
+        column.insert(column.end(), rawPayload.begin() + pos, rawPayload.begin() + literal);
+        varint::append(zeroes - literal, column);
+        pos = zeroes;
+    }
+}
+
+
+void
+TransferExporter::ColumnEncoder::Finish(ExportRowGroup &group, std::string &out)
+{
+    idRuns.flush(columns[ExportRowGroup::ID]);
+    typeRuns.flush(columns[ExportRowGroup::TYPE]);
+    lengthRuns.flush(columns[ExportRowGroup::LENGTH]);
+    EncodePayload();
+
+    for (int c = 0; c < ExportRowGroup::NUM_COLUMNS; c++) {
+        group.columnSize[c] = columns[c].size();
+        out.append(columns[c].begin(), columns[c].end());
+    }
+}
+
+
+TransferExporter::TransferExporter(LogIndex *_index, const Options &_options)
+    : rowsWritten(0),
+      bytesWritten(0),
+      numRowGroups(0),
+      numChunks(0),
+      index(_index),
+      options(_options),
+      logPath(_index->GetLogFileName().GetFullPath()),
+      file(NULL),
+      numThreads(0),
+      writer(NULL),
+      nextChunk(0),
+      stopping(false),
+      writing(false),
+      succeeded(false),
+      logBytesWritten(0)
+{}
+
+
+TransferExporter::~TransferExporter()
+{
+    if (writer)
+        Stop();
+    Wait();
+}
+
+
+void
+TransferExporter::Start(FILE *_file, int _numThreads)
+{
+    file = _file;
+    numThreads = std::max(1, _numThreads);
+    writing = true;
+
+    {
+        std::string dbPath(index->GetIndexFileName().GetFullPath().fn_str());
+        sqlite3_connection db(dbPath.c_str());
+        sqlite3_command cmd(db, "SELECT time, offset, transferId FROM strata ORDER BY time");
+        sqlite3_cursor crsr = cmd.executecursor();
+
+        while (crsr.step()) {
+            RowHeader h;
+            h.time = crsr.getint64(0);
+            h.offset = crsr.getint64(1);
+            h.transferId = crsr.getint64(2);
+            rows.push_back(h);
+        }
+    }
+
+    /*
+     * Chunk 'c' starts just after strata row c * CHUNK_TIMESTEPS - 1
+     * (the first one starts at the beginning of the log), and ends
+     * with that row's transfer CHUNK_TIMESTEPS rows later. The last
+     * chunk goes on to the end of the log.
+     */
+
+    numChunks = rows.size() / CHUNK_TIMESTEPS + 1;
+    chunks.resize(numChunks);
+
+    OffsetType logSize = (OffsetType) index->GetLogFileName().GetSize().ToDouble();
+    for (int c = 0; c < numChunks; c++) {
+        size_t first = c * CHUNK_TIMESTEPS;
+        OffsetType begin = first ? rows[first - 1].offset : 0;
+        OffsetType end = c + 1 < numChunks ? rows[first + CHUNK_TIMESTEPS - 1].offset : logSize;
+        chunks[c].logBytes = end > begin ? end - begin : 0;
+    }
+
+    for (int i = 0; i < numThreads * MAX_PENDING_PER_THREAD; i++)
+        slots.Post();
+
+    writer = new WriterThread(this);
+    writer->Create();
+    writer->Run();
+
+    for (int i = 0; i < numThreads; i++) {
+        WorkerThread *thread = new WorkerThread(this);
+        thread->Create();
+        thread->Run();
+        threads.push_back(thread);
+    }
+}
+
+
+bool
+TransferExporter::Wait()
+{
+    if (writer) {
+        writer->Wait();
+        delete writer;
+        writer = NULL;
+    }
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->Wait();
+        delete threads[i];
+    }
+    threads.clear();
+
+    wxCriticalSectionLocker locker(lock);
+    return succeeded;
+}
+
+
+double
+TransferExporter::GetProgress()
+{
+    double logSize = std::max<double>(1.0, index->GetLogFileName().GetSize().ToDouble());
+    wxCriticalSectionLocker locker(lock);
+    return logBytesWritten / logSize;
+}
+
+
+bool
+TransferExporter::IsDone()
+{
+    wxCriticalSectionLocker locker(lock);
+    return !writing;
+}
+
+
+void
+TransferExporter::Stop()
+{
+    // Wake up everyone who could be waiting, so they notice.
+
+    wxCriticalSectionLocker locker(lock);
+    stopping = true;
+
+    for (int i = 0; i < numThreads; i++)
+        slots.Post();
+    finished.Post();
+}
+
+
+bool
+TransferExporter::NextChunk(int &chunk)
+{
+    /*
+     * Wait for a free slot before taking a chunk. Chunks are handed
+     * out in order and the writer frees a slot per chunk it writes,
+     * so no chunk starts too far ahead of the writer.
+     */
+
+    slots.Wait();
+
+    wxCriticalSectionLocker locker(lock);
+    if (stopping || nextChunk >= numChunks) {
+        slots.Post();
+        return false;
+    }
+
+    chunk = nextChunk++;
+    return true;
+}
+
+
+wxThread::ExitCode
+TransferExporter::WorkerThread::Entry()
+{
+    TraceLog::setThreadName("Exporter");
+
+    LogReader reader(exporter->logPath.c_str());
+    int chunk;
+
+    while (exporter->NextChunk(chunk))
+        exporter->EncodeChunk(chunk, reader);
+
+    return 0;
+}
+
+
+void
+TransferExporter::EncodeChunk(int c, LogReader &reader)
+{
+    TraceScope trace("Export chunk");
+
+    Chunk &chunk = chunks[c];
+    size_t first = c * CHUNK_TIMESTEPS;
+    bool lastChunk = c + 1 == numChunks;
+    OffsetType lastId = lastChunk ? (OffsetType) -1 : rows[first + CHUNK_TIMESTEPS - 1].transferId;
+
+    MemTransfer mt(0);
+    ClockType time = 0;
+    bool eof = false;
+
+    if (first) {
+        // Start just after the transfer at the end of the previous chunk
+        RowHeader &h = rows[first - 1];
+        mt = MemTransfer(h.offset, h.transferId);
+        time = h.time;
+        eof = !reader.Next(mt);
+    }
+
+    ExportRowGroup &group = chunk.group;
+    memset(&group, 0, sizeof group);
+
+    ColumnEncoder encoder(options.payload);
+    std::string data;
+
+    while (!eof && mt.id <= lastId) {
+        if (!reader.Read(mt))
+            break;
+
+        time += mt.duration;
+
+        if (options.criteria.Matches(mt)) {
+            if (!group.numRows) {
+                group.firstId = mt.id;
+                group.firstTime = time;
+            }
+            group.lastId = mt.id;
+            group.lastTime = time;
+            group.numRows++;
+
+            if (options.format == COLUMNAR) {
+                encoder.Add(mt, time);
+            } else {
+                ExportRow row = { time, mt.id, mt.type, mt.address, mt.byteCount, 0 };
+                row.writeCSV(data, options.payload ? mt.buffer : NULL);
+            }
+        }
+
+        eof = !reader.Next(mt);
+    }
+
+    if (options.format == COLUMNAR && group.numRows)
+        encoder.Finish(group, data);
+
+    wxCriticalSectionLocker locker(lock);
+    chunk.data.swap(data);
+    chunk.ready = true;
+    finished.Post();
+}
+
+
+wxThread::ExitCode
+TransferExporter::WriterThread::Entry()
+{
+    TraceLog::setThreadName("Export writer");
+    exporter->WriteChunks();
+    return 0;
+}
+
+
+bool
+TransferExporter::WriteBytes(const void *data, size_t size)
+{
+    if (size && fwrite(data, size, 1, file) != 1)
+        return false;
+    bytesWritten += size;
+    return true;
+}
+
+
+void
+TransferExporter::WriteChunks()
+{
+    std::vector<ExportRowGroup> groups;
+    bool ok = true;
+
+    if (options.format == COLUMNAR) {
+        uint8_t header[ExportRowGroup::HEADER_SIZE];
+        memcpy(header, ExportRowGroup::MAGIC, 8);
+        putLE(header + 8, ExportRowGroup::VERSION, 4);
+        putLE(header + 12, options.payload ? ExportRowGroup::FLAG_PAYLOAD : 0, 4);
+        ok = WriteBytes(header, sizeof header);
+    } else {
+        std::string header;
+        ExportRow::writeCSVHeader(header, options.payload);
+        ok = WriteBytes(header.data(), header.size());
+    }
+
+    for (int c = 0; ok && c < numChunks; c++) {
+        Chunk &chunk = chunks[c];
+        std::string data;
+
+        while (1) {
+            {
+                wxCriticalSectionLocker locker(lock);
+                if (stopping) {
+                    ok = false;
+                    break;
+                }
+                if (chunk.ready) {
+                    data.swap(chunk.data);
+                    break;
+                }
+            }
+            finished.Wait();
+        }
+        if (!ok)
+            break;
+
+        if (chunk.group.numRows) {
+            chunk.group.fileOffset = bytesWritten;
+            groups.push_back(chunk.group);
+            rowsWritten += chunk.group.numRows;
+        }
+        ok = WriteBytes(data.data(), data.size());
+
+        {
+            wxCriticalSectionLocker locker(lock);
+            logBytesWritten += chunk.logBytes;
+        }
+        slots.Post();
+    }
+
+    if (ok && options.format == COLUMNAR) {
+        uint64_t indexOffset = bytesWritten;
+        std::vector<uint8_t> entry(ExportRowGroup::INDEX_ENTRY_SIZE);
+
+        for (size_t i = 0; ok && i < groups.size(); i++) {
+            ExportRowGroup &g = groups[i];
+            uint64_t fields[6] = { g.fileOffset, g.numRows, g.firstId, g.lastId,
+                                   (uint64_t) g.firstTime, (uint64_t) g.lastTime };
+
+            for (int f = 0; f < 6; f++)
+                putLE(&entry[f * 8], fields[f], 8);
+            for (int col = 0; col < ExportRowGroup::NUM_COLUMNS; col++)
+                putLE(&entry[(6 + col) * 8], g.columnSize[col], 8);
+
+            ok = WriteBytes(&entry[0], entry.size());
+        }
+
+        uint8_t trailer[ExportRowGroup::TRAILER_SIZE];
+        putLE(trailer, indexOffset, 8);
+        putLE(trailer + 8, groups.size(), 8);
+        memcpy(trailer + 16, ExportRowGroup::MAGIC, 8);
+        ok = ok && WriteBytes(trailer, sizeof trailer);
+    }
+
+    ok = ok && fflush(file) == 0;
+    if (!ok)
+        Stop();
+
+    wxCriticalSectionLocker locker(lock);
+    numRowGroups = groups.size();
+    succeeded = ok;
+    writing = false;
+}
+
+
+bool
+ExportFileReader::Open(const char *path, std::string &error)
+{
+    Close();
+
+    file = fopen(path, "rb");
+    if (!file) {
+        error = "Can't open the file";
+        return false;
+    }
+
+    uint8_t header[ExportRowGroup::HEADER_SIZE];
+    uint8_t trailer[ExportRowGroup::TRAILER_SIZE];
+
+    if (fread(header, sizeof header, 1, file) != 1 ||
+        memcmp(header, ExportRowGroup::MAGIC, 8)) {
+        error = "Not a THD columnar export";
+        return false;
+    }
+    if (getLE(header + 8, 4) != ExportRowGroup::VERSION) {
+        error = "Unsupported format version";
+        return false;
+    }
+    flags = getLE(header + 12, 4);
+
+    if (fseeko(file, -(off_t) sizeof trailer, SEEK_END) ||
+        fread(trailer, sizeof trailer, 1, file) != 1 ||
+        memcmp(trailer + 16, ExportRowGroup::MAGIC, 8)) {
+        error = "The file is truncated";
+        return false;
+    }
+
+    uint64_t indexOffset = getLE(trailer, 8);
+    uint64_t numGroups = getLE(trailer + 8, 8);
+    std::vector<uint8_t> entries(numGroups * ExportRowGroup::INDEX_ENTRY_SIZE);
+
+    if (fseeko(file, indexOffset, SEEK_SET) ||
+        (numGroups && fread(&entries[0], entries.size(), 1, file) != 1)) {
+        error = "Can't read the row group index";
+        return false;
+    }
+
+    groups.resize(numGroups);
+    for (uint64_t i = 0; i < numGroups; i++) {
+        const uint8_t *e = &entries[i * ExportRowGroup::INDEX_ENTRY_SIZE];
+        ExportRowGroup &g = groups[i];
+
+        g.fileOffset = getLE(e, 8);
+        g.numRows = getLE(e + 8, 8);
+        g.firstId = getLE(e + 16, 8);
+        g.lastId = getLE(e + 24, 8);
+        g.firstTime = getLE(e + 32, 8);
+        g.lastTime = getLE(e + 40, 8);
+        for (int c = 0; c < ExportRowGroup::NUM_COLUMNS; c++)
+            g.columnSize[c] = getLE(e + (6 + c) * 8, 8);
+
+        if (g.fileOffset + g.getSize() > indexOffset) {
+            error = "The row group index is corrupt";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void
+ExportFileReader::Close()
+{
+    if (file)
+        fclose(file);
+    file = NULL;
+    flags = 0;
+    groups.clear();
+}
+
+
+size_t
+ExportFileReader::FindRowGroup(ClockType time) const
+{
+    size_t lo = 0, hi = groups.size();
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (groups[mid].lastTime < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+bool
+ExportFileReader::ReadRowGroup(size_t group, std::vector<ExportRow> &rows,
+                               std::vector<uint8_t> &payload, std::string &error)
+{
+    const ExportRowGroup &g = groups[group];
+
+    buffer.resize(g.getSize() + 1);
+    if (fseeko(file, g.fileOffset, SEEK_SET) ||
+        (g.getSize() && fread(&buffer[0], g.getSize(), 1, file) != 1)) {
+        error = "Can't read the row group";
+        return false;
+    }
+
+    const uint8_t *columns[ExportRowGroup::NUM_COLUMNS];
+    const uint8_t *fences[ExportRowGroup::NUM_COLUMNS];
+    const uint8_t *p = &buffer[0];
+
+    for (int c = 0; c < ExportRowGroup::NUM_COLUMNS; c++) {
+        columns[c] = p;
+        p += g.columnSize[c];
+        fences[c] = p;
+    }
+
+    rows.resize(g.numRows);
+    payload.clear();
+
+    /*
+     * Runs are decoded as we go. 'runValue' and 'runLeft' hold the
+     * current run of each run-length coded column.
+     */
+
+    uint64_t runValue[ExportRowGroup::NUM_COLUMNS] = { 0 };
+    uint64_t runLeft[ExportRowGroup::NUM_COLUMNS] = { 0 };
+    static const int runColumns[] = { ExportRowGroup::ID, ExportRowGroup::TYPE,
+                                      ExportRowGroup::LENGTH };
+
+    ClockType time = 0;
+    OffsetType id = 0;
+    AddressType nextAddress = 0;
+    size_t payloadSize = 0;
+
+    for (uint64_t i = 0; i < g.numRows; i++) {
+        for (int r = 0; r < 3; r++) {
+            int c = runColumns[r];
+            if (!runLeft[c]) {
+                runValue[c] = varint::read(columns[c], fences[c]);
+                runLeft[c] = varint::read(columns[c], fences[c]);
+                if (runValue[c] > varint::MAX || runLeft[c] > varint::MAX || !runLeft[c]) {
+                    error = "Corrupt run-length column";
+                    return false;
+                }
+            }
+            runLeft[c]--;
+        }
+
+        uint64_t timeDelta = varint::read(columns[ExportRowGroup::TIME], fences[ExportRowGroup::TIME]);
+        uint64_t zigzag = varint::read(columns[ExportRowGroup::ADDRESS], fences[ExportRowGroup::ADDRESS]);
+        if (timeDelta > varint::MAX || zigzag > varint::MAX) {
+            error = "Corrupt time or address column";
+            return false;
+        }
+
+        ExportRow &row = rows[i];
+        time += timeDelta;
+        id += runValue[ExportRowGroup::ID];
+
+        row.time = time;
+        row.id = id;
+        row.type = (MemTransfer::TypeEnum) runValue[ExportRowGroup::TYPE];
+        row.length = runValue[ExportRowGroup::LENGTH];
+        row.address = nextAddress + (AddressType)((zigzag >> 1) ^ -(zigzag & 1));
+        row.payloadOffset = payloadSize;
+
+        if (row.hasPayload())
+            payloadSize += row.length;
+        nextAddress = row.address + row.length;
+    }
+
+    if (!HasPayload())
+        return true;
+
+    const uint8_t *pp = columns[ExportRowGroup::PAYLOAD];
+    const uint8_t *pfence = fences[ExportRowGroup::PAYLOAD];
+    payload.reserve(payloadSize);
+
+    while (payload.size() < payloadSize) {
+        uint64_t literal = varint::read(pp, pfence);
+        if (literal > (uint64_t)(pfence - pp) || payload.size() + literal > payloadSize) {
+            error = "Corrupt payload column";
+            return false;
+        }
+        payload.insert(payload.end(), pp, pp + literal);
+        pp += literal;
+
+        uint64_t zeroes = varint::read(pp, pfence);
+        if (zeroes > payloadSize - payload.size() || !(literal || zeroes)) {
+            error = "Corrupt payload column";
+            return false;
+        }
+        payload.resize(payload.size() + zeroes, 0);
+    }
+
+    return true;
+}
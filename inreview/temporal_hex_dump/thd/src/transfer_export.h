@@ -0,0 +1,292 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * transfer_export.h -- Streams transfers out of a log, as CSV or as a
+ *                      compact columnar file.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __TRANSFER_EXPORT_H
+#define __TRANSFER_EXPORT_H
+
+#include <wx/thread.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "log_index.h"
+#include "transfer_filter.h"
+
+
+/*
+ * One exported transfer. 'time' is the clock at the end of the
+ * transfer, like a TransferSummary's. Only reads and writes have a
+ * payload; it's 'length' bytes, starting at 'payloadOffset' in the
+ * row group's payload buffer.
+ */
+
+struct ExportRow {
+    ClockType time;
+    OffsetType id;
+    MemTransfer::TypeEnum type;
+    AddressType address;
+    LengthType length;
+    size_t payloadOffset;
+
+    bool hasPayload() const {
+        return type == MemTransfer::READ || type == MemTransfer::WRITE;
+    }
+
+    static const char *getTypeName(MemTransfer::TypeEnum type);
+
+    // Append one line of CSV. 'payload' is NULL if there's no payload column.
+    static void writeCSVHeader(std::string &out, bool payloadColumn);
+    void writeCSV(std::string &out, const uint8_t *payload) const;
+};
+
+
+/*
+ * The columnar format.
+ *
+ * A file is a 16-byte header, the row groups, the row group index,
+ * and a 24-byte trailer. Fixed-size integers are little-endian.
+ *
+ *   Header    "THDCOLS1", uint32 version, uint32 flags (bit 0: payload)
+ *   Trailer   uint64 index offset, uint64 row group count, "THDCOLS1"
+ *
+ * The index has one entry of 12 uint64s per row group: its file
+ * offset, row count, first and last transfer ID, first and last
+ * time, and the encoded size of each of its NUM_COLUMNS columns. A
+ * row group's columns are stored back to back, in column order.
+ * The payload column is empty unless the file has payloads.
+ *
+ * Variable-length integers are varint.h's. Every column starts over
+ * at each row group, with all of its "previous" values at zero, so
+ * row groups can be decoded on their own:
+ *
+ *   TIME      varint(time - previous time), one per row
+ *   ID        Runs of equal ID deltas: varint(delta), varint(count)
+ *   TYPE      Runs: varint(type), varint(count)
+ *   ADDRESS   varint(zigzag(address - (previous address + previous length)))
+ *   LENGTH    Runs: varint(length), varint(count)
+ *   PAYLOAD   The payloads of every read and write, back to back, as
+ *             varint(literal count), literal bytes, varint(zero count),
+ *             repeated until they're all accounted for
+ *
+ * Sequential transfers have an address delta of zero, an unfiltered
+ * export's IDs are one run, and zero-filled writes mostly vanish.
+ */
+
+struct ExportRowGroup {
+    enum Column {
+        TIME,
+        ID,
+        TYPE,
+        ADDRESS,
+        LENGTH,
+        PAYLOAD,
+        NUM_COLUMNS,
+    };
+
+    static const uint32_t VERSION = 1;
+    static const uint32_t FLAG_PAYLOAD = 1 << 0;
+    static const int HEADER_SIZE = 16;
+    static const int TRAILER_SIZE = 24;
+    static const int INDEX_ENTRY_SIZE = (6 + NUM_COLUMNS) * 8;
+    static const char MAGIC[9];
+
+    uint64_t fileOffset;
+    uint64_t numRows;
+    OffsetType firstId;
+    OffsetType lastId;
+    ClockType firstTime;
+    ClockType lastTime;
+    uint64_t columnSize[NUM_COLUMNS];
+
+    uint64_t getSize() const {
+        uint64_t size = 0;
+        for (int c = 0; c < NUM_COLUMNS; c++)
+            size += columnSize[c];
+        return size;
+    }
+};
+
+
+/*
+ * Streams every transfer in a log that matches some TransferFilter
+ * criteria to a file, as CSV or in the columnar format.
+ *
+ * The index must be COMPLETE. Like IndexVerifier, we cut the log into
+ * chunks at its strata rows, which tell us each chunk's starting
+ * offset, transfer ID, and time. A pool of threads encodes chunks,
+ * each with its own LogReader, and a writer thread writes them out
+ * in order, one row group per chunk. Workers don't start a chunk
+ * more than MAX_PENDING_PER_THREAD chunks per thread ahead of the
+ * writer, so memory use is bounded however long the log is.
+ */
+
+class TransferExporter {
+public:
+    enum Format {
+        CSV,
+        COLUMNAR,
+    };
+
+    struct Options {
+        Options() : format(COLUMNAR), payload(false) {}
+
+        Format format;
+        bool payload;
+        TransferFilter::Criteria criteria;
+    };
+
+    TransferExporter(LogIndex *index, const Options &options);
+    ~TransferExporter();
+
+    /*
+     * Start exporting to 'file' in the background, then Wait() for
+     * the result. Wait() returns false if writing to 'file' failed.
+     * The file isn't closed.
+     */
+    void Start(FILE *file, int numThreads);
+    bool Wait();
+
+    // Fraction of the log written so far, and whether the writer has finished
+    double GetProgress();
+    bool IsDone();
+
+    // Totals, valid after Wait().
+    uint64_t rowsWritten;
+    uint64_t bytesWritten;
+    int numRowGroups;
+    int numChunks;
+
+private:
+    static const int CHUNK_TIMESTEPS = 8;
+    static const int MAX_PENDING_PER_THREAD = 2;
+
+    struct RowHeader {
+        ClockType time;
+        OffsetType offset;
+        OffsetType transferId;
+    };
+
+    struct Chunk {
+        Chunk() : ready(false), logBytes(0) {}
+
+        bool ready;
+        OffsetType logBytes;
+        ExportRowGroup group;
+        std::string data;       // Encoded columns, or CSV lines
+    };
+
+    class ColumnEncoder;
+
+    class WorkerThread : public wxThread {
+    public:
+        WorkerThread(TransferExporter *_exporter)
+            : wxThread(wxTHREAD_JOINABLE), exporter(_exporter) {}
+        virtual ExitCode Entry();
+
+    private:
+        TransferExporter *exporter;
+    };
+
+    class WriterThread : public wxThread {
+    public:
+        WriterThread(TransferExporter *_exporter)
+            : wxThread(wxTHREAD_JOINABLE), exporter(_exporter) {}
+        virtual ExitCode Entry();
+
+    private:
+        TransferExporter *exporter;
+    };
+
+    bool NextChunk(int &chunk);
+    void EncodeChunk(int chunk, LogReader &reader);
+    void WriteChunks();
+    bool WriteBytes(const void *data, size_t size);
+    void Stop();
+
+    LogIndex *index;
+    Options options;
+    wxString logPath;
+    FILE *file;
+    int numThreads;
+    std::vector<RowHeader> rows;
+    std::vector<Chunk> chunks;
+    std::vector<WorkerThread*> threads;
+    WriterThread *writer;
+
+    wxSemaphore slots;         // One per chunk that may be started
+    wxSemaphore finished;      // Posted whenever a chunk is ready
+
+    wxCriticalSection lock;    // Protects everything below
+    int nextChunk;
+    bool stopping;
+    bool writing;
+    bool succeeded;
+    double logBytesWritten;
+};
+
+
+/*
+ * Reads a file in the columnar format. Row groups are decoded one at
+ * a time, so a file of any size can be read in bounded memory, and
+ * the index finds the row groups for a range of time or of transfer
+ * IDs without reading the others.
+ */
+
+class ExportFileReader {
+public:
+    ExportFileReader() : file(NULL), flags(0) {}
+    ~ExportFileReader() { Close(); }
+
+    // Returns false and sets 'error' if the file can't be read.
+    bool Open(const char *path, std::string &error);
+    void Close();
+
+    bool HasPayload() const {
+        return (flags & ExportRowGroup::FLAG_PAYLOAD) != 0;
+    }
+
+    const std::vector<ExportRowGroup> &GetRowGroups() const {
+        return groups;
+    }
+
+    // The first row group with transfers at or after 'time'. GetRowGroups().size() if none.
+    size_t FindRowGroup(ClockType time) const;
+
+    /*
+     * Decode one row group. Row payloads point into 'payload'.
+     * Returns false and sets 'error' if the row group is corrupt.
+     */
+    bool ReadRowGroup(size_t group, std::vector<ExportRow> &rows,
+                      std::vector<uint8_t> &payload, std::string &error);
+
+private:
+    FILE *file;
+    uint32_t flags;
+    std::vector<ExportRowGroup> groups;
+    std::vector<uint8_t> buffer;
+};
+
+#endif /* __TRANSFER_EXPORT_H */
@@ -0,0 +1,280 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * transfer_filter.cpp -- Finds the transfers that match a filter, in the background.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "transfer_filter.h"
+#include "trace_event.h"
+
+
+TransferFilter::Criteria::Criteria()
+    : typeMask(~0U),
+      firstAddress(0),
+      lastAddress((AddressType)-1),
+      minLength(0),
+      maxLength((LengthType)-1)
+{}
+
+
+// Parse "N" or "N-M". Both ends are N if there's no M.
+static bool
+parseRange(const char *text, uint64_t &first, uint64_t &last)
+{
+    char *end;
+
+    first = last = strtoull(text, &end, 0);
+    if (end == text)
+        return false;
+
+    if (*end == '-') {
+        const char *second = end + 1;
+        last = strtoull(second, &end, 0);
+        if (end == second || last < first)
+            return false;
+    }
+
+    return *end == '\0';
+}
+
+
+bool
+TransferFilter::Criteria::Parse(const char *text, std::string &error)
+{
+    static const unsigned readMask = 1 << MemTransfer::READ;
+    static const unsigned writeMask = 1 << MemTransfer::WRITE;
+    static const unsigned errorMask = ~(readMask | writeMask);
+
+    *this = Criteria();
+    unsigned types = 0;
+
+    std::string terms(text);
+    size_t pos = 0;
+
+    while (pos < terms.size()) {
+        size_t end = terms.find(' ', pos);
+        if (end == std::string::npos)
+            end = terms.size();
+
+        std::string term = terms.substr(pos, end - pos);
+        pos = end + 1;
+
+        uint64_t first, last;
+
+        if (term.empty()) {
+            continue;
+        } else if (term == "read") {
+            types |= readMask;
+        } else if (term == "write") {
+            types |= writeMask;
+        } else if (term == "error") {
+            types |= errorMask;
+        } else if (!term.compare(0, 5, "addr:") && parseRange(term.c_str() + 5, first, last) &&
+                   last <= (AddressType)-1) {
+            firstAddress = first;
+            lastAddress = last;
+        } else if (!term.compare(0, 4, "len:") && parseRange(term.c_str() + 4, first, last) &&
+                   last <= (LengthType)-1) {
+            minLength = first;
+            maxLength = last;
+        } else {
+            error = "Unknown filter term '" + term + "'";
+            return false;
+        }
+    }
+
+    if (types)
+        typeMask = types;
+    return true;
+}
+
+
+bool
+TransferFilter::Criteria::Matches(const MemTransfer &mt) const
+{
+    if (!(typeMask & (1 << mt.type)))
+        return false;
+
+    bool anyAddress = firstAddress == 0 && lastAddress == (AddressType)-1;
+    bool anyLength = minLength == 0 && maxLength == (LengthType)-1;
+
+    // Errors have no address or length to match.
+    if (mt.isError())
+        return anyAddress && anyLength;
+
+    if (mt.byteCount < minLength || mt.byteCount > maxLength)
+        return false;
+
+    uint64_t last = (uint64_t)mt.address + std::max<LengthType>(1, mt.byteCount) - 1;
+    return last >= firstAddress && mt.address <= lastAddress;
+}
+
+
+TransferFilter::TransferFilter(LogIndex *index, const Criteria &_criteria)
+    : criteria(_criteria),
+      logPath(index->GetLogFileName().GetFullPath()),
+      logFileSize(std::max<double>(1.0, index->GetLogFileName().GetSize().ToDouble())),
+      thread(NULL),
+      stopping(false),
+      scannedOffset(0),
+      done(false)
+{}
+
+
+TransferFilter::~TransferFilter()
+{
+    Stop();
+}
+
+
+void
+TransferFilter::Start()
+{
+    Stop();
+
+    stopping = false;
+    thread = new ScanThread(this);
+    thread->Create();
+    thread->Run();
+}
+
+
+void
+TransferFilter::Stop()
+{
+    if (thread) {
+        stopping = true;
+        thread->Wait();
+        delete thread;
+        thread = NULL;
+    }
+}
+
+
+bool
+TransferFilter::IsDone()
+{
+    wxCriticalSectionLocker locker(lock);
+    return done;
+}
+
+
+double
+TransferFilter::GetProgress()
+{
+    wxCriticalSectionLocker locker(lock);
+    return done ? 1.0 : scannedOffset / logFileSize;
+}
+
+
+OffsetType
+TransferFilter::GetCount()
+{
+    wxCriticalSectionLocker locker(lock);
+    return ids.size();
+}
+
+
+OffsetType
+TransferFilter::GetId(OffsetType row)
+{
+    wxCriticalSectionLocker locker(lock);
+    return ids.select(row);
+}
+
+
+OffsetType
+TransferFilter::GetRow(OffsetType id)
+{
+    wxCriticalSectionLocker locker(lock);
+    return ids.rank(id);
+}
+
+
+uint64_t
+TransferFilter::GetMemoryUsed()
+{
+    wxCriticalSectionLocker locker(lock);
+    return ids.memoryUsed();
+}
+
+
+wxThread::ExitCode
+TransferFilter::ScanThread::Entry()
+{
+    TraceLog::setThreadName("Filter");
+    filter->Scan();
+    return 0;
+}
+
+
+void
+TransferFilter::Scan()
+{
+    /*
+     * Read every transfer in order, the same way the indexer does,
+     * so the IDs agree with the index.
+     */
+
+    TraceScope trace("TransferFilter::Scan");
+
+    LogReader reader(logPath.c_str());
+    MemTransfer mt(0);
+    std::vector<OffsetType> batch;
+    OffsetType sinceUpdate = 0;
+
+    batch.reserve(BATCH_SIZE);
+
+    while (!stopping && reader.Read(mt)) {
+        if (criteria.Matches(mt))
+            batch.push_back(mt.id);
+
+        if (batch.size() >= BATCH_SIZE || ++sinceUpdate >= PROGRESS_INTERVAL) {
+            Publish(batch, mt.offset);
+            sinceUpdate = 0;
+        }
+
+        if (!reader.Next(mt))
+            break;
+    }
+
+    Publish(batch, mt.offset);
+    reader.Close();
+
+    wxCriticalSectionLocker locker(lock);
+    done = !stopping;
+}
+
+
+void
+TransferFilter::Publish(std::vector<OffsetType> &batch, OffsetType offset)
+{
+    wxCriticalSectionLocker locker(lock);
+
+    for (std::vector<OffsetType>::iterator i = batch.begin(); i != batch.end(); i++)
+        ids.append(*i);
+
+    scannedOffset = offset;
+    batch.clear();
+}
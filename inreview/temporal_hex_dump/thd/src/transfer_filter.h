@@ -0,0 +1,131 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * transfer_filter.h -- Finds the transfers that match a filter, in the background.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __TRANSFER_FILTER_H
+#define __TRANSFER_FILTER_H
+
+#include <wx/thread.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
+
+#include "log_index.h"
+#include "id_set.h"
+
+
+/*
+ * A view of the log that only includes some transfers: say, only
+ * writes, only errors, or only transfers that touch an address range.
+ *
+ * Start() begins reading the log on a background thread. The IDs of
+ * the matching transfers go into a compressed IdSet, in batches, so
+ * the view is usable right away and grows as the scan goes on. Rows
+ * in the view map to transfer IDs through the set, with GetId() and
+ * GetRow(). All methods are thread-safe.
+ */
+
+class TransferFilter {
+public:
+    struct Criteria {
+        Criteria();
+
+        /*
+         * Parse a filter from space-separated terms. Returns false
+         * and sets 'error' if there's a term we don't understand.
+         *
+         *   read, write, error   Only these types (any of them)
+         *   addr:A[-B]           Transfers touching an address, or the range A to B
+         *   len:N[-M]            Transfers of N bytes, or N to M bytes
+         *
+         * Numbers can be decimal, or hex with 0x. An empty string
+         * matches every transfer.
+         */
+        bool Parse(const char *text, std::string &error);
+
+        bool Matches(const MemTransfer &mt) const;
+
+        unsigned typeMask;          // Bit (1 << type) for each MemTransfer type
+        AddressType firstAddress;
+        AddressType lastAddress;
+        LengthType minLength;
+        LengthType maxLength;
+    };
+
+    TransferFilter(LogIndex *index, const Criteria &criteria);
+    ~TransferFilter();
+
+    void Start();
+    void Stop();
+
+    bool IsDone();
+    double GetProgress();
+
+    // Matching transfers found so far
+    OffsetType GetCount();
+
+    // The ID of the transfer in row 'row', for row < GetCount().
+    OffsetType GetId(OffsetType row);
+
+    // The first row whose transfer ID is at least 'id'. This is GetCount() if there isn't one.
+    OffsetType GetRow(OffsetType id);
+
+    // Bytes used by the ID set.
+    uint64_t GetMemoryUsed();
+
+    const Criteria &GetCriteria() const {
+        return criteria;
+    }
+
+private:
+    static const int BATCH_SIZE = 4096;            // Matches per lock
+    static const int PROGRESS_INTERVAL = 1 << 16;  // Transfers between updates
+
+    class ScanThread : public wxThread {
+    public:
+        ScanThread(TransferFilter *_filter)
+            : wxThread(wxTHREAD_JOINABLE), filter(_filter) {}
+        virtual ExitCode Entry();
+
+    private:
+        TransferFilter *filter;
+    };
+
+    void Scan();
+    void Publish(std::vector<OffsetType> &batch, OffsetType offset);
+
+    Criteria criteria;
+    wxString logPath;
+    double logFileSize;
+    ScanThread *thread;
+    volatile bool stopping;
+
+    wxCriticalSection lock;    // Protects everything below
+    IdSet ids;
+    OffsetType scannedOffset;
+    bool done;
+};
+
+typedef boost::shared_ptr<TransferFilter> filterPtr_t;
+
+#endif /* __TRANSFER_FILTER_H */
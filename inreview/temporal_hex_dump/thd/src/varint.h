@@ -55,6 +55,7 @@
 #define __VARINT_H
 
 #include <stdint.h>
+#include <vector>
 
 struct varint {
 
@@ -117,7 +118,7 @@ struct varint {
         if (c & 0x08) {
             if (p + 4 >= fence)
                 return FENCE;
-            varint_t result = (((varint_t) c & 0x07) << 32) | (p[1] << 24) |
+            varint_t result = (((varint_t) c & 0x07) << 32) | (((varint_t) p[1]) << 24) |
                 (p[2] << 16) | (p[3] << 8) | p[4];
             p += 5;
             return result;
@@ -127,7 +128,7 @@ struct varint {
             if (p + 5 >= fence)
                 return FENCE;
             varint_t result = (((varint_t) c & 0x03) << 40) | (((varint_t) p[1]) << 32) |
-                (p[2] << 24) | (p[3] << 16) | (p[4] << 8) | p[5];
+                (((varint_t) p[2]) << 24) | (p[3] << 16) | (p[4] << 8) | p[5];
             p += 6;
             return result;
         }
@@ -136,7 +137,7 @@ struct varint {
             if (p + 6 >= fence)
                 return FENCE;
             varint_t result = (((varint_t) c & 0x01) << 48) | (((varint_t) p[1]) << 40) |
-                (((varint_t) p[2]) << 32) | (p[3] << 24) | (p[4] << 16) |
+                (((varint_t) p[2]) << 32) | (((varint_t) p[3]) << 24) | (p[4] << 16) |
                 (p[5] << 8) | p[6];
             p += 7;
             return result;
@@ -145,7 +146,7 @@ struct varint {
         if (p + 7 >= fence)
             return FENCE;
         varint_t result = (((varint_t) p[1]) << 48) | (((varint_t) p[2]) << 40) |
-            (((varint_t) p[3]) << 32) | (p[4] << 24) | (p[5] << 16) |
+            (((varint_t) p[3]) << 32) | (((varint_t) p[4]) << 24) | (p[5] << 16) |
             (p[6] << 8) | p[7];
         p += 8;
         return result;
@@ -198,7 +199,7 @@ struct varint {
         if (c & 0x08) {
             if (p - 4 <= fence)
                 return FENCE;
-            varint_t result = (((varint_t) c & 0x07) << 32) | (p[-1] << 24) |
+            varint_t result = (((varint_t) c & 0x07) << 32) | (((varint_t) p[-1]) << 24) |
                 (p[-2] << 16) | (p[-3] << 8) | p[-4];
             p -= 5;
             return result;
@@ -208,7 +209,7 @@ struct varint {
             if (p - 5 <= fence)
                 return FENCE;
             varint_t result = (((varint_t) c & 0x03) << 40) |
-                (((varint_t) p[-1]) << 32) | (p[-2] << 24) | (p[-3] << 16) |
+                (((varint_t) p[-1]) << 32) | (((varint_t) p[-2]) << 24) | (p[-3] << 16) |
                 (p[-4] << 8) | p[-5];
             p -= 6;
             return result;
@@ -219,7 +220,7 @@ struct varint {
                 return FENCE;
             varint_t result = (((varint_t) c & 0x01) << 48) |
                 (((varint_t) p[-1]) << 40) | (((varint_t) p[-2]) << 32) |
-                (p[-3] << 24) | (p[-4] << 16) | (p[-5] << 8) | p[-6];
+                (((varint_t) p[-3]) << 24) | (p[-4] << 16) | (p[-5] << 8) | p[-6];
             p -= 7;
             return result;
         }
@@ -227,7 +228,7 @@ struct varint {
         if (p - 7 <= fence)
             return FENCE;
         varint_t result = (((varint_t) p[-1]) << 48) | (((varint_t) p[-2]) << 40) |
-            (((varint_t) p[-3]) << 32) | (p[-4] << 24) | (p[-5] << 16) |
+            (((varint_t) p[-3]) << 32) | (((varint_t) p[-4]) << 24) | (p[-5] << 16) |
             (p[-6] << 8) | p[-7];
         p -= 8;
         return result;
@@ -312,6 +313,15 @@ struct varint {
         }
     }
 
+    // Append a sample to the end of a buffer.
+    static void
+    append(varint_t s, std::vector<uint8_t> &buffer)
+    {
+        size_t size = buffer.size();
+        buffer.resize(size + len(s));
+        write(s, &buffer[size]);
+    }
+
     /* A reversed version of sample_write */
     static void
     write_r(varint_t s, uint8_t *p)
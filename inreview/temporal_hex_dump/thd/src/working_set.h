@@ -0,0 +1,146 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+ *
+ * working_set.h -- HyperLogLog sketches of the memory blocks a log touches.
+ *
+ * Copyright (C) 2009 Micah Dowty
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __WORKING_SET_H
+#define __WORKING_SET_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+
+/*
+ * A HyperLogLog sketch of a set of block IDs. It estimates how many
+ * distinct blocks were added, to within a few percent (the standard
+ * error is 1.04 / sqrt(REGISTERS), about 3%), in a fixed REGISTERS
+ * bytes. Sketches merge losslessly: the merge of two sketches is the
+ * sketch of the union of their sets. That's what lets the index keep
+ * one sketch per timestep, and answer the working set size of any
+ * run of timesteps by merging a few of them.
+ */
+
+class WorkingSetSketch {
+public:
+    static const int PRECISION = 10;
+    static const int REGISTERS = 1 << PRECISION;
+
+    WorkingSetSketch()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        memset(registers, 0, sizeof registers);
+    }
+
+    void add(uint64_t blockId)
+    {
+        uint64_t h = hash(blockId);
+        int index = h >> (64 - PRECISION);
+
+        // Rank of the first 1 bit after the index. The guard bit stops it at 64 - PRECISION + 1.
+        uint64_t rest = (h << PRECISION) | ((uint64_t)1 << (PRECISION - 1));
+        uint8_t rank = __builtin_clzll(rest) + 1;
+
+        if (rank > registers[index])
+            registers[index] = rank;
+    }
+
+    void merge(const WorkingSetSketch &other)
+    {
+        for (int i = 0; i < REGISTERS; i++)
+            registers[i] = std::max(registers[i], other.registers[i]);
+    }
+
+    bool isEmpty() const
+    {
+        for (int i = 0; i < REGISTERS; i++)
+            if (registers[i])
+                return false;
+        return true;
+    }
+
+    double estimate() const
+    {
+        double sum = 0;
+        int zeroes = 0;
+
+        for (int i = 0; i < REGISTERS; i++) {
+            sum += ldexp(1.0, -registers[i]);
+            if (!registers[i])
+                zeroes++;
+        }
+
+        const double alpha = 0.7213 / (1.0 + 1.079 / REGISTERS);
+        double e = alpha * REGISTERS * REGISTERS / sum;
+
+        // Small sets: linear counting is more accurate.
+        if (e <= 2.5 * REGISTERS && zeroes)
+            e = REGISTERS * log(REGISTERS / (double)zeroes);
+
+        return e;
+    }
+
+    const uint8_t *getRegisters() const
+    {
+        return registers;
+    }
+
+    void setRegisters(const void *data, int size)
+    {
+        clear();
+        memcpy(registers, data, std::min(size, REGISTERS));
+    }
+
+private:
+    static uint64_t hash(uint64_t x)
+    {
+        // splitmix64's finalizer. Block IDs are small and sequential, so they need a good mix.
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    uint8_t registers[REGISTERS];
+};
+
+
+/*
+ * Working set sizes, in 512-byte blocks, for the blocks read, the
+ * blocks written, and the blocks either read or written.
+ */
+
+struct WorkingSet {
+    double read;
+    double written;
+    double touched;
+};
+
+#endif /* __WORKING_SET_H */